@@ -48,4 +48,78 @@ print('};\n')
 # *.sort() is stable so we always get the first keysym for duplicate
 print('static const struct name_keysym keysym_to_name[] = {')
 print_entries(next(g[1]) for g in itertools.groupby(sorted(entries, key=lambda e: e[1]), key=lambda e: e[1]))
-print('};')
+print('};\n')
+
+# Minimal perfect hashes from names to indices in name_to_keysym, using
+# the "hash and displace" method. The name is hashed once with 64 bit
+# FNV-1a; the high half picks a bucket, and the slot is given by mixing
+# the hash with the displacement of that bucket. This must match
+# keysym_name_hash() and keysym_name_slot() in keysym.c.
+MASK64 = (1 << 64) - 1
+
+def name_hash(name, icase):
+    h = 0xcbf29ce484222325
+    for c in name:
+        o = ord(c)
+        if icase and ord('A') <= o <= ord('Z'):
+            o += ord('a') - ord('A')
+        h = ((h ^ o) * 0x100000001b3) & MASK64
+    return h
+
+def name_slot(h, disp, size):
+    k = h ^ disp
+    k ^= k >> 33
+    k = (k * 0xff51afd7ed558ccd) & MASK64
+    k ^= k >> 33
+    k = (k * 0xc4ceb9fe1a85ec53) & MASK64
+    k ^= k >> 33
+    return k % size
+
+def perfect_hash(keys):
+    size = len(keys)
+    num_buckets = (len(keys) + 3) // 4
+    buckets = [[] for _ in range(num_buckets)]
+    for (h, value) in keys:
+        buckets[(h >> 32) % num_buckets].append((h, value))
+
+    disps = [0] * num_buckets
+    slots = [None] * size
+    for b in sorted(range(num_buckets), key=lambda b: -len(buckets[b])):
+        if not buckets[b]:
+            continue
+        for disp in range(1 << 16):
+            pos = [name_slot(h, disp, size) for (h, _) in buckets[b]]
+            if len(set(pos)) == len(pos) and all(slots[p] is None for p in pos):
+                break
+        else:
+            raise Exception('no displacement found for bucket {}'.format(b))
+        disps[b] = disp
+        for (p, (_, value)) in zip(pos, buckets[b]):
+            slots[p] = value
+
+    return disps, slots
+
+def print_perfect_hash(prefix, keys):
+    disps, slots = perfect_hash(keys)
+    print('static const uint16_t {}_disps[] = {{'.format(prefix))
+    for i in range(0, len(disps), 8):
+        print('    ' + ' '.join('0x{:04x},'.format(d) for d in disps[i:i + 8]))
+    print('};\n')
+    print('static const uint16_t {}_slots[] = {{'.format(prefix))
+    for i in range(0, len(slots), 8):
+        print('    ' + ' '.join('0x{:04x},'.format(v) for v in slots[i:i + 8]))
+    print('};\n')
+
+by_name = sorted(entries, key=lambda e: e[0].lower())
+
+# Case-sensitive: each name maps to its own entry.
+print_perfect_hash('name_to_keysym_hash',
+                   [(name_hash(name, False), i)
+                    for (i, (name, _)) in enumerate(by_name)])
+
+# Case-insensitive: each folded name maps to the first of the entries
+# which only differ from it by case; these are adjacent in name_to_keysym.
+print_perfect_hash('name_to_keysym_ihash',
+                   [(name_hash(folded, True), next(g)[0])
+                    for (folded, g) in itertools.groupby(enumerate(by_name),
+                                                         key=lambda e: e[1][0].lower())])
@@ -0,0 +1,58 @@
+#!/usr/bin/env python
+
+import re, sys, io
+
+pattern = re.compile(r'^(?P<keysym>0x[0-9a-fA-F]+)\s+(?P<ucs>0x[0-9a-fA-F]+)\s')
+matches = [pattern.match(line) for line in io.open(sys.argv[1], encoding='utf-8')]
+keysymtab = [(int(m.group('keysym'), 16), int(m.group('ucs'), 16)) for m in matches if m]
+
+# Latin-1 characters are mapped 1:1.
+entries = [(ks, ks) for ks in range(0x20, 0x7f)]
+entries += [(ks, ks) for ks in range(0xa0, 0x100)]
+entries += keysymtab
+# Special keysyms for ASCII control characters and the keypad.
+specials = list(range(0xff08, 0xff0c)) + [0xff0d, 0xff1b, 0xffff]
+specials += [0xff80, 0xff89, 0xff8d, 0xffbd] + list(range(0xffaa, 0xffba))
+entries += [(ks, 0x20 if ks == 0xff80 else ks & 0x7f) for ks in specials]
+
+print('''
+/**
+ * This file comes from libxkbcommon and was generated by makeutf.py
+ * from src/keysymtab.txt.
+ */
+''')
+
+# Both directions are two-level tables: the high byte of the (16 bit)
+# value selects a page, and the low byte the entry in it. Page 0 is
+# empty, and 0 means there is no mapping.
+def print_paged(prefix, pairs):
+    pages = {}
+    for (src, dst) in pairs:
+        assert src <= 0xffff and 0 < dst <= 0xffff
+        page = pages.setdefault(src >> 8, [0] * 256)
+        # Keep the first, i.e. the lowest keysym, for duplicates.
+        if page[src & 0xff] == 0:
+            page[src & 0xff] = dst
+
+    highs = sorted(pages)
+    index = [0] * (highs[-1] + 1)
+    for (i, high) in enumerate(highs):
+        index[high] = i + 1
+
+    print('static const uint8_t {}_index[] = {{'.format(prefix))
+    for i in range(0, len(index), 16):
+        print('    ' + ' '.join('{:2d},'.format(v) for v in index[i:i + 16]))
+    print('};\n')
+
+    print('static const uint16_t {}_pages[][256] = {{'.format(prefix))
+    print('    { 0 },')
+    for high in highs:
+        print('    {{ /* 0x{:02x}00 */'.format(high))
+        page = pages[high]
+        for i in range(0, 256, 8):
+            print('        ' + ' '.join('0x{:04x},'.format(v) for v in page[i:i + 8]))
+        print('    },')
+    print('};\n')
+
+print_paged('keysym_to_utf32', sorted(entries))
+print_paged('utf32_to_keysym', sorted((ucs, ks) for (ks, ucs) in entries))
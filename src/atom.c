@@ -73,16 +73,31 @@
 #include "utils.h"
 #include "atom.h"
 
-struct atom_node {
-    xkb_atom_t left, right;
-    xkb_atom_t atom;
-    unsigned int fingerprint;
-    char *string;
+/*
+ * The atoms are interned in an open-addressing hash table (with linear
+ * probing), which maps to indices into the atoms array; the atom is the
+ * index itself. The strings are copied into large blocks which are never
+ * moved or freed while the table is alive, so that atom_text() can hand
+ * out pointers into them.
+ */
+
+#define ATOM_BLOCK_SIZE 4096
+#define ATOM_INDEX_MIN_SIZE 256
+
+struct atom_entry {
+    const char *string;
+    uint32_t len;
+    uint32_t hash;
 };
 
 struct atom_table {
-    xkb_atom_t root;
-    darray(struct atom_node) table;
+    /* Power of 2 sized; XKB_ATOM_NONE marks an empty slot. */
+    xkb_atom_t *index;
+    size_t index_size;
+    darray(struct atom_entry) atoms;
+    darray(char *) blocks;
+    char *block_pos;
+    size_t block_left;
 };
 
 struct atom_table *
@@ -94,9 +109,17 @@ atom_table_new(void)
     if (!table)
         return NULL;
 
-    darray_init(table->table);
-    /* The original throw-away root is here, at the illegal atom 0. */
-    darray_resize0(table->table, 1);
+    table->index_size = ATOM_INDEX_MIN_SIZE;
+    table->index = calloc(table->index_size, sizeof(*table->index));
+    if (!table->index) {
+        free(table);
+        return NULL;
+    }
+
+    darray_init(table->atoms);
+    darray_init(table->blocks);
+    /* The original throw-away entry is here, at the illegal atom 0. */
+    darray_resize0(table->atoms, 1);
 
     return table;
 }
@@ -104,122 +127,171 @@ atom_table_new(void)
 void
 atom_table_free(struct atom_table *table)
 {
-    struct atom_node *node;
+    char **block;
 
     if (!table)
         return;
 
-    darray_foreach(node, table->table)
-        free(node->string);
-    darray_free(table->table);
+    darray_foreach(block, table->blocks)
+        free(*block);
+    darray_free(table->blocks);
+    darray_free(table->atoms);
+    free(table->index);
     free(table);
 }
 
 const char *
 atom_text(struct atom_table *table, xkb_atom_t atom)
 {
-    if (atom == XKB_ATOM_NONE || atom >= darray_size(table->table))
+    if (atom == XKB_ATOM_NONE || atom >= darray_size(table->atoms))
         return NULL;
 
-    return darray_item(table->table, atom).string;
+    return darray_item(table->atoms, atom).string;
+}
+
+/* FNV-1a, followed by the MurmurHash3 finalizer to mix the low bits. */
+static uint32_t
+hash_string(const char *string, size_t len)
+{
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ (unsigned char) string[i]) * 16777619u;
+
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+
+    return hash;
+}
+
+/*
+ * Returns the slot in the index where @string is, or where it should be
+ * inserted if it's not there.
+ */
+static xkb_atom_t *
+find_atom_slot(struct atom_table *table, const char *string, size_t len,
+               uint32_t hash)
+{
+    const size_t mask = table->index_size - 1;
+
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        xkb_atom_t *slot = &table->index[i];
+        const struct atom_entry *entry;
+
+        if (*slot == XKB_ATOM_NONE)
+            return slot;
+
+        entry = &darray_item(table->atoms, *slot);
+        if (entry->hash == hash && entry->len == len &&
+            memcmp(entry->string, string, len) == 0)
+            return slot;
+    }
 }
 
 static bool
-find_atom_pointer(struct atom_table *table, const char *string, size_t len,
-                  xkb_atom_t **atomp_out, unsigned int *fingerprint_out)
+grow_index(struct atom_table *table)
 {
-    xkb_atom_t *atomp = &table->root;
-    unsigned int fingerprint = 0;
-    bool found = false;
+    const size_t new_size = table->index_size * 2;
+    xkb_atom_t *old_index = table->index;
+    xkb_atom_t atom;
 
-    for (size_t i = 0; i < (len + 1) / 2; i++) {
-        fingerprint = fingerprint * 27 + string[i];
-        fingerprint = fingerprint * 27 + string[len - 1 - i];
+    table->index = calloc(new_size, sizeof(*table->index));
+    if (!table->index) {
+        table->index = old_index;
+        return false;
     }
+    table->index_size = new_size;
 
-    while (*atomp != XKB_ATOM_NONE) {
-        struct atom_node *node = &darray_item(table->table, *atomp);
+    for (atom = 1; atom < darray_size(table->atoms); atom++) {
+        const struct atom_entry *entry = &darray_item(table->atoms, atom);
+        *find_atom_slot(table, entry->string, entry->len, entry->hash) = atom;
+    }
 
-        if (fingerprint < node->fingerprint) {
-            atomp = &node->left;
-        }
-        else if (fingerprint > node->fingerprint) {
-            atomp = &node->right;
-        }
-        else {
-            /* Now start testing the strings. */
-            const int cmp = strncmp(string, node->string, len);
-            if (cmp < 0 || (cmp == 0 && len < strlen(node->string))) {
-                atomp = &node->left;
-            }
-            else if (cmp > 0) {
-                atomp = &node->right;
-            }
-            else {
-                found = true;
-                break;
-            }
+    free(old_index);
+    return true;
+}
+
+static char *
+store_string(struct atom_table *table, const char *string, size_t len)
+{
+    char *copy;
+
+    /* Big strings get their own block, so as to not waste the current. */
+    if (len + 1 > ATOM_BLOCK_SIZE / 4) {
+        copy = malloc(len + 1);
+        if (!copy)
+            return NULL;
+        darray_append(table->blocks, copy);
+    }
+    else {
+        if (len + 1 > table->block_left) {
+            char *block = malloc(ATOM_BLOCK_SIZE);
+            if (!block)
+                return NULL;
+            darray_append(table->blocks, block);
+            table->block_pos = block;
+            table->block_left = ATOM_BLOCK_SIZE;
         }
+        copy = table->block_pos;
+        table->block_pos += len + 1;
+        table->block_left -= len + 1;
     }
 
-    if (fingerprint_out)
-        *fingerprint_out = fingerprint;
-    if (atomp_out)
-        *atomp_out = atomp;
-    return found;
+    memcpy(copy, string, len);
+    copy[len] = '\0';
+    return copy;
 }
 
 xkb_atom_t
 atom_lookup(struct atom_table *table, const char *string, size_t len)
 {
-    xkb_atom_t *atomp;
-
     if (!string)
         return XKB_ATOM_NONE;
 
-    if (!find_atom_pointer(table, string, len, &atomp, NULL))
-        return XKB_ATOM_NONE;
-
-    return *atomp;
+    return *find_atom_slot(table, string, len, hash_string(string, len));
 }
 
 /*
- * If steal is true, we do not strdup @string; therefore it must be
+ * If steal is true, @string is free'd by this function; therefore it must be
  * dynamically allocated, NUL-terminated, not be free'd by the caller
- * and not be used afterwards. Use to avoid some redundant allocations.
+ * and not be used afterwards.
  */
 xkb_atom_t
 atom_intern(struct atom_table *table, const char *string, size_t len,
             bool steal)
 {
-    xkb_atom_t *atomp;
-    struct atom_node node;
-    unsigned int fingerprint;
+    xkb_atom_t *slot;
+    struct atom_entry entry;
 
     if (!string)
         return XKB_ATOM_NONE;
 
-    if (find_atom_pointer(table, string, len, &atomp, &fingerprint)) {
-        if (steal)
-            free(UNCONSTIFY(string));
-        return *atomp;
-    }
+    entry.hash = hash_string(string, len);
+    entry.len = len;
 
-    if (steal) {
-        node.string = UNCONSTIFY(string);
-    }
-    else {
-        node.string = strndup(string, len);
-        if (!node.string)
-            return XKB_ATOM_NONE;
+    slot = find_atom_slot(table, string, len, entry.hash);
+    if (*slot != XKB_ATOM_NONE)
+        goto out;
+
+    /* Keep the load factor at most 1/2. */
+    if (darray_size(table->atoms) * 2 > table->index_size) {
+        if (!grow_index(table))
+            goto out;
+        slot = find_atom_slot(table, string, len, entry.hash);
     }
 
-    node.left = node.right = XKB_ATOM_NONE;
-    node.fingerprint = fingerprint;
-    node.atom = darray_size(table->table);
-    /* Do this before the append, as it may realloc and change the offsets. */
-    *atomp = node.atom;
-    darray_append(table->table, node);
+    entry.string = store_string(table, string, len);
+    if (!entry.string)
+        goto out;
+
+    *slot = darray_size(table->atoms);
+    darray_append(table->atoms, entry);
 
-    return node.atom;
+out:
+    if (steal)
+        free(UNCONSTIFY(string));
+    return *slot;
 }
@@ -24,6 +24,8 @@
 #ifndef ATOM_H
 #define ATOM_H
 
+#include "darray.h"
+
 typedef uint32_t xkb_atom_t;
 
 #define XKB_ATOM_NONE 0
@@ -46,4 +48,25 @@ atom_intern(struct atom_table *table, const char *string, size_t len,
 const char *
 atom_text(struct atom_table *table, xkb_atom_t atom);
 
+/*
+ * Direct-indexed tables keyed by atom. Atoms are small dense integers,
+ * so an array indexed by the atom itself makes a cheap map. The stored
+ * value is an index into some other array, plus one; 0 means "not
+ * present". Since entries are never removed from the index, users must
+ * check that the index they get back still refers to the atom.
+ */
+static inline unsigned
+atom_index_get(const darray_uint *index, xkb_atom_t atom)
+{
+    return atom < darray_size(*index) ? darray_item(*index, atom) : 0;
+}
+
+static inline void
+atom_index_set(darray_uint *index, xkb_atom_t atom, unsigned value)
+{
+    if (atom >= darray_size(*index))
+        darray_resize0(*index, atom + 1);
+    darray_item(*index, atom) = value;
+}
+
 #endif /* ATOM_H */
@@ -32,6 +32,7 @@
 #include "xkbcommon/xkbcommon.h"
 #include "utils.h"
 #include "context.h"
+#include "keymap.h"
 
 unsigned int
 xkb_context_num_failed_include_paths(struct xkb_context *ctx)
@@ -52,25 +53,45 @@ xkb_context_failed_include_path_get(struct xkb_context *ctx,
 xkb_atom_t
 xkb_atom_lookup(struct xkb_context *ctx, const char *string)
 {
-    return atom_lookup(ctx->atom_table, string, strlen(string));
+    xkb_atom_t atom;
+
+    xkb_context_lock(ctx, &ctx->atom_lock);
+    atom = atom_lookup(ctx->atom_table, string, strlen(string));
+    xkb_context_unlock(ctx, &ctx->atom_lock);
+    return atom;
 }
 
 xkb_atom_t
 xkb_atom_intern(struct xkb_context *ctx, const char *string, size_t len)
 {
-    return atom_intern(ctx->atom_table, string, len, false);
+    xkb_atom_t atom;
+
+    xkb_context_lock(ctx, &ctx->atom_lock);
+    atom = atom_intern(ctx->atom_table, string, len, false);
+    xkb_context_unlock(ctx, &ctx->atom_lock);
+    return atom;
 }
 
 xkb_atom_t
 xkb_atom_steal(struct xkb_context *ctx, char *string)
 {
-    return atom_intern(ctx->atom_table, string, strlen(string), true);
+    xkb_atom_t atom;
+
+    xkb_context_lock(ctx, &ctx->atom_lock);
+    atom = atom_intern(ctx->atom_table, string, strlen(string), true);
+    xkb_context_unlock(ctx, &ctx->atom_lock);
+    return atom;
 }
 
 const char *
 xkb_atom_text(struct xkb_context *ctx, xkb_atom_t atom)
 {
-    return atom_text(ctx->atom_table, atom);
+    const char *text;
+
+    xkb_context_lock(ctx, &ctx->atom_lock);
+    text = atom_text(ctx->atom_table, atom);
+    xkb_context_unlock(ctx, &ctx->atom_lock);
+    return text;
 }
 
 void
@@ -87,19 +108,30 @@ xkb_log(struct xkb_context *ctx, enum xkb_log_level level, int verbosity,
     va_end(args);
 }
 
+/* Threads sharing a context each get their own buffer. */
+static __thread char thread_text_buffer[2048];
+static __thread size_t thread_text_next;
+
 char *
 xkb_context_get_buffer(struct xkb_context *ctx, size_t size)
 {
+    char *buffer = ctx->text_buffer;
+    size_t *next = &ctx->text_next;
     char *rtrn;
 
+    if (ctx->threaded) {
+        buffer = thread_text_buffer;
+        next = &thread_text_next;
+    }
+
     if (size >= sizeof(ctx->text_buffer))
         return NULL;
 
-    if (sizeof(ctx->text_buffer) - ctx->text_next <= size)
-        ctx->text_next = 0;
+    if (sizeof(ctx->text_buffer) - *next <= size)
+        *next = 0;
 
-    rtrn = &ctx->text_buffer[ctx->text_next];
-    ctx->text_next += size;
+    rtrn = &buffer[*next];
+    *next += size;
 
     return rtrn;
 }
@@ -188,3 +220,128 @@ xkb_context_sanitize_rule_names(struct xkb_context *ctx,
     if (rmlvo->options == NULL)
         rmlvo->options = xkb_context_get_default_options(ctx);
 }
+
+static bool
+keymap_cache_name_eq(const char *cached, const char *name)
+{
+    return streq(cached, name ? name : "");
+}
+
+static void
+keymap_cache_entry_free(struct keymap_cache_entry *entry)
+{
+    free(entry->rules);
+    free(entry->model);
+    free(entry->layout);
+    free(entry->variant);
+    free(entry->options);
+}
+
+struct xkb_keymap *
+xkb_context_keymap_cache_lookup(struct xkb_context *ctx,
+                                const struct xkb_rule_names *rmlvo,
+                                enum xkb_keymap_compile_flags flags)
+{
+    struct keymap_cache_entry *entry;
+    struct xkb_keymap *keymap = NULL;
+
+    xkb_context_lock(ctx, &ctx->keymap_cache_lock);
+    darray_foreach(entry, ctx->keymap_cache) {
+        if (entry->flags == flags &&
+            keymap_cache_name_eq(entry->rules, rmlvo->rules) &&
+            keymap_cache_name_eq(entry->model, rmlvo->model) &&
+            keymap_cache_name_eq(entry->layout, rmlvo->layout) &&
+            keymap_cache_name_eq(entry->variant, rmlvo->variant) &&
+            keymap_cache_name_eq(entry->options, rmlvo->options)) {
+            keymap = xkb_keymap_ref(entry->keymap);
+            break;
+        }
+    }
+    xkb_context_unlock(ctx, &ctx->keymap_cache_lock);
+
+    return keymap;
+}
+
+void
+xkb_context_keymap_cache_add(struct xkb_context *ctx,
+                             const struct xkb_rule_names *rmlvo,
+                             enum xkb_keymap_compile_flags flags,
+                             struct xkb_keymap *keymap)
+{
+    struct keymap_cache_entry entry;
+
+    entry.rules = strdup(rmlvo->rules ? rmlvo->rules : "");
+    entry.model = strdup(rmlvo->model ? rmlvo->model : "");
+    entry.layout = strdup(rmlvo->layout ? rmlvo->layout : "");
+    entry.variant = strdup(rmlvo->variant ? rmlvo->variant : "");
+    entry.options = strdup(rmlvo->options ? rmlvo->options : "");
+    entry.flags = flags;
+    entry.keymap = keymap;
+
+    /* Not being able to cache the keymap is not an error. */
+    if (!entry.rules || !entry.model || !entry.layout ||
+        !entry.variant || !entry.options) {
+        keymap_cache_entry_free(&entry);
+        return;
+    }
+
+    xkb_context_lock(ctx, &ctx->keymap_cache_lock);
+    darray_append(ctx->keymap_cache, entry);
+    xkb_context_unlock(ctx, &ctx->keymap_cache_lock);
+}
+
+bool
+xkb_context_keymap_cache_unref(struct xkb_context *ctx,
+                               struct xkb_keymap *keymap)
+{
+    bool last;
+
+    /* Under the lock, so that a lookup can't take it back meanwhile. */
+    xkb_context_lock(ctx, &ctx->keymap_cache_lock);
+
+    last = (refcnt_dec(&keymap->refcnt) == 0);
+
+    /* Several names may have led to the same shared keymap. */
+    for (unsigned i = 0; last && i < darray_size(ctx->keymap_cache); ) {
+        struct keymap_cache_entry *entry = &darray_item(ctx->keymap_cache, i);
+
+        if (entry->keymap != keymap) {
+            i++;
+            continue;
+        }
+
+        keymap_cache_entry_free(entry);
+        *entry = darray_item(ctx->keymap_cache,
+                             darray_size(ctx->keymap_cache) - 1);
+        darray_resize(ctx->keymap_cache, darray_size(ctx->keymap_cache) - 1);
+    }
+
+    for (unsigned i = 0; last && i < darray_size(ctx->keymap_contents); i++) {
+        struct keymap_content_entry *entry =
+            &darray_item(ctx->keymap_contents, i);
+
+        if (entry->keymap != keymap)
+            continue;
+
+        *entry = darray_item(ctx->keymap_contents,
+                             darray_size(ctx->keymap_contents) - 1);
+        darray_resize(ctx->keymap_contents,
+                      darray_size(ctx->keymap_contents) - 1);
+        break;
+    }
+
+    xkb_context_unlock(ctx, &ctx->keymap_cache_lock);
+
+    return last;
+}
+
+void
+xkb_context_keymap_cache_clear(struct xkb_context *ctx)
+{
+    struct keymap_cache_entry *entry;
+
+    darray_foreach(entry, ctx->keymap_cache)
+        keymap_cache_entry_free(entry);
+    darray_free(ctx->keymap_cache);
+    darray_free(ctx->keymap_contents);
+}
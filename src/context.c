@@ -43,6 +43,10 @@ xkb_context_include_path_append(struct xkb_context *ctx, const char *path)
     int err;
     char *tmp;
 
+    /* Keymaps compiled before might not be found anymore. */
+    xkb_context_keymap_cache_clear(ctx);
+    xkb_context_include_index_clear(ctx);
+
     tmp = strdup(path);
     if (!tmp)
         goto err;
@@ -102,6 +106,11 @@ xkb_context_include_path_clear(struct xkb_context *ctx)
 {
     char **path;
 
+    xkb_context_keymap_cache_clear(ctx);
+    xkb_context_include_cache_clear(ctx);
+    xkb_context_include_index_clear(ctx);
+    xkb_context_rules_cache_clear(ctx);
+
     darray_foreach(path, ctx->includes)
         free(*path);
     darray_free(ctx->includes);
@@ -149,7 +158,7 @@ xkb_context_include_path_get(struct xkb_context *ctx, unsigned int idx)
 XKB_EXPORT struct xkb_context *
 xkb_context_ref(struct xkb_context *ctx)
 {
-    ctx->refcnt++;
+    refcnt_inc(&ctx->refcnt);
     return ctx;
 }
 
@@ -160,11 +169,15 @@ xkb_context_ref(struct xkb_context *ctx)
 XKB_EXPORT void
 xkb_context_unref(struct xkb_context *ctx)
 {
-    if (!ctx || --ctx->refcnt > 0)
+    if (!ctx || refcnt_dec(&ctx->refcnt) > 0)
         return;
 
     xkb_context_include_path_clear(ctx);
     atom_table_free(ctx->atom_table);
+    pthread_mutex_destroy(&ctx->atom_lock);
+    pthread_mutex_destroy(&ctx->include_lock);
+    pthread_mutex_destroy(&ctx->rules_lock);
+    pthread_mutex_destroy(&ctx->keymap_cache_lock);
     free(ctx);
 }
 
@@ -248,6 +261,10 @@ xkb_context_new(enum xkb_context_flags flags)
 
     ctx->refcnt = 1;
     ctx->log_fn = default_log_fn;
+    pthread_mutex_init(&ctx->atom_lock, NULL);
+    pthread_mutex_init(&ctx->include_lock, NULL);
+    pthread_mutex_init(&ctx->rules_lock, NULL);
+    pthread_mutex_init(&ctx->keymap_cache_lock, NULL);
     ctx->log_level = XKB_LOG_LEVEL_ERROR;
     ctx->log_verbosity = 0;
 
@@ -269,6 +286,8 @@ xkb_context_new(enum xkb_context_flags flags)
     }
 
     ctx->use_environment_names = !(flags & XKB_CONTEXT_NO_ENVIRONMENT_NAMES);
+    ctx->use_keymap_cache = !!(flags & XKB_CONTEXT_KEYMAP_CACHE);
+    ctx->threaded = !!(flags & XKB_CONTEXT_THREAD_SAFE);
 
     ctx->atom_table = atom_table_new();
     if (!ctx->atom_table) {
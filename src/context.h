@@ -26,8 +26,35 @@
 #ifndef CONTEXT_H
 #define CONTEXT_H
 
+#include <pthread.h>
+
 #include "atom.h"
 
+struct keymap_cache_entry {
+    char *rules;
+    char *model;
+    char *layout;
+    char *variant;
+    char *options;
+    enum xkb_keymap_compile_flags flags;
+    /* Not referenced; removed from the cache when freed. */
+    struct xkb_keymap *keymap;
+};
+
+struct keymap_content_entry {
+    /* Digest and size of the keymap in the binary format. */
+    uint64_t digest;
+    size_t size;
+    /* Not referenced; removed from the cache when freed. */
+    struct xkb_keymap *keymap;
+};
+
+/* Defined in xkbcomp/include.c. */
+struct include_cache_entry;
+struct include_index_entry;
+struct include_index_dir;
+struct rules_cache_entry;
+
 struct xkb_context {
     int refcnt;
 
@@ -45,13 +72,47 @@ struct xkb_context {
 
     struct atom_table *atom_table;
 
+    darray(struct keymap_cache_entry) keymap_cache;
+    darray(struct keymap_content_entry) keymap_contents;
+    darray(struct include_cache_entry) include_cache;
+    darray(struct include_index_entry) include_index;
+    darray(struct include_index_dir) include_index_dirs;
+    darray(struct rules_cache_entry) rules_cache;
+
+    /*
+     * Set if the context is XKB_CONTEXT_THREAD_SAFE; the atom table and
+     * the caches are then only accessed under these locks.
+     */
+    bool threaded;
+    pthread_mutex_t atom_lock;
+    pthread_mutex_t include_lock;
+    pthread_mutex_t rules_lock;
+    pthread_mutex_t keymap_cache_lock;
+    /* Number of compilations using files from the include cache. */
+    unsigned include_cache_users;
+
     /* Buffer for the *Text() functions. */
     char text_buffer[2048];
     size_t text_next;
 
     unsigned int use_environment_names : 1;
+    unsigned int use_keymap_cache : 1;
 };
 
+static inline void
+xkb_context_lock(struct xkb_context *ctx, pthread_mutex_t *lock)
+{
+    if (ctx->threaded)
+        pthread_mutex_lock(lock);
+}
+
+static inline void
+xkb_context_unlock(struct xkb_context *ctx, pthread_mutex_t *lock)
+{
+    if (ctx->threaded)
+        pthread_mutex_unlock(lock);
+}
+
 unsigned int
 xkb_context_num_failed_include_paths(struct xkb_context *ctx);
 
@@ -95,6 +156,42 @@ void
 xkb_context_sanitize_rule_names(struct xkb_context *ctx,
                                 struct xkb_rule_names *rmlvo);
 
+/*
+ * Returns a new reference to a keymap previously compiled from the same
+ * (sanitized) @rmlvo and @flags, or NULL if there is none.
+ */
+struct xkb_keymap *
+xkb_context_keymap_cache_lookup(struct xkb_context *ctx,
+                                const struct xkb_rule_names *rmlvo,
+                                enum xkb_keymap_compile_flags flags);
+
+void
+xkb_context_keymap_cache_add(struct xkb_context *ctx,
+                             const struct xkb_rule_names *rmlvo,
+                             enum xkb_keymap_compile_flags flags,
+                             struct xkb_keymap *keymap);
+
+/*
+ * Drops a reference to a keymap added to the cache. Returns true if it
+ * was the last one, in which case the keymap is removed from the cache
+ * and should be freed.
+ */
+bool
+xkb_context_keymap_cache_unref(struct xkb_context *ctx,
+                               struct xkb_keymap *keymap);
+
+void
+xkb_context_keymap_cache_clear(struct xkb_context *ctx);
+
+void
+xkb_context_include_cache_clear(struct xkb_context *ctx);
+
+void
+xkb_context_include_index_clear(struct xkb_context *ctx);
+
+void
+xkb_context_rules_cache_clear(struct xkb_context *ctx);
+
 /*
  * The format is not part of the argument list in order to avoid the
  * "ISO C99 requires rest arguments to be used" warning when only the
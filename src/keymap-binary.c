@@ -0,0 +1,886 @@
+/*
+ * Copyright © 2014 libxkbcommon contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The XKB_KEYMAP_FORMAT_BINARY_V1 format.
+ *
+ * This is a direct encoding of the fields of a compiled struct xkb_keymap,
+ * so loading it only needs to copy them back, with no parsing or
+ * compilation. It is meant for passing keymaps between processes on the
+ * same machine, and is not stable across versions of the library, or
+ * portable between machines of different byte order; both are checked in
+ * the header.
+ *
+ * All integers are in the byte order of the machine. Atoms (and other
+ * strings) are written as their length followed by the characters, and
+ * interned again when read. The layout is, in order: the header, the
+ * keymap-wide fields, the modifiers, the LEDs, the types, the interprets,
+ * the key aliases and the keys, each preceded by its count.
+ *
+ * The keys are preceded by the total number of groups, levels and keysyms
+ * they hold, so that they are read straight into the pools of the new
+ * keymap (see XkbCompactKeymap()). Each group gives the index of its
+ * levels in the level pool; if they are the same as those of an earlier
+ * group, the index refers to these, and the levels are not repeated.
+ */
+
+#include "keymap.h"
+
+#define BINARY_V1_MAGIC "xkbB"
+#define BINARY_V1_VERSION 3
+#define BINARY_V1_BYTE_ORDER 0x01020304
+#define BINARY_V1_NO_STRING UINT32_MAX
+
+struct writer {
+    struct xkb_keymap *keymap;
+    darray(char) buf;
+};
+
+static void
+write_bytes(struct writer *w, const void *data, size_t len)
+{
+    darray_append_items(w->buf, (const char *) data, len);
+}
+
+static void
+write_u8(struct writer *w, uint8_t v)
+{
+    write_bytes(w, &v, sizeof(v));
+}
+
+static void
+write_u16(struct writer *w, uint16_t v)
+{
+    write_bytes(w, &v, sizeof(v));
+}
+
+static void
+write_u32(struct writer *w, uint32_t v)
+{
+    write_bytes(w, &v, sizeof(v));
+}
+
+static void
+write_string(struct writer *w, const char *string)
+{
+    if (!string) {
+        write_u32(w, BINARY_V1_NO_STRING);
+        return;
+    }
+
+    write_u32(w, strlen(string));
+    write_bytes(w, string, strlen(string));
+}
+
+static void
+write_atom(struct writer *w, xkb_atom_t atom)
+{
+    write_string(w, xkb_atom_text(w->keymap->ctx, atom));
+}
+
+static void
+write_mods(struct writer *w, const struct xkb_mods *mods)
+{
+    write_u32(w, mods->mods);
+    write_u32(w, mods->mask);
+}
+
+static void
+write_action(struct writer *w, const union xkb_action *action)
+{
+    write_u8(w, action->type);
+
+    switch (action->type) {
+    case ACTION_TYPE_MOD_SET:
+    case ACTION_TYPE_MOD_LATCH:
+    case ACTION_TYPE_MOD_LOCK:
+        write_u16(w, action->mods.flags);
+        write_mods(w, &action->mods.mods);
+        break;
+
+    case ACTION_TYPE_GROUP_SET:
+    case ACTION_TYPE_GROUP_LATCH:
+    case ACTION_TYPE_GROUP_LOCK:
+        write_u16(w, action->group.flags);
+        write_u32(w, (uint32_t) action->group.group);
+        break;
+
+    case ACTION_TYPE_PTR_MOVE:
+        write_u16(w, action->ptr.flags);
+        write_u16(w, (uint16_t) action->ptr.x);
+        write_u16(w, (uint16_t) action->ptr.y);
+        break;
+
+    case ACTION_TYPE_PTR_BUTTON:
+    case ACTION_TYPE_PTR_LOCK:
+        write_u16(w, action->btn.flags);
+        write_u8(w, action->btn.count);
+        write_u8(w, action->btn.button);
+        break;
+
+    case ACTION_TYPE_PTR_DEFAULT:
+        write_u16(w, action->dflt.flags);
+        write_u8(w, (uint8_t) action->dflt.value);
+        break;
+
+    case ACTION_TYPE_SWITCH_VT:
+        write_u16(w, action->screen.flags);
+        write_u8(w, (uint8_t) action->screen.screen);
+        break;
+
+    case ACTION_TYPE_CTRL_SET:
+    case ACTION_TYPE_CTRL_LOCK:
+        write_u16(w, action->ctrls.flags);
+        write_u32(w, action->ctrls.ctrls);
+        break;
+
+    case ACTION_TYPE_NONE:
+    case ACTION_TYPE_TERMINATE:
+        break;
+
+    /* Private actions keep their own type, which may be anything above. */
+    case ACTION_TYPE_PRIVATE:
+    default:
+        write_bytes(w, action->priv.data, sizeof(action->priv.data));
+        break;
+    }
+}
+
+/*
+ * The index of the levels of a group in the level pool. If the keymap is
+ * not compacted, every group has levels of its own, next in line.
+ */
+static uint32_t
+level_index(const struct xkb_keymap *keymap, const struct xkb_group *group,
+            uint32_t next_level)
+{
+    if (keymap->level_pool)
+        return group->levels - keymap->level_pool;
+    return next_level;
+}
+
+static void
+write_keymap(struct writer *w)
+{
+    struct xkb_keymap *keymap = w->keymap;
+    const struct xkb_mod *mod;
+    const struct xkb_led *led;
+    const struct xkb_key *key;
+    uint32_t num_groups = 0, num_levels = 0, num_syms = 0;
+
+    write_bytes(w, BINARY_V1_MAGIC, strlen(BINARY_V1_MAGIC));
+    write_u32(w, BINARY_V1_VERSION);
+    write_u32(w, BINARY_V1_BYTE_ORDER);
+
+    write_u32(w, keymap->enabled_ctrls);
+    write_u32(w, keymap->num_groups);
+    write_string(w, keymap->keycodes_section_name);
+    write_string(w, keymap->types_section_name);
+    write_string(w, keymap->compat_section_name);
+    write_string(w, keymap->symbols_section_name);
+
+    write_u32(w, keymap->num_group_names);
+    for (unsigned i = 0; i < keymap->num_group_names; i++)
+        write_atom(w, keymap->group_names[i]);
+
+    write_u32(w, keymap->mods.num_mods);
+    xkb_mods_foreach(mod, &keymap->mods) {
+        write_atom(w, mod->name);
+        write_u8(w, mod->type);
+        write_u32(w, mod->mapping);
+    }
+
+    write_u32(w, keymap->num_leds);
+    xkb_leds_foreach(led, keymap) {
+        write_atom(w, led->name);
+        write_u32(w, led->which_groups);
+        write_u32(w, led->groups);
+        write_u32(w, led->which_mods);
+        write_mods(w, &led->mods);
+        write_u32(w, led->ctrls);
+    }
+
+    write_u32(w, keymap->num_types);
+    for (unsigned i = 0; i < keymap->num_types; i++) {
+        const struct xkb_key_type *type = &keymap->types[i];
+
+        write_atom(w, type->name);
+        write_mods(w, &type->mods);
+        write_u32(w, type->num_levels);
+        write_u32(w, type->level_names ? type->num_levels : 0);
+        for (unsigned j = 0; type->level_names && j < type->num_levels; j++)
+            write_atom(w, type->level_names[j]);
+        write_u32(w, type->num_entries);
+        for (unsigned j = 0; j < type->num_entries; j++) {
+            write_u32(w, type->entries[j].level);
+            write_mods(w, &type->entries[j].mods);
+            write_mods(w, &type->entries[j].preserve);
+        }
+    }
+
+    write_u32(w, keymap->num_sym_interprets);
+    for (unsigned i = 0; i < keymap->num_sym_interprets; i++) {
+        const struct xkb_sym_interpret *interp = &keymap->sym_interprets[i];
+
+        write_u32(w, interp->sym);
+        write_u8(w, interp->match);
+        write_u32(w, interp->mods);
+        write_u32(w, interp->virtual_mod);
+        write_action(w, &interp->action);
+        write_u8(w, interp->level_one_only);
+        write_u8(w, interp->repeat);
+    }
+
+    write_u32(w, keymap->num_key_aliases);
+    for (unsigned i = 0; i < keymap->num_key_aliases; i++) {
+        write_atom(w, keymap->key_aliases[i].real);
+        write_atom(w, keymap->key_aliases[i].alias);
+    }
+
+    write_u32(w, keymap->min_key_code);
+    write_u32(w, keymap->max_key_code);
+
+    xkb_keys_foreach(key, keymap) {
+        for (unsigned i = 0; i < key->num_groups; i++) {
+            const struct xkb_group *group = &key->groups[i];
+
+            num_groups++;
+            if (level_index(keymap, group, num_levels) != num_levels)
+                continue;
+
+            for (unsigned j = 0; j < XkbKeyGroupWidth(key, i); j++)
+                if (group->levels[j].num_syms > 1)
+                    num_syms += group->levels[j].num_syms;
+            num_levels += XkbKeyGroupWidth(key, i);
+        }
+    }
+    write_u32(w, num_groups);
+    write_u32(w, num_levels);
+    write_u32(w, num_syms);
+
+    num_levels = 0;
+    xkb_keys_foreach(key, keymap) {
+        write_atom(w, key->name);
+        write_u8(w, key->explicit);
+        write_u32(w, key->modmap);
+        write_u32(w, key->vmodmap);
+        write_u8(w, key->repeats);
+        write_u8(w, key->out_of_range_group_action);
+        write_u32(w, key->out_of_range_group_number);
+        write_u32(w, key->num_groups);
+
+        for (unsigned i = 0; i < key->num_groups; i++) {
+            const struct xkb_group *group = &key->groups[i];
+
+            const uint32_t index = level_index(keymap, group, num_levels);
+
+            write_u8(w, group->explicit_type);
+            write_u32(w, group->type - keymap->types);
+            write_u32(w, index);
+            if (index != num_levels)
+                continue;
+
+            num_levels += XkbKeyGroupWidth(key, i);
+            for (unsigned j = 0; j < XkbKeyGroupWidth(key, i); j++) {
+                const struct xkb_level *level = &group->levels[j];
+
+                write_action(w, &level->action);
+                write_u32(w, level->num_syms);
+                if (level->num_syms == 1)
+                    write_u32(w, level->u.sym);
+                else if (level->num_syms > 1)
+                    write_bytes(w, level->u.syms,
+                                level->num_syms * sizeof(*level->u.syms));
+            }
+        }
+    }
+}
+
+static char *
+binary_v1_keymap_get_as_buffer(struct xkb_keymap *keymap, size_t *length_out)
+{
+    struct writer w = { keymap, darray_new() };
+    char *buf;
+
+    write_keymap(&w);
+
+    *length_out = darray_size(w.buf);
+    darray_steal(w.buf, &buf, NULL);
+    return buf;
+}
+
+struct reader {
+    struct xkb_keymap *keymap;
+    const char *pos;
+    const char *end;
+    bool error;
+    /* Sizes of the keymap's pools, and how much of them is filled. */
+    uint32_t num_groups, num_levels, num_syms;
+    uint32_t next_group, next_level, next_sym;
+};
+
+static const void *
+read_bytes(struct reader *r, size_t len)
+{
+    const char *data = r->pos;
+
+    if (r->error || (size_t) (r->end - r->pos) < len) {
+        r->error = true;
+        return NULL;
+    }
+
+    r->pos += len;
+    return data;
+}
+
+static uint8_t
+read_u8(struct reader *r)
+{
+    uint8_t v = 0;
+    const void *data = read_bytes(r, sizeof(v));
+    if (data)
+        memcpy(&v, data, sizeof(v));
+    return v;
+}
+
+static uint16_t
+read_u16(struct reader *r)
+{
+    uint16_t v = 0;
+    const void *data = read_bytes(r, sizeof(v));
+    if (data)
+        memcpy(&v, data, sizeof(v));
+    return v;
+}
+
+static uint32_t
+read_u32(struct reader *r)
+{
+    uint32_t v = 0;
+    const void *data = read_bytes(r, sizeof(v));
+    if (data)
+        memcpy(&v, data, sizeof(v));
+    return v;
+}
+
+/*
+ * Reads a count of items, each taking at least @min_item_size bytes, and
+ * makes sure that there is enough input left for them, so that the count
+ * can be safely used to allocate.
+ */
+static uint32_t
+read_count(struct reader *r, size_t min_item_size, uint32_t max)
+{
+    uint32_t count = read_u32(r);
+
+    if (count > max ||
+        (size_t) (r->end - r->pos) / min_item_size < count) {
+        r->error = true;
+        return 0;
+    }
+
+    return count;
+}
+
+/* Returns NULL (and may set an error) if there is no string. */
+static const char *
+read_string_data(struct reader *r, uint32_t *len_out)
+{
+    uint32_t len = read_u32(r);
+
+    if (r->error || len == BINARY_V1_NO_STRING)
+        return NULL;
+
+    *len_out = len;
+    return read_bytes(r, len);
+}
+
+static char *
+read_string(struct reader *r)
+{
+    uint32_t len;
+    const char *data = read_string_data(r, &len);
+
+    return data ? strndup(data, len) : NULL;
+}
+
+static xkb_atom_t
+read_atom(struct reader *r)
+{
+    uint32_t len;
+    const char *data = read_string_data(r, &len);
+
+    if (!data)
+        return XKB_ATOM_NONE;
+
+    return xkb_atom_intern(r->keymap->ctx, data, len);
+}
+
+static void
+read_mods(struct reader *r, struct xkb_mods *mods)
+{
+    mods->mods = read_u32(r);
+    mods->mask = read_u32(r);
+}
+
+static void
+read_action(struct reader *r, union xkb_action *action)
+{
+    enum xkb_action_type type = read_u8(r);
+
+    memset(action, 0, sizeof(*action));
+    action->type = type;
+
+    switch (type) {
+    case ACTION_TYPE_MOD_SET:
+    case ACTION_TYPE_MOD_LATCH:
+    case ACTION_TYPE_MOD_LOCK:
+        action->mods.flags = read_u16(r);
+        read_mods(r, &action->mods.mods);
+        break;
+
+    case ACTION_TYPE_GROUP_SET:
+    case ACTION_TYPE_GROUP_LATCH:
+    case ACTION_TYPE_GROUP_LOCK:
+        action->group.flags = read_u16(r);
+        action->group.group = (int32_t) read_u32(r);
+        break;
+
+    case ACTION_TYPE_PTR_MOVE:
+        action->ptr.flags = read_u16(r);
+        action->ptr.x = (int16_t) read_u16(r);
+        action->ptr.y = (int16_t) read_u16(r);
+        break;
+
+    case ACTION_TYPE_PTR_BUTTON:
+    case ACTION_TYPE_PTR_LOCK:
+        action->btn.flags = read_u16(r);
+        action->btn.count = read_u8(r);
+        action->btn.button = read_u8(r);
+        break;
+
+    case ACTION_TYPE_PTR_DEFAULT:
+        action->dflt.flags = read_u16(r);
+        action->dflt.value = (int8_t) read_u8(r);
+        break;
+
+    case ACTION_TYPE_SWITCH_VT:
+        action->screen.flags = read_u16(r);
+        action->screen.screen = (int8_t) read_u8(r);
+        break;
+
+    case ACTION_TYPE_CTRL_SET:
+    case ACTION_TYPE_CTRL_LOCK:
+        action->ctrls.flags = read_u16(r);
+        action->ctrls.ctrls = read_u32(r);
+        break;
+
+    case ACTION_TYPE_NONE:
+    case ACTION_TYPE_TERMINATE:
+        break;
+
+    case ACTION_TYPE_PRIVATE:
+    default: {
+        const void *data = read_bytes(r, sizeof(action->priv.data));
+        if (data)
+            memcpy(action->priv.data, data, sizeof(action->priv.data));
+        break;
+    }
+    }
+}
+
+static bool
+read_header(struct reader *r)
+{
+    const void *magic = read_bytes(r, strlen(BINARY_V1_MAGIC));
+    uint32_t version, byte_order;
+
+    if (!magic || memcmp(magic, BINARY_V1_MAGIC, strlen(BINARY_V1_MAGIC)) != 0) {
+        log_err(r->keymap->ctx, "Not a binary keymap\n");
+        return false;
+    }
+
+    version = read_u32(r);
+    byte_order = read_u32(r);
+    if (version != BINARY_V1_VERSION || byte_order != BINARY_V1_BYTE_ORDER) {
+        log_err(r->keymap->ctx,
+                "Binary keymap was written by a different version of "
+                "xkbcommon, or on a machine of different byte order\n");
+        return false;
+    }
+
+    return true;
+}
+
+static bool
+read_types(struct reader *r)
+{
+    struct xkb_keymap *keymap = r->keymap;
+
+    keymap->num_types = read_count(r, 24, UINT32_MAX);
+    if (keymap->num_types == 0)
+        return false;
+
+    keymap->types = calloc(keymap->num_types, sizeof(*keymap->types));
+    if (!keymap->types) {
+        keymap->num_types = 0;
+        return false;
+    }
+
+    for (unsigned i = 0; i < keymap->num_types; i++) {
+        struct xkb_key_type *type = &keymap->types[i];
+        unsigned num_level_names;
+
+        type->name = read_atom(r);
+        read_mods(r, &type->mods);
+        type->num_levels = read_u32(r);
+        if (r->error || type->num_levels == 0)
+            return false;
+
+        num_level_names = read_count(r, 4, type->num_levels);
+        if (num_level_names != 0) {
+            if (num_level_names != type->num_levels)
+                return false;
+            type->level_names = calloc(num_level_names,
+                                       sizeof(*type->level_names));
+            if (!type->level_names)
+                return false;
+            for (unsigned j = 0; j < num_level_names; j++)
+                type->level_names[j] = read_atom(r);
+        }
+
+        type->num_entries = read_count(r, 20, UINT32_MAX);
+        if (type->num_entries != 0) {
+            type->entries = calloc(type->num_entries, sizeof(*type->entries));
+            if (!type->entries)
+                return false;
+            for (unsigned j = 0; j < type->num_entries; j++) {
+                type->entries[j].level = read_u32(r);
+                read_mods(r, &type->entries[j].mods);
+                read_mods(r, &type->entries[j].preserve);
+                if (type->entries[j].level >= type->num_levels)
+                    return false;
+            }
+        }
+
+        if (r->error || !XkbKeyTypeUpdateEntryMap(type))
+            return false;
+    }
+
+    return !r->error;
+}
+
+static bool
+read_key(struct reader *r, struct xkb_key *key)
+{
+    struct xkb_keymap *keymap = r->keymap;
+
+    key->name = read_atom(r);
+    key->explicit = read_u8(r);
+    key->modmap = read_u32(r);
+    key->vmodmap = read_u32(r);
+    key->repeats = read_u8(r);
+    key->out_of_range_group_action = read_u8(r);
+    key->out_of_range_group_number = read_u32(r);
+    if (key->out_of_range_group_action > RANGE_REDIRECT)
+        return false;
+
+    key->num_groups = read_count(r, 9, XKB_MAX_GROUPS);
+    if (r->error || key->num_groups == 0)
+        return !r->error;
+
+    if (r->num_groups - r->next_group < key->num_groups) {
+        key->num_groups = 0;
+        return false;
+    }
+    key->groups = &keymap->group_pool[r->next_group];
+    r->next_group += key->num_groups;
+
+    for (unsigned i = 0; i < key->num_groups; i++) {
+        struct xkb_group *group = &key->groups[i];
+        uint32_t type_index, level_index;
+        unsigned width;
+
+        group->explicit_type = read_u8(r);
+        type_index = read_u32(r);
+        if (r->error || type_index >= keymap->num_types)
+            return false;
+        group->type = &keymap->types[type_index];
+        width = XkbKeyGroupWidth(key, i);
+
+        level_index = read_u32(r);
+        if (r->error)
+            return false;
+
+        /* The same levels as an earlier group. */
+        if (level_index < r->next_level) {
+            if (r->next_level - level_index < width)
+                return false;
+            group->levels = &keymap->level_pool[level_index];
+            continue;
+        }
+
+        if (level_index != r->next_level ||
+            r->num_levels - r->next_level < width ||
+            (size_t) (r->end - r->pos) / 5 < width)
+            return false;
+        group->levels = &keymap->level_pool[r->next_level];
+        r->next_level += width;
+
+        for (unsigned j = 0; j < width; j++) {
+            struct xkb_level *level = &group->levels[j];
+
+            read_action(r, &level->action);
+            level->num_syms = read_count(r, sizeof(xkb_keysym_t), UINT32_MAX);
+            if (level->num_syms == 1) {
+                level->u.sym = read_u32(r);
+            }
+            else if (level->num_syms > 1) {
+                const void *syms;
+
+                syms = read_bytes(r, level->num_syms * sizeof(xkb_keysym_t));
+                if (!syms || r->num_syms - r->next_sym < level->num_syms) {
+                    level->num_syms = 0;
+                    return false;
+                }
+                level->u.syms = &keymap->sym_pool[r->next_sym];
+                r->next_sym += level->num_syms;
+                memcpy(level->u.syms, syms,
+                       level->num_syms * sizeof(xkb_keysym_t));
+            }
+
+            if (r->error)
+                return false;
+        }
+    }
+
+    return !r->error;
+}
+
+static bool
+read_pools(struct reader *r)
+{
+    struct xkb_keymap *keymap = r->keymap;
+
+    r->num_groups = read_count(r, 9, UINT32_MAX);
+    r->num_levels = read_count(r, 5, UINT32_MAX);
+    r->num_syms = read_count(r, sizeof(xkb_keysym_t), UINT32_MAX);
+    if (r->error)
+        return false;
+
+    if (r->num_groups > 0) {
+        keymap->group_pool = calloc(r->num_groups,
+                                    sizeof(*keymap->group_pool));
+        if (!keymap->group_pool)
+            return false;
+    }
+    if (r->num_levels > 0) {
+        keymap->level_pool = calloc(r->num_levels,
+                                    sizeof(*keymap->level_pool));
+        if (!keymap->level_pool)
+            return false;
+    }
+    if (r->num_syms > 0) {
+        keymap->sym_pool = calloc(r->num_syms, sizeof(*keymap->sym_pool));
+        if (!keymap->sym_pool)
+            return false;
+    }
+
+    return true;
+}
+
+static bool
+read_keymap(struct reader *r)
+{
+    struct xkb_keymap *keymap = r->keymap;
+    struct xkb_mod *mod;
+    struct xkb_led *led;
+    struct xkb_key *key;
+    uint32_t num_keys;
+
+    if (!read_header(r))
+        return false;
+
+    /*
+     * The keymap was compiled from the text format, which is also what
+     * XKB_KEYMAP_USE_ORIGINAL_FORMAT should give back.
+     */
+    keymap->format = XKB_KEYMAP_FORMAT_TEXT_V1;
+
+    keymap->enabled_ctrls = read_u32(r);
+    keymap->num_groups = read_u32(r);
+    if (keymap->num_groups > XKB_MAX_GROUPS)
+        return false;
+    keymap->keycodes_section_name = read_string(r);
+    keymap->types_section_name = read_string(r);
+    keymap->compat_section_name = read_string(r);
+    keymap->symbols_section_name = read_string(r);
+
+    keymap->num_group_names = read_count(r, 4, XKB_MAX_GROUPS);
+    if (keymap->num_group_names != 0) {
+        keymap->group_names = calloc(keymap->num_group_names,
+                                     sizeof(*keymap->group_names));
+        if (!keymap->group_names) {
+            keymap->num_group_names = 0;
+            return false;
+        }
+        for (unsigned i = 0; i < keymap->num_group_names; i++)
+            keymap->group_names[i] = read_atom(r);
+    }
+
+    keymap->mods.num_mods = read_count(r, 9, XKB_MAX_MODS);
+    xkb_mods_foreach(mod, &keymap->mods) {
+        mod->name = read_atom(r);
+        mod->type = read_u8(r);
+        mod->mapping = read_u32(r);
+    }
+
+    keymap->num_leds = read_count(r, 28, XKB_MAX_LEDS);
+    xkb_leds_foreach(led, keymap) {
+        led->name = read_atom(r);
+        led->which_groups = read_u32(r);
+        led->groups = read_u32(r);
+        led->which_mods = read_u32(r);
+        read_mods(r, &led->mods);
+        led->ctrls = read_u32(r);
+    }
+
+    if (r->error || !read_types(r))
+        return false;
+
+    keymap->num_sym_interprets = read_count(r, 15, UINT32_MAX);
+    if (keymap->num_sym_interprets != 0) {
+        keymap->sym_interprets = calloc(keymap->num_sym_interprets,
+                                        sizeof(*keymap->sym_interprets));
+        if (!keymap->sym_interprets) {
+            keymap->num_sym_interprets = 0;
+            return false;
+        }
+    }
+    for (unsigned i = 0; i < keymap->num_sym_interprets; i++) {
+        struct xkb_sym_interpret *interp = &keymap->sym_interprets[i];
+
+        interp->sym = read_u32(r);
+        interp->match = read_u8(r);
+        interp->mods = read_u32(r);
+        interp->virtual_mod = read_u32(r);
+        read_action(r, &interp->action);
+        interp->level_one_only = read_u8(r);
+        interp->repeat = read_u8(r);
+        if (interp->match > MATCH_EXACTLY)
+            return false;
+        if (interp->virtual_mod != XKB_MOD_INVALID &&
+            interp->virtual_mod >= keymap->mods.num_mods)
+            return false;
+    }
+
+    keymap->num_key_aliases = read_count(r, 8, UINT32_MAX);
+    if (keymap->num_key_aliases != 0) {
+        keymap->key_aliases = calloc(keymap->num_key_aliases,
+                                     sizeof(*keymap->key_aliases));
+        if (!keymap->key_aliases) {
+            keymap->num_key_aliases = 0;
+            return false;
+        }
+    }
+    for (unsigned i = 0; i < keymap->num_key_aliases; i++) {
+        keymap->key_aliases[i].real = read_atom(r);
+        keymap->key_aliases[i].alias = read_atom(r);
+    }
+
+    keymap->min_key_code = read_u32(r);
+    keymap->max_key_code = read_u32(r);
+    if (r->error || keymap->min_key_code > keymap->max_key_code ||
+        keymap->max_key_code > XKB_KEYCODE_MAX)
+        return false;
+
+    /* Every key takes at least 23 bytes. */
+    num_keys = keymap->max_key_code - keymap->min_key_code + 1;
+    if ((size_t) (r->end - r->pos) / 23 < num_keys)
+        return false;
+
+    keymap->keys = calloc(keymap->max_key_code + 1, sizeof(*keymap->keys));
+    if (!keymap->keys)
+        return false;
+
+    if (!read_pools(r))
+        return false;
+
+    xkb_keys_foreach(key, keymap) {
+        key->keycode = key - keymap->keys;
+        if (!read_key(r, key))
+            return false;
+    }
+
+    return !r->error && r->pos == r->end;
+}
+
+static bool
+binary_v1_keymap_new_from_string(struct xkb_keymap *keymap,
+                                 const char *string, size_t len)
+{
+    struct reader r = { keymap, string, string + len, false };
+
+    if (!read_keymap(&r)) {
+        log_err(keymap->ctx, "Failed to load binary keymap\n");
+        return false;
+    }
+
+    return true;
+}
+
+static bool
+binary_v1_keymap_new_from_file(struct xkb_keymap *keymap, FILE *file)
+{
+    darray(char) buf = darray_new();
+    char chunk[4096];
+    const char *string;
+    size_t len;
+    bool ok;
+
+    /* Load straight from a mapping of the file, if it can be mapped. */
+    if (map_file(file, &string, &len)) {
+        ok = binary_v1_keymap_new_from_string(keymap, string, len);
+        unmap_file(string, len);
+        return ok;
+    }
+
+    while ((len = fread(chunk, 1, sizeof(chunk), file)) > 0)
+        darray_append_items(buf, chunk, len);
+
+    if (ferror(file)) {
+        log_err(keymap->ctx, "Failed to read binary keymap file\n");
+        darray_free(buf);
+        return false;
+    }
+
+    ok = binary_v1_keymap_new_from_string(keymap, buf.item, darray_size(buf));
+    darray_free(buf);
+    return ok;
+}
+
+const struct xkb_keymap_format_ops binary_v1_keymap_format_ops = {
+    .keymap_new_from_string = binary_v1_keymap_new_from_string,
+    .keymap_new_from_file = binary_v1_keymap_new_from_file,
+    .keymap_get_as_buffer = binary_v1_keymap_get_as_buffer,
+};
@@ -72,19 +72,41 @@ xkb_keymap_new(struct xkb_context *ctx,
     return keymap;
 }
 
-struct xkb_key *
-XkbKeyByName(struct xkb_keymap *keymap, xkb_atom_t name, bool use_aliases)
+static struct xkb_key *
+XkbKeyByRealName(struct xkb_keymap *keymap, xkb_atom_t name)
 {
     struct xkb_key *key;
 
+    if (!darray_empty(keymap->key_index)) {
+        unsigned kc = atom_index_get(&keymap->key_index, name);
+
+        if (kc > keymap->min_key_code && kc <= keymap->max_key_code + 1 &&
+            keymap->keys[kc - 1].name == name)
+            return &keymap->keys[kc - 1];
+
+        return NULL;
+    }
+
     xkb_keys_foreach(key, keymap)
         if (key->name == name)
             return key;
 
+    return NULL;
+}
+
+struct xkb_key *
+XkbKeyByName(struct xkb_keymap *keymap, xkb_atom_t name, bool use_aliases)
+{
+    struct xkb_key *key;
+
+    key = XkbKeyByRealName(keymap, name);
+    if (key)
+        return key;
+
     if (use_aliases) {
         xkb_atom_t new_name = XkbResolveKeyAlias(keymap, name);
         if (new_name != XKB_ATOM_NONE)
-            return XkbKeyByName(keymap, new_name, false);
+            return XkbKeyByRealName(keymap, new_name);
     }
 
     return NULL;
@@ -93,6 +115,16 @@ XkbKeyByName(struct xkb_keymap *keymap, xkb_atom_t name, bool use_aliases)
 xkb_atom_t
 XkbResolveKeyAlias(const struct xkb_keymap *keymap, xkb_atom_t name)
 {
+    if (!darray_empty(keymap->alias_index)) {
+        unsigned i = atom_index_get(&keymap->alias_index, name);
+
+        if (i != 0 && i <= keymap->num_key_aliases &&
+            keymap->key_aliases[i - 1].alias == name)
+            return keymap->key_aliases[i - 1].real;
+
+        return XKB_ATOM_NONE;
+    }
+
     for (unsigned i = 0; i < keymap->num_key_aliases; i++)
         if (keymap->key_aliases[i].alias == name)
             return keymap->key_aliases[i].real;
@@ -100,6 +132,322 @@ XkbResolveKeyAlias(const struct xkb_keymap *keymap, xkb_atom_t name)
     return XKB_ATOM_NONE;
 }
 
+/*
+ * Returns a new index of the keymap's keys by keysym, or NULL if out of
+ * memory. The keymap is not changed, so this may run while other threads
+ * use it.
+ */
+struct xkb_keysym_index *
+XkbBuildKeysymIndex(const struct xkb_keymap *keymap)
+{
+    const struct xkb_key *key;
+    struct xkb_keysym_index *index;
+    struct xkb_keysym_location *locs, *tmp, *swap;
+    xkb_layout_index_t layout, max_layouts = 0;
+    xkb_level_index_t level, max_levels = 0;
+    unsigned int num_locs, i, n;
+
+    num_locs = 0;
+    xkb_keys_foreach(key, keymap) {
+        max_layouts = MAX(max_layouts, key->num_groups);
+        for (layout = 0; layout < key->num_groups; layout++) {
+            max_levels = MAX(max_levels, XkbKeyGroupWidth(key, layout));
+            for (level = 0; level < XkbKeyGroupWidth(key, layout); level++)
+                num_locs += key->groups[layout].levels[level].num_syms;
+        }
+    }
+
+    index = calloc(1, sizeof(*index) + num_locs * sizeof(*locs));
+    if (!index)
+        return NULL;
+    if (num_locs == 0)
+        return index;
+
+    locs = index->locations;
+    tmp = calloc(num_locs, sizeof(*tmp));
+    if (!tmp) {
+        free(index);
+        return NULL;
+    }
+
+    /*
+     * Emit the locations already ordered by layout, level and keycode,
+     * so that only a stable sort by keysym is left to do.
+     */
+    n = 0;
+    for (layout = 0; layout < max_layouts; layout++) {
+        for (level = 0; level < max_levels; level++) {
+            xkb_keys_foreach(key, keymap) {
+                const struct xkb_level *leveli;
+                const xkb_keysym_t *syms;
+
+                if (layout >= key->num_groups ||
+                    level >= XkbKeyGroupWidth(key, layout))
+                    continue;
+
+                leveli = &key->groups[layout].levels[level];
+                syms = leveli->num_syms > 1 ? leveli->u.syms : &leveli->u.sym;
+                for (i = 0; i < leveli->num_syms; i++) {
+                    unsigned int j;
+
+                    /* A level may produce the same keysym more than once. */
+                    for (j = 0; j < i; j++)
+                        if (syms[j] == syms[i])
+                            break;
+                    if (j < i)
+                        continue;
+
+                    locs[n].sym = syms[i];
+                    locs[n].keycode = key->keycode;
+                    locs[n].layout = layout;
+                    locs[n].level = level;
+                    n++;
+                }
+            }
+        }
+    }
+    num_locs = n;
+
+    /* LSD radix sort by keysym, one byte at a time. */
+    for (unsigned int shift = 0; shift < 32; shift += 8) {
+        unsigned int count[256] = { 0 };
+
+        for (i = 0; i < num_locs; i++)
+            count[(locs[i].sym >> shift) & 0xff]++;
+
+        /* Every keysym has the same byte here; nothing to do. */
+        if (count[(locs[0].sym >> shift) & 0xff] == num_locs)
+            continue;
+
+        for (i = 0, n = 0; i < 256; i++) {
+            unsigned int c = count[i];
+            count[i] = n;
+            n += c;
+        }
+
+        for (i = 0; i < num_locs; i++)
+            tmp[count[(locs[i].sym >> shift) & 0xff]++] = locs[i];
+
+        swap = locs;
+        locs = tmp;
+        tmp = swap;
+    }
+
+    /* The sort may have left the result in the scratch array. */
+    if (locs != index->locations)
+        memcpy(index->locations, locs, num_locs * sizeof(*locs));
+    free(locs == index->locations ? tmp : locs);
+    index->num_locations = num_locs;
+    return index;
+}
+
+const struct xkb_keysym_location *
+XkbKeysymLocations(const struct xkb_keysym_index *index, xkb_keysym_t sym,
+                   unsigned int *count_out)
+{
+    unsigned int lo = 0, hi = index->num_locations, end;
+
+    while (lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        if (index->locations[mid].sym < sym)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    for (end = lo; end < index->num_locations; end++)
+        if (index->locations[end].sym != sym)
+            break;
+
+    *count_out = end - lo;
+    return end > lo ? &index->locations[lo] : NULL;
+}
+
+static uint32_t
+hash_levels(const struct xkb_level *levels, xkb_level_index_t width)
+{
+    uint32_t hash = 2166136261u;
+
+    for (xkb_level_index_t i = 0; i < width; i++) {
+        const xkb_keysym_t *syms = (levels[i].num_syms > 1 ?
+                                    levels[i].u.syms : &levels[i].u.sym);
+
+        hash = (hash ^ levels[i].action.type) * 16777619u;
+        hash = (hash ^ levels[i].num_syms) * 16777619u;
+        for (unsigned j = 0; j < levels[i].num_syms; j++)
+            hash = (hash ^ syms[j]) * 16777619u;
+    }
+
+    return hash;
+}
+
+static bool
+levels_equal(const struct xkb_level *a, const struct xkb_level *b,
+             xkb_level_index_t width)
+{
+    for (xkb_level_index_t i = 0; i < width; i++) {
+        if (a[i].num_syms != b[i].num_syms ||
+            memcmp(&a[i].action, &b[i].action, sizeof(a[i].action)) != 0)
+            return false;
+        if (a[i].num_syms == 1 && a[i].u.sym != b[i].u.sym)
+            return false;
+        if (a[i].num_syms > 1 &&
+            memcmp(a[i].u.syms, b[i].u.syms,
+                   a[i].num_syms * sizeof(*a[i].u.syms)) != 0)
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Move every key's groups, levels and multi-keysym arrays into three
+ * contiguous pools, laid out in keycode order, so that looking up
+ * neighbouring keys touches neighbouring memory instead of a few
+ * hundred scattered small allocations. The key, group and level
+ * structs keep their pointers, now pointing into the pools.
+ *
+ * Groups with identical levels share a single run of levels in the
+ * pool.
+ *
+ * Must be called once the keymap is complete; the levels are never
+ * modified afterwards. If an allocation fails the keymap is left as it
+ * was, which is still fully usable.
+ */
+void
+XkbCompactKeymap(struct xkb_keymap *keymap)
+{
+    struct xkb_key *key;
+    struct xkb_group *groups = NULL;
+    struct xkb_level *levels = NULL;
+    xkb_keysym_t *syms = NULL;
+    struct xkb_level **runs = NULL;
+    xkb_level_index_t *widths = NULL;
+    unsigned int *first = NULL, *table = NULL;
+    size_t num_groups = 0, num_levels = 0, num_syms = 0;
+    size_t table_size = 1, gi, li = 0, si = 0;
+
+    if (!keymap->keys || keymap->group_pool)
+        return;
+
+    xkb_keys_foreach(key, keymap)
+        num_groups += key->num_groups;
+    if (num_groups == 0)
+        return;
+
+    while (table_size < num_groups * 2)
+        table_size *= 2;
+
+    runs = calloc(num_groups, sizeof(*runs));
+    widths = calloc(num_groups, sizeof(*widths));
+    first = calloc(num_groups, sizeof(*first));
+    table = calloc(table_size, sizeof(*table));
+    if (!runs || !widths || !first || !table)
+        goto out;
+
+    /* Find the first group with the same levels as each group. */
+    gi = 0;
+    xkb_keys_foreach(key, keymap) {
+        for (xkb_layout_index_t i = 0; i < key->num_groups; i++, gi++) {
+            struct xkb_level *run = key->groups[i].levels;
+            xkb_level_index_t width = XkbKeyGroupWidth(key, i);
+            size_t slot;
+
+            runs[gi] = run;
+            widths[gi] = width;
+            first[gi] = gi;
+            if (!run)
+                continue;
+
+            slot = hash_levels(run, width) & (table_size - 1);
+            for (; table[slot] != 0; slot = (slot + 1) & (table_size - 1)) {
+                unsigned int other = table[slot] - 1;
+                if (widths[other] == width &&
+                    levels_equal(runs[other], run, width)) {
+                    first[gi] = other;
+                    break;
+                }
+            }
+            if (first[gi] != gi)
+                continue;
+
+            table[slot] = gi + 1;
+            num_levels += width;
+            for (xkb_level_index_t j = 0; j < width; j++)
+                if (run[j].num_syms > 1)
+                    num_syms += run[j].num_syms;
+        }
+    }
+
+    groups = calloc(num_groups, sizeof(*groups));
+    if (num_levels > 0)
+        levels = calloc(num_levels, sizeof(*levels));
+    if (num_syms > 0)
+        syms = calloc(num_syms, sizeof(*syms));
+    if (!groups || (num_levels > 0 && !levels) || (num_syms > 0 && !syms)) {
+        free(groups);
+        free(levels);
+        free(syms);
+        goto out;
+    }
+
+    /*
+     * Copy the first run of each kind of levels into the pool, and point
+     * the identical ones at it. runs[] is updated to the copies as we go;
+     * a run is always copied before the runs which share it.
+     */
+    gi = 0;
+    xkb_keys_foreach(key, keymap) {
+        struct xkb_group *key_groups = &groups[gi];
+
+        for (xkb_layout_index_t i = 0; i < key->num_groups; i++, gi++) {
+            struct xkb_level *old = key->groups[i].levels;
+            struct xkb_group *group = &groups[gi];
+
+            *group = key->groups[i];
+            if (!old)
+                continue;
+
+            if (first[gi] != gi) {
+                group->levels = runs[first[gi]];
+            }
+            else {
+                group->levels = &levels[li];
+                for (xkb_level_index_t j = 0; j < widths[gi]; j++) {
+                    struct xkb_level *level = &levels[li++];
+
+                    *level = old[j];
+                    if (level->num_syms > 1) {
+                        memcpy(&syms[si], old[j].u.syms,
+                               level->num_syms * sizeof(*syms));
+                        level->u.syms = &syms[si];
+                        si += level->num_syms;
+                    }
+                }
+                runs[gi] = group->levels;
+            }
+
+            for (xkb_level_index_t j = 0; j < widths[gi]; j++)
+                if (old[j].num_syms > 1)
+                    free(old[j].u.syms);
+            free(old);
+        }
+
+        free(key->groups);
+        key->groups = key->num_groups > 0 ? key_groups : NULL;
+    }
+
+    keymap->group_pool = groups;
+    keymap->level_pool = levels;
+    keymap->sym_pool = syms;
+
+out:
+    free(runs);
+    free(widths);
+    free(first);
+    free(table);
+}
+
 void
 XkbEscapeMapName(char *name)
 {
@@ -124,6 +472,48 @@ XkbEscapeMapName(char *name)
     }
 }
 
+/*
+ * Build the direct lookup table from the masked effective modifiers to
+ * the type entry to use. Must be called once the effective masks of the
+ * type and its entries are final.
+ */
+bool
+XkbKeyTypeUpdateEntryMap(struct xkb_key_type *type)
+{
+    unsigned width = msb_pos(type->mods.mask);
+    xkb_mod_mask_t size;
+
+    free(type->entry_map);
+    type->entry_map = NULL;
+
+    /*
+     * Effective masks only contain real modifiers, so this is at most
+     * 256 slots; be safe in case this ever changes.
+     */
+    if (width > 8 || type->num_entries >= UINT8_MAX)
+        return true;
+
+    size = 1u << width;
+    type->entry_map = calloc(size, sizeof(*type->entry_map));
+    if (!type->entry_map)
+        return false;
+
+    /*
+     * The first matching entry wins. As in the search, entries whose
+     * virtual modifiers are not bound to anything are skipped.
+     */
+    for (unsigned i = 0; i < type->num_entries; i++) {
+        xkb_mod_mask_t mask = type->entries[i].mods.mask;
+
+        if (!mask || mask >= size || type->entry_map[mask])
+            continue;
+
+        type->entry_map[mask] = i + 1;
+    }
+
+    return true;
+}
+
 xkb_mod_index_t
 XkbModNameToIndex(const struct xkb_mod_set *mods, xkb_atom_t name,
                   enum mod_type type)
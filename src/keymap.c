@@ -52,21 +52,31 @@
 
 #include "keymap.h"
 #include "text.h"
+#include "xkbcomp/rules.h"
 
 XKB_EXPORT struct xkb_keymap *
 xkb_keymap_ref(struct xkb_keymap *keymap)
 {
-    keymap->refcnt++;
+    refcnt_inc(&keymap->refcnt);
     return keymap;
 }
 
 XKB_EXPORT void
 xkb_keymap_unref(struct xkb_keymap *keymap)
 {
-    if (!keymap || --keymap->refcnt > 0)
+    if (!keymap)
         return;
 
-    if (keymap->keys) {
+    if (keymap->ctx->use_keymap_cache) {
+        if (!xkb_context_keymap_cache_unref(keymap->ctx, keymap))
+            return;
+    }
+    else if (refcnt_dec(&keymap->refcnt) > 0) {
+        return;
+    }
+
+    /* With the pools, the keys don't own their groups and levels. */
+    if (keymap->keys && !keymap->group_pool) {
         struct xkb_key *key;
         xkb_keys_foreach(key, keymap) {
             if (key->groups) {
@@ -81,17 +91,24 @@ xkb_keymap_unref(struct xkb_keymap *keymap)
                 free(key->groups);
             }
         }
-        free(keymap->keys);
     }
+    free(keymap->keys);
+    free(keymap->group_pool);
+    free(keymap->level_pool);
+    free(keymap->sym_pool);
     if (keymap->types) {
         for (unsigned i = 0; i < keymap->num_types; i++) {
             free(keymap->types[i].entries);
+            free(keymap->types[i].entry_map);
             free(keymap->types[i].level_names);
         }
         free(keymap->types);
     }
     free(keymap->sym_interprets);
     free(keymap->key_aliases);
+    free(keymap->keysym_index);
+    darray_free(keymap->key_index);
+    darray_free(keymap->alias_index);
     free(keymap->group_names);
     free(keymap->keycodes_section_name);
     free(keymap->symbols_section_name);
@@ -106,6 +123,7 @@ get_keymap_format_ops(enum xkb_keymap_format format)
 {
     static const struct xkb_keymap_format_ops *keymap_format_ops[] = {
         [XKB_KEYMAP_FORMAT_TEXT_V1] = &text_v1_keymap_format_ops,
+        [XKB_KEYMAP_FORMAT_BINARY_V1] = &binary_v1_keymap_format_ops,
     };
 
     if ((int) format < 0 || (int) format >= (int) ARRAY_SIZE(keymap_format_ops))
@@ -114,6 +132,109 @@ get_keymap_format_ops(enum xkb_keymap_format format)
     return keymap_format_ops[(int) format];
 }
 
+/*
+ * A 64-bit digest of the binary format of a keymap, to find the cached
+ * keymaps which may be identical to a new one. It is easy to collide on
+ * purpose, so a match must still be compared byte for byte.
+ * Words are mixed as in MurmurHash3's finalizer.
+ */
+static uint64_t
+hash_buffer(const char *buf, size_t len)
+{
+    uint64_t hash = 0x9e3779b97f4a7c15ull ^ len;
+    uint64_t word;
+    size_t i;
+
+    for (i = 0; i + 8 <= len; i += 8) {
+        memcpy(&word, buf + i, 8);
+        word *= 0xff51afd7ed558ccdull;
+        word ^= word >> 33;
+        hash = (hash ^ word) * 0xc4ceb9fe1a85ec53ull;
+        hash = (hash << 31) | (hash >> 33);
+    }
+    for (word = 0; i < len; i++)
+        word = (word << 8) | (unsigned char) buf[i];
+    hash ^= word;
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+/*
+ * With the keymap cache, keymaps with the same contents are shared, no
+ * matter how they were created: the binary format of the keymap is
+ * hashed, and looked up among the digests of the cached keymaps. If the
+ * keymap was just loaded from the binary format, @buf holds those bytes
+ * already; otherwise it is NULL and the keymap is serialized here.
+ * Returns either @keymap, now in the cache, or a new reference to an
+ * identical cached keymap, in which case @keymap is unreferenced.
+ */
+static struct xkb_keymap *
+share_keymap(struct xkb_keymap *keymap, const char *buf, size_t len)
+{
+    struct xkb_context *ctx = keymap->ctx;
+    const struct xkb_keymap_format_ops *ops = &binary_v1_keymap_format_ops;
+    struct keymap_content_entry *entry, new_entry;
+    struct xkb_keymap *candidate = NULL;
+    char *own = NULL, *other;
+    size_t other_len;
+    bool same;
+
+    if (!buf) {
+        /* Not being able to share the keymap is not an error. */
+        own = ops->keymap_get_as_buffer(keymap, &len);
+        if (!own)
+            return keymap;
+        buf = own;
+    }
+
+    new_entry.digest = hash_buffer(buf, len);
+    new_entry.size = len;
+    new_entry.keymap = keymap;
+
+    /*
+     * Only look the digest up under the lock; the reference keeps the
+     * candidate alive while it is serialized and compared outside of it.
+     */
+    xkb_context_lock(ctx, &ctx->keymap_cache_lock);
+    darray_foreach(entry, ctx->keymap_contents) {
+        if (entry->digest == new_entry.digest && entry->size == len) {
+            candidate = xkb_keymap_ref(entry->keymap);
+            break;
+        }
+    }
+    if (!candidate)
+        darray_append(ctx->keymap_contents, new_entry);
+    xkb_context_unlock(ctx, &ctx->keymap_cache_lock);
+
+    if (!candidate) {
+        free(own);
+        return keymap;
+    }
+
+    other = ops->keymap_get_as_buffer(candidate, &other_len);
+    same = (other && other_len == len && memcmp(other, buf, len) == 0);
+    free(other);
+    free(own);
+
+    /*
+     * A different keymap with the same digest: it keeps its entry, and
+     * this one is simply not shared.
+     */
+    if (!same) {
+        xkb_keymap_unref(candidate);
+        return keymap;
+    }
+
+    xkb_keymap_unref(keymap);
+    return candidate;
+}
+
 XKB_EXPORT struct xkb_keymap *
 xkb_keymap_new_from_names(struct xkb_context *ctx,
                           const struct xkb_rule_names *rmlvo_in,
@@ -130,29 +251,67 @@ xkb_keymap_new_from_names(struct xkb_context *ctx,
         return NULL;
     }
 
-    if (flags & ~(XKB_KEYMAP_COMPILE_NO_FLAGS)) {
+    if (flags & ~(XKB_KEYMAP_COMPILE_PARALLEL)) {
         log_err_func(ctx, "unrecognized flags: %#x\n", flags);
         return NULL;
     }
 
-    keymap = xkb_keymap_new(ctx, format, flags);
-    if (!keymap)
-        return NULL;
-
     if (rmlvo_in)
         rmlvo = *rmlvo_in;
     else
         memset(&rmlvo, 0, sizeof(rmlvo));
     xkb_context_sanitize_rule_names(ctx, &rmlvo);
 
+    if (ctx->use_keymap_cache) {
+        keymap = xkb_context_keymap_cache_lookup(ctx, &rmlvo, flags);
+        if (keymap)
+            return keymap;
+    }
+
+    keymap = xkb_keymap_new(ctx, format, flags);
+    if (!keymap)
+        return NULL;
+
     if (!ops->keymap_new_from_names(keymap, &rmlvo)) {
         xkb_keymap_unref(keymap);
         return NULL;
     }
 
+    if (ctx->use_keymap_cache) {
+        keymap = share_keymap(keymap, NULL, 0);
+        xkb_context_keymap_cache_add(ctx, &rmlvo, flags, keymap);
+    }
+
     return keymap;
 }
 
+XKB_EXPORT size_t
+xkb_components_from_names(struct xkb_context *ctx,
+                          const struct xkb_rule_names *names_in,
+                          size_t count,
+                          struct xkb_component_names *components_out)
+{
+    size_t ret;
+    struct xkb_rule_names *names;
+
+    names = calloc(count > 0 ? count : 1, sizeof(*names));
+    if (!names) {
+        log_err_func1(ctx, "couldn't allocate names\n");
+        memset(components_out, 0, count * sizeof(*components_out));
+        return 0;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        names[i] = names_in[i];
+        xkb_context_sanitize_rule_names(ctx, &names[i]);
+    }
+
+    ret = xkb_components_from_rules_bulk(ctx, names, count, components_out);
+
+    free(names);
+    return ret;
+}
+
 XKB_EXPORT struct xkb_keymap *
 xkb_keymap_new_from_string(struct xkb_context *ctx,
                            const char *string,
@@ -178,7 +337,7 @@ xkb_keymap_new_from_buffer(struct xkb_context *ctx,
         return NULL;
     }
 
-    if (flags & ~(XKB_KEYMAP_COMPILE_NO_FLAGS)) {
+    if (flags & ~(XKB_KEYMAP_COMPILE_PARALLEL)) {
         log_err_func(ctx, "unrecognized flags: %#x\n", flags);
         return NULL;
     }
@@ -197,6 +356,13 @@ xkb_keymap_new_from_buffer(struct xkb_context *ctx,
         return NULL;
     }
 
+    if (ctx->use_keymap_cache) {
+        if (format == XKB_KEYMAP_FORMAT_BINARY_V1)
+            keymap = share_keymap(keymap, buffer, length);
+        else
+            keymap = share_keymap(keymap, NULL, 0);
+    }
+
     return keymap;
 }
 
@@ -215,7 +381,7 @@ xkb_keymap_new_from_file(struct xkb_context *ctx,
         return NULL;
     }
 
-    if (flags & ~(XKB_KEYMAP_COMPILE_NO_FLAGS)) {
+    if (flags & ~(XKB_KEYMAP_COMPILE_PARALLEL)) {
         log_err_func(ctx, "unrecognized flags: %#x\n", flags);
         return NULL;
     }
@@ -234,6 +400,9 @@ xkb_keymap_new_from_file(struct xkb_context *ctx,
         return NULL;
     }
 
+    if (ctx->use_keymap_cache)
+        keymap = share_keymap(keymap, NULL, 0);
+
     return keymap;
 }
 
@@ -255,6 +424,37 @@ xkb_keymap_get_as_string(struct xkb_keymap *keymap,
     return ops->keymap_get_as_string(keymap);
 }
 
+XKB_EXPORT char *
+xkb_keymap_get_as_buffer(struct xkb_keymap *keymap,
+                         enum xkb_keymap_format format,
+                         size_t *length_out)
+{
+    const struct xkb_keymap_format_ops *ops;
+    char *buffer;
+
+    if (format == XKB_KEYMAP_USE_ORIGINAL_FORMAT)
+        format = keymap->format;
+
+    ops = get_keymap_format_ops(format);
+    if (!ops || (!ops->keymap_get_as_buffer && !ops->keymap_get_as_string)) {
+        log_err_func(keymap->ctx, "unsupported keymap format: %d\n", format);
+        return NULL;
+    }
+
+    if (!length_out) {
+        log_err_func1(keymap->ctx, "no length argument specified\n");
+        return NULL;
+    }
+
+    if (ops->keymap_get_as_buffer)
+        return ops->keymap_get_as_buffer(keymap, length_out);
+
+    buffer = ops->keymap_get_as_string(keymap);
+    if (buffer)
+        *length_out = strlen(buffer);
+    return buffer;
+}
+
 /**
  * Returns the total number of modifiers active in the keymap.
  */
@@ -448,6 +648,40 @@ err:
     return 0;
 }
 
+XKB_EXPORT void
+xkb_keymap_keysym_for_each(struct xkb_keymap *keymap, xkb_keysym_t keysym,
+                           xkb_keymap_keysym_iter_t iter, void *data)
+{
+    struct xkb_keysym_index *index, *built;
+    const struct xkb_keysym_location *locs;
+    unsigned int count;
+
+    /*
+     * Most keymaps are never searched by keysym, so the index is built on
+     * first use. The keymap may be shared between threads: the first
+     * index to be published wins, and any other is thrown away.
+     */
+    index = atomic_load_acquire(&keymap->keysym_index);
+    if (!index) {
+        built = XkbBuildKeysymIndex(keymap);
+        if (!built) {
+            log_err_func1(keymap->ctx, "couldn't allocate keysym index\n");
+            return;
+        }
+        if (atomic_cas(&keymap->keysym_index, NULL, built)) {
+            index = built;
+        }
+        else {
+            free(built);
+            index = atomic_load_acquire(&keymap->keysym_index);
+        }
+    }
+
+    locs = XkbKeysymLocations(index, keysym, &count);
+    for (unsigned int i = 0; i < count; i++)
+        iter(keymap, locs[i].keycode, locs[i].layout, locs[i].level, data);
+}
+
 XKB_EXPORT xkb_keycode_t
 xkb_keymap_min_keycode(struct xkb_keymap *keymap)
 {
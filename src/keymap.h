@@ -256,6 +256,14 @@ struct xkb_key_type {
     xkb_atom_t *level_names;
     unsigned int num_entries;
     struct xkb_key_type_entry *entries;
+    /*
+     * Maps the effective modifiers masked by mods.mask directly to the
+     * matching entry, as an index into entries plus one (0 means no entry
+     * matches). Has (1 << msb_pos(mods.mask)) slots. May be NULL if the
+     * mask is too wide for a direct lookup, in which case the entries
+     * are searched.
+     */
+    uint8_t *entry_map;
 };
 
 struct xkb_sym_interpret {
@@ -282,6 +290,23 @@ struct xkb_key_alias {
     xkb_atom_t alias;
 };
 
+/* A level of a key which produces a keysym. */
+struct xkb_keysym_location {
+    xkb_keysym_t sym;
+    xkb_keycode_t keycode;
+    xkb_layout_index_t layout;
+    xkb_level_index_t level;
+};
+
+/*
+ * Every level of every key, by keysym. Sorted by keysym, then layout,
+ * then level, then keycode.
+ */
+struct xkb_keysym_index {
+    unsigned int num_locations;
+    struct xkb_keysym_location locations[];
+};
+
 struct xkb_controls {
     unsigned char groups_wrap;
     struct xkb_mods internal;
@@ -371,10 +396,31 @@ struct xkb_keymap {
     xkb_keycode_t max_key_code;
     struct xkb_key *keys;
 
+    /*
+     * If set, every key's groups, levels and multi-keysym arrays live
+     * in these pools, in keycode order; see XkbCompactKeymap().
+     */
+    struct xkb_group *group_pool;
+    struct xkb_level *level_pool;
+    xkb_keysym_t *sym_pool;
+
     /* aliases in no particular order */
     unsigned int num_key_aliases;
     struct xkb_key_alias *key_aliases;
 
+    /*
+     * Key name -> keycode + 1, and alias name -> alias index + 1.
+     * Only built while compiling; see XkbKeyByName().
+     */
+    darray_uint key_index;
+    darray_uint alias_index;
+
+    /*
+     * Built while compiling the symbols, and again on the first
+     * xkb_keymap_keysym_for_each(); see XkbBuildKeysymIndex().
+     */
+    struct xkb_keysym_index *keysym_index;
+
     struct xkb_key_type *types;
     unsigned int num_types;
 
@@ -448,9 +494,22 @@ XkbKeyByName(struct xkb_keymap *keymap, xkb_atom_t name, bool use_aliases);
 xkb_atom_t
 XkbResolveKeyAlias(const struct xkb_keymap *keymap, xkb_atom_t name);
 
+struct xkb_keysym_index *
+XkbBuildKeysymIndex(const struct xkb_keymap *keymap);
+
+void
+XkbCompactKeymap(struct xkb_keymap *keymap);
+
+const struct xkb_keysym_location *
+XkbKeysymLocations(const struct xkb_keysym_index *index, xkb_keysym_t sym,
+                   unsigned int *count_out);
+
 void
 XkbEscapeMapName(char *name);
 
+bool
+XkbKeyTypeUpdateEntryMap(struct xkb_key_type *type);
+
 xkb_mod_index_t
 XkbModNameToIndex(const struct xkb_mod_set *mods, xkb_atom_t name,
                   enum mod_type type);
@@ -471,8 +530,11 @@ struct xkb_keymap_format_ops {
                                    const char *string, size_t length);
     bool (*keymap_new_from_file)(struct xkb_keymap *keymap, FILE *file);
     char *(*keymap_get_as_string)(struct xkb_keymap *keymap);
+    char *(*keymap_get_as_buffer)(struct xkb_keymap *keymap,
+                                  size_t *length_out);
 };
 
 extern const struct xkb_keymap_format_ops text_v1_keymap_format_ops;
+extern const struct xkb_keymap_format_ops binary_v1_keymap_format_ops;
 
 #endif
@@ -71,14 +71,6 @@ compare_by_keysym(const void *a, const void *b)
     return 0;
 }
 
-static int
-compare_by_name(const void *a, const void *b)
-{
-    const char *key = a;
-    const struct name_keysym *entry = b;
-    return strcasecmp(key, get_name(entry));
-}
-
 XKB_EXPORT int
 xkb_keysym_get_name(xkb_keysym_t ks, char *buffer, size_t size)
 {
@@ -107,14 +99,49 @@ xkb_keysym_get_name(xkb_keysym_t ks, char *buffer, size_t size)
 }
 
 /*
- * Find the correct keysym if one case-insensitive match is given.
+ * The name_to_keysym_hash and name_to_keysym_ihash tables are minimal
+ * perfect hashes generated by makekeys.py; these must match the
+ * name_hash() and name_slot() functions there. The name is hashed once
+ * (FNV-1a, optionally folding ASCII to lower case), the high half of the
+ * hash picks a displacement, and mixing the two gives the only slot in
+ * which the name can be found.
+ */
+static uint64_t
+keysym_name_hash(const char *name, bool icase)
+{
+    uint64_t h = UINT64_C(0xcbf29ce484222325);
+
+    for (; *name; name++) {
+        unsigned char c = *name;
+        if (icase && c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        h = (h ^ c) * UINT64_C(0x100000001b3);
+    }
+
+    return h;
+}
+
+static size_t
+keysym_name_slot(uint64_t h, const uint16_t *disps, size_t num_disps,
+                 size_t num_slots)
+{
+    uint64_t k = h ^ disps[(h >> 32) % num_disps];
+
+    k ^= k >> 33;
+    k *= UINT64_C(0xff51afd7ed558ccd);
+    k ^= k >> 33;
+    k *= UINT64_C(0xc4ceb9fe1a85ec53);
+    k ^= k >> 33;
+
+    return k % num_slots;
+}
+
+/*
+ * Find the entry whose name is @name, or, if @icase is true, the best
+ * case-insensitive match.
  *
- * The name_to_keysym table is sorted by strcasecmp(). So bsearch() may return
- * _any_ of all possible case-insensitive duplicates. This function searches the
- * returned entry @entry, all previous and all next entries that match by
- * case-insensitive comparison and returns the exact match to @name. If @icase
- * is true, then this returns the best case-insensitive match instead of a
- * correct match.
+ * Entries which only differ by letter-case are adjacent in name_to_keysym,
+ * and the case-insensitive hash gives the first of them.
  * The "best" case-insensitive match is the lower-case keysym which we find with
  * the help of xkb_keysym_is_lower().
  * The only keysyms that only differ by letter-case are keysyms that are
@@ -122,41 +149,35 @@ xkb_keysym_get_name(xkb_keysym_t ks, char *buffer, size_t size)
  * returning the first lower-case match is enough in this case.
  */
 static const struct name_keysym *
-find_sym(const struct name_keysym *entry, const char *name, bool icase)
+find_sym(const char *name, bool icase)
 {
-    const struct name_keysym *iter, *last;
-    size_t len = ARRAY_SIZE(name_to_keysym);
+    const struct name_keysym *entry, *iter, *last;
+    uint64_t h = keysym_name_hash(name, icase);
+
+    if (!icase) {
+        entry = &name_to_keysym[name_to_keysym_hash_slots[
+            keysym_name_slot(h, name_to_keysym_hash_disps,
+                             ARRAY_SIZE(name_to_keysym_hash_disps),
+                             ARRAY_SIZE(name_to_keysym_hash_slots))]];
+        return strcmp(get_name(entry), name) == 0 ? entry : NULL;
+    }
 
-    if (!entry)
+    entry = &name_to_keysym[name_to_keysym_ihash_slots[
+        keysym_name_slot(h, name_to_keysym_ihash_disps,
+                         ARRAY_SIZE(name_to_keysym_ihash_disps),
+                         ARRAY_SIZE(name_to_keysym_ihash_slots))]];
+    if (strcasecmp(get_name(entry), name) != 0)
         return NULL;
 
-    if (!icase && strcmp(get_name(entry), name) == 0)
-        return entry;
-    if (icase && xkb_keysym_is_lower(entry->keysym))
-        return entry;
-
-    for (iter = entry - 1; iter >= name_to_keysym; --iter) {
-        if (!icase && strcmp(get_name(iter), name) == 0)
-            return iter;
-        if (strcasecmp(get_name(iter), get_name(entry)) != 0)
-            break;
-        if (icase && xkb_keysym_is_lower(iter->keysym))
-            return iter;
-    }
-
-    last = name_to_keysym + len;
-    for (iter = entry + 1; iter < last; ++iter) {
-        if (!icase && strcmp(get_name(iter), name) == 0)
-            return iter;
-        if (strcasecmp(get_name(iter), get_name(entry)) != 0)
+    last = name_to_keysym + ARRAY_SIZE(name_to_keysym);
+    for (iter = entry; iter < last; iter++) {
+        if (iter != entry && strcasecmp(get_name(iter), name) != 0)
             break;
-        if (icase && xkb_keysym_is_lower(iter->keysym))
+        if (xkb_keysym_is_lower(iter->keysym))
             return iter;
     }
 
-    if (icase)
-        return entry;
-    return NULL;
+    return entry;
 }
 
 XKB_EXPORT xkb_keysym_t
@@ -170,11 +191,7 @@ xkb_keysym_from_name(const char *s, enum xkb_keysym_flags flags)
     if (flags & ~XKB_KEYSYM_CASE_INSENSITIVE)
         return XKB_KEY_NoSymbol;
 
-    entry = bsearch(s, name_to_keysym,
-                    ARRAY_SIZE(name_to_keysym),
-                    sizeof(*name_to_keysym),
-                    compare_by_name);
-    entry = find_sym(entry, s, icase);
+    entry = find_sym(s, icase);
     if (entry)
         return entry->keysym;
 
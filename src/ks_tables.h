@@ -7102,3 +7102,716 @@ static const struct name_keysym keysym_to_name[] = {
     { 0x1008ffb1, 28716 }, /* XF86TouchpadOff */
     { 0x1008ffb2, 26785 }, /* XF86AudioMicMute */
 };
+
+static const uint16_t name_to_keysym_hash_disps[] = {
+    0x0053, 0x0000, 0x0040, 0x0062, 0x0000, 0x000c, 0x0003, 0x004b,
+    0x0071, 0x007d, 0x0020, 0x0000, 0x00a0, 0x0008, 0x0000, 0x0002,
+    0x003a, 0x009e, 0x01ec, 0x0017, 0x0005, 0x001f, 0x0042, 0x0011,
+    0x0010, 0x0002, 0x0051, 0x00d9, 0x0039, 0x0000, 0x0003, 0x0009,
+    0x0002, 0x0077, 0x0035, 0x0001, 0x0000, 0x0005, 0x0029, 0x0046,
+    0x000a, 0x000e, 0x001d, 0x000d, 0x0000, 0x006c, 0x0000, 0x0001,
+    0x0010, 0x0037, 0x0000, 0x001f, 0x0006, 0x006a, 0x0000, 0x0006,
+    0x000d, 0x0006, 0x0007, 0x0013, 0x0001, 0x003e, 0x0004, 0x0049,
+    0x0115, 0x0013, 0x0002, 0x0045, 0x0002, 0x0073, 0x0011, 0x000d,
+    0x002e, 0x0005, 0x002a, 0x002e, 0x0019, 0x0029, 0x01a8, 0x0001,
+    0x0005, 0x0001, 0x0193, 0x0011, 0x0003, 0x0092, 0x0001, 0x0019,
+    0x0013, 0x0021, 0x0033, 0x0061, 0x0003, 0x0071, 0x000e, 0x000e,
+    0x001b, 0x0010, 0x004f, 0x0001, 0x000d, 0x0004, 0x006a, 0x0014,
+    0x00ef, 0x0000, 0x0064, 0x012e, 0x0000, 0x0019, 0x0000, 0x000b,
+    0x002b, 0x003a, 0x0031, 0x0008, 0x00a3, 0x0004, 0x008a, 0x0005,
+    0x004d, 0x0000, 0x0016, 0x0001, 0x0004, 0x0003, 0x0000, 0x0009,
+    0x0040, 0x0000, 0x0000, 0x002c, 0x00d1, 0x018a, 0x013e, 0x0000,
+    0x005a, 0x0008, 0x0082, 0x003b, 0x00eb, 0x001c, 0x0032, 0x000b,
+    0x0000, 0x007e, 0x000e, 0x0003, 0x0008, 0x001b, 0x030b, 0x00d5,
+    0x0003, 0x002b, 0x0014, 0x002a, 0x007a, 0x0004, 0x00a1, 0x0001,
+    0x0014, 0x0029, 0x00c0, 0x0001, 0x0011, 0x002a, 0x0023, 0x000b,
+    0x00ee, 0x0002, 0x000a, 0x0105, 0x002f, 0x0004, 0x0009, 0x0025,
+    0x0003, 0x000a, 0x0007, 0x0000, 0x0006, 0x0006, 0x004c, 0x0045,
+    0x0004, 0x0082, 0x0005, 0x0029, 0x0011, 0x027e, 0x007d, 0x02c7,
+    0x0002, 0x0164, 0x00ed, 0x006a, 0x0004, 0x008f, 0x0011, 0x03e3,
+    0x00ae, 0x0060, 0x0000, 0x0003, 0x00ca, 0x00b1, 0x0003, 0x0000,
+    0x0003, 0x002f, 0x0133, 0x0073, 0x0000, 0x0002, 0x0008, 0x0003,
+    0x0193, 0x004d, 0x00a2, 0x0048, 0x0113, 0x0098, 0x002f, 0x0001,
+    0x0007, 0x0000, 0x0000, 0x0000, 0x000d, 0x0016, 0x0004, 0x0001,
+    0x0002, 0x0244, 0x0090, 0x004e, 0x0000, 0x000d, 0x0052, 0x0000,
+    0x0001, 0x0286, 0x0010, 0x0000, 0x0000, 0x0008, 0x001e, 0x000a,
+    0x0008, 0x0083, 0x000e, 0x002f, 0x0094, 0x0074, 0x001d, 0x008b,
+    0x000c, 0x008e, 0x00b9, 0x0012, 0x0054, 0x0292, 0x00dc, 0x0003,
+    0x0063, 0x0039, 0x0255, 0x0001, 0x0128, 0x000b, 0x005a, 0x0075,
+    0x0156, 0x003d, 0x0006, 0x000b, 0x002c, 0x0076, 0x00ae, 0x010b,
+    0x0012, 0x0086, 0x0000, 0x005d, 0x001c, 0x0039, 0x0002, 0x0005,
+    0x000d, 0x0000, 0x01fc, 0x00bb, 0x0000, 0x0000, 0x0000, 0x0003,
+    0x0008, 0x0014, 0x0015, 0x00a3, 0x0155, 0x0014, 0x0002, 0x01b2,
+    0x0000, 0x0007, 0x018d, 0x0007, 0x0001, 0x0000, 0x00da, 0x0021,
+    0x0000, 0x0000, 0x0001, 0x0027, 0x0082, 0x0077, 0x0008, 0x0198,
+    0x0042, 0x003f, 0x0049, 0x003f, 0x00a0, 0x0095, 0x00a5, 0x000d,
+    0x00b9, 0x00fd, 0x0006, 0x0008, 0x003c, 0x0023, 0x0053, 0x03f7,
+    0x0022, 0x0192, 0x0002, 0x0000, 0x0000, 0x014a, 0x0001, 0x02d8,
+    0x00b0, 0x0004, 0x00be, 0x0017, 0x0016, 0x0016, 0x0000, 0x001a,
+    0x0004, 0x0008, 0x0026, 0x01f9, 0x005b, 0x00ed, 0x01dc, 0x007c,
+    0x0000, 0x0235, 0x004c, 0x0005, 0x0084, 0x00d3, 0x0006, 0x0187,
+    0x0003, 0x0005, 0x0001, 0x004f, 0x010c, 0x0009, 0x0018, 0x0077,
+    0x02b5, 0x0106, 0x02d5, 0x0000, 0x0003, 0x0001, 0x000e, 0x0053,
+    0x0047, 0x0011, 0x002e, 0x001f, 0x0004, 0x0127, 0x00d1, 0x0046,
+    0x0002, 0x0000, 0x002c, 0x0ff6, 0x0496, 0x0003, 0x02c5, 0x0003,
+    0x00bb, 0x03e8, 0x0020, 0x0016, 0x00e9, 0x02f9, 0x0037, 0x000b,
+    0x0051, 0x0078, 0x0070, 0x0063, 0x005b, 0x000c, 0x0558, 0x0001,
+    0x0108, 0x0000, 0x0061, 0x02c2, 0x0025, 0x0027, 0x001f, 0x0015,
+    0x0040, 0x0006, 0x009a, 0x0190, 0x05b1, 0x0011, 0x001b, 0x01c9,
+    0x009e, 0x0345, 0x0015, 0x06fc, 0x029e, 0x03db, 0x0064, 0x004c,
+    0x0000, 0x0028, 0x0013, 0x005a, 0x0172, 0x0016, 0x0006, 0x0001,
+    0x0455, 0x0013, 0x0000, 0x02f0, 0x0000, 0x0049, 0x006e, 0x01bc,
+    0x0121, 0x058e, 0x0008, 0x0000, 0x00b8, 0x005d, 0x0005, 0x0000,
+    0x006c, 0x005a, 0x0006, 0x051f, 0x014b, 0x0014, 0x0004, 0x004f,
+    0x0001, 0x0156, 0x01c4, 0x0157, 0x0071, 0x0015, 0x0000, 0x004e,
+    0x0001, 0x02ab, 0x0002, 0x0ccf, 0x0011, 0x0000, 0x0029, 0x002e,
+    0x0008, 0x000d, 0x052b, 0x0244, 0x002f, 0x0051, 0x0223, 0x0081,
+    0x00a7, 0x0000, 0x004e, 0x006a, 0x0003, 0x0010, 0x0005, 0x008b,
+    0x0000, 0x026e, 0x001a, 0x066c, 0x0009, 0x0000, 0x018d, 0x01bd,
+    0x0407, 0x009a, 0x002e, 0x0591, 0x0196, 0x0000, 0x0005, 0x02ec,
+    0x00e7, 0x0089, 0x020e, 0x0000, 0x0144, 0x0003, 0x0000, 0x00f5,
+    0x012c, 0x0086, 0x01ed, 0x0005, 0x0000, 0x00da, 0x04f5, 0x00bc,
+    0x0003, 0x0088, 0x012f, 0x0a94, 0x1312, 0x0456, 0x001e, 0x0001,
+    0x00a9, 0x0007, 0x00ed, 0x0212, 0x007b, 0x0193, 0x0000, 0x0240,
+    0x0077, 0x018f, 0x00ec, 0x000a, 0x002a, 0x0107, 0x0005, 0x0006,
+    0x0001, 0x0464, 0x04da, 0x013e, 0x004a, 0x0284, 0x0053, 0x0005,
+    0x00ae, 0x0029, 0x0000, 0x0004, 0x0047, 0x0852, 0x0072, 0x001b,
+    0x049e, 0x0000, 0x0066, 0x0005, 0x0076, 0x1a94, 0x0009, 0x003c,
+    0x002d, 0x009a, 0x0093, 0x0009, 0x0047, 0x03a8, 0x03b8, 0x0687,
+    0x0255, 0x0000, 0x0008, 0x01d4, 0x01c3, 0x0196, 0x000c, 0x04e3,
+    0x03e1,
+};
+
+static const uint16_t name_to_keysym_hash_slots[] = {
+    0x003d, 0x03e0, 0x039d, 0x04de, 0x02ff, 0x07e4, 0x034e, 0x0234,
+    0x01b1, 0x0205, 0x0304, 0x02e3, 0x095b, 0x030f, 0x00a8, 0x0541,
+    0x055a, 0x0875, 0x02eb, 0x0200, 0x08f5, 0x0277, 0x0512, 0x0190,
+    0x0580, 0x06fa, 0x05ff, 0x01d0, 0x073b, 0x0101, 0x058a, 0x028a,
+    0x06d3, 0x06b3, 0x046f, 0x0847, 0x01de, 0x02cc, 0x057a, 0x0670,
+    0x08c7, 0x06d7, 0x08ff, 0x0074, 0x00ba, 0x03f8, 0x0708, 0x03ef,
+    0x02ee, 0x0899, 0x07da, 0x0053, 0x081f, 0x0613, 0x02e1, 0x057f,
+    0x06cc, 0x0484, 0x0592, 0x0499, 0x0106, 0x0256, 0x0428, 0x0247,
+    0x0737, 0x071e, 0x0228, 0x06b6, 0x01dd, 0x06f5, 0x014a, 0x0540,
+    0x0545, 0x01ee, 0x089d, 0x004c, 0x041a, 0x038f, 0x032d, 0x03ee,
+    0x01dc, 0x02ea, 0x033f, 0x0132, 0x085a, 0x042d, 0x051d, 0x05c8,
+    0x056e, 0x0424, 0x004e, 0x00ed, 0x0909, 0x07ff, 0x0839, 0x03a2,
+    0x050c, 0x07fa, 0x0740, 0x0664, 0x086e, 0x04e7, 0x065f, 0x0073,
+    0x0295, 0x043d, 0x072c, 0x0083, 0x07ab, 0x0285, 0x0386, 0x08e7,
+    0x0035, 0x0562, 0x012b, 0x0552, 0x0076, 0x03e5, 0x07b8, 0x0759,
+    0x0510, 0x01e4, 0x06c3, 0x08ef, 0x04d1, 0x0691, 0x03b1, 0x072f,
+    0x002e, 0x04d4, 0x0760, 0x093f, 0x023e, 0x0642, 0x06f2, 0x0825,
+    0x0634, 0x002c, 0x0381, 0x0611, 0x0876, 0x0726, 0x036c, 0x0660,
+    0x01d1, 0x0238, 0x07ee, 0x05e8, 0x0180, 0x0730, 0x01d9, 0x04ca,
+    0x086f, 0x00b2, 0x03c8, 0x08e2, 0x006b, 0x08e0, 0x070a, 0x032c,
+    0x06c4, 0x0585, 0x0959, 0x0306, 0x0722, 0x08fe, 0x0504, 0x0118,
+    0x03d2, 0x0139, 0x0833, 0x00da, 0x002a, 0x090c, 0x0868, 0x01ca,
+    0x026f, 0x0702, 0x06ac, 0x0319, 0x0054, 0x091d, 0x00e7, 0x002b,
+    0x04a1, 0x0201, 0x02d8, 0x0188, 0x0496, 0x04bf, 0x02e5, 0x043a,
+    0x04e2, 0x063c, 0x00cc, 0x0287, 0x03c1, 0x062a, 0x052f, 0x041f,
+    0x0393, 0x04d6, 0x0071, 0x086c, 0x0211, 0x02dc, 0x08a8, 0x00fb,
+    0x0321, 0x0094, 0x0515, 0x062e, 0x0371, 0x0024, 0x0284, 0x08f8,
+    0x0237, 0x0822, 0x08a4, 0x07de, 0x055f, 0x0819, 0x0112, 0x0919,
+    0x049e, 0x07a4, 0x05fd, 0x05be, 0x06a2, 0x049a, 0x075f, 0x085b,
+    0x0129, 0x0606, 0x08d5, 0x0010, 0x0007, 0x05df, 0x0922, 0x04d3,
+    0x06ab, 0x0651, 0x04f9, 0x02c5, 0x0507, 0x092b, 0x0682, 0x0049,
+    0x0656, 0x0441, 0x08c8, 0x04e6, 0x01db, 0x00b0, 0x0086, 0x0243,
+    0x03e4, 0x07e5, 0x0701, 0x0278, 0x08cd, 0x0720, 0x060b, 0x02bb,
+    0x0780, 0x02af, 0x074c, 0x007f, 0x02f2, 0x0798, 0x0526, 0x0838,
+    0x0059, 0x028d, 0x0896, 0x08f1, 0x0124, 0x0715, 0x0192, 0x04cb,
+    0x0646, 0x026a, 0x088f, 0x00bb, 0x0298, 0x06b1, 0x0070, 0x044a,
+    0x087f, 0x093d, 0x0676, 0x00dd, 0x0502, 0x08b0, 0x0303, 0x01a9,
+    0x04c1, 0x04ab, 0x0643, 0x08f9, 0x03ed, 0x0105, 0x0440, 0x0212,
+    0x01fa, 0x0280, 0x08a1, 0x0864, 0x0168, 0x0633, 0x0108, 0x0906,
+    0x07ef, 0x05a0, 0x020d, 0x0359, 0x0378, 0x02c2, 0x01d6, 0x0152,
+    0x0698, 0x065b, 0x04cc, 0x059c, 0x0455, 0x02e9, 0x0142, 0x02a4,
+    0x00c5, 0x01eb, 0x0372, 0x040d, 0x033b, 0x003a, 0x052a, 0x0160,
+    0x0542, 0x025d, 0x02be, 0x00f2, 0x0375, 0x05cf, 0x071b, 0x065e,
+    0x08c6, 0x0831, 0x0088, 0x0255, 0x08f0, 0x06d6, 0x052c, 0x0456,
+    0x0305, 0x00c3, 0x0246, 0x0666, 0x0314, 0x02df, 0x08a9, 0x0846,
+    0x07f1, 0x0452, 0x0436, 0x0370, 0x04a4, 0x07ce, 0x02a1, 0x0377,
+    0x076c, 0x0617, 0x0075, 0x076e, 0x0493, 0x0047, 0x0138, 0x035e,
+    0x0479, 0x093b, 0x0863, 0x026d, 0x08fc, 0x0404, 0x015c, 0x03e9,
+    0x013f, 0x0612, 0x048b, 0x0465, 0x02d1, 0x077b, 0x0487, 0x0757,
+    0x01e6, 0x079d, 0x0349, 0x07c6, 0x0857, 0x0091, 0x07f3, 0x0038,
+    0x02f6, 0x0352, 0x06af, 0x036e, 0x05fc, 0x081d, 0x0658, 0x023b,
+    0x0797, 0x0408, 0x0799, 0x07c2, 0x0872, 0x06aa, 0x0214, 0x07af,
+    0x01aa, 0x0593, 0x07a9, 0x0172, 0x0294, 0x08da, 0x05a4, 0x0141,
+    0x0850, 0x003f, 0x0792, 0x0383, 0x086d, 0x03f9, 0x00e0, 0x05d3,
+    0x0655, 0x0738, 0x0719, 0x07f9, 0x0807, 0x0056, 0x0771, 0x00cd,
+    0x0003, 0x0607, 0x0553, 0x0422, 0x04dd, 0x0810, 0x007e, 0x0175,
+    0x04ae, 0x0532, 0x0858, 0x0697, 0x0788, 0x07df, 0x00c6, 0x0712,
+    0x0373, 0x03f0, 0x0223, 0x037f, 0x0555, 0x04bd, 0x0364, 0x0742,
+    0x03d7, 0x06b0, 0x052e, 0x0773, 0x04e8, 0x01c0, 0x0891, 0x0225,
+    0x0092, 0x0942, 0x0546, 0x08b9, 0x081a, 0x073d, 0x047a, 0x0128,
+    0x069f, 0x0867, 0x0673, 0x0444, 0x060d, 0x0727, 0x010f, 0x0240,
+    0x053c, 0x0453, 0x0406, 0x01c4, 0x0517, 0x03bb, 0x042c, 0x0566,
+    0x0630, 0x0551, 0x0123, 0x0685, 0x0061, 0x06c7, 0x05a6, 0x0020,
+    0x05d2, 0x05b5, 0x0693, 0x013c, 0x0789, 0x0699, 0x0638, 0x045d,
+    0x0320, 0x0741, 0x0209, 0x0330, 0x03f4, 0x08fd, 0x0907, 0x0259,
+    0x0684, 0x0523, 0x03a3, 0x01a3, 0x004d, 0x0751, 0x07f2, 0x0177,
+    0x0011, 0x05d7, 0x02cb, 0x0661, 0x02c6, 0x078e, 0x01e1, 0x0756,
+    0x0468, 0x07a6, 0x0162, 0x0755, 0x0928, 0x05ab, 0x0336, 0x0339,
+    0x08f2, 0x03a7, 0x082f, 0x055b, 0x00d2, 0x05a8, 0x07aa, 0x0793,
+    0x08a5, 0x0410, 0x05fa, 0x0547, 0x055e, 0x02c0, 0x013a, 0x03fc,
+    0x090d, 0x019e, 0x05a2, 0x0706, 0x08ea, 0x07d5, 0x0257, 0x0328,
+    0x0368, 0x0668, 0x065d, 0x075a, 0x06f0, 0x0680, 0x01a1, 0x07ea,
+    0x048c, 0x054a, 0x0800, 0x07b9, 0x02d5, 0x0494, 0x023f, 0x0351,
+    0x0358, 0x0230, 0x0614, 0x03be, 0x06c6, 0x06b8, 0x011b, 0x0843,
+    0x0854, 0x0748, 0x05cd, 0x04ce, 0x0520, 0x02b5, 0x020c, 0x08fb,
+    0x0450, 0x04f4, 0x00f7, 0x05e4, 0x07c9, 0x072a, 0x029f, 0x08d1,
+    0x0432, 0x021d, 0x0411, 0x0762, 0x08bd, 0x07cd, 0x0946, 0x044e,
+    0x084f, 0x0050, 0x05b7, 0x0937, 0x040c, 0x0961, 0x0777, 0x0196,
+    0x056a, 0x05ae, 0x036b, 0x047c, 0x02e6, 0x00c1, 0x01bd, 0x091e,
+    0x0151, 0x058e, 0x06e8, 0x004f, 0x0718, 0x004a, 0x064d, 0x04f5,
+    0x0058, 0x03c7, 0x0953, 0x02e7, 0x0249, 0x0790, 0x03cd, 0x0269,
+    0x0924, 0x01da, 0x05bf, 0x0886, 0x041c, 0x0187, 0x023a, 0x0717,
+    0x0529, 0x0767, 0x0147, 0x067d, 0x072b, 0x01e5, 0x04d9, 0x020f,
+    0x04d2, 0x0639, 0x0645, 0x015e, 0x0663, 0x00b5, 0x07d6, 0x0743,
+    0x05ca, 0x01ac, 0x04f0, 0x0569, 0x0248, 0x08ce, 0x0193, 0x0191,
+    0x000b, 0x0350, 0x011e, 0x080e, 0x05cb, 0x0021, 0x038a, 0x0395,
+    0x02fe, 0x001c, 0x06a6, 0x042b, 0x021c, 0x04db, 0x02f3, 0x0236,
+    0x044f, 0x055c, 0x01ae, 0x057d, 0x0324, 0x04b0, 0x05ce, 0x070c,
+    0x0746, 0x06f7, 0x066c, 0x00c9, 0x067e, 0x00a3, 0x00ce, 0x025b,
+    0x068a, 0x074a, 0x041b, 0x04e0, 0x0623, 0x02d4, 0x0769, 0x08c2,
+    0x0910, 0x0513, 0x07b2, 0x0882, 0x06ce, 0x03fa, 0x066f, 0x01e3,
+    0x0133, 0x0089, 0x06d9, 0x04b7, 0x07a0, 0x04e1, 0x058c, 0x0250,
+    0x0286, 0x0528, 0x03bd, 0x062b, 0x00cf, 0x040f, 0x06cf, 0x0485,
+    0x02b0, 0x0627, 0x03b6, 0x05e6, 0x04af, 0x0171, 0x0276, 0x01ea,
+    0x0690, 0x03c9, 0x08c0, 0x00be, 0x035a, 0x0421, 0x01b9, 0x0040,
+    0x0637, 0x0390, 0x068e, 0x0018, 0x0060, 0x061f, 0x015b, 0x01f5,
+    0x04d8, 0x025c, 0x07c1, 0x019a, 0x07f5, 0x049b, 0x02fc, 0x014c,
+    0x0605, 0x0474, 0x0384, 0x03a5, 0x0879, 0x092a, 0x0665, 0x00af,
+    0x04c2, 0x04c5, 0x04f7, 0x01e8, 0x0705, 0x05bd, 0x03e2, 0x04ee,
+    0x01bc, 0x089f, 0x0241, 0x0930, 0x032b, 0x0283, 0x0597, 0x06ad,
+    0x0096, 0x037e, 0x05d4, 0x0135, 0x06fe, 0x039b, 0x0492, 0x0447,
+    0x0065, 0x067c, 0x0588, 0x0683, 0x0581, 0x068d, 0x00eb, 0x0031,
+    0x087b, 0x00fd, 0x00fc, 0x05de, 0x07d4, 0x07d9, 0x0045, 0x0464,
+    0x046b, 0x0920, 0x04b2, 0x05e7, 0x02ad, 0x00db, 0x0952, 0x00d3,
+    0x01a8, 0x0274, 0x0150, 0x0016, 0x0733, 0x016f, 0x0828, 0x0392,
+    0x035d, 0x0900, 0x01c6, 0x06dd, 0x034a, 0x0302, 0x0299, 0x06b9,
+    0x04b4, 0x053a, 0x02fd, 0x074e, 0x0761, 0x0252, 0x0758, 0x082e,
+    0x02ac, 0x0688, 0x059f, 0x046e, 0x0482, 0x08eb, 0x0941, 0x0572,
+    0x009b, 0x07ba, 0x0361, 0x0784, 0x06a0, 0x03f5, 0x0832, 0x02ce,
+    0x0335, 0x0394, 0x0749, 0x04b3, 0x019b, 0x0887, 0x094a, 0x0423,
+    0x0414, 0x0170, 0x0582, 0x0072, 0x0068, 0x0388, 0x0878, 0x017f,
+    0x0309, 0x03a1, 0x095f, 0x0654, 0x0912, 0x065a, 0x07f4, 0x062f,
+    0x034b, 0x0911, 0x0883, 0x05a7, 0x0244, 0x093e, 0x0332, 0x087a,
+    0x0227, 0x083c, 0x0013, 0x04df, 0x0264, 0x024a, 0x0034, 0x040b,
+    0x076f, 0x07bd, 0x0290, 0x0589, 0x0856, 0x0640, 0x04fa, 0x08b8,
+    0x040a, 0x01b4, 0x0046, 0x06ec, 0x046c, 0x0732, 0x030a, 0x00a0,
+    0x02e8, 0x052b, 0x094e, 0x084d, 0x04b8, 0x02bd, 0x046a, 0x06db,
+    0x0570, 0x009d, 0x02aa, 0x0608, 0x051f, 0x0044, 0x0590, 0x00aa,
+    0x0289, 0x03c0, 0x0127, 0x02c7, 0x00b9, 0x068c, 0x0498, 0x06a4,
+    0x02ae, 0x0164, 0x079e, 0x087e, 0x02f0, 0x008f, 0x0628, 0x01c8,
+    0x0817, 0x0736, 0x073f, 0x038b, 0x03fd, 0x06bd, 0x05ef, 0x0724,
+    0x037b, 0x046d, 0x006c, 0x03d8, 0x03de, 0x0300, 0x06b4, 0x0431,
+    0x0917, 0x03cb, 0x04da, 0x00fe, 0x057c, 0x0119, 0x024b, 0x03bf,
+    0x0865, 0x02cf, 0x06f1, 0x0795, 0x03bc, 0x04f3, 0x07fd, 0x070f,
+    0x063f, 0x0525, 0x08ae, 0x08bc, 0x0511, 0x0082, 0x04ea, 0x06c2,
+    0x074d, 0x0686, 0x020a, 0x02c8, 0x061d, 0x01af, 0x0213, 0x0149,
+    0x05ac, 0x0781, 0x038e, 0x08b6, 0x0524, 0x068f, 0x00b1, 0x0442,
+    0x07c8, 0x08e8, 0x0925, 0x0944, 0x0621, 0x028b, 0x0340, 0x0559,
+    0x0206, 0x0820, 0x023c, 0x03d9, 0x0635, 0x07fb, 0x0602, 0x00e8,
+    0x00f9, 0x077a, 0x07d7, 0x0885, 0x03d1, 0x08ee, 0x0506, 0x0334,
+    0x01ed, 0x04c6, 0x0069, 0x03d6, 0x0567, 0x03ec, 0x00d5, 0x070b,
+    0x0043, 0x031a, 0x04aa, 0x0347, 0x034f, 0x01e9, 0x0716, 0x0939,
+    0x0458, 0x0409, 0x08bb, 0x07a3, 0x0156, 0x0400, 0x057b, 0x0534,
+    0x01f9, 0x08ec, 0x0333, 0x075b, 0x001e, 0x03ce, 0x0835, 0x0836,
+    0x0556, 0x0331, 0x01f4, 0x0099, 0x0270, 0x032a, 0x0235, 0x03a9,
+    0x0805, 0x00dc, 0x07b3, 0x005c, 0x022d, 0x08a3, 0x010e, 0x08e1,
+    0x009e, 0x017c, 0x0644, 0x0855, 0x0667, 0x04e3, 0x0535, 0x01c3,
+    0x06e7, 0x02a3, 0x08b5, 0x00ad, 0x08d9, 0x0369, 0x0362, 0x02f4,
+    0x094f, 0x03dc, 0x0744, 0x0933, 0x061b, 0x0558, 0x047f, 0x0803,
+    0x075d, 0x06fd, 0x0776, 0x0934, 0x00e2, 0x053b, 0x00bc, 0x031e,
+    0x0261, 0x052d, 0x04ac, 0x0778, 0x055d, 0x0837, 0x0297, 0x05c2,
+    0x0179, 0x05b2, 0x0862, 0x0851, 0x0951, 0x01c5, 0x0521, 0x033c,
+    0x091c, 0x0509, 0x07a2, 0x0360, 0x0927, 0x04a9, 0x022f, 0x01d7,
+    0x006e, 0x03fb, 0x0446, 0x03ad, 0x010d, 0x0754, 0x0625, 0x07ad,
+    0x020e, 0x0577, 0x03a4, 0x093c, 0x01d3, 0x0365, 0x0584, 0x08ba,
+    0x0425, 0x069b, 0x04c9, 0x08b1, 0x010a, 0x02a2, 0x01a2, 0x03e6,
+    0x0157, 0x05db, 0x0543, 0x04ed, 0x037d, 0x06ef, 0x0787, 0x0849,
+    0x05ad, 0x006d, 0x0818, 0x06e3, 0x0084, 0x0711, 0x0154, 0x01b3,
+    0x0104, 0x0710, 0x066a, 0x0239, 0x053e, 0x08cc, 0x05b8, 0x0391,
+    0x092f, 0x02f1, 0x04a3, 0x089a, 0x047d, 0x027d, 0x025e, 0x0538,
+    0x0327, 0x0420, 0x07bf, 0x0943, 0x0955, 0x058d, 0x0471, 0x0522,
+    0x0265, 0x0679, 0x0948, 0x0004, 0x019d, 0x060e, 0x0739, 0x03a6,
+    0x013e, 0x06a3, 0x095d, 0x05c5, 0x07c4, 0x0908, 0x0039, 0x087c,
+    0x06c1, 0x091b, 0x05dc, 0x06a1, 0x03aa, 0x0405, 0x02b9, 0x04fd,
+    0x0516, 0x0325, 0x081b, 0x0427, 0x0412, 0x0890, 0x050e, 0x0796,
+    0x0631, 0x0707, 0x01f2, 0x078d, 0x02e0, 0x0550, 0x00d0, 0x0830,
+    0x03af, 0x044b, 0x0036, 0x007a, 0x0782, 0x054c, 0x0859, 0x08db,
+    0x01b8, 0x082c, 0x06e9, 0x0591, 0x0066, 0x04ad, 0x0560, 0x04a0,
+    0x0356, 0x00d4, 0x025a, 0x04cd, 0x0095, 0x072e, 0x07e3, 0x02a8,
+    0x05c6, 0x0217, 0x017b, 0x0207, 0x078f, 0x06e2, 0x018f, 0x0518,
+    0x0905, 0x02b2, 0x0215, 0x088b, 0x0565, 0x029a, 0x0473, 0x06ca,
+    0x045f, 0x0486, 0x04c8, 0x0279, 0x05ee, 0x0419, 0x05e5, 0x05d9,
+    0x0022, 0x0652, 0x079a, 0x0120, 0x02f7, 0x07f8, 0x03c4, 0x069d,
+    0x0657, 0x00e4, 0x03b9, 0x07a7, 0x0641, 0x0677, 0x0791, 0x08c3,
+    0x0184, 0x0615, 0x08d3, 0x05b1, 0x0918, 0x00ae, 0x06de, 0x02d2,
+    0x0338, 0x05ea, 0x0014, 0x029d, 0x016e, 0x0750, 0x05f3, 0x01e7,
+    0x03b2, 0x042f, 0x0313, 0x034d, 0x037a, 0x090f, 0x02fb, 0x0895,
+    0x026c, 0x08c9, 0x05da, 0x0028, 0x04fe, 0x06f8, 0x0015, 0x0125,
+    0x0220, 0x03eb, 0x0407, 0x00c7, 0x0000, 0x01b7, 0x00e6, 0x0445,
+    0x073e, 0x070d, 0x027b, 0x03e3, 0x08d8, 0x0692, 0x003b, 0x01b5,
+    0x02b3, 0x01f8, 0x0775, 0x0402, 0x04bb, 0x07b6, 0x06c0, 0x017e,
+    0x078b, 0x011c, 0x0153, 0x0476, 0x030b, 0x0774, 0x066b, 0x07fe,
+    0x033a, 0x0268, 0x08b3, 0x044d, 0x01d4, 0x080c, 0x0090, 0x0960,
+    0x0121, 0x05e3, 0x08a2, 0x041d, 0x03b3, 0x08ca, 0x083b, 0x08af,
+    0x05b6, 0x084e, 0x0954, 0x003c, 0x0619, 0x06cb, 0x01c1, 0x0271,
+    0x0032, 0x095e, 0x05fb, 0x011a, 0x0169, 0x0103, 0x002d, 0x024d,
+    0x029e, 0x0957, 0x075e, 0x027a, 0x01f1, 0x06a7, 0x0923, 0x0501,
+    0x06e5, 0x0814, 0x04eb, 0x03e1, 0x036d, 0x0002, 0x045b, 0x028e,
+    0x01cf, 0x05f0, 0x077d, 0x061c, 0x091f, 0x051b, 0x012e, 0x064c,
+    0x0202, 0x043b, 0x007c, 0x067b, 0x04ba, 0x00e3, 0x0678, 0x05c7,
+    0x08b2, 0x03d4, 0x016d, 0x01ab, 0x02d7, 0x061e, 0x00b8, 0x0037,
+    0x0894, 0x0165, 0x02ef, 0x0834, 0x07bb, 0x0594, 0x050d, 0x092c,
+    0x0067, 0x079c, 0x03ab, 0x013b, 0x0700, 0x057e, 0x02a7, 0x00bd,
+    0x04a8, 0x0596, 0x0620, 0x0173, 0x024f, 0x085d, 0x0281, 0x076b,
+    0x047b, 0x0159, 0x0903, 0x002f, 0x012f, 0x07dd, 0x058b, 0x0087,
+    0x04b1, 0x01bb, 0x0114, 0x0366, 0x0296, 0x0648, 0x02b1, 0x0734,
+    0x07d3, 0x085f, 0x00b7, 0x02b7, 0x0439, 0x08e3, 0x087d, 0x0051,
+    0x03e7, 0x043e, 0x0763, 0x0902, 0x0064, 0x0178, 0x0811, 0x0725,
+    0x079b, 0x088e, 0x0488, 0x090a, 0x0042, 0x0508, 0x0077, 0x01e2,
+    0x06ee, 0x036f, 0x056f, 0x0671, 0x0766, 0x0674, 0x004b, 0x0344,
+    0x07ae, 0x0443, 0x054e, 0x02b6, 0x04a6, 0x02fa, 0x01cb, 0x0260,
+    0x072d, 0x0263, 0x0530, 0x0107, 0x0481, 0x06fc, 0x0317, 0x089b,
+    0x05d6, 0x0945, 0x0826, 0x0783, 0x00a7, 0x08cf, 0x095a, 0x0768,
+    0x07eb, 0x044c, 0x0019, 0x000a, 0x0687, 0x064f, 0x0113, 0x08f6,
+    0x050f, 0x02ca, 0x02ab, 0x089c, 0x0134, 0x0752, 0x05af, 0x06d5,
+    0x08ad, 0x0563, 0x0401, 0x08ac, 0x039f, 0x05b9, 0x0578, 0x0102,
+    0x03d3, 0x00f1, 0x051a, 0x035b, 0x05aa, 0x05c4, 0x07ca, 0x01ba,
+    0x053f, 0x0490, 0x06bc, 0x068b, 0x06f4, 0x0813, 0x0293, 0x01d5,
+    0x0145, 0x0870, 0x0647, 0x074b, 0x0041, 0x08c1, 0x0829, 0x02c4,
+    0x0337, 0x00d7, 0x0454, 0x01b2, 0x07ed, 0x008c, 0x01b6, 0x024c,
+    0x0382, 0x0231, 0x0609, 0x069c, 0x0579, 0x0624, 0x0426, 0x0672,
+    0x08cb, 0x0008, 0x05b4, 0x07c7, 0x008a, 0x07e2, 0x08f4, 0x0033,
+    0x04b5, 0x0892, 0x0696, 0x0451, 0x078c, 0x014b, 0x0583, 0x03f7,
+    0x091a, 0x005a, 0x0389, 0x0266, 0x07a5, 0x0403, 0x0929, 0x07a1,
+    0x03dd, 0x06bf, 0x0262, 0x018c, 0x0253, 0x0632, 0x03f2, 0x0245,
+    0x018e, 0x06eb, 0x02a6, 0x0601, 0x0176, 0x017d, 0x06ea, 0x049d,
+    0x0267, 0x0460, 0x0675, 0x0048, 0x05ba, 0x02cd, 0x05f6, 0x0097,
+    0x02d9, 0x0117, 0x0779, 0x0027, 0x016a, 0x0367, 0x01fe, 0x0842,
+    0x0396, 0x00d8, 0x086b, 0x0342, 0x080b, 0x00de, 0x065c, 0x01f6,
+    0x00f4, 0x051e, 0x0110, 0x067a, 0x009a, 0x01c7, 0x073c, 0x06c8,
+    0x00e5, 0x06c5, 0x03c5, 0x06da, 0x000d, 0x02da, 0x059d, 0x00ca,
+    0x0195, 0x0311, 0x08dd, 0x0194, 0x0853, 0x0866, 0x066e, 0x018a,
+    0x04b6, 0x03f3, 0x0650, 0x00cb, 0x0026, 0x04f2, 0x0161, 0x0218,
+    0x02f9, 0x05cc, 0x053d, 0x06d2, 0x0573, 0x0315, 0x081c, 0x03ea,
+    0x00e9, 0x0346, 0x05c9, 0x031d, 0x04bc, 0x0379, 0x077c, 0x03ae,
+    0x0497, 0x08f3, 0x07bc, 0x05f4, 0x076d, 0x03b4, 0x0434, 0x0318,
+    0x02c9, 0x0357, 0x07ac, 0x0844, 0x081e, 0x0080, 0x0548, 0x02ba,
+    0x00a1, 0x06c9, 0x063e, 0x08a7, 0x07e9, 0x0341, 0x0167, 0x04cf,
+    0x069e, 0x07c5, 0x0144, 0x07b1, 0x0353, 0x01cc, 0x01a6, 0x03c3,
+    0x0466, 0x0801, 0x00f0, 0x07d8, 0x03b7, 0x0316, 0x00a2, 0x0418,
+    0x0816, 0x02a5, 0x0662, 0x08dc, 0x06ae, 0x0747, 0x063b, 0x0204,
+    0x07c3, 0x0527, 0x0947, 0x0272, 0x01e0, 0x021a, 0x07dc, 0x048d,
+    0x07f0, 0x085c, 0x0861, 0x037c, 0x088d, 0x06b7, 0x03f1, 0x0009,
+    0x077e, 0x014e, 0x031b, 0x07cb, 0x019f, 0x00b6, 0x0312, 0x094c,
+    0x054b, 0x07cc, 0x0852, 0x0786, 0x04a5, 0x092e, 0x0821, 0x0025,
+    0x045a, 0x08fa, 0x085e, 0x07c0, 0x0827, 0x0131, 0x083f, 0x0704,
+    0x02bc, 0x0326, 0x04f8, 0x048a, 0x06d8, 0x08df, 0x0956, 0x006a,
+    0x042e, 0x06b5, 0x03c2, 0x080d, 0x010c, 0x01d2, 0x082b, 0x02f8,
+    0x0914, 0x0233, 0x026b, 0x0078, 0x0210, 0x0626, 0x0433, 0x0130,
+    0x07fc, 0x0901, 0x05e0, 0x0385, 0x05f5, 0x04ec, 0x07b0, 0x04c7,
+    0x0884, 0x01fb, 0x0222, 0x005d, 0x022e, 0x06e1, 0x04a2, 0x0669,
+    0x049c, 0x06bb, 0x08be, 0x059b, 0x0219, 0x01df, 0x08b4, 0x0806,
+    0x04dc, 0x0229, 0x010b, 0x030d, 0x050b, 0x07e7, 0x00c0, 0x0017,
+    0x043c, 0x090b, 0x038c, 0x015f, 0x0093, 0x0023, 0x033d, 0x08d2,
+    0x0915, 0x009f, 0x0871, 0x00f5, 0x054f, 0x0085, 0x0355, 0x06a5,
+    0x0888, 0x0380, 0x0292, 0x0343, 0x05ec, 0x047e, 0x00fa, 0x0764,
+    0x00c8, 0x05bb, 0x0258, 0x01fd, 0x03ac, 0x0146, 0x05f1, 0x0709,
+    0x02f5, 0x0183, 0x04f6, 0x0841, 0x027c, 0x0703, 0x0462, 0x0874,
+    0x00b3, 0x03ca, 0x060a, 0x02d0, 0x0055, 0x071d, 0x005f, 0x0815,
+    0x0824, 0x05f8, 0x0100, 0x00ee, 0x05d8, 0x04a7, 0x08ab, 0x0437,
+    0x03b5, 0x012d, 0x00a4, 0x0636, 0x064b, 0x0459, 0x0629, 0x054d,
+    0x0199, 0x07e6, 0x027f, 0x0500, 0x03a8, 0x0166, 0x08c5, 0x05c0,
+    0x0932, 0x08e4, 0x0480, 0x02a0, 0x03c6, 0x067f, 0x01a5, 0x0897,
+    0x0116, 0x018b, 0x05a5, 0x0185, 0x034c, 0x06d0, 0x0301, 0x08d4,
+    0x0936, 0x00a6, 0x02c3, 0x0354, 0x03df, 0x0931, 0x0949, 0x0622,
+    0x0695, 0x0753, 0x0477, 0x001d, 0x08aa, 0x03a0, 0x03b0, 0x04fb,
+    0x01ef, 0x0794, 0x01c2, 0x00ea, 0x05f9, 0x01ce, 0x039e, 0x017a,
+    0x021f, 0x06ed, 0x022a, 0x08bf, 0x08f7, 0x0595, 0x06ff, 0x070e,
+    0x04be, 0x07b5, 0x049f, 0x0345, 0x01d8, 0x0429, 0x0713, 0x05b0,
+    0x05bc, 0x0557, 0x032f, 0x048f, 0x05d0, 0x07db, 0x0158, 0x05f7,
+    0x0770, 0x0398, 0x0689, 0x071a, 0x080f, 0x00a5, 0x0163, 0x061a,
+    0x006f, 0x0772, 0x0809, 0x084c, 0x0729, 0x0374, 0x02de, 0x0435,
+    0x05e1, 0x082d, 0x02d3, 0x0610, 0x0273, 0x0461, 0x05c3, 0x05e9,
+    0x0438, 0x045c, 0x084a, 0x02b8, 0x011f, 0x069a, 0x014f, 0x018d,
+    0x0221, 0x08ed, 0x06cd, 0x02e4, 0x02c1, 0x012a, 0x0935, 0x00f6,
+    0x06fb, 0x0860, 0x00ff, 0x014d, 0x0081, 0x00ec, 0x03da, 0x0148,
+    0x045e, 0x0881, 0x07be, 0x0216, 0x0604, 0x0808, 0x0079, 0x042a,
+    0x083a, 0x07e8, 0x07d1, 0x0721, 0x07b7, 0x02ed, 0x0310, 0x094b,
+    0x04f1, 0x03cc, 0x04d5, 0x06d1, 0x022b, 0x040e, 0x0495, 0x0348,
+    0x0539, 0x015a, 0x0823, 0x07d2, 0x033e, 0x0001, 0x05ed, 0x0475,
+    0x0307, 0x0155, 0x0417, 0x03cf, 0x0491, 0x056b, 0x05d1, 0x0653,
+    0x059a, 0x01be, 0x08b7, 0x0323, 0x0561, 0x0397, 0x03db, 0x08e5,
+    0x0554, 0x0575, 0x079f, 0x0503, 0x0785, 0x029c, 0x04c0, 0x03b8,
+    0x02d6, 0x0197, 0x078a, 0x0958, 0x01ec, 0x0735, 0x0109, 0x0399,
+    0x0174, 0x071f, 0x0531, 0x07f6, 0x00ab, 0x009c, 0x0143, 0x06a9,
+    0x060f, 0x074f, 0x06a8, 0x08d6, 0x0181, 0x0571, 0x0115, 0x088c,
+    0x056c, 0x01ad, 0x01f0, 0x0063, 0x0514, 0x05b3, 0x02dd, 0x08e6,
+    0x035f, 0x00d9, 0x022c, 0x0926, 0x000c, 0x0140, 0x0472, 0x05eb,
+    0x032e, 0x000e, 0x0376, 0x0568, 0x0467, 0x008b, 0x001a, 0x06dc,
+    0x04b9, 0x050a, 0x007d, 0x0275, 0x01f3, 0x035c, 0x04e4, 0x0182,
+    0x083e, 0x03ba, 0x0587, 0x030e, 0x0723, 0x06be, 0x0251, 0x01b0,
+    0x0470, 0x0232, 0x0098, 0x02db, 0x00d6, 0x0603, 0x093a, 0x0812,
+    0x04e9, 0x051c, 0x06d4, 0x01bf, 0x0322, 0x08de, 0x0029, 0x030c,
+    0x06e4, 0x03e8, 0x0537, 0x005b, 0x0916, 0x0005, 0x01cd, 0x056d,
+    0x013d, 0x0802, 0x03f6, 0x06f6, 0x07e0, 0x0122, 0x01c9, 0x012c,
+    0x00ac, 0x0282, 0x027e, 0x02a9, 0x06ba, 0x0052, 0x01f7, 0x031f,
+    0x0208, 0x0057, 0x06e6, 0x0873, 0x0291, 0x0848, 0x0483, 0x062d,
+    0x003e, 0x0006, 0x063a, 0x043f, 0x0869, 0x00f8, 0x0649, 0x0586,
+    0x04c4, 0x00c2, 0x00e1, 0x0329, 0x0694, 0x0254, 0x02e2, 0x0616,
+    0x0880, 0x04d0, 0x0203, 0x08d0, 0x026e, 0x088a, 0x0600, 0x04fc,
+    0x0413, 0x0226, 0x00ef, 0x058f, 0x0363, 0x08c4, 0x016b, 0x0893,
+    0x059e, 0x048e, 0x028c, 0x0913, 0x021b, 0x077f, 0x07ec, 0x073a,
+    0x0840, 0x0062, 0x0288, 0x07cf, 0x092d, 0x0714, 0x0599, 0x0681,
+    0x062c, 0x0549, 0x01ff, 0x0564, 0x0940, 0x007b, 0x005e, 0x031c,
+    0x0536, 0x0186, 0x0478, 0x0598, 0x0659, 0x08a6, 0x0519, 0x0111,
+    0x064a, 0x02b4, 0x0731, 0x06df, 0x008d, 0x00d1, 0x0904, 0x04c3,
+    0x064e, 0x04ef, 0x0877, 0x0126, 0x0030, 0x0576, 0x06b2, 0x06e0,
+    0x0489, 0x07b4, 0x0242, 0x03d0, 0x01a4, 0x066d, 0x04ff, 0x05f2,
+    0x008e, 0x05d5, 0x05a1, 0x0618, 0x0845, 0x076a, 0x01fc, 0x025f,
+    0x0415, 0x04d7, 0x0898, 0x02bf, 0x00bf, 0x0448, 0x0457, 0x0469,
+    0x06f3, 0x0136, 0x0889, 0x0544, 0x0950, 0x039c, 0x0745, 0x039a,
+    0x00a9, 0x001f, 0x0505, 0x082a, 0x07e1, 0x0938, 0x0012, 0x084b,
+    0x05dd, 0x04e5, 0x00c4, 0x075c, 0x028f, 0x024e, 0x05c1, 0x0430,
+    0x0574, 0x021e, 0x0189, 0x011d, 0x015d, 0x090e, 0x019c, 0x089e,
+    0x05fe, 0x001b, 0x095c, 0x0533, 0x086a, 0x08e9, 0x0728, 0x05a3,
+    0x08a0, 0x0921, 0x020b, 0x08d7, 0x038d, 0x02ec, 0x071c, 0x03ff,
+    0x083d, 0x080a, 0x036a, 0x07a8, 0x05a9, 0x000f, 0x00df, 0x060c,
+    0x0765, 0x0308, 0x00f3, 0x094d, 0x01a7, 0x023d, 0x07d0, 0x0804,
+    0x041e, 0x029b, 0x0198, 0x016c, 0x063d, 0x0449, 0x0137, 0x05e2,
+    0x07f7, 0x0387, 0x0416, 0x0224, 0x0463, 0x06f9, 0x03fe, 0x01a0,
+    0x03d5, 0x00b4,
+};
+
+static const uint16_t name_to_keysym_ihash_disps[] = {
+    0x0019, 0x0019, 0x0023, 0x0004, 0x009c, 0x000d, 0x001f, 0x0020,
+    0x000f, 0x000d, 0x000d, 0x0010, 0x0005, 0x0003, 0x0001, 0x0011,
+    0x002d, 0x0018, 0x0003, 0x0050, 0x0002, 0x000d, 0x0002, 0x0000,
+    0x0005, 0x00ad, 0x0032, 0x0000, 0x000b, 0x0012, 0x0004, 0x0032,
+    0x00ef, 0x01ac, 0x0153, 0x0002, 0x0004, 0x000c, 0x000c, 0x0049,
+    0x007b, 0x0000, 0x0075, 0x0008, 0x0000, 0x0179, 0x0000, 0x001b,
+    0x0043, 0x0006, 0x00bb, 0x0000, 0x0002, 0x0007, 0x0024, 0x007d,
+    0x0066, 0x0048, 0x0003, 0x0000, 0x0015, 0x0025, 0x0022, 0x0002,
+    0x0001, 0x013d, 0x0000, 0x004f, 0x0006, 0x0022, 0x0096, 0x0032,
+    0x000b, 0x002b, 0x005d, 0x001c, 0x000b, 0x0000, 0x0002, 0x0009,
+    0x000d, 0x0014, 0x007b, 0x0013, 0x0064, 0x0040, 0x0000, 0x0002,
+    0x001e, 0x0028, 0x000b, 0x0104, 0x0058, 0x012a, 0x009d, 0x0002,
+    0x0000, 0x0001, 0x0014, 0x0069, 0x0008, 0x0009, 0x0002, 0x0009,
+    0x01b1, 0x0000, 0x0009, 0x0035, 0x0000, 0x0018, 0x0005, 0x0001,
+    0x002a, 0x0001, 0x002d, 0x0003, 0x0000, 0x0000, 0x0026, 0x0013,
+    0x013a, 0x0000, 0x0002, 0x000c, 0x0000, 0x0002, 0x0029, 0x0007,
+    0x00da, 0x0005, 0x0009, 0x0000, 0x006a, 0x0000, 0x0004, 0x0004,
+    0x0000, 0x0031, 0x0093, 0x0005, 0x0000, 0x0007, 0x0002, 0x0000,
+    0x0031, 0x0000, 0x006e, 0x000c, 0x0017, 0x0047, 0x000d, 0x008f,
+    0x002f, 0x0239, 0x0125, 0x0002, 0x0005, 0x0011, 0x0000, 0x0003,
+    0x0038, 0x0012, 0x0046, 0x019c, 0x002a, 0x0000, 0x0001, 0x0047,
+    0x0000, 0x001c, 0x0017, 0x0000, 0x0001, 0x0020, 0x009a, 0x00ca,
+    0x003b, 0x020b, 0x003c, 0x0079, 0x0008, 0x0045, 0x0006, 0x0008,
+    0x0000, 0x000f, 0x0034, 0x0131, 0x001c, 0x0123, 0x000c, 0x001b,
+    0x0054, 0x0000, 0x0000, 0x000f, 0x0028, 0x0004, 0x0004, 0x0027,
+    0x0005, 0x004d, 0x0029, 0x001d, 0x0104, 0x004f, 0x001b, 0x0157,
+    0x0004, 0x0042, 0x0006, 0x00c1, 0x0001, 0x00e1, 0x0044, 0x000a,
+    0x0076, 0x0004, 0x0011, 0x0004, 0x0048, 0x0001, 0x0007, 0x0132,
+    0x0004, 0x009e, 0x0010, 0x0016, 0x0061, 0x0091, 0x001e, 0x00da,
+    0x0002, 0x0013, 0x019c, 0x0126, 0x006a, 0x0151, 0x00b4, 0x001d,
+    0x0000, 0x003b, 0x00a6, 0x0013, 0x001a, 0x0057, 0x0001, 0x02b0,
+    0x0069, 0x0051, 0x00a2, 0x0272, 0x0000, 0x004e, 0x00db, 0x0002,
+    0x0022, 0x0073, 0x000b, 0x0031, 0x003b, 0x0135, 0x0028, 0x020b,
+    0x00b6, 0x0020, 0x0091, 0x0000, 0x002c, 0x0190, 0x0000, 0x0003,
+    0x00b0, 0x0000, 0x000a, 0x001e, 0x0006, 0x00a5, 0x00b3, 0x0002,
+    0x0049, 0x009f, 0x00d5, 0x007b, 0x0000, 0x0003, 0x0000, 0x00b0,
+    0x0009, 0x0003, 0x009d, 0x001b, 0x0080, 0x0073, 0x0055, 0x000e,
+    0x003e, 0x0154, 0x0013, 0x0013, 0x0000, 0x0013, 0x0008, 0x000c,
+    0x005d, 0x0128, 0x0103, 0x0003, 0x0098, 0x04f1, 0x0006, 0x003f,
+    0x0014, 0x0001, 0x0009, 0x005e, 0x0017, 0x03ea, 0x0001, 0x0142,
+    0x0023, 0x00e4, 0x004f, 0x0000, 0x0007, 0x0001, 0x0002, 0x0170,
+    0x0044, 0x01a8, 0x02db, 0x009f, 0x0085, 0x0003, 0x0010, 0x0000,
+    0x002a, 0x0004, 0x000e, 0x0029, 0x00a9, 0x0086, 0x00ed, 0x002c,
+    0x001f, 0x0000, 0x0007, 0x0003, 0x0039, 0x0006, 0x0034, 0x0020,
+    0x0088, 0x018b, 0x002b, 0x03f9, 0x0021, 0x001c, 0x010b, 0x00d9,
+    0x0194, 0x0128, 0x00ed, 0x0004, 0x0007, 0x0002, 0x0000, 0x0001,
+    0x00c2, 0x0000, 0x004b, 0x000a, 0x0009, 0x0000, 0x0360, 0x0c10,
+    0x0320, 0x04cb, 0x02e2, 0x0001, 0x000f, 0x0056, 0x0040, 0x0022,
+    0x0040, 0x001f, 0x0094, 0x010f, 0x0035, 0x0001, 0x075c, 0x0026,
+    0x00eb, 0x0277, 0x003d, 0x0004, 0x002a, 0x0049, 0x00ba, 0x0002,
+    0x011f, 0x000a, 0x01d2, 0x0003, 0x0005, 0x0002, 0x058f, 0x078e,
+    0x0039, 0x0069, 0x0007, 0x001d, 0x007c, 0x0010, 0x0171, 0x023e,
+    0x002b, 0x01c6, 0x0102, 0x0009, 0x0065, 0x01ce, 0x0184, 0x0007,
+    0x0085, 0x0043, 0x0098, 0x000f, 0x0019, 0x008c, 0x05b8, 0x016b,
+    0x04ef, 0x01f7, 0x00cc, 0x0002, 0x0025, 0x015c, 0x0004, 0x03af,
+    0x0000, 0x072a, 0x0000, 0x000d, 0x00d0, 0x0003, 0x006d, 0x002f,
+    0x018d, 0x0068, 0x025e, 0x0109, 0x00a0, 0x0000, 0x01c2, 0x0000,
+    0x0000, 0x0310, 0x000d, 0x0000, 0x04e4, 0x07aa, 0x09b8, 0x0318,
+    0x0015, 0x0555, 0x07cb, 0x0012, 0x0004, 0x0079, 0x0009, 0x0001,
+    0x0024, 0x0012, 0x01a9, 0x00e5, 0x032d, 0x0001, 0x0001, 0x0000,
+    0x0032, 0x000d, 0x0007, 0x0008, 0x0140, 0x066d, 0x0070, 0x00a9,
+    0x0a9e, 0x08dc, 0x1268, 0x05fc, 0x000e, 0x0065, 0x00b2, 0x0019,
+    0x0005, 0x0002, 0x02e2, 0x1033, 0x000d, 0x10c6, 0x14ed, 0x04dc,
+    0x065f, 0x0042, 0x06a5, 0x017b, 0x0000, 0x0001, 0x019f, 0x0003,
+    0x1d4a, 0x01c5, 0x0001,
+};
+
+static const uint16_t name_to_keysym_ihash_slots[] = {
+    0x048b, 0x03f2, 0x0803, 0x08fd, 0x05a7, 0x0296, 0x03ad, 0x082b,
+    0x070f, 0x08ff, 0x008a, 0x00de, 0x061f, 0x0158, 0x07c9, 0x02b0,
+    0x0466, 0x084f, 0x07cb, 0x07bd, 0x00f8, 0x05a9, 0x036a, 0x0471,
+    0x009a, 0x0587, 0x06bc, 0x019c, 0x0693, 0x092c, 0x028c, 0x018c,
+    0x0116, 0x063d, 0x001c, 0x0121, 0x07de, 0x053d, 0x0035, 0x021c,
+    0x02a2, 0x01f3, 0x0553, 0x0418, 0x06fa, 0x05fd, 0x0003, 0x031e,
+    0x027a, 0x0109, 0x04c1, 0x02d3, 0x055d, 0x0905, 0x0753, 0x0932,
+    0x002a, 0x06ed, 0x0196, 0x067f, 0x03f0, 0x061b, 0x025d, 0x0758,
+    0x0739, 0x08db, 0x0303, 0x0236, 0x049b, 0x0014, 0x01a3, 0x04ab,
+    0x02ee, 0x0670, 0x04b0, 0x04c6, 0x0906, 0x0104, 0x07ab, 0x06f4,
+    0x0388, 0x03da, 0x03c4, 0x02d9, 0x0823, 0x03a7, 0x04eb, 0x04e5,
+    0x0272, 0x0562, 0x050d, 0x0182, 0x0228, 0x04d0, 0x008b, 0x08ec,
+    0x0132, 0x006b, 0x0487, 0x07a1, 0x02ed, 0x0705, 0x07c2, 0x0090,
+    0x0223, 0x0176, 0x066e, 0x02b4, 0x07a4, 0x088a, 0x0683, 0x090e,
+    0x010b, 0x05b9, 0x00ba, 0x01a6, 0x07a8, 0x05bb, 0x0024, 0x0462,
+    0x030f, 0x0454, 0x02a4, 0x0387, 0x013a, 0x03d8, 0x05e8, 0x0363,
+    0x05ff, 0x0191, 0x0092, 0x048c, 0x0221, 0x08a3, 0x01cc, 0x05e2,
+    0x053a, 0x08ae, 0x0390, 0x060b, 0x08ac, 0x04ae, 0x07be, 0x0008,
+    0x0494, 0x01a8, 0x038e, 0x02b8, 0x05b0, 0x0305, 0x07ad, 0x0874,
+    0x08fb, 0x07cd, 0x0806, 0x01df, 0x0645, 0x0284, 0x00d1, 0x06ef,
+    0x0308, 0x014a, 0x00c0, 0x0814, 0x05b7, 0x006c, 0x084b, 0x02dd,
+    0x08d2, 0x05fb, 0x0103, 0x0652, 0x08ba, 0x090a, 0x0312, 0x066a,
+    0x053f, 0x0054, 0x0527, 0x0757, 0x07b6, 0x0047, 0x041e, 0x0479,
+    0x051a, 0x06c5, 0x0153, 0x00a7, 0x07e2, 0x08d4, 0x0589, 0x01ce,
+    0x0623, 0x0259, 0x05ef, 0x0118, 0x043b, 0x0802, 0x0414, 0x047d,
+    0x000c, 0x0321, 0x02d2, 0x057f, 0x04b2, 0x07d0, 0x01b8, 0x031d,
+    0x07ed, 0x0721, 0x06aa, 0x03a5, 0x0835, 0x01a1, 0x046f, 0x0309,
+    0x02d7, 0x04c3, 0x0076, 0x0743, 0x04e6, 0x06f2, 0x08c8, 0x0810,
+    0x0865, 0x0322, 0x0780, 0x02d6, 0x07d9, 0x0256, 0x05c1, 0x04f6,
+    0x0145, 0x0253, 0x00ca, 0x05af, 0x01a5, 0x047f, 0x0313, 0x02c8,
+    0x012c, 0x0346, 0x0262, 0x05e7, 0x03e0, 0x00e0, 0x0929, 0x03a3,
+    0x0547, 0x08e2, 0x014f, 0x0195, 0x0458, 0x017e, 0x0927, 0x0202,
+    0x04c8, 0x06c6, 0x0773, 0x04d9, 0x055b, 0x0615, 0x0391, 0x0801,
+    0x06cb, 0x04be, 0x08e0, 0x0009, 0x02e9, 0x0367, 0x02d8, 0x0957,
+    0x0140, 0x06d8, 0x0654, 0x086d, 0x06c7, 0x0656, 0x046e, 0x04de,
+    0x0669, 0x038f, 0x03a4, 0x043d, 0x01fc, 0x0641, 0x0270, 0x04bf,
+    0x0771, 0x02ce, 0x0941, 0x029a, 0x0157, 0x0566, 0x04dc, 0x0498,
+    0x07ea, 0x0785, 0x03cf, 0x059c, 0x073e, 0x08c7, 0x07d3, 0x00fa,
+    0x0187, 0x0243, 0x030a, 0x00d3, 0x03de, 0x04ca, 0x00ab, 0x04ec,
+    0x085b, 0x0677, 0x0384, 0x0828, 0x0358, 0x0485, 0x0535, 0x037a,
+    0x0292, 0x042f, 0x0746, 0x03ac, 0x0569, 0x062c, 0x01d0, 0x058b,
+    0x0937, 0x08f7, 0x07ca, 0x04b6, 0x0057, 0x0422, 0x0581, 0x020b,
+    0x0286, 0x067b, 0x0225, 0x0244, 0x04c2, 0x06f8, 0x0214, 0x0488,
+    0x0788, 0x07f3, 0x07ff, 0x038b, 0x00b7, 0x0459, 0x05b3, 0x040c,
+    0x00c1, 0x02a8, 0x0799, 0x019d, 0x0586, 0x01cd, 0x0212, 0x06f1,
+    0x01a4, 0x0497, 0x018e, 0x0762, 0x08a9, 0x0518, 0x001e, 0x0031,
+    0x0489, 0x0376, 0x024f, 0x00a3, 0x0752, 0x0825, 0x0875, 0x04c5,
+    0x03a9, 0x0675, 0x057a, 0x0324, 0x052d, 0x0722, 0x0408, 0x0063,
+    0x08b2, 0x0611, 0x0061, 0x03af, 0x0530, 0x0496, 0x01cf, 0x0025,
+    0x01c7, 0x07c7, 0x0725, 0x0482, 0x0184, 0x033f, 0x0382, 0x0276,
+    0x035f, 0x00cc, 0x0053, 0x047e, 0x07a6, 0x0170, 0x0704, 0x076d,
+    0x0792, 0x03cd, 0x01da, 0x08f1, 0x04a7, 0x08c2, 0x0166, 0x0933,
+    0x074c, 0x0452, 0x0492, 0x0280, 0x0091, 0x045e, 0x032d, 0x04c0,
+    0x009e, 0x04d7, 0x0831, 0x0745, 0x045c, 0x0682, 0x03c7, 0x0097,
+    0x0691, 0x090f, 0x075d, 0x06a0, 0x06ce, 0x046c, 0x0787, 0x0681,
+    0x0318, 0x07ee, 0x08fe, 0x052f, 0x01ae, 0x04b8, 0x0664, 0x0445,
+    0x01d4, 0x056c, 0x07cf, 0x015a, 0x02f8, 0x000d, 0x0481, 0x07a0,
+    0x043e, 0x06bf, 0x04ed, 0x08c5, 0x02f6, 0x04db, 0x04ad, 0x0266,
+    0x025f, 0x086b, 0x02e5, 0x073f, 0x056e, 0x0410, 0x06ca, 0x03e8,
+    0x0908, 0x0837, 0x07b4, 0x039e, 0x010f, 0x00ed, 0x0215, 0x0953,
+    0x0325, 0x0694, 0x0772, 0x0263, 0x08ce, 0x07fb, 0x0651, 0x08ee,
+    0x03c8, 0x01ff, 0x000e, 0x0703, 0x08ab, 0x0179, 0x01bc, 0x07c6,
+    0x0265, 0x0701, 0x0580, 0x0406, 0x0546, 0x04da, 0x026a, 0x087c,
+    0x03aa, 0x033b, 0x0925, 0x02ba, 0x077d, 0x06c1, 0x02fa, 0x059d,
+    0x01ad, 0x0940, 0x00b0, 0x053c, 0x0839, 0x05d2, 0x04a1, 0x02dc,
+    0x05ec, 0x0557, 0x0755, 0x06b5, 0x05ca, 0x0401, 0x0150, 0x095f,
+    0x00c3, 0x048f, 0x0742, 0x0192, 0x0626, 0x009d, 0x06ec, 0x091d,
+    0x01d2, 0x03b3, 0x001d, 0x05cf, 0x0125, 0x08af, 0x0816, 0x04e8,
+    0x04e1, 0x093a, 0x0156, 0x0584, 0x051b, 0x019f, 0x06ad, 0x0211,
+    0x0551, 0x0359, 0x00a5, 0x057e, 0x0921, 0x06b1, 0x08f2, 0x05e9,
+    0x018f, 0x055f, 0x070c, 0x02be, 0x0362, 0x05a2, 0x0709, 0x07e1,
+    0x0687, 0x0870, 0x03b6, 0x05c9, 0x0528, 0x03cc, 0x0855, 0x093d,
+    0x0556, 0x0155, 0x05de, 0x08cf, 0x0337, 0x0570, 0x0919, 0x039c,
+    0x07f4, 0x0934, 0x022d, 0x0260, 0x0955, 0x016d, 0x004a, 0x01f5,
+    0x0861, 0x0216, 0x05ed, 0x095c, 0x0446, 0x093e, 0x0658, 0x0453,
+    0x037b, 0x086f, 0x00ec, 0x061c, 0x008c, 0x0242, 0x074e, 0x009c,
+    0x08f0, 0x0093, 0x0735, 0x0609, 0x0114, 0x0859, 0x0227, 0x04bd,
+    0x054a, 0x0144, 0x0741, 0x02ca, 0x05bf, 0x0524, 0x04a9, 0x0258,
+    0x03e9, 0x06c0, 0x05b1, 0x0234, 0x069d, 0x077e, 0x01b6, 0x077a,
+    0x0041, 0x0412, 0x0316, 0x0086, 0x07b0, 0x0004, 0x0396, 0x0708,
+    0x02fe, 0x07e6, 0x0540, 0x012a, 0x0379, 0x0239, 0x08e1, 0x065c,
+    0x0716, 0x02b2, 0x0531, 0x0431, 0x017f, 0x04df, 0x0676, 0x066b,
+    0x08bc, 0x0129, 0x00c8, 0x06e4, 0x08e5, 0x01ea, 0x0900, 0x0891,
+    0x0598, 0x01c3, 0x007b, 0x08bb, 0x03c3, 0x0071, 0x02e3, 0x0208,
+    0x0066, 0x0232, 0x04f7, 0x0218, 0x0775, 0x0493, 0x036b, 0x03c5,
+    0x00d8, 0x0450, 0x00ff, 0x01a9, 0x0328, 0x0205, 0x0539, 0x035b,
+    0x094c, 0x03e5, 0x01f4, 0x0436, 0x081b, 0x0522, 0x00aa, 0x058d,
+    0x08fc, 0x07eb, 0x0573, 0x0011, 0x0087, 0x01e0, 0x06d3, 0x01bd,
+    0x0060, 0x0892, 0x00ac, 0x08dc, 0x0821, 0x05d7, 0x0089, 0x0740,
+    0x0010, 0x08bf, 0x08f9, 0x05b6, 0x0612, 0x03bd, 0x031c, 0x0350,
+    0x00f6, 0x0894, 0x03a0, 0x0692, 0x025c, 0x07ba, 0x03f6, 0x07f7,
+    0x06ba, 0x06b7, 0x0278, 0x00e5, 0x067a, 0x0028, 0x04d4, 0x03ca,
+    0x07d4, 0x0199, 0x00fb, 0x05e4, 0x01c2, 0x0877, 0x05cb, 0x01b5,
+    0x0131, 0x0094, 0x00a9, 0x005d, 0x0543, 0x045a, 0x0314, 0x081a,
+    0x0538, 0x0023, 0x0748, 0x05be, 0x014d, 0x0306, 0x02d4, 0x01ba,
+    0x084d, 0x0534, 0x010c, 0x03eb, 0x047c, 0x0843, 0x01f7, 0x003d,
+    0x01aa, 0x016b, 0x058e, 0x0298, 0x07e8, 0x0509, 0x0203, 0x02f0,
+    0x0173, 0x03d7, 0x0576, 0x08d3, 0x0917, 0x03ed, 0x0608, 0x0597,
+    0x06ab, 0x077f, 0x01f0, 0x034b, 0x0808, 0x04d1, 0x03d6, 0x0424,
+    0x031a, 0x073b, 0x06f3, 0x058f, 0x0833, 0x04c9, 0x06ff, 0x0723,
+    0x078a, 0x02f2, 0x0161, 0x0012, 0x065e, 0x0555, 0x07d2, 0x048e,
+    0x0878, 0x064f, 0x03b5, 0x030d, 0x0869, 0x0818, 0x0635, 0x06c8,
+    0x093f, 0x01a0, 0x0159, 0x062f, 0x06c4, 0x0548, 0x052c, 0x06e0,
+    0x0673, 0x0895, 0x0399, 0x077b, 0x0617, 0x01d8, 0x08bd, 0x071a,
+    0x0639, 0x06e3, 0x0398, 0x044f, 0x08e9, 0x03c1, 0x08f5, 0x02e6,
+    0x025b, 0x0734, 0x01ab, 0x0491, 0x0420, 0x03e1, 0x05d9, 0x04d8,
+    0x0583, 0x0918, 0x02f4, 0x04a3, 0x0224, 0x061e, 0x0127, 0x05ba,
+    0x0495, 0x01ef, 0x049f, 0x0749, 0x06d4, 0x033d, 0x06d9, 0x0909,
+    0x079b, 0x0643, 0x056b, 0x02d0, 0x07f6, 0x079f, 0x03e2, 0x036f,
+    0x087f, 0x0255, 0x0165, 0x03e3, 0x0079, 0x0081, 0x04f5, 0x00cd,
+    0x0344, 0x0779, 0x0536, 0x01c8, 0x042b, 0x0789, 0x0175, 0x0718,
+    0x0026, 0x05db, 0x007d, 0x044d, 0x0888, 0x008d, 0x000b, 0x05df,
+    0x0517, 0x0542, 0x00af, 0x044b, 0x088c, 0x056f, 0x0924, 0x089f,
+    0x08cd, 0x00b1, 0x0426, 0x0811, 0x04cc, 0x0254, 0x0607, 0x04e0,
+    0x04a2, 0x0733, 0x0824, 0x018d, 0x0699, 0x00ef, 0x050a, 0x039f,
+    0x068f, 0x06de, 0x03a1, 0x0523, 0x0832, 0x052a, 0x04a4, 0x05cc,
+    0x05f1, 0x08d7, 0x017a, 0x0200, 0x0301, 0x020d, 0x0931, 0x0696,
+    0x0624, 0x08c9, 0x0476, 0x05f0, 0x011f, 0x0207, 0x04f0, 0x080b,
+    0x0698, 0x04d6, 0x07e4, 0x06cf, 0x03ea, 0x0936, 0x022e, 0x0702,
+    0x015b, 0x0473, 0x01f9, 0x0069, 0x00c6, 0x07fa, 0x00e3, 0x0554,
+    0x08a4, 0x094d, 0x05f5, 0x02eb, 0x0043, 0x0515, 0x0601, 0x01ca,
+    0x02e0, 0x005e, 0x0096, 0x0632, 0x0015, 0x077c, 0x0565, 0x048d,
+    0x0849, 0x0439, 0x04e9, 0x02ae, 0x0395, 0x01f2, 0x06dc, 0x044e,
+    0x0913, 0x095e, 0x0475, 0x05a4, 0x0697, 0x0625, 0x007c, 0x07e9,
+    0x07c4, 0x0085, 0x0836, 0x0545, 0x04e3, 0x06bd, 0x052e, 0x056a,
+    0x0222, 0x01e3, 0x067c, 0x04fd, 0x068b, 0x087d, 0x03dc, 0x00e1,
+    0x05aa, 0x06eb, 0x0294, 0x030e, 0x07c5, 0x0021, 0x0049, 0x05a5,
+    0x0737, 0x042d, 0x0667, 0x0033, 0x0052, 0x05d3, 0x0610, 0x079d,
+    0x00b5, 0x082f, 0x0817, 0x057b, 0x0106, 0x038c, 0x008f, 0x0629,
+    0x06e2, 0x07db, 0x05ae, 0x0560, 0x01f1, 0x0474, 0x0751, 0x0767,
+    0x0113, 0x065a, 0x0736, 0x0385, 0x01c5, 0x0559, 0x08b3, 0x0045,
+    0x083f, 0x0352, 0x094f, 0x081c, 0x01db, 0x0183, 0x08d1, 0x057d,
+    0x07d8, 0x0449, 0x06d2, 0x01b0, 0x068d, 0x011c, 0x08a6, 0x0902,
+    0x01eb, 0x034e, 0x006f, 0x089a, 0x04f3, 0x075b, 0x091c, 0x01e2,
+    0x0707, 0x03dd, 0x012d, 0x0520, 0x0591, 0x0793, 0x085d, 0x066c,
+    0x05c6, 0x069f, 0x013b, 0x003f, 0x0374, 0x079e, 0x04ba, 0x012b,
+    0x016c, 0x06a1, 0x0027, 0x0621, 0x02e7, 0x06a5, 0x0193, 0x02db,
+    0x02cc, 0x0111, 0x02fd, 0x0354, 0x004e, 0x0148, 0x049e, 0x0777,
+    0x0347, 0x06b8, 0x005f, 0x06af, 0x01fa, 0x05b5, 0x089c, 0x015e,
+    0x06a7, 0x091e, 0x04a5, 0x037e, 0x024b, 0x0392, 0x06fd, 0x04fc,
+    0x0217, 0x07fc, 0x0444, 0x0532, 0x011a, 0x01b1, 0x06ae, 0x0098,
+    0x016e, 0x025e, 0x063b, 0x0056, 0x0521, 0x0438, 0x01e1, 0x0351,
+    0x00dc, 0x026c, 0x039b, 0x015f, 0x0761, 0x027e, 0x034d, 0x043f,
+    0x04e7, 0x08b5, 0x04f2, 0x03d5, 0x08b9, 0x03b0, 0x08c3, 0x0897,
+    0x027c, 0x01d1, 0x006a, 0x0563, 0x00cf, 0x06b2, 0x02c6, 0x0130,
+    0x02a6, 0x01e7, 0x06c9, 0x0829, 0x07e0, 0x01d9, 0x0082, 0x04b7,
+    0x05a6, 0x010e, 0x078e, 0x01bb, 0x07dc, 0x06d7, 0x0525, 0x0695,
+    0x0915, 0x0456, 0x06df, 0x0688, 0x049c, 0x04bb, 0x04bc, 0x0077,
+    0x08a2, 0x08e4, 0x0867, 0x01bf, 0x03d1, 0x0948, 0x03cb, 0x0649,
+    0x0939, 0x0712, 0x0181, 0x080d, 0x0339, 0x075a, 0x0174, 0x0478,
+    0x04f1, 0x04b3, 0x01b9, 0x0720, 0x00f4, 0x020e, 0x0219, 0x03b7,
+    0x021b, 0x0067, 0x04b1, 0x00da, 0x0938, 0x0764, 0x0469, 0x0002,
+    0x0813, 0x045f, 0x01f6, 0x082e, 0x0099, 0x0472, 0x05a1, 0x0311,
+    0x0830, 0x0006, 0x0134, 0x005c, 0x08dd, 0x083b, 0x02ac, 0x0815,
+    0x0951, 0x07b3, 0x0020, 0x0571, 0x0457, 0x0800, 0x079a, 0x03bf,
+    0x05e1, 0x029e, 0x07f1, 0x0315, 0x011b, 0x01b3, 0x0596, 0x01ac,
+    0x01f8, 0x0375, 0x0364, 0x0514, 0x0853, 0x03fa, 0x0841, 0x0416,
+    0x0143, 0x0912, 0x055e, 0x07cc, 0x0377, 0x0141, 0x0680, 0x01fb,
+    0x014b, 0x074a, 0x03a8, 0x0188, 0x03db, 0x0922, 0x0229, 0x08a8,
+    0x05b8, 0x0160, 0x02de, 0x021a, 0x0901, 0x0226, 0x02f1, 0x092b,
+    0x015c, 0x0124, 0x0595, 0x036c, 0x0016, 0x0460, 0x052b, 0x0136,
+    0x01fd, 0x08b8, 0x0005, 0x010a, 0x07e7, 0x0017, 0x0672, 0x05cd,
+    0x01e5, 0x01e8, 0x03df, 0x0245, 0x05f3, 0x0613, 0x04ce, 0x02b6,
+    0x0348, 0x047b, 0x04cb, 0x0529, 0x045d, 0x0886, 0x0257, 0x0795,
+    0x0790, 0x0512, 0x038d, 0x0108, 0x0237, 0x059e, 0x0022, 0x0062,
+    0x06a8, 0x0633, 0x04fb, 0x05d1, 0x0464, 0x009b, 0x04b4, 0x05c5,
+    0x0164, 0x06b4, 0x003c, 0x0603, 0x0568, 0x0619, 0x06c2, 0x0647,
+    0x03fe, 0x089b, 0x03bb, 0x0230, 0x07a9, 0x08c0, 0x085f, 0x022b,
+    0x055a, 0x0637, 0x08e6, 0x060e, 0x014c, 0x0206, 0x0147, 0x06ea,
+    0x041a, 0x092f, 0x08b7, 0x02e8, 0x0329, 0x01a7, 0x0959, 0x05ab,
+    0x089e, 0x0355, 0x0627, 0x088d, 0x004c, 0x0163, 0x06b0, 0x0319,
+    0x03a2, 0x094a, 0x0059, 0x06e1, 0x01ee, 0x01e6, 0x0686, 0x0467,
+    0x0050, 0x0378, 0x001f, 0x020a, 0x073a, 0x01ec, 0x02aa, 0x0072,
+    0x013d, 0x078b, 0x0477, 0x0307, 0x076f, 0x062b, 0x07b2, 0x018b,
+    0x07e5, 0x0847, 0x0186, 0x0152, 0x07f0, 0x0731, 0x0149, 0x0317,
+    0x006d, 0x0389, 0x035d, 0x03b2, 0x050e, 0x070b, 0x0323, 0x05a8,
+    0x02e1, 0x0171, 0x0710, 0x07d6, 0x030c, 0x0198, 0x012f, 0x06ee,
+    0x036d, 0x0942, 0x0871, 0x091a, 0x020c, 0x053b, 0x008e, 0x00f2,
+    0x0246, 0x0083, 0x016a, 0x013e, 0x0065, 0x029c, 0x06ac, 0x0880,
+    0x00a0, 0x071e, 0x0872, 0x00a6, 0x031b, 0x01e4, 0x0151, 0x0490,
+    0x0018, 0x007e, 0x06d6, 0x07df, 0x08d9, 0x0404, 0x06da, 0x0126,
+    0x0064, 0x05bd, 0x0373, 0x01be, 0x0429, 0x0007, 0x05f7, 0x0797,
+    0x04a8, 0x06a9, 0x0400, 0x08ca, 0x0616, 0x0804, 0x002c, 0x0190,
+    0x067d, 0x028a, 0x0822, 0x060f, 0x053e, 0x03fc, 0x04a0, 0x007f,
+    0x0326, 0x04c4, 0x08b4, 0x044c, 0x0360, 0x0582, 0x04f4, 0x024e,
+    0x06be, 0x08ed, 0x007a, 0x00b8, 0x076a, 0x0154, 0x06b3, 0x0290,
+    0x0252, 0x088f, 0x0774, 0x08ef, 0x015d, 0x08b0, 0x0585, 0x0074,
+    0x0602, 0x08da, 0x011e, 0x00f0, 0x0304, 0x03b1, 0x0914, 0x06cc,
+    0x0383, 0x0101, 0x046a, 0x0604, 0x0465, 0x00a8, 0x0167, 0x087e,
+    0x080a, 0x054e, 0x03a6, 0x0484, 0x0634, 0x0572, 0x03d4, 0x08cc,
+    0x02f7, 0x04ef, 0x0357, 0x0500, 0x0117, 0x0451, 0x0768, 0x05d5,
+    0x00e8, 0x009f, 0x001a, 0x05ce, 0x0727, 0x00a2, 0x035e, 0x0463,
+    0x067e, 0x074b, 0x05e5, 0x019e, 0x070a, 0x0133, 0x0461, 0x04af,
+    0x0899, 0x00a4, 0x0371, 0x0732, 0x03d2, 0x01e9, 0x0201, 0x0928,
+    0x08c4, 0x013f, 0x0369, 0x0868, 0x0593, 0x03ab, 0x0470, 0x0884,
+    0x07c8, 0x0320, 0x018a, 0x0930, 0x0537, 0x095b, 0x0781, 0x03c9,
+    0x011d, 0x0039, 0x01b2, 0x05e0, 0x037d, 0x0882, 0x0128, 0x03d3,
+    0x046d, 0x0796, 0x0851, 0x07f2, 0x0037, 0x0135, 0x082c, 0x070d,
+    0x080e, 0x0342, 0x01c4, 0x08b1, 0x0666, 0x0403, 0x0960, 0x0759,
+    0x04d2, 0x05bc, 0x0662, 0x078c, 0x0499, 0x06b9, 0x02c2, 0x0231,
+    0x05da, 0x017d, 0x089d, 0x07bb, 0x0394, 0x041c, 0x0769, 0x06d5,
+    0x051d, 0x0210, 0x02bc, 0x05dc, 0x000a, 0x0013, 0x044a, 0x0826,
+    0x045b, 0x0819, 0x071f, 0x01cb, 0x0119, 0x0665, 0x0209, 0x0599,
+    0x06bb, 0x0428, 0x0807, 0x0706, 0x06d0, 0x0274, 0x03e4, 0x017c,
+    0x08e3, 0x068c, 0x076b, 0x005b, 0x082a, 0x03d9, 0x06cd, 0x090b,
+    0x05f9, 0x091f, 0x021e, 0x00e6, 0x0946, 0x0614, 0x01c1, 0x064b,
+    0x0380, 0x039d, 0x00d5, 0x072f, 0x01d3, 0x092d, 0x002e, 0x05eb,
+    0x0544, 0x0944, 0x04fe, 0x03ec, 0x08ea, 0x00bc, 0x01b4, 0x0169,
+    0x057c, 0x02f9, 0x0310, 0x014e, 0x0443, 0x092e, 0x006e, 0x023b,
+    0x092a, 0x0505, 0x07d1, 0x083d, 0x0486, 0x0863, 0x022c, 0x0754,
+    0x0519, 0x00be, 0x050c, 0x06f5, 0x06f0, 0x0084, 0x035a, 0x00ae,
+    0x05ad, 0x08a0, 0x06e9, 0x0349, 0x049a, 0x005a, 0x05c3, 0x0268,
+    0x00ea, 0x0873, 0x081d, 0x023e, 0x068e, 0x0335, 0x07ef, 0x07dd,
+    0x0139, 0x08ad, 0x093c, 0x0776, 0x06db, 0x068a, 0x028e, 0x03b4,
+    0x0574, 0x016f, 0x06c3, 0x0744, 0x0783, 0x04c7, 0x07f9, 0x0138,
+    0x0794, 0x034a, 0x002f, 0x062a, 0x07f5, 0x0070, 0x069b, 0x07da,
+    0x04cf, 0x0690, 0x01d6, 0x0770, 0x04e2, 0x090d, 0x0220, 0x00c4,
+    0x08c6, 0x078f, 0x02c0, 0x01c9, 0x0468, 0x0747, 0x04cd, 0x02f3,
+    0x07a2, 0x019b, 0x04ea, 0x0146, 0x05a0, 0x04ee, 0x05ee, 0x0920,
+    0x040a, 0x0896, 0x037f, 0x0756, 0x075c, 0x07ae, 0x0778, 0x05fe,
+    0x06d1, 0x091b, 0x08f3, 0x0501, 0x0282, 0x02df, 0x0095, 0x04d3,
+    0x0078, 0x072d, 0x08e8, 0x0533, 0x0738, 0x025a, 0x0857, 0x06fe,
+    0x0333, 0x071c, 0x037c, 0x06a3, 0x038a, 0x0088, 0x06e8, 0x072b,
+    0x040e, 0x0264, 0x0729, 0x0180, 0x0001, 0x070e, 0x0516, 0x039a,
+    0x0910, 0x054f, 0x055c, 0x017b, 0x060c, 0x043a, 0x0685, 0x0510,
+    0x0628, 0x0204, 0x02e4, 0x04b9, 0x0172, 0x076e, 0x06b6, 0x0483,
+    0x01ed, 0x0724, 0x0605, 0x0178, 0x0353, 0x0356, 0x0080, 0x08f6,
+    0x0765, 0x03ee, 0x060d, 0x02ff, 0x0904, 0x0288, 0x073d, 0x08f4,
+    0x03c6, 0x0235, 0x049d, 0x0068, 0x03d0, 0x0455, 0x0926, 0x08b6,
+    0x00d7, 0x0700, 0x0340, 0x080c, 0x076c, 0x031f, 0x0122, 0x0671,
+    0x056d, 0x090c, 0x0381, 0x0766, 0x03f8, 0x02ef, 0x012e, 0x03e6,
+    0x062d, 0x07d7, 0x00a1, 0x080f, 0x0440, 0x01c6, 0x064d, 0x0881,
+    0x059f, 0x08c1, 0x074f, 0x0247, 0x04a6, 0x0541, 0x0760, 0x0213,
+    0x0331, 0x05ea, 0x0393, 0x03b9, 0x0618, 0x06a2, 0x0432, 0x047a,
+    0x0240, 0x05a3, 0x032f, 0x000f, 0x03ce, 0x07b1, 0x01d7, 0x05e3,
+    0x0162, 0x07aa, 0x087a, 0x0827, 0x0809, 0x06e7, 0x0820, 0x05ac,
+    0x01fe, 0x07a7, 0x021d, 0x04f8, 0x082d, 0x01b7, 0x0507, 0x0441,
+    0x08a1, 0x066f, 0x08aa, 0x0197, 0x02c4, 0x074d, 0x08e7, 0x06e6,
+    0x07ac, 0x03f4, 0x0630, 0x05e6, 0x034c, 0x05c0, 0x07a3, 0x02a0,
+    0x07b5, 0x0911, 0x04b5, 0x08a5, 0x05c7, 0x022f, 0x0898, 0x0579,
+    0x003b, 0x00fd, 0x0674, 0x078d, 0x062e, 0x019a, 0x04fa, 0x0503,
+    0x032b, 0x04dd, 0x0189, 0x0120, 0x0684, 0x01dd, 0x0300, 0x0660,
+    0x054c, 0x059b, 0x04d5, 0x0689, 0x0782, 0x093b, 0x048a, 0x0567,
+    0x001b, 0x08d0, 0x05c2, 0x0194, 0x0137, 0x0115, 0x0526, 0x0386,
+    0x0073, 0x02ea, 0x08f8, 0x03ae, 0x021f, 0x051c, 0x01af, 0x0763,
+    0x0000, 0x0185, 0x0564, 0x022a, 0x02ec, 0x01c0, 0x024d, 0x04e4,
+    0x07c0, 0x06f7, 0x0019, 0x075e, 0x051e, 0x075f, 0x01de, 0x020f,
+    0x07b8, 0x08df, 0x00b3, 0x05b2, 0x05b4, 0x01dc, 0x02e2, 0x086e,
+    0x08be, 0x08cb, 0x063f, 0x0903, 0x07b9, 0x0123, 0x0923, 0x08de,
+    0x0679, 0x0075, 0x02fc, 0x07e3, 0x07d5, 0x0606, 0x07a5, 0x0805,
+    0x0784, 0x0600, 0x08d8, 0x0142, 0x0791, 0x0678, 0x0916, 0x07b7,
+    0x07fe, 0x0578, 0x07fd, 0x08fa, 0x0480, 0x0750, 0x08a7, 0x07f8,
+    0x0812, 0x05dd, 0x03e7, 0x079c, 0x0233, 0x036e, 0x0168, 0x0177,
+    0x013c, 0x0907, 0x04ac, 0x095d, 0x0434, 0x069a, 0x046b, 0x01d5,
+    0x0261, 0x07ec, 0x0714, 0x08d5, 0x0893, 0x0249, 0x0935, 0x0442,
+    0x08eb, 0x07ce, 0x060a, 0x0409, 0x086a, 0x073c, 0x0577, 0x0447,
+    0x08d6, 0x026e, 0x0786, 0x07af, 0x0845, 0x0668, 0x0838, 0x01a2,
+    0x05c8, 0x0448, 0x06fc, 0x0798,
+};
+
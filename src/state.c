@@ -59,10 +59,19 @@
  *   - messages (very unlikely)
  */
 
+#include <stddef.h>
+
 #include "keymap.h"
 #include "keysym.h"
 #include "utf8.h"
 
+/*
+ * The maximum number of filters which can be active at once, i.e. roughly
+ * the number of keys with actions which can be held down together.
+ * Bounded by the size of xkb_state->live_filters.
+ */
+#define MAX_FILTERS 32
+
 struct xkb_filter {
     union xkb_action action;
     const struct xkb_key *key;
@@ -111,9 +120,35 @@ struct xkb_state {
      */
     int16_t mod_key_count[XKB_MAX_MODS];
 
+    /* The state components which any of the LEDs depend on. */
+    enum xkb_state_component led_components;
+
     int refcnt;
-    darray(struct xkb_filter) filters;
     struct xkb_keymap *keymap;
+
+    /*
+     * A copy of the components, published at the end of each update for
+     * other threads to read without a lock; see
+     * xkb_state_update_snapshot(). This is a sequence lock: seq is odd
+     * while the copy is being written.
+     */
+    uint32_t seq;
+    struct state_components published;
+
+    /*
+     * Set for the read-only copies made by xkb_state_snapshot(). These
+     * are allocated up to the filters only, and can only be updated by
+     * xkb_state_update_snapshot().
+     */
+    bool snapshot;
+
+    /*
+     * The filters are allocated from a fixed pool, so that processing
+     * keys never allocates. A bit is set in live_filters for each filter
+     * in use; they are applied in order of their index.
+     */
+    uint32_t live_filters;
+    struct xkb_filter filters[MAX_FILTERS];
 };
 
 static const struct xkb_key_type_entry *
@@ -123,6 +158,11 @@ get_entry_for_key_state(struct xkb_state *state, const struct xkb_key *key,
     const struct xkb_key_type *type = key->groups[group].type;
     xkb_mod_mask_t active_mods = state->components.mods & type->mods.mask;
 
+    if (type->entry_map) {
+        uint8_t idx = type->entry_map[active_mods];
+        return idx ? &type->entries[idx - 1] : NULL;
+    }
+
     for (unsigned i = 0; i < type->num_entries; i++) {
         /*
          * If the virtual modifiers are not bound to anything, we're
@@ -237,20 +277,20 @@ xkb_key_get_action(struct xkb_state *state, const struct xkb_key *key)
 static struct xkb_filter *
 xkb_filter_new(struct xkb_state *state)
 {
-    struct xkb_filter *filter = NULL, *iter;
+    struct xkb_filter *filter;
+    int idx;
 
-    darray_foreach(iter, state->filters) {
-        if (iter->func)
-            continue;
-        filter = iter;
-        break;
-    }
+    STATIC_ASSERT(MAX_FILTERS <= sizeof(state->live_filters) * 8,
+                  "live_filters is too small for MAX_FILTERS");
 
-    if (!filter) {
-        darray_resize0(state->filters, darray_size(state->filters) + 1);
-        filter = &darray_item(state->filters, darray_size(state->filters) -1);
-    }
+    /* Take the first free slot. */
+    idx = ffs((int) ~state->live_filters) - 1;
+    if (idx < 0 || idx >= MAX_FILTERS)
+        return NULL;
+
+    state->live_filters |= (1u << idx);
 
+    filter = &state->filters[idx];
     filter->refcnt = 1;
     return filter;
 }
@@ -532,13 +572,19 @@ xkb_filter_apply_all(struct xkb_state *state,
     struct xkb_filter *filter;
     const union xkb_action *action;
     bool send = true;
+    uint32_t live;
 
     /* First run through all the currently active filters and see if any of
      * them have claimed this event. */
-    darray_foreach(filter, state->filters) {
-        if (!filter->func)
-            continue;
+    for (live = state->live_filters; live; live &= live - 1) {
+        int idx = ffs((int) live) - 1;
+
+        filter = &state->filters[idx];
         send = filter->func(state, filter, key, direction) && send;
+
+        /* The filter has finished. */
+        if (!filter->func)
+            state->live_filters &= ~(1u << idx);
     }
 
     if (!send || direction == XKB_KEY_UP)
@@ -569,6 +615,193 @@ xkb_filter_apply_all(struct xkb_state *state,
     filter_action_funcs[action->type].new(state, filter);
 }
 
+static enum xkb_state_component
+get_state_component_changes(const struct state_components *a,
+                            const struct state_components *b)
+{
+    xkb_mod_mask_t mask = 0;
+
+    if (a->group != b->group)
+        mask |= XKB_STATE_LAYOUT_EFFECTIVE;
+    if (a->base_group != b->base_group)
+        mask |= XKB_STATE_LAYOUT_DEPRESSED;
+    if (a->latched_group != b->latched_group)
+        mask |= XKB_STATE_LAYOUT_LATCHED;
+    if (a->locked_group != b->locked_group)
+        mask |= XKB_STATE_LAYOUT_LOCKED;
+    if (a->mods != b->mods)
+        mask |= XKB_STATE_MODS_EFFECTIVE;
+    if (a->base_mods != b->base_mods)
+        mask |= XKB_STATE_MODS_DEPRESSED;
+    if (a->latched_mods != b->latched_mods)
+        mask |= XKB_STATE_MODS_LATCHED;
+    if (a->locked_mods != b->locked_mods)
+        mask |= XKB_STATE_MODS_LOCKED;
+    if (a->leds != b->leds)
+        mask |= XKB_STATE_LEDS;
+
+    return mask;
+}
+
+/**
+ * Returns the state components which the LED depends on, not counting
+ * the controls, which are fixed in the keymap.
+ */
+static enum xkb_state_component
+get_led_components(const struct xkb_led *led)
+{
+    enum xkb_state_component components = 0;
+
+    if (led->mods.mask != 0)
+        components |= led->which_mods;
+    if (led->groups != 0)
+        components |= led->which_groups;
+
+    return components;
+}
+
+static bool
+xkb_state_led_is_lit(struct xkb_state *state, const struct xkb_led *led)
+{
+    xkb_mod_mask_t mod_mask = 0;
+    xkb_layout_mask_t group_mask = 0;
+
+    if (led->which_mods != 0 && led->mods.mask != 0) {
+        if (led->which_mods & XKB_STATE_MODS_EFFECTIVE)
+            mod_mask |= state->components.mods;
+        if (led->which_mods & XKB_STATE_MODS_DEPRESSED)
+            mod_mask |= state->components.base_mods;
+        if (led->which_mods & XKB_STATE_MODS_LATCHED)
+            mod_mask |= state->components.latched_mods;
+        if (led->which_mods & XKB_STATE_MODS_LOCKED)
+            mod_mask |= state->components.locked_mods;
+
+        if (led->mods.mask & mod_mask)
+            return true;
+    }
+
+    if (led->which_groups != 0 && led->groups != 0) {
+        if (led->which_groups & XKB_STATE_LAYOUT_EFFECTIVE)
+            group_mask |= (1u << state->components.group);
+        if (led->which_groups & XKB_STATE_LAYOUT_DEPRESSED)
+            group_mask |= (1u << state->components.base_group);
+        if (led->which_groups & XKB_STATE_LAYOUT_LATCHED)
+            group_mask |= (1u << state->components.latched_group);
+        if (led->which_groups & XKB_STATE_LAYOUT_LOCKED)
+            group_mask |= (1u << state->components.locked_group);
+
+        if (led->groups & group_mask)
+            return true;
+    }
+
+    if (led->ctrls & state->keymap->enabled_ctrls)
+        return true;
+
+    return false;
+}
+
+/**
+ * Update the LED state to match the rest of the xkb_state.
+ */
+static void
+xkb_state_led_update_all(struct xkb_state *state)
+{
+    xkb_led_index_t idx;
+    const struct xkb_led *led;
+
+    state->components.leds = 0;
+    state->led_components = 0;
+
+    xkb_leds_enumerate(idx, led, state->keymap) {
+        state->led_components |= get_led_components(led);
+
+        if (xkb_state_led_is_lit(state, led))
+            state->components.leds |= (1u << idx);
+    }
+}
+
+/**
+ * Update the LED state after the other state components have changed
+ * from @prev, and return the mask of all the changed components.  Since
+ * the LEDs only depend on the other components, only the LEDs whose
+ * inputs have changed are recomputed, and usually none are.
+ */
+static enum xkb_state_component
+xkb_state_led_update(struct xkb_state *state,
+                     const struct state_components *prev)
+{
+    enum xkb_state_component changed;
+    xkb_led_index_t idx;
+    const struct xkb_led *led;
+
+    changed = get_state_component_changes(prev, &state->components);
+    if (!(changed & state->led_components))
+        return changed;
+
+    xkb_leds_enumerate(idx, led, state->keymap) {
+        if (!(changed & get_led_components(led)))
+            continue;
+
+        if (xkb_state_led_is_lit(state, led))
+            state->components.leds |= (1u << idx);
+        else
+            state->components.leds &= ~(1u << idx);
+    }
+
+    if (state->components.leds != prev->leds)
+        changed |= XKB_STATE_LEDS;
+
+    return changed;
+}
+
+/* Only called from the thread which updates the state. */
+static void
+xkb_state_publish(struct xkb_state *state)
+{
+    const struct state_components *c = &state->components;
+    struct state_components *p = &state->published;
+    const uint32_t seq = atomic_load_relaxed(&state->seq);
+
+    atomic_store_relaxed(&state->seq, seq + 1);
+    atomic_fence_release();
+
+    atomic_store_relaxed(&p->base_group, c->base_group);
+    atomic_store_relaxed(&p->latched_group, c->latched_group);
+    atomic_store_relaxed(&p->locked_group, c->locked_group);
+    atomic_store_relaxed(&p->group, c->group);
+    atomic_store_relaxed(&p->base_mods, c->base_mods);
+    atomic_store_relaxed(&p->latched_mods, c->latched_mods);
+    atomic_store_relaxed(&p->locked_mods, c->locked_mods);
+    atomic_store_relaxed(&p->mods, c->mods);
+    atomic_store_relaxed(&p->leds, c->leds);
+
+    atomic_store_release(&state->seq, seq + 2);
+}
+
+/* May be called from any thread, while the state is being updated. */
+static void
+xkb_state_read_published(struct xkb_state *state, struct state_components *c)
+{
+    const struct state_components *p = &state->published;
+    uint32_t seq;
+
+    do {
+        seq = atomic_load_acquire(&state->seq);
+
+        c->base_group = atomic_load_relaxed(&p->base_group);
+        c->latched_group = atomic_load_relaxed(&p->latched_group);
+        c->locked_group = atomic_load_relaxed(&p->locked_group);
+        c->group = atomic_load_relaxed(&p->group);
+        c->base_mods = atomic_load_relaxed(&p->base_mods);
+        c->latched_mods = atomic_load_relaxed(&p->latched_mods);
+        c->locked_mods = atomic_load_relaxed(&p->locked_mods);
+        c->mods = atomic_load_relaxed(&p->mods);
+        c->leds = atomic_load_relaxed(&p->leds);
+
+        atomic_fence_acquire();
+    } while ((seq & 1) || seq != atomic_load_relaxed(&state->seq));
+}
+
 XKB_EXPORT struct xkb_state *
 xkb_state_new(struct xkb_keymap *keymap)
 {
@@ -581,24 +814,81 @@ xkb_state_new(struct xkb_keymap *keymap)
     ret->refcnt = 1;
     ret->keymap = xkb_keymap_ref(keymap);
 
+    xkb_state_led_update_all(ret);
+    xkb_state_publish(ret);
+
+    return ret;
+}
+
+static struct xkb_state *
+xkb_state_copy(struct xkb_state *state, bool snapshot)
+{
+    struct xkb_state *ret;
+
+    ret = malloc(sizeof(*ret));
+    if (!ret)
+        return NULL;
+
+    if (snapshot || state->snapshot) {
+        /* Only what was published, as the state may be changing. */
+        memset(ret, 0, offsetof(struct xkb_state, filters));
+        xkb_state_read_published(state, &ret->components);
+        ret->published = ret->components;
+        ret->led_components = state->led_components;
+        ret->snapshot = true;
+    }
+    else {
+        *ret = *state;
+    }
+
+    ret->refcnt = 1;
+    ret->keymap = xkb_keymap_ref(state->keymap);
+
     return ret;
 }
 
+XKB_EXPORT struct xkb_state *
+xkb_state_clone(struct xkb_state *state)
+{
+    return xkb_state_copy(state, false);
+}
+
+XKB_EXPORT struct xkb_state *
+xkb_state_snapshot(struct xkb_state *state)
+{
+    return xkb_state_copy(state, true);
+}
+
+XKB_EXPORT enum xkb_state_component
+xkb_state_update_snapshot(struct xkb_state *snapshot, struct xkb_state *state)
+{
+    struct state_components prev_components;
+
+    if (!snapshot->snapshot || snapshot->keymap != state->keymap)
+        return 0;
+
+    prev_components = snapshot->components;
+    xkb_state_read_published(state, &snapshot->components);
+    xkb_state_publish(snapshot);
+
+    return get_state_component_changes(&prev_components,
+                                       &snapshot->components);
+}
+
 XKB_EXPORT struct xkb_state *
 xkb_state_ref(struct xkb_state *state)
 {
-    state->refcnt++;
+    refcnt_inc(&state->refcnt);
     return state;
 }
 
 XKB_EXPORT void
 xkb_state_unref(struct xkb_state *state)
 {
-    if (!state || --state->refcnt > 0)
+    if (!state || refcnt_dec(&state->refcnt) > 0)
         return;
 
     xkb_keymap_unref(state->keymap);
-    darray_free(state->filters);
     free(state);
 }
 
@@ -609,62 +899,8 @@ xkb_state_get_keymap(struct xkb_state *state)
 }
 
 /**
- * Update the LED state to match the rest of the xkb_state.
- */
-static void
-xkb_state_led_update_all(struct xkb_state *state)
-{
-    xkb_led_index_t idx;
-    const struct xkb_led *led;
-
-    state->components.leds = 0;
-
-    xkb_leds_enumerate(idx, led, state->keymap) {
-        xkb_mod_mask_t mod_mask = 0;
-        xkb_layout_mask_t group_mask = 0;
-
-        if (led->which_mods != 0 && led->mods.mask != 0) {
-            if (led->which_mods & XKB_STATE_MODS_EFFECTIVE)
-                mod_mask |= state->components.mods;
-            if (led->which_mods & XKB_STATE_MODS_DEPRESSED)
-                mod_mask |= state->components.base_mods;
-            if (led->which_mods & XKB_STATE_MODS_LATCHED)
-                mod_mask |= state->components.latched_mods;
-            if (led->which_mods & XKB_STATE_MODS_LOCKED)
-                mod_mask |= state->components.locked_mods;
-
-            if (led->mods.mask & mod_mask) {
-                state->components.leds |= (1u << idx);
-                continue;
-            }
-        }
-
-        if (led->which_groups != 0 && led->groups != 0) {
-            if (led->which_groups & XKB_STATE_LAYOUT_EFFECTIVE)
-                group_mask |= (1u << state->components.group);
-            if (led->which_groups & XKB_STATE_LAYOUT_DEPRESSED)
-                group_mask |= (1u << state->components.base_group);
-            if (led->which_groups & XKB_STATE_LAYOUT_LATCHED)
-                group_mask |= (1u << state->components.latched_group);
-            if (led->which_groups & XKB_STATE_LAYOUT_LOCKED)
-                group_mask |= (1u << state->components.locked_group);
-
-            if (led->groups & group_mask) {
-                state->components.leds |= (1u << idx);
-                continue;
-            }
-        }
-
-        if (led->ctrls & state->keymap->enabled_ctrls) {
-            state->components.leds |= (1u << idx);
-            continue;
-        }
-    }
-}
-
-/**
- * Calculates the derived state (effective mods/group and LEDs) from an
- * up-to-date xkb_state.
+ * Calculates the derived state (effective mods/group) from an up-to-date
+ * xkb_state.  The LEDs must be updated separately afterwards.
  */
 static void
 xkb_state_update_derived(struct xkb_state *state)
@@ -690,55 +926,18 @@ xkb_state_update_derived(struct xkb_state *state)
                                     RANGE_WRAP, 0);
     state->components.group =
         (wrapped == XKB_LAYOUT_INVALID ? 0 : wrapped);
-
-    xkb_state_led_update_all(state);
-}
-
-static enum xkb_state_component
-get_state_component_changes(const struct state_components *a,
-                            const struct state_components *b)
-{
-    xkb_mod_mask_t mask = 0;
-
-    if (a->group != b->group)
-        mask |= XKB_STATE_LAYOUT_EFFECTIVE;
-    if (a->base_group != b->base_group)
-        mask |= XKB_STATE_LAYOUT_DEPRESSED;
-    if (a->latched_group != b->latched_group)
-        mask |= XKB_STATE_LAYOUT_LATCHED;
-    if (a->locked_group != b->locked_group)
-        mask |= XKB_STATE_LAYOUT_LOCKED;
-    if (a->mods != b->mods)
-        mask |= XKB_STATE_MODS_EFFECTIVE;
-    if (a->base_mods != b->base_mods)
-        mask |= XKB_STATE_MODS_DEPRESSED;
-    if (a->latched_mods != b->latched_mods)
-        mask |= XKB_STATE_MODS_LATCHED;
-    if (a->locked_mods != b->locked_mods)
-        mask |= XKB_STATE_MODS_LOCKED;
-    if (a->leds != b->leds)
-        mask |= XKB_STATE_LEDS;
-
-    return mask;
 }
 
 /**
- * Given a particular key event, updates the state structure to reflect the
- * new modifiers.
+ * Runs a key event through the filters and applies the resulting changes
+ * to the base modifiers.  The derived state is not updated.
  */
-XKB_EXPORT enum xkb_state_component
-xkb_state_update_key(struct xkb_state *state, xkb_keycode_t kc,
-                     enum xkb_key_direction direction)
+static void
+xkb_state_apply_key(struct xkb_state *state, const struct xkb_key *key,
+                    enum xkb_key_direction direction)
 {
     xkb_mod_index_t i;
     xkb_mod_mask_t bit;
-    struct state_components prev_components;
-    const struct xkb_key *key = XkbKey(state->keymap, kc);
-
-    if (!key)
-        return 0;
-
-    prev_components = state->components;
 
     state->set_mods = 0;
     state->clear_mods = 0;
@@ -763,10 +962,77 @@ xkb_state_update_key(struct xkb_state *state, xkb_keycode_t kc,
             state->clear_mods &= ~bit;
         }
     }
+}
+
+/**
+ * Given a particular key event, updates the state structure to reflect the
+ * new modifiers.
+ */
+XKB_EXPORT enum xkb_state_component
+xkb_state_update_key(struct xkb_state *state, xkb_keycode_t kc,
+                     enum xkb_key_direction direction)
+{
+    struct state_components prev_components;
+    const struct xkb_key *key = XkbKey(state->keymap, kc);
+    enum xkb_state_component changed;
+
+    if (!key || state->snapshot)
+        return 0;
 
+    prev_components = state->components;
+
+    xkb_state_apply_key(state, key, direction);
     xkb_state_update_derived(state);
 
-    return get_state_component_changes(&prev_components, &state->components);
+    changed = xkb_state_led_update(state, &prev_components);
+    if (changed)
+        xkb_state_publish(state);
+
+    return changed;
+}
+
+/**
+ * Like xkb_state_update_key() for each event in turn, except that if the
+ * caller is not interested in the per-event changes, the LEDs are only
+ * updated once, after the last event.
+ */
+XKB_EXPORT enum xkb_state_component
+xkb_state_update_keys(struct xkb_state *state,
+                      const struct xkb_key_event *events, size_t num_events,
+                      enum xkb_state_component *changed_out)
+{
+    struct state_components prev_components, event_components;
+    enum xkb_state_component changed;
+
+    prev_components = state->components;
+
+    for (size_t i = 0; i < num_events; i++) {
+        const struct xkb_key *key = XkbKey(state->keymap, events[i].keycode);
+
+        if (!key || state->snapshot) {
+            if (changed_out)
+                changed_out[i] = 0;
+            continue;
+        }
+
+        event_components = state->components;
+
+        xkb_state_apply_key(state, key, events[i].direction);
+        xkb_state_update_derived(state);
+
+        if (changed_out)
+            changed_out[i] = xkb_state_led_update(state, &event_components);
+    }
+
+    if (!changed_out)
+        changed = xkb_state_led_update(state, &prev_components);
+    else
+        changed = get_state_component_changes(&prev_components,
+                                              &state->components);
+    if (changed)
+        xkb_state_publish(state);
+
+    return changed;
 }
 
 /**
@@ -786,8 +1052,12 @@ xkb_state_update_mask(struct xkb_state *state,
                       xkb_layout_index_t locked_group)
 {
     struct state_components prev_components;
+    enum xkb_state_component changed;
     xkb_mod_mask_t mask;
 
+    if (state->snapshot)
+        return 0;
+
     prev_components = state->components;
 
     /* Only include modifiers which exist in the keymap. */
@@ -824,7 +1094,11 @@ xkb_state_update_mask(struct xkb_state *state,
 
     xkb_state_update_derived(state);
 
-    return get_state_component_changes(&prev_components, &state->components);
+    changed = xkb_state_led_update(state, &prev_components);
+    if (changed)
+        xkb_state_publish(state);
+
+    return changed;
 }
 
 /**
@@ -923,6 +1197,22 @@ xkb_state_key_get_one_sym(struct xkb_state *state, xkb_keycode_t kc)
     return sym;
 }
 
+static int
+key_get_syms_by_level(const struct xkb_key *key, xkb_layout_index_t layout,
+                      xkb_level_index_t level, const xkb_keysym_t **syms_out)
+{
+    const struct xkb_level *leveli = &key->groups[layout].levels[level];
+
+    if (leveli->num_syms == 0)
+        *syms_out = NULL;
+    else if (leveli->num_syms == 1)
+        *syms_out = &leveli->u.sym;
+    else
+        *syms_out = leveli->u.syms;
+
+    return leveli->num_syms;
+}
+
 /*
  * The caps and ctrl transformations require some special handling,
  * so we cannot simply use xkb_state_get_one_sym() for them.
@@ -933,35 +1223,26 @@ xkb_state_key_get_one_sym(struct xkb_state *state, xkb_keycode_t kc)
  * but it is enabled by default, yippee.
  */
 static xkb_keysym_t
-get_one_sym_for_string(struct xkb_state *state, xkb_keycode_t kc)
+key_get_one_sym_for_string(struct xkb_state *state, const struct xkb_key *key,
+                           xkb_layout_index_t layout, xkb_level_index_t level,
+                           bool do_caps, bool do_ctrl)
 {
-    xkb_level_index_t level;
-    xkb_layout_index_t layout, num_layouts;
     const xkb_keysym_t *syms;
     int nsyms;
     xkb_keysym_t sym;
 
-    layout = xkb_state_key_get_layout(state, kc);
-    num_layouts = xkb_keymap_num_layouts_for_key(state->keymap, kc);
-    level = xkb_state_key_get_level(state, kc, layout);
-    if (layout == XKB_LAYOUT_INVALID || num_layouts == 0 ||
-        level == XKB_LEVEL_INVALID)
-        return XKB_KEY_NoSymbol;
-
-    nsyms = xkb_keymap_key_get_syms_by_level(state->keymap, kc,
-                                             layout, level, &syms);
+    nsyms = key_get_syms_by_level(key, layout, level, &syms);
     if (nsyms != 1)
         return XKB_KEY_NoSymbol;
     sym = syms[0];
 
-    if (should_do_ctrl_transformation(state, kc) && sym > 127u) {
-        for (xkb_layout_index_t i = 0; i < num_layouts; i++) {
-            level = xkb_state_key_get_level(state, kc, i);
-            if (level == XKB_LEVEL_INVALID)
-                continue;
+    if (do_ctrl && sym > 127u) {
+        for (xkb_layout_index_t i = 0; i < key->num_groups; i++) {
+            const struct xkb_key_type_entry *entry;
 
-            nsyms = xkb_keymap_key_get_syms_by_level(state->keymap, kc,
-                                                     i, level, &syms);
+            entry = get_entry_for_key_state(state, key, i);
+            nsyms = key_get_syms_by_level(key, i, entry ? entry->level : 0,
+                                          &syms);
             if (nsyms == 1 && syms[0] <= 127u) {
                 sym = syms[0];
                 break;
@@ -969,31 +1250,36 @@ get_one_sym_for_string(struct xkb_state *state, xkb_keycode_t kc)
         }
     }
 
-    if (should_do_caps_transformation(state, kc)) {
+    if (do_caps)
         sym = xkb_keysym_to_upper(sym);
-    }
 
     return sym;
 }
 
-XKB_EXPORT int
-xkb_state_key_get_utf8(struct xkb_state *state, xkb_keycode_t kc,
-                       char *buffer, size_t size)
+static xkb_keysym_t
+get_one_sym_for_string(struct xkb_state *state, xkb_keycode_t kc)
+{
+    const struct xkb_key *key = XkbKey(state->keymap, kc);
+    xkb_layout_index_t layout;
+    xkb_level_index_t level;
+
+    layout = xkb_state_key_get_layout(state, kc);
+    level = xkb_state_key_get_level(state, kc, layout);
+    if (layout == XKB_LAYOUT_INVALID || level == XKB_LEVEL_INVALID)
+        return XKB_KEY_NoSymbol;
+
+    return key_get_one_sym_for_string(state, key, layout, level,
+                                      should_do_caps_transformation(state, kc),
+                                      should_do_ctrl_transformation(state, kc));
+}
+
+static int
+syms_to_utf8(const xkb_keysym_t *syms, int nsyms, bool do_ctrl,
+             char *buffer, size_t size)
 {
-    xkb_keysym_t sym;
-    const xkb_keysym_t *syms;
-    int nsyms;
     int offset;
     char tmp[7];
 
-    sym = get_one_sym_for_string(state, kc);
-    if (sym != XKB_KEY_NoSymbol) {
-        nsyms = 1; syms = &sym;
-    }
-    else {
-        nsyms = xkb_state_key_get_syms(state, kc, &syms);
-    }
-
     /* Make sure not to truncate in the middle of a UTF-8 sequence. */
     offset = 0;
     for (int i = 0; i < nsyms; i++) {
@@ -1014,8 +1300,7 @@ xkb_state_key_get_utf8(struct xkb_state *state, xkb_keycode_t kc,
     if (!is_valid_utf8(buffer, offset))
         goto err_bad;
 
-    if (offset == 1 && (unsigned int) buffer[0] <= 127u &&
-        should_do_ctrl_transformation(state, kc))
+    if (offset == 1 && (unsigned int) buffer[0] <= 127u && do_ctrl)
         buffer[0] = XkbToControl(buffer[0]);
 
     return offset;
@@ -1031,6 +1316,26 @@ err_bad:
     return 0;
 }
 
+XKB_EXPORT int
+xkb_state_key_get_utf8(struct xkb_state *state, xkb_keycode_t kc,
+                       char *buffer, size_t size)
+{
+    xkb_keysym_t sym;
+    const xkb_keysym_t *syms;
+    int nsyms;
+
+    sym = get_one_sym_for_string(state, kc);
+    if (sym != XKB_KEY_NoSymbol) {
+        nsyms = 1; syms = &sym;
+    }
+    else {
+        nsyms = xkb_state_key_get_syms(state, kc, &syms);
+    }
+
+    return syms_to_utf8(syms, nsyms, should_do_ctrl_transformation(state, kc),
+                        buffer, size);
+}
+
 XKB_EXPORT uint32_t
 xkb_state_key_get_utf32(struct xkb_state *state, xkb_keycode_t kc)
 {
@@ -1046,6 +1351,84 @@ xkb_state_key_get_utf32(struct xkb_state *state, xkb_keycode_t kc)
     return cp;
 }
 
+/*
+ * Whether the modifier is active in the state and not consumed by the key.
+ */
+static bool
+mod_is_active_unconsumed(struct xkb_state *state, const char *name,
+                         xkb_mod_mask_t consumed)
+{
+    xkb_mod_index_t idx = xkb_keymap_mod_get_index(state->keymap, name);
+
+    if (idx == XKB_MOD_INVALID)
+        return false;
+
+    return (state->components.mods & ~consumed & (1u << idx)) != 0;
+}
+
+/**
+ * Resolves the layout and level of the key once, and derives everything
+ * the xkb_state_key_get_* functions would from them.
+ */
+XKB_EXPORT int
+xkb_state_key_get_info(struct xkb_state *state, xkb_keycode_t kc,
+                       struct xkb_key_info *info, char *buffer, size_t size)
+{
+    const struct xkb_key *key = XkbKey(state->keymap, kc);
+    const struct xkb_key_type_entry *entry;
+    bool do_caps, do_ctrl;
+    xkb_keysym_t sym;
+
+    info->layout = XKB_LAYOUT_INVALID;
+    info->level = XKB_LEVEL_INVALID;
+    info->syms = NULL;
+    info->num_syms = 0;
+    info->sym = XKB_KEY_NoSymbol;
+    info->utf32 = 0;
+    info->consumed_mods = 0;
+
+    if (size > 0)
+        buffer[0] = '\0';
+
+    if (!key)
+        return 0;
+
+    info->layout = XkbWrapGroupIntoRange(state->components.group,
+                                         key->num_groups,
+                                         key->out_of_range_group_action,
+                                         key->out_of_range_group_number);
+    if (info->layout == XKB_LAYOUT_INVALID)
+        return 0;
+
+    entry = get_entry_for_key_state(state, key, info->layout);
+    info->level = entry ? entry->level : 0;
+    info->consumed_mods = key->groups[info->layout].type->mods.mask &
+                          ~(entry ? entry->preserve.mask : 0);
+    info->num_syms = key_get_syms_by_level(key, info->layout, info->level,
+                                           &info->syms);
+
+    do_caps = mod_is_active_unconsumed(state, XKB_MOD_NAME_CAPS,
+                                       info->consumed_mods);
+    do_ctrl = mod_is_active_unconsumed(state, XKB_MOD_NAME_CTRL,
+                                       info->consumed_mods);
+
+    if (info->num_syms == 1)
+        info->sym = (do_caps ? xkb_keysym_to_upper(info->syms[0]) :
+                     info->syms[0]);
+
+    sym = key_get_one_sym_for_string(state, key, info->layout, info->level,
+                                     do_caps, do_ctrl);
+
+    info->utf32 = xkb_keysym_to_utf32(sym);
+    if (info->utf32 <= 127u && do_ctrl)
+        info->utf32 = (uint32_t) XkbToControl((char) info->utf32);
+
+    if (sym != XKB_KEY_NoSymbol)
+        return syms_to_utf8(&sym, 1, do_ctrl, buffer, size);
+
+    return syms_to_utf8(info->syms, info->num_syms, do_ctrl, buffer, size);
+}
+
 /**
  * Serialises the requested modifier state into an xkb_mod_mask_t, with all
  * the same disclaimers as in xkb_state_update_mask.
@@ -58,6 +58,15 @@ streq_not_null(const char *s1, const char *s2)
     return streq(s1, s2);
 }
 
+/* Like streq, but two NULLs are equal too. */
+static inline bool
+streq_null(const char *s1, const char *s2)
+{
+    if (!s1 || !s2)
+        return s1 == s2;
+    return streq(s1, s2);
+}
+
 static inline bool
 istreq(const char *s1, const char *s2)
 {
@@ -210,6 +219,40 @@ unmap_file(const char *str, size_t size);
 # define unlikely(x) (x)
 #endif
 
+/* Reference counts may be changed from several threads at once. */
+#if defined(__ATOMIC_ACQ_REL)
+# define refcnt_inc(refcnt) __atomic_add_fetch((refcnt), 1, __ATOMIC_RELAXED)
+# define refcnt_dec(refcnt) __atomic_sub_fetch((refcnt), 1, __ATOMIC_ACQ_REL)
+#else
+# define refcnt_inc(refcnt) __sync_add_and_fetch((refcnt), 1)
+# define refcnt_dec(refcnt) __sync_sub_and_fetch((refcnt), 1)
+#endif
+
+/* For data published to other threads without a lock. */
+#if defined(__ATOMIC_ACQ_REL)
+# define atomic_load_relaxed(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+# define atomic_load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+# define atomic_store_relaxed(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+# define atomic_store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+# define atomic_fence_acquire() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+# define atomic_fence_release() __atomic_thread_fence(__ATOMIC_RELEASE)
+# define atomic_cas(p, old, new) \
+    ({ __typeof__(*(p)) o_ = (old); \
+       __atomic_compare_exchange_n((p), &o_, (new), false, \
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE); })
+#else
+# define atomic_load_relaxed(p) (*(volatile __typeof__(*(p)) *) (p))
+# define atomic_load_acquire(p) \
+    ({ __typeof__(*(p)) v_ = atomic_load_relaxed(p); __sync_synchronize(); v_; })
+# define atomic_store_relaxed(p, v) \
+    (*(volatile __typeof__(*(p)) *) (p) = (v))
+# define atomic_store_release(p, v) \
+    do { __sync_synchronize(); atomic_store_relaxed(p, v); } while (0)
+# define atomic_fence_acquire() __sync_synchronize()
+# define atomic_fence_release() __sync_synchronize()
+# define atomic_cas(p, old, new) __sync_bool_compare_and_swap((p), (old), (new))
+#endif
+
 /* Compiler Attributes */
 
 #if defined(__GNUC__) && (__GNUC__ >= 4) && !defined(__CYGWIN__)
@@ -382,6 +382,9 @@ get_types(struct xkb_keymap *keymap, xcb_connection_t *conn,
             }
         }
 
+        if (!XkbKeyTypeUpdateEntryMap(type))
+            goto fail;
+
         xcb_xkb_key_type_next(&types_iter);
     }
 
@@ -1172,5 +1175,6 @@ xkb_x11_keymap_new_from_device(struct xkb_context *ctx,
         return NULL;
     }
 
+    XkbCompactKeymap(keymap);
     return keymap;
 }
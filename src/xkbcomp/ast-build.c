@@ -55,6 +55,146 @@
 #include "ast-build.h"
 #include "include.h"
 
+/*
+ * The arena is a list of chunks, allocated from by bumping a pointer.
+ * Large allocations get a chunk of their own.
+ */
+#define AST_ARENA_CHUNK_SIZE 4096
+#define AST_ARENA_ALIGN 8
+
+struct ast_arena_chunk {
+    struct ast_arena_chunk *next;
+    size_t size;
+    size_t used;
+    unsigned char data[];
+};
+
+struct ast_arena {
+    struct ast_arena_chunk *chunks;
+    /* The last allocation, which can be grown in place. */
+    void *last;
+};
+
+struct ast_arena *
+AstArenaNew(void)
+{
+    return calloc(1, sizeof(struct ast_arena));
+}
+
+void
+AstArenaFree(struct ast_arena *arena)
+{
+    struct ast_arena_chunk *chunk, *next;
+
+    if (!arena)
+        return;
+
+    for (chunk = arena->chunks; chunk; chunk = next) {
+        next = chunk->next;
+        free(chunk);
+    }
+    free(arena);
+}
+
+static size_t
+AstArenaOffset(struct ast_arena_chunk *chunk)
+{
+    uintptr_t addr = (uintptr_t) (chunk->data + chunk->used);
+    uintptr_t aligned = (addr + AST_ARENA_ALIGN - 1) &
+                        ~(uintptr_t) (AST_ARENA_ALIGN - 1);
+
+    return chunk->used + (aligned - addr);
+}
+
+void *
+AstArenaAlloc(struct ast_arena *arena, size_t size)
+{
+    struct ast_arena_chunk *chunk = arena->chunks;
+    size_t offset;
+
+    if (!chunk || (offset = AstArenaOffset(chunk)) + size > chunk->size) {
+        size_t chunk_size = AST_ARENA_CHUNK_SIZE - sizeof(*chunk);
+        bool large = size + AST_ARENA_ALIGN > chunk_size;
+
+        if (large)
+            chunk_size = size + AST_ARENA_ALIGN;
+
+        chunk = malloc(sizeof(*chunk) + chunk_size);
+        if (!chunk)
+            return NULL;
+
+        chunk->size = chunk_size;
+        chunk->used = 0;
+
+        /*
+         * A chunk holding a single large allocation goes behind the
+         * current one, which may still have room for small ones.
+         */
+        if (large && arena->chunks) {
+            chunk->next = arena->chunks->next;
+            arena->chunks->next = chunk;
+        }
+        else {
+            chunk->next = arena->chunks;
+            arena->chunks = chunk;
+        }
+
+        offset = AstArenaOffset(chunk);
+    }
+
+    chunk->used = offset + size;
+    if (chunk == arena->chunks)
+        arena->last = chunk->data + offset;
+    return chunk->data + offset;
+}
+
+void *
+AstArenaGrow(struct ast_arena *arena, void *ptr, size_t old_size,
+             size_t new_size)
+{
+    struct ast_arena_chunk *chunk = arena->chunks;
+    void *new;
+
+    if (ptr && ptr == arena->last &&
+        (unsigned char *) ptr + new_size <= chunk->data + chunk->size) {
+        chunk->used = (unsigned char *) ptr - chunk->data + new_size;
+        return ptr;
+    }
+
+    new = AstArenaAlloc(arena, new_size);
+    if (new && ptr)
+        memcpy(new, ptr, old_size);
+    return new;
+}
+
+char *
+AstArenaStrdup(struct ast_arena *arena, const char *s)
+{
+    size_t len;
+    char *copy;
+
+    if (!s)
+        return NULL;
+
+    len = strlen(s);
+    copy = AstArenaAlloc(arena, len + 1);
+    if (copy)
+        memcpy(copy, s, len + 1);
+    return copy;
+}
+
+/* Like darray_append(), but the storage comes from the arena. */
+#define arena_darray_append(arena, arr, val) do { \
+    if ((arr).size >= (arr).alloc) { \
+        unsigned __alloc = (arr).alloc ? (arr).alloc * 2 : 4; \
+        (arr).item = AstArenaGrow((arena), (arr).item, \
+                                  (arr).size * sizeof(*(arr).item), \
+                                  __alloc * sizeof(*(arr).item)); \
+        (arr).alloc = __alloc; \
+    } \
+    (arr).item[(arr).size++] = (val); \
+} while (0)
+
 ParseCommon *
 AppendStmt(ParseCommon *to, ParseCommon *append)
 {
@@ -70,9 +210,10 @@ AppendStmt(ParseCommon *to, ParseCommon *append)
 }
 
 static ExprDef *
-ExprCreate(enum expr_op_type op, enum expr_value_type type, size_t size)
+ExprCreate(struct ast_arena *arena, enum expr_op_type op,
+           enum expr_value_type type, size_t size)
 {
-    ExprDef *expr = malloc(size);
+    ExprDef *expr = AstArenaAlloc(arena, size);
     if (!expr)
         return NULL;
 
@@ -85,12 +226,12 @@ ExprCreate(enum expr_op_type op, enum expr_value_type type, size_t size)
 }
 
 #define EXPR_CREATE(type_, name_, op_, value_type_) \
-    ExprDef *name_ = ExprCreate(op_, value_type_, sizeof(type_)); \
+    ExprDef *name_ = ExprCreate(arena, op_, value_type_, sizeof(type_)); \
     if (!name_) \
         return NULL;
 
 ExprDef *
-ExprCreateString(xkb_atom_t str)
+ExprCreateString(struct ast_arena *arena, xkb_atom_t str)
 {
     EXPR_CREATE(ExprString, expr, EXPR_VALUE, EXPR_TYPE_STRING);
     expr->string.str = str;
@@ -98,7 +239,7 @@ ExprCreateString(xkb_atom_t str)
 }
 
 ExprDef *
-ExprCreateInteger(int ival)
+ExprCreateInteger(struct ast_arena *arena, int ival)
 {
     EXPR_CREATE(ExprInteger, expr, EXPR_VALUE, EXPR_TYPE_INT);
     expr->integer.ival = ival;
@@ -106,7 +247,7 @@ ExprCreateInteger(int ival)
 }
 
 ExprDef *
-ExprCreateBoolean(bool set)
+ExprCreateBoolean(struct ast_arena *arena, bool set)
 {
     EXPR_CREATE(ExprBoolean, expr, EXPR_VALUE, EXPR_TYPE_BOOLEAN);
     expr->boolean.set = set;
@@ -114,7 +255,7 @@ ExprCreateBoolean(bool set)
 }
 
 ExprDef *
-ExprCreateKeyName(xkb_atom_t key_name)
+ExprCreateKeyName(struct ast_arena *arena, xkb_atom_t key_name)
 {
     EXPR_CREATE(ExprKeyName, expr, EXPR_VALUE, EXPR_TYPE_KEYNAME);
     expr->key_name.key_name = key_name;
@@ -122,7 +263,7 @@ ExprCreateKeyName(xkb_atom_t key_name)
 }
 
 ExprDef *
-ExprCreateIdent(xkb_atom_t ident)
+ExprCreateIdent(struct ast_arena *arena, xkb_atom_t ident)
 {
     EXPR_CREATE(ExprIdent, expr, EXPR_IDENT, EXPR_TYPE_UNKNOWN);
     expr->ident.ident = ident;
@@ -130,8 +271,8 @@ ExprCreateIdent(xkb_atom_t ident)
 }
 
 ExprDef *
-ExprCreateUnary(enum expr_op_type op, enum expr_value_type type,
-                ExprDef *child)
+ExprCreateUnary(struct ast_arena *arena, enum expr_op_type op,
+                enum expr_value_type type, ExprDef *child)
 {
     EXPR_CREATE(ExprUnary, expr, op, type);
     expr->unary.child = child;
@@ -139,7 +280,8 @@ ExprCreateUnary(enum expr_op_type op, enum expr_value_type type,
 }
 
 ExprDef *
-ExprCreateBinary(enum expr_op_type op, ExprDef *left, ExprDef *right)
+ExprCreateBinary(struct ast_arena *arena, enum expr_op_type op,
+                 ExprDef *left, ExprDef *right)
 {
     EXPR_CREATE(ExprBinary, expr, op, EXPR_TYPE_UNKNOWN);
 
@@ -155,7 +297,8 @@ ExprCreateBinary(enum expr_op_type op, ExprDef *left, ExprDef *right)
 }
 
 ExprDef *
-ExprCreateFieldRef(xkb_atom_t element, xkb_atom_t field)
+ExprCreateFieldRef(struct ast_arena *arena, xkb_atom_t element,
+                   xkb_atom_t field)
 {
     EXPR_CREATE(ExprFieldRef, expr, EXPR_FIELD_REF, EXPR_TYPE_UNKNOWN);
     expr->field_ref.element = element;
@@ -164,7 +307,8 @@ ExprCreateFieldRef(xkb_atom_t element, xkb_atom_t field)
 }
 
 ExprDef *
-ExprCreateArrayRef(xkb_atom_t element, xkb_atom_t field, ExprDef *entry)
+ExprCreateArrayRef(struct ast_arena *arena, xkb_atom_t element,
+                   xkb_atom_t field, ExprDef *entry)
 {
     EXPR_CREATE(ExprArrayRef, expr, EXPR_ARRAY_REF, EXPR_TYPE_UNKNOWN);
     expr->array_ref.element = element;
@@ -174,7 +318,7 @@ ExprCreateArrayRef(xkb_atom_t element, xkb_atom_t field, ExprDef *entry)
 }
 
 ExprDef *
-ExprCreateAction(xkb_atom_t name, ExprDef *args)
+ExprCreateAction(struct ast_arena *arena, xkb_atom_t name, ExprDef *args)
 {
     EXPR_CREATE(ExprAction, expr, EXPR_ACTION_DECL, EXPR_TYPE_UNKNOWN);
     expr->action.name = name;
@@ -183,7 +327,7 @@ ExprCreateAction(xkb_atom_t name, ExprDef *args)
 }
 
 ExprDef *
-ExprCreateKeysymList(xkb_keysym_t sym)
+ExprCreateKeysymList(struct ast_arena *arena, xkb_keysym_t sym)
 {
     EXPR_CREATE(ExprKeysymList, expr, EXPR_KEYSYM_LIST, EXPR_TYPE_SYMBOLS);
 
@@ -191,20 +335,21 @@ ExprCreateKeysymList(xkb_keysym_t sym)
     darray_init(expr->keysym_list.symsMapIndex);
     darray_init(expr->keysym_list.symsNumEntries);
 
-    darray_append(expr->keysym_list.syms, sym);
-    darray_append(expr->keysym_list.symsMapIndex, 0);
-    darray_append(expr->keysym_list.symsNumEntries, 1);
+    arena_darray_append(arena, expr->keysym_list.syms, sym);
+    arena_darray_append(arena, expr->keysym_list.symsMapIndex, 0);
+    arena_darray_append(arena, expr->keysym_list.symsNumEntries, 1);
 
     return expr;
 }
 
 ExprDef *
-ExprCreateMultiKeysymList(ExprDef *expr)
+ExprCreateMultiKeysymList(struct ast_arena *arena, ExprDef *expr)
 {
     unsigned nLevels = darray_size(expr->keysym_list.symsMapIndex);
 
-    darray_resize(expr->keysym_list.symsMapIndex, 1);
-    darray_resize(expr->keysym_list.symsNumEntries, 1);
+    /* Shrinking never needs to reallocate. */
+    darray_size(expr->keysym_list.symsMapIndex) = 1;
+    darray_size(expr->keysym_list.symsNumEntries) = 1;
     darray_item(expr->keysym_list.symsMapIndex, 0) = 0;
     darray_item(expr->keysym_list.symsNumEntries, 0) = nLevels;
 
@@ -212,38 +357,37 @@ ExprCreateMultiKeysymList(ExprDef *expr)
 }
 
 ExprDef *
-ExprAppendKeysymList(ExprDef *expr, xkb_keysym_t sym)
+ExprAppendKeysymList(struct ast_arena *arena, ExprDef *expr, xkb_keysym_t sym)
 {
     unsigned nSyms = darray_size(expr->keysym_list.syms);
 
-    darray_append(expr->keysym_list.symsMapIndex, nSyms);
-    darray_append(expr->keysym_list.symsNumEntries, 1);
-    darray_append(expr->keysym_list.syms, sym);
+    arena_darray_append(arena, expr->keysym_list.symsMapIndex, nSyms);
+    arena_darray_append(arena, expr->keysym_list.symsNumEntries, 1);
+    arena_darray_append(arena, expr->keysym_list.syms, sym);
 
     return expr;
 }
 
 ExprDef *
-ExprAppendMultiKeysymList(ExprDef *expr, ExprDef *append)
+ExprAppendMultiKeysymList(struct ast_arena *arena, ExprDef *expr,
+                          ExprDef *append)
 {
-    xkb_keysym_t *syms;
+    xkb_keysym_t *sym;
     unsigned nSyms = darray_size(expr->keysym_list.syms);
     unsigned numEntries = darray_size(append->keysym_list.syms);
 
-    darray_append(expr->keysym_list.symsMapIndex, nSyms);
-    darray_append(expr->keysym_list.symsNumEntries, numEntries);
-    darray_steal(append->keysym_list.syms, &syms, NULL);
-    darray_append_items(expr->keysym_list.syms, syms, numEntries);
-
-    FreeStmt((ParseCommon *) &append);
+    arena_darray_append(arena, expr->keysym_list.symsMapIndex, nSyms);
+    arena_darray_append(arena, expr->keysym_list.symsNumEntries, numEntries);
+    darray_foreach(sym, append->keysym_list.syms)
+        arena_darray_append(arena, expr->keysym_list.syms, *sym);
 
     return expr;
 }
 
 KeycodeDef *
-KeycodeCreate(xkb_atom_t name, int64_t value)
+KeycodeCreate(struct ast_arena *arena, xkb_atom_t name, int64_t value)
 {
-    KeycodeDef *def = malloc(sizeof(*def));
+    KeycodeDef *def = AstArenaAlloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -256,9 +400,9 @@ KeycodeCreate(xkb_atom_t name, int64_t value)
 }
 
 KeyAliasDef *
-KeyAliasCreate(xkb_atom_t alias, xkb_atom_t real)
+KeyAliasCreate(struct ast_arena *arena, xkb_atom_t alias, xkb_atom_t real)
 {
-    KeyAliasDef *def = malloc(sizeof(*def));
+    KeyAliasDef *def = AstArenaAlloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -271,9 +415,9 @@ KeyAliasCreate(xkb_atom_t alias, xkb_atom_t real)
 }
 
 VModDef *
-VModCreate(xkb_atom_t name, ExprDef *value)
+VModCreate(struct ast_arena *arena, xkb_atom_t name, ExprDef *value)
 {
-    VModDef *def = malloc(sizeof(*def));
+    VModDef *def = AstArenaAlloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -286,9 +430,9 @@ VModCreate(xkb_atom_t name, ExprDef *value)
 }
 
 VarDef *
-VarCreate(ExprDef *name, ExprDef *value)
+VarCreate(struct ast_arena *arena, ExprDef *name, ExprDef *value)
 {
-    VarDef *def = malloc(sizeof(*def));
+    VarDef *def = AstArenaAlloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -301,23 +445,22 @@ VarCreate(ExprDef *name, ExprDef *value)
 }
 
 VarDef *
-BoolVarCreate(xkb_atom_t ident, bool set)
+BoolVarCreate(struct ast_arena *arena, xkb_atom_t ident, bool set)
 {
     ExprDef *name, *value;
-    if (!(name = ExprCreateIdent(ident))) {
+    if (!(name = ExprCreateIdent(arena, ident))) {
         return NULL;
     }
-    if (!(value = ExprCreateBoolean(set))) {
-        FreeStmt((ParseCommon *) name);
+    if (!(value = ExprCreateBoolean(arena, set))) {
         return NULL;
     }
-    return VarCreate(name, value);
+    return VarCreate(arena, name, value);
 }
 
 InterpDef *
-InterpCreate(xkb_keysym_t sym, ExprDef *match)
+InterpCreate(struct ast_arena *arena, xkb_keysym_t sym, ExprDef *match)
 {
-    InterpDef *def = malloc(sizeof(*def));
+    InterpDef *def = AstArenaAlloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -331,9 +474,9 @@ InterpCreate(xkb_keysym_t sym, ExprDef *match)
 }
 
 KeyTypeDef *
-KeyTypeCreate(xkb_atom_t name, VarDef *body)
+KeyTypeCreate(struct ast_arena *arena, xkb_atom_t name, VarDef *body)
 {
-    KeyTypeDef *def = malloc(sizeof(*def));
+    KeyTypeDef *def = AstArenaAlloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -347,9 +490,9 @@ KeyTypeCreate(xkb_atom_t name, VarDef *body)
 }
 
 SymbolsDef *
-SymbolsCreate(xkb_atom_t keyName, VarDef *symbols)
+SymbolsCreate(struct ast_arena *arena, xkb_atom_t keyName, VarDef *symbols)
 {
-    SymbolsDef *def = malloc(sizeof(*def));
+    SymbolsDef *def = AstArenaAlloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -363,9 +506,9 @@ SymbolsCreate(xkb_atom_t keyName, VarDef *symbols)
 }
 
 GroupCompatDef *
-GroupCompatCreate(unsigned group, ExprDef *val)
+GroupCompatCreate(struct ast_arena *arena, unsigned group, ExprDef *val)
 {
-    GroupCompatDef *def = malloc(sizeof(*def));
+    GroupCompatDef *def = AstArenaAlloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -379,9 +522,9 @@ GroupCompatCreate(unsigned group, ExprDef *val)
 }
 
 ModMapDef *
-ModMapCreate(xkb_atom_t modifier, ExprDef *keys)
+ModMapCreate(struct ast_arena *arena, xkb_atom_t modifier, ExprDef *keys)
 {
-    ModMapDef *def = malloc(sizeof(*def));
+    ModMapDef *def = AstArenaAlloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -395,9 +538,9 @@ ModMapCreate(xkb_atom_t modifier, ExprDef *keys)
 }
 
 LedMapDef *
-LedMapCreate(xkb_atom_t name, VarDef *body)
+LedMapCreate(struct ast_arena *arena, xkb_atom_t name, VarDef *body)
 {
-    LedMapDef *def = malloc(sizeof(*def));
+    LedMapDef *def = AstArenaAlloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -411,9 +554,10 @@ LedMapCreate(xkb_atom_t name, VarDef *body)
 }
 
 LedNameDef *
-LedNameCreate(unsigned ndx, ExprDef *name, bool virtual)
+LedNameCreate(struct ast_arena *arena, unsigned ndx, ExprDef *name,
+              bool virtual)
 {
-    LedNameDef *def = malloc(sizeof(*def));
+    LedNameDef *def = AstArenaAlloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -427,22 +571,21 @@ LedNameCreate(unsigned ndx, ExprDef *name, bool virtual)
     return def;
 }
 
-static void
-FreeInclude(IncludeStmt *incl);
-
 IncludeStmt *
-IncludeCreate(struct xkb_context *ctx, char *str, enum merge_mode merge)
+IncludeCreate(struct ast_arena *arena, struct xkb_context *ctx, char *str,
+              enum merge_mode merge)
 {
     IncludeStmt *incl, *first;
     char *file, *map, *stmt, *tmp, *extra_data;
     char nextop;
 
     incl = first = NULL;
-    file = map = NULL;
     tmp = str;
-    stmt = strdup_safe(str);
+    /* ParseIncludeMap() cuts up the string as it goes. */
+    stmt = AstArenaStrdup(arena, str);
     while (tmp && *tmp)
     {
+        file = map = extra_data = NULL;
         if (!ParseIncludeMap(&tmp, &file, &map, &nextop, &extra_data))
             goto err;
 
@@ -460,9 +603,9 @@ IncludeCreate(struct xkb_context *ctx, char *str, enum merge_mode merge)
         }
 
         if (first == NULL) {
-            first = incl = malloc(sizeof(*first));
+            first = incl = AstArenaAlloc(arena, sizeof(*first));
         } else {
-            incl->next_incl = malloc(sizeof(*first));
+            incl->next_incl = AstArenaAlloc(arena, sizeof(*first));
             incl = incl->next_incl;
         }
 
@@ -470,6 +613,9 @@ IncludeCreate(struct xkb_context *ctx, char *str, enum merge_mode merge)
             log_wsgo(ctx,
                      "Allocation failure in IncludeCreate; "
                      "Using only part of the include\n");
+            free(file);
+            free(map);
+            free(extra_data);
             break;
         }
 
@@ -477,10 +623,13 @@ IncludeCreate(struct xkb_context *ctx, char *str, enum merge_mode merge)
         incl->common.next = NULL;
         incl->merge = merge;
         incl->stmt = NULL;
-        incl->file = file;
-        incl->map = map;
-        incl->modifier = extra_data;
+        incl->file = AstArenaStrdup(arena, file);
+        incl->map = AstArenaStrdup(arena, map);
+        incl->modifier = AstArenaStrdup(arena, extra_data);
         incl->next_incl = NULL;
+        free(file);
+        free(map);
+        free(extra_data);
 
         if (nextop == '|')
             merge = MERGE_AUGMENT;
@@ -490,34 +639,36 @@ IncludeCreate(struct xkb_context *ctx, char *str, enum merge_mode merge)
 
     if (first)
         first->stmt = stmt;
-    else
-        free(stmt);
 
     return first;
 
 err:
     log_err(ctx, "Illegal include statement \"%s\"; Ignored\n", stmt);
-    FreeInclude(first);
-    free(stmt);
     return NULL;
 }
 
 XkbFile *
-XkbFileCreate(enum xkb_file_type type, char *name, ParseCommon *defs,
-              enum xkb_map_flags flags)
+XkbFileCreate(struct ast_arena *arena, enum xkb_file_type type, char *name,
+              ParseCommon *defs, enum xkb_map_flags flags)
 {
     XkbFile *file;
 
-    file = calloc(1, sizeof(*file));
-    if (!file)
+    file = AstArenaAlloc(arena, sizeof(*file));
+    if (!file) {
+        free(name);
         return NULL;
+    }
 
     XkbEscapeMapName(name);
+    file->common.type = STMT_UNKNOWN;
+    file->common.next = NULL;
     file->file_type = type;
-    file->topName = strdup_safe(name);
-    file->name = name;
+    file->name = AstArenaStrdup(arena, name);
+    file->topName = file->name;
     file->defs = defs;
     file->flags = flags;
+    file->arena = NULL;
+    free(name);
 
     return file;
 }
@@ -534,181 +685,42 @@ XkbFileFromComponents(struct xkb_context *ctx,
     IncludeStmt *include = NULL;
     XkbFile *file = NULL;
     ParseCommon *defs = NULL;
+    struct ast_arena *arena;
+
+    arena = AstArenaNew();
+    if (!arena)
+        return NULL;
 
     for (type = FIRST_KEYMAP_FILE_TYPE; type <= LAST_KEYMAP_FILE_TYPE; type++) {
-        include = IncludeCreate(ctx, components[type], MERGE_DEFAULT);
+        include = IncludeCreate(arena, ctx, components[type], MERGE_DEFAULT);
         if (!include)
             goto err;
 
-        file = XkbFileCreate(type, NULL, (ParseCommon *) include, 0);
-        if (!file) {
-            FreeInclude(include);
+        file = XkbFileCreate(arena, type, NULL, (ParseCommon *) include, 0);
+        if (!file)
             goto err;
-        }
 
         defs = AppendStmt(defs, &file->common);
     }
 
-    file = XkbFileCreate(FILE_TYPE_KEYMAP, NULL, defs, 0);
+    file = XkbFileCreate(arena, FILE_TYPE_KEYMAP, NULL, defs, 0);
     if (!file)
         goto err;
 
+    file->arena = arena;
     return file;
 
 err:
-    FreeXkbFile((XkbFile *) defs);
+    AstArenaFree(arena);
     return NULL;
 }
 
-static void
-FreeExpr(ExprDef *expr)
-{
-    if (!expr)
-        return;
-
-    switch (expr->expr.op) {
-    case EXPR_ACTION_LIST:
-    case EXPR_NEGATE:
-    case EXPR_UNARY_PLUS:
-    case EXPR_NOT:
-    case EXPR_INVERT:
-        FreeStmt((ParseCommon *) expr->unary.child);
-        break;
-
-    case EXPR_DIVIDE:
-    case EXPR_ADD:
-    case EXPR_SUBTRACT:
-    case EXPR_MULTIPLY:
-    case EXPR_ASSIGN:
-        FreeStmt((ParseCommon *) expr->binary.left);
-        FreeStmt((ParseCommon *) expr->binary.right);
-        break;
-
-    case EXPR_ACTION_DECL:
-        FreeStmt((ParseCommon *) expr->action.args);
-        break;
-
-    case EXPR_ARRAY_REF:
-        FreeStmt((ParseCommon *) expr->array_ref.entry);
-        break;
-
-    case EXPR_KEYSYM_LIST:
-        darray_free(expr->keysym_list.syms);
-        darray_free(expr->keysym_list.symsMapIndex);
-        darray_free(expr->keysym_list.symsNumEntries);
-        break;
-
-    default:
-        break;
-    }
-}
-
-static void
-FreeInclude(IncludeStmt *incl)
-{
-    IncludeStmt *next;
-
-    while (incl)
-    {
-        next = incl->next_incl;
-
-        free(incl->file);
-        free(incl->map);
-        free(incl->modifier);
-        free(incl->stmt);
-
-        free(incl);
-        incl = next;
-    }
-}
-
-void
-FreeStmt(ParseCommon *stmt)
-{
-    ParseCommon *next;
-
-    while (stmt)
-    {
-        next = stmt->next;
-
-        switch (stmt->type) {
-        case STMT_INCLUDE:
-            FreeInclude((IncludeStmt *) stmt);
-            /* stmt is already free'd here. */
-            stmt = NULL;
-            break;
-        case STMT_EXPR:
-            FreeExpr((ExprDef *) stmt);
-            break;
-        case STMT_VAR:
-            FreeStmt((ParseCommon *) ((VarDef *) stmt)->name);
-            FreeStmt((ParseCommon *) ((VarDef *) stmt)->value);
-            break;
-        case STMT_TYPE:
-            FreeStmt((ParseCommon *) ((KeyTypeDef *) stmt)->body);
-            break;
-        case STMT_INTERP:
-            FreeStmt((ParseCommon *) ((InterpDef *) stmt)->match);
-            FreeStmt((ParseCommon *) ((InterpDef *) stmt)->def);
-            break;
-        case STMT_VMOD:
-            FreeStmt((ParseCommon *) ((VModDef *) stmt)->value);
-            break;
-        case STMT_SYMBOLS:
-            FreeStmt((ParseCommon *) ((SymbolsDef *) stmt)->symbols);
-            break;
-        case STMT_MODMAP:
-            FreeStmt((ParseCommon *) ((ModMapDef *) stmt)->keys);
-            break;
-        case STMT_GROUP_COMPAT:
-            FreeStmt((ParseCommon *) ((GroupCompatDef *) stmt)->def);
-            break;
-        case STMT_LED_MAP:
-            FreeStmt((ParseCommon *) ((LedMapDef *) stmt)->body);
-            break;
-        case STMT_LED_NAME:
-            FreeStmt((ParseCommon *) ((LedNameDef *) stmt)->name);
-            break;
-        default:
-            break;
-        }
-
-        free(stmt);
-        stmt = next;
-    }
-}
-
 void
 FreeXkbFile(XkbFile *file)
 {
-    XkbFile *next;
-
-    while (file)
-    {
-        next = (XkbFile *) file->common.next;
-
-        switch (file->file_type) {
-        case FILE_TYPE_KEYMAP:
-            FreeXkbFile((XkbFile *) file->defs);
-            break;
-
-        case FILE_TYPE_TYPES:
-        case FILE_TYPE_COMPAT:
-        case FILE_TYPE_SYMBOLS:
-        case FILE_TYPE_KEYCODES:
-        case FILE_TYPE_GEOMETRY:
-            FreeStmt(file->defs);
-            break;
-
-        default:
-            break;
-        }
-
-        free(file->name);
-        free(file->topName);
-        free(file);
-        file = next;
-    }
+    /* Everything, including the file itself, lives in the arena. */
+    if (file)
+        AstArenaFree(file->arena);
 }
 
 static const char *xkb_file_type_strings[_FILE_TYPE_NUM_ENTRIES] = {
@@ -27,96 +27,115 @@
 #ifndef XKBCOMP_AST_BUILD_H
 #define XKBCOMP_AST_BUILD_H
 
+struct ast_arena *
+AstArenaNew(void);
+
+void
+AstArenaFree(struct ast_arena *arena);
+
+void *
+AstArenaAlloc(struct ast_arena *arena, size_t size);
+
+void *
+AstArenaGrow(struct ast_arena *arena, void *ptr, size_t old_size,
+             size_t new_size);
+
+char *
+AstArenaStrdup(struct ast_arena *arena, const char *s);
+
 ParseCommon *
 AppendStmt(ParseCommon *to, ParseCommon *append);
 
 ExprDef *
-ExprCreateString(xkb_atom_t str);
+ExprCreateString(struct ast_arena *arena, xkb_atom_t str);
 
 ExprDef *
-ExprCreateInteger(int ival);
+ExprCreateInteger(struct ast_arena *arena, int ival);
 
 ExprDef *
-ExprCreateBoolean(bool set);
+ExprCreateBoolean(struct ast_arena *arena, bool set);
 
 ExprDef *
-ExprCreateKeyName(xkb_atom_t key_name);
+ExprCreateKeyName(struct ast_arena *arena, xkb_atom_t key_name);
 
 ExprDef *
-ExprCreateIdent(xkb_atom_t ident);
+ExprCreateIdent(struct ast_arena *arena, xkb_atom_t ident);
 
 ExprDef *
-ExprCreateUnary(enum expr_op_type op, enum expr_value_type type,
-                ExprDef *child);
+ExprCreateUnary(struct ast_arena *arena, enum expr_op_type op,
+                enum expr_value_type type, ExprDef *child);
 
 ExprDef *
-ExprCreateBinary(enum expr_op_type op, ExprDef *left, ExprDef *right);
+ExprCreateBinary(struct ast_arena *arena, enum expr_op_type op,
+                 ExprDef *left, ExprDef *right);
 
 ExprDef *
-ExprCreateFieldRef(xkb_atom_t element, xkb_atom_t field);
+ExprCreateFieldRef(struct ast_arena *arena, xkb_atom_t element,
+                   xkb_atom_t field);
 
 ExprDef *
-ExprCreateArrayRef(xkb_atom_t element, xkb_atom_t field, ExprDef *entry);
+ExprCreateArrayRef(struct ast_arena *arena, xkb_atom_t element,
+                   xkb_atom_t field, ExprDef *entry);
 
 ExprDef *
-ExprCreateAction(xkb_atom_t name, ExprDef *args);
+ExprCreateAction(struct ast_arena *arena, xkb_atom_t name, ExprDef *args);
 
 ExprDef *
-ExprCreateMultiKeysymList(ExprDef *list);
+ExprCreateMultiKeysymList(struct ast_arena *arena, ExprDef *list);
 
 ExprDef *
-ExprCreateKeysymList(xkb_keysym_t sym);
+ExprCreateKeysymList(struct ast_arena *arena, xkb_keysym_t sym);
 
 ExprDef *
-ExprAppendMultiKeysymList(ExprDef *list, ExprDef *append);
+ExprAppendMultiKeysymList(struct ast_arena *arena, ExprDef *list,
+                          ExprDef *append);
 
 ExprDef *
-ExprAppendKeysymList(ExprDef *list, xkb_keysym_t sym);
+ExprAppendKeysymList(struct ast_arena *arena, ExprDef *list, xkb_keysym_t sym);
 
 KeycodeDef *
-KeycodeCreate(xkb_atom_t name, int64_t value);
+KeycodeCreate(struct ast_arena *arena, xkb_atom_t name, int64_t value);
 
 KeyAliasDef *
-KeyAliasCreate(xkb_atom_t alias, xkb_atom_t real);
+KeyAliasCreate(struct ast_arena *arena, xkb_atom_t alias, xkb_atom_t real);
 
 VModDef *
-VModCreate(xkb_atom_t name, ExprDef *value);
+VModCreate(struct ast_arena *arena, xkb_atom_t name, ExprDef *value);
 
 VarDef *
-VarCreate(ExprDef *name, ExprDef *value);
+VarCreate(struct ast_arena *arena, ExprDef *name, ExprDef *value);
 
 VarDef *
-BoolVarCreate(xkb_atom_t ident, bool set);
+BoolVarCreate(struct ast_arena *arena, xkb_atom_t ident, bool set);
 
 InterpDef *
-InterpCreate(xkb_keysym_t sym, ExprDef *match);
+InterpCreate(struct ast_arena *arena, xkb_keysym_t sym, ExprDef *match);
 
 KeyTypeDef *
-KeyTypeCreate(xkb_atom_t name, VarDef *body);
+KeyTypeCreate(struct ast_arena *arena, xkb_atom_t name, VarDef *body);
 
 SymbolsDef *
-SymbolsCreate(xkb_atom_t keyName, VarDef *symbols);
+SymbolsCreate(struct ast_arena *arena, xkb_atom_t keyName, VarDef *symbols);
 
 GroupCompatDef *
-GroupCompatCreate(unsigned group, ExprDef *def);
+GroupCompatCreate(struct ast_arena *arena, unsigned group, ExprDef *def);
 
 ModMapDef *
-ModMapCreate(xkb_atom_t modifier, ExprDef *keys);
+ModMapCreate(struct ast_arena *arena, xkb_atom_t modifier, ExprDef *keys);
 
 LedMapDef *
-LedMapCreate(xkb_atom_t name, VarDef *body);
+LedMapCreate(struct ast_arena *arena, xkb_atom_t name, VarDef *body);
 
 LedNameDef *
-LedNameCreate(unsigned ndx, ExprDef *name, bool virtual);
+LedNameCreate(struct ast_arena *arena, unsigned ndx, ExprDef *name,
+              bool virtual);
 
 IncludeStmt *
-IncludeCreate(struct xkb_context *ctx, char *str, enum merge_mode merge);
+IncludeCreate(struct ast_arena *arena, struct xkb_context *ctx, char *str,
+              enum merge_mode merge);
 
 XkbFile *
-XkbFileCreate(enum xkb_file_type type, char *name, ParseCommon *defs,
-              enum xkb_map_flags flags);
-
-void
-FreeStmt(ParseCommon *stmt);
+XkbFileCreate(struct ast_arena *arena, enum xkb_file_type type, char *name,
+              ParseCommon *defs, enum xkb_map_flags flags);
 
 #endif
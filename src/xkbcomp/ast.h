@@ -143,6 +143,13 @@ expr_op_type_to_string(enum expr_op_type type);
 const char *
 expr_value_type_to_string(enum expr_value_type type);
 
+/*
+ * All of the nodes of a parsed file, and the strings they point to, are
+ * allocated from an arena owned by the top-level XkbFile. The whole tree
+ * is released at once by FreeXkbFile().
+ */
+struct ast_arena;
+
 typedef struct _ParseCommon  {
     struct _ParseCommon *next;
     enum stmt_type type;
@@ -338,10 +345,12 @@ enum xkb_map_flags {
 typedef struct {
     ParseCommon common;
     enum xkb_file_type file_type;
-    char *topName;
+    const char *topName;
     char *name;
     ParseCommon *defs;
     enum xkb_map_flags flags;
+    /* Only set in the top-level file, which owns the arena. */
+    struct ast_arena *arena;
 } XkbFile;
 
 #endif
@@ -50,6 +50,8 @@
 #include <errno.h>
 #include <limits.h>
 #include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include "xkbcomp-priv.h"
 #include "include.h"
@@ -193,17 +195,221 @@ DirectoryForInclude(enum xkb_file_type type)
     return xkb_file_type_include_dirs[type];
 }
 
-FILE *
-FindFileInXkbPath(struct xkb_context *ctx, const char *name,
-                  enum xkb_file_type type, char **pathRtrn)
+static void
+file_stamp_from_stat(struct file_stamp *stamp, const struct stat *st)
+{
+    stamp->dev = st->st_dev;
+    stamp->ino = st->st_ino;
+    stamp->mtime = st->st_mtime;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+    stamp->mtime_nsec = st->st_mtim.tv_nsec;
+#else
+    stamp->mtime_nsec = 0;
+#endif
+    stamp->size = st->st_size;
+}
+
+bool
+file_stamp_get(struct file_stamp *stamp, FILE *file)
+{
+    struct stat st;
+
+    if (fstat(fileno(file), &st) != 0)
+        return false;
+
+    file_stamp_from_stat(stamp, &st);
+    return true;
+}
+
+bool
+file_stamp_eq(const struct file_stamp *a, const struct file_stamp *b)
+{
+    return a->dev == b->dev && a->ino == b->ino &&
+           a->mtime == b->mtime && a->mtime_nsec == b->mtime_nsec &&
+           a->size == b->size;
+}
+
+/*
+ * Where a file was found in the include path (or that it wasn't) is
+ * remembered in the context, so that each include statement does not need
+ * to try opening the file in every include directory. The directories
+ * which were searched are recorded together with their modification time;
+ * if any of them changed, e.g. because a file was added or removed, the
+ * whole index is thrown away. This is checked by RefreshIncludeCaches()
+ * before every compilation.
+ */
+struct include_index_entry {
+    enum xkb_file_type type;
+    char *name;
+    /* NULL if the file was not found. */
+    char *path;
+};
+
+struct include_index_dir {
+    char *path;
+    bool exists;
+    struct file_stamp stamp;
+};
+
+static void
+include_index_dir_stat(struct include_index_dir *dir)
+{
+    struct stat st;
+
+    dir->exists = (stat(dir->path, &st) == 0);
+    if (dir->exists)
+        file_stamp_from_stat(&dir->stamp, &st);
+    else
+        memset(&dir->stamp, 0, sizeof(dir->stamp));
+}
+
+/*
+ * Record that the directory made of the first @len characters of @path
+ * was searched, so that the index is invalidated if it changes.
+ */
+static void
+include_index_watch_dir(struct xkb_context *ctx, const char *path,
+                        size_t len)
+{
+    struct include_index_dir *dir;
+    struct include_index_dir new;
+
+    darray_foreach(dir, ctx->include_index_dirs)
+        if (strncmp(dir->path, path, len) == 0 && dir->path[len] == '\0')
+            return;
+
+    new.path = strndup(path, len);
+    if (!new.path)
+        return;
+
+    include_index_dir_stat(&new);
+    darray_append(ctx->include_index_dirs, new);
+}
+
+static void
+include_index_add(struct xkb_context *ctx, enum xkb_file_type type,
+                  const char *name, const char *path)
+{
+    struct include_index_entry entry = { type, NULL, NULL };
+
+    entry.name = strdup(name);
+    entry.path = strdup_safe(path);
+    if (!entry.name || (path && !entry.path)) {
+        free(entry.name);
+        free(entry.path);
+        return;
+    }
+
+    darray_append(ctx->include_index, entry);
+}
+
+static struct include_index_entry *
+include_index_lookup(struct xkb_context *ctx, enum xkb_file_type type,
+                     const char *name)
+{
+    struct include_index_entry *entry;
+
+    darray_foreach(entry, ctx->include_index)
+        if (entry->type == type && streq(entry->name, name))
+            return entry;
+
+    return NULL;
+}
+
+void
+xkb_context_include_index_clear(struct xkb_context *ctx)
+{
+    struct include_index_entry *entry;
+    struct include_index_dir *dir;
+
+    darray_foreach(entry, ctx->include_index) {
+        free(entry->name);
+        free(entry->path);
+    }
+    darray_free(ctx->include_index);
+
+    darray_foreach(dir, ctx->include_index_dirs)
+        free(dir->path);
+    darray_free(ctx->include_index_dirs);
+}
+
+static void
+RevalidateIncludeIndex(struct xkb_context *ctx)
+{
+    struct include_index_dir *dir;
+
+    darray_foreach(dir, ctx->include_index_dirs) {
+        struct include_index_dir now = { dir->path };
+
+        include_index_dir_stat(&now);
+        if (now.exists != dir->exists ||
+            !file_stamp_eq(&now.stamp, &dir->stamp)) {
+            xkb_context_include_index_clear(ctx);
+            return;
+        }
+    }
+}
+
+static void
+LogFileNotFound(struct xkb_context *ctx, const char *typeDir,
+                const char *name)
+{
+    unsigned int i;
+
+    log_err(ctx, "Couldn't find file \"%s/%s\" in include paths\n",
+            typeDir, name);
+
+    if (xkb_context_num_include_paths(ctx) > 0) {
+        log_err(ctx, "%d include paths searched:\n",
+                xkb_context_num_include_paths(ctx));
+        for (i = 0; i < xkb_context_num_include_paths(ctx); i++)
+            log_err(ctx, "\t%s\n",
+                    xkb_context_include_path_get(ctx, i));
+    }
+    else {
+        log_err(ctx, "There are no include paths to search\n");
+    }
+
+    if (xkb_context_num_failed_include_paths(ctx) > 0) {
+        log_err(ctx, "%d include paths could not be added:\n",
+                xkb_context_num_failed_include_paths(ctx));
+        for (i = 0; i < xkb_context_num_failed_include_paths(ctx); i++)
+            log_err(ctx, "\t%s\n",
+                    xkb_context_failed_include_path_get(ctx, i));
+    }
+}
+
+static FILE *
+find_file(struct xkb_context *ctx, const char *name,
+          enum xkb_file_type type, char **pathRtrn, bool log_not_found)
 {
     unsigned int i;
     FILE *file = NULL;
     char *buf = NULL;
     const char *typeDir;
     size_t buf_size = 0, typeDirLen, name_len;
+    struct include_index_entry *entry;
+    const char *slash;
 
     typeDir = DirectoryForInclude(type);
+
+    entry = include_index_lookup(ctx, type, name);
+    if (entry && !entry->path) {
+        if (log_not_found)
+            LogFileNotFound(ctx, typeDir, name);
+        return NULL;
+    }
+    if (entry) {
+        file = fopen(entry->path, "r");
+        if (file) {
+            if (pathRtrn)
+                *pathRtrn = strdup(entry->path);
+            return file;
+        }
+        /* Gone without the directory noticeably changing; search again. */
+        xkb_context_include_index_clear(ctx);
+    }
+
     typeDirLen = strlen(typeDir);
     name_len = strlen(name);
 
@@ -231,34 +437,21 @@ FindFileInXkbPath(struct xkb_context *ctx, const char *name,
             continue;
         }
 
+        /* The name may contain subdirectories; watch them all. */
+        slash = buf + ret - name_len - 1;
+        for (; slash; slash = strchr(slash + 1, '/'))
+            include_index_watch_dir(ctx, buf, slash - buf);
+
         file = fopen(buf, "r");
         if (file)
             break;
     }
 
-    if (!file) {
-        log_err(ctx, "Couldn't find file \"%s/%s\" in include paths\n",
-                typeDir, name);
-
-        if (xkb_context_num_include_paths(ctx) > 0) {
-            log_err(ctx, "%d include paths searched:\n",
-                    xkb_context_num_include_paths(ctx));
-            for (i = 0; i < xkb_context_num_include_paths(ctx); i++)
-                log_err(ctx, "\t%s\n",
-                        xkb_context_include_path_get(ctx, i));
-        }
-        else {
-            log_err(ctx, "There are no include paths to search\n");
-        }
-
-        if (xkb_context_num_failed_include_paths(ctx) > 0) {
-            log_err(ctx, "%d include paths could not be added:\n",
-                    xkb_context_num_failed_include_paths(ctx));
-            for (i = 0; i < xkb_context_num_failed_include_paths(ctx); i++)
-                log_err(ctx, "\t%s\n",
-                        xkb_context_failed_include_path_get(ctx, i));
-        }
+    include_index_add(ctx, type, name, file ? buf : NULL);
 
+    if (!file) {
+        if (log_not_found)
+            LogFileNotFound(ctx, typeDir, name);
         free(buf);
         return NULL;
     }
@@ -270,19 +463,212 @@ FindFileInXkbPath(struct xkb_context *ctx, const char *name,
     return file;
 }
 
-XkbFile *
-ProcessIncludeFile(struct xkb_context *ctx, IncludeStmt *stmt,
-                   enum xkb_file_type file_type)
+FILE *
+FindFileInXkbPath(struct xkb_context *ctx, const char *name,
+                  enum xkb_file_type type, char **pathRtrn)
 {
     FILE *file;
-    XkbFile *xkb_file;
 
-    file = FindFileInXkbPath(ctx, stmt->file, file_type, NULL);
-    if (!file)
+    xkb_context_lock(ctx, &ctx->include_lock);
+    file = find_file(ctx, name, type, pathRtrn, true);
+    xkb_context_unlock(ctx, &ctx->include_lock);
+    return file;
+}
+
+/*
+ * Parsed include files are kept in the context, so that files included
+ * many times (e.g. symbols/pc, or the same layout with another variant)
+ * are only parsed once. An entry is valid as long as the file it was
+ * parsed from has not changed on disk; a changed file gets a new entry,
+ * and the old one is only marked stale, because it might still be in use
+ * further up the include chain. Stale entries are freed by
+ * RefreshIncludeCaches() once no compilation is using the cache, see
+ * HoldIncludeCache(). Files which
+ * failed to parse are remembered too (with a NULL file), so that their
+ * errors are only reported once.
+ */
+struct include_cache_entry {
+    char *path;
+    char *map;
+    struct file_stamp stamp;
+    bool stale;
+    XkbFile *file;
+};
+
+static void
+include_cache_entry_free(struct include_cache_entry *entry)
+{
+    free(entry->path);
+    free(entry->map);
+    FreeXkbFile(entry->file);
+}
+
+/*
+ * Returns whether @path and @map are in the cache; if so, @file_out is
+ * set to the parsed file, or NULL if it could not be parsed.
+ */
+static bool
+include_cache_lookup(struct xkb_context *ctx, const char *path,
+                     const char *map, const struct file_stamp *stamp,
+                     XkbFile **file_out)
+{
+    struct include_cache_entry *entry;
+
+    darray_foreach(entry, ctx->include_cache) {
+        if (entry->stale || !streq(entry->path, path) ||
+            !streq_null(entry->map, map))
+            continue;
+
+        if (file_stamp_eq(&entry->stamp, stamp)) {
+            *file_out = entry->file;
+            return true;
+        }
+
+        entry->stale = true;
+        break;
+    }
+
+    return false;
+}
+
+static bool
+include_cache_add(struct xkb_context *ctx, const char *path, const char *map,
+                  const struct file_stamp *stamp, XkbFile *file)
+{
+    struct include_cache_entry entry = {
+        .stamp = *stamp,
+        .file = file,
+    };
+
+    entry.path = strdup(path);
+    entry.map = strdup_safe(map);
+    if (!entry.path || (map && !entry.map)) {
+        free(entry.path);
+        free(entry.map);
         return false;
+    }
+
+    darray_append(ctx->include_cache, entry);
+    return true;
+}
+
+static void
+PruneIncludeCache(struct xkb_context *ctx)
+{
+    unsigned i = 0;
+
+    while (i < darray_size(ctx->include_cache)) {
+        struct include_cache_entry *entry = &darray_item(ctx->include_cache, i);
+
+        if (!entry->stale) {
+            i++;
+            continue;
+        }
+
+        include_cache_entry_free(entry);
+        *entry = darray_item(ctx->include_cache,
+                             darray_size(ctx->include_cache) - 1);
+        darray_resize(ctx->include_cache, darray_size(ctx->include_cache) - 1);
+    }
+}
+
+void
+xkb_context_include_cache_clear(struct xkb_context *ctx)
+{
+    struct include_cache_entry *entry;
+
+    darray_foreach(entry, ctx->include_cache)
+        include_cache_entry_free(entry);
+    darray_free(ctx->include_cache);
+}
+
+void
+RefreshIncludeCaches(struct xkb_context *ctx)
+{
+    xkb_context_lock(ctx, &ctx->include_lock);
+    RevalidateIncludeIndex(ctx);
+    if (ctx->include_cache_users == 0)
+        PruneIncludeCache(ctx);
+    xkb_context_unlock(ctx, &ctx->include_lock);
+}
+
+void
+HoldIncludeCache(struct xkb_context *ctx)
+{
+    xkb_context_lock(ctx, &ctx->include_lock);
+    ctx->include_cache_users++;
+    xkb_context_unlock(ctx, &ctx->include_lock);
+}
+
+void
+ReleaseIncludeCache(struct xkb_context *ctx)
+{
+    xkb_context_lock(ctx, &ctx->include_lock);
+    ctx->include_cache_users--;
+    xkb_context_unlock(ctx, &ctx->include_lock);
+}
+
+static XkbFile *
+include_file_get(struct xkb_context *ctx, IncludeStmt *stmt,
+                 enum xkb_file_type file_type, bool log_errors)
+{
+    FILE *file;
+    XkbFile *xkb_file = NULL, *parsed;
+    char *path;
+    struct file_stamp stamp;
+    bool found;
+
+    xkb_context_lock(ctx, &ctx->include_lock);
+    file = find_file(ctx, stmt->file, file_type, &path, log_errors);
+    xkb_context_unlock(ctx, &ctx->include_lock);
+    if (!file)
+        return NULL;
 
-    xkb_file = XkbParseFile(ctx, file, stmt->file, stmt->map);
+    if (!file_stamp_get(&stamp, file)) {
+        log_err(ctx, "Couldn't stat include file \"%s\": %s\n",
+                path, strerror(errno));
+        goto out;
+    }
+
+    xkb_context_lock(ctx, &ctx->include_lock);
+    found = include_cache_lookup(ctx, path, stmt->map, &stamp, &xkb_file);
+    xkb_context_unlock(ctx, &ctx->include_lock);
+    if (found)
+        goto out;
+
+    /* Parse without the lock, so that other files can be parsed meanwhile. */
+    parsed = XkbParseFile(ctx, file, stmt->file, stmt->map);
+
+    xkb_context_lock(ctx, &ctx->include_lock);
+    if (include_cache_lookup(ctx, path, stmt->map, &stamp, &xkb_file)) {
+        /* Another thread got there first. */
+        FreeXkbFile(parsed);
+    }
+    else if (include_cache_add(ctx, path, stmt->map, &stamp, parsed)) {
+        xkb_file = parsed;
+    }
+    else {
+        FreeXkbFile(parsed);
+    }
+    xkb_context_unlock(ctx, &ctx->include_lock);
+
+out:
     fclose(file);
+    free(path);
+    return xkb_file;
+}
+
+/*
+ * The returned file is owned by the context's include cache, and must
+ * not be freed or modified.
+ */
+XkbFile *
+ProcessIncludeFile(struct xkb_context *ctx, IncludeStmt *stmt,
+                   enum xkb_file_type file_type)
+{
+    XkbFile *xkb_file;
+
+    xkb_file = include_file_get(ctx, stmt, file_type, true);
     if (!xkb_file) {
         if (stmt->map)
             log_err(ctx, "Couldn't process include statement for '%s(%s)'\n",
@@ -299,7 +685,6 @@ ProcessIncludeFile(struct xkb_context *ctx, IncludeStmt *stmt,
                 "Include file \"%s\" ignored\n",
                 xkb_file_type_to_string(file_type),
                 xkb_file_type_to_string(xkb_file->file_type), stmt->file);
-        FreeXkbFile(xkb_file);
         return NULL;
     }
 
@@ -307,3 +692,41 @@ ProcessIncludeFile(struct xkb_context *ctx, IncludeStmt *stmt,
 
     return xkb_file;
 }
+
+/* Recursive includes aren't detected; don't follow them forever. */
+#define PREFETCH_MAX_DEPTH 20
+
+/*
+ * Read and parse the files included by @file into the include cache,
+ * recursively, so that compiling it later doesn't have to. Nothing is
+ * reported about files which can't be found; the compilation does that.
+ * This may run in several threads at once, when ctx->threaded is set.
+ */
+static void
+prefetch_includes(struct xkb_context *ctx, XkbFile *file, unsigned depth)
+{
+    ParseCommon *stmt;
+    IncludeStmt *include;
+    XkbFile *included;
+
+    if (depth > PREFETCH_MAX_DEPTH)
+        return;
+
+    for (stmt = file->defs; stmt; stmt = stmt->next) {
+        if (stmt->type != STMT_INCLUDE)
+            continue;
+
+        for (include = (IncludeStmt *) stmt; include;
+             include = include->next_incl) {
+            included = include_file_get(ctx, include, file->file_type, false);
+            if (included && included->file_type == file->file_type)
+                prefetch_includes(ctx, included, depth + 1);
+        }
+    }
+}
+
+void
+PrefetchIncludeFiles(struct xkb_context *ctx, XkbFile *file)
+{
+    prefetch_includes(ctx, file, 0);
+}
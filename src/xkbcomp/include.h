@@ -27,6 +27,23 @@
 #ifndef XKBCOMP_INCLUDE_H
 #define XKBCOMP_INCLUDE_H
 
+#include <sys/types.h>
+
+/* Identifies a version of a file, to notice when it has changed. */
+struct file_stamp {
+    dev_t dev;
+    ino_t ino;
+    time_t mtime;
+    long mtime_nsec;
+    off_t size;
+};
+
+bool
+file_stamp_get(struct file_stamp *stamp, FILE *file);
+
+bool
+file_stamp_eq(const struct file_stamp *a, const struct file_stamp *b);
+
 bool
 ParseIncludeMap(char **str_inout, char **file_rtrn, char **map_rtrn,
                 char *nextop_rtrn, char **extra_data);
@@ -39,4 +56,29 @@ XkbFile *
 ProcessIncludeFile(struct xkb_context *ctx, IncludeStmt *stmt,
                    enum xkb_file_type file_type);
 
+/*
+ * Parses the files included by @file, recursively, into the context's
+ * include cache.  Safe to call from several threads at once while
+ * ctx->threaded is set.
+ */
+void
+PrefetchIncludeFiles(struct xkb_context *ctx, XkbFile *file);
+
+/*
+ * Must be called before compiling.  Stale files are only freed from the
+ * include cache if no compilation is holding it.
+ */
+void
+RefreshIncludeCaches(struct xkb_context *ctx);
+
+/*
+ * Files returned by ProcessIncludeFile() may only be used between these,
+ * since other threads may refresh the caches meanwhile.
+ */
+void
+HoldIncludeCache(struct xkb_context *ctx);
+
+void
+ReleaseIncludeCache(struct xkb_context *ctx);
+
 #endif
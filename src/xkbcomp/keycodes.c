@@ -49,9 +49,13 @@ typedef struct {
     xkb_keycode_t min_key_code;
     xkb_keycode_t max_key_code;
     darray(xkb_atom_t) key_names;
+    /* Key name -> keycode + 1. */
+    darray_uint key_index;
     LedNameInfo led_names[XKB_MAX_LEDS];
     unsigned int num_led_names;
     darray(AliasInfo) aliases;
+    /* Alias name -> index in aliases + 1. */
+    darray_uint alias_index;
 
     struct xkb_context *ctx;
 } KeyNamesInfo;
@@ -148,7 +152,9 @@ ClearKeyNamesInfo(KeyNamesInfo *info)
 {
     free(info->name);
     darray_free(info->key_names);
+    darray_free(info->key_index);
     darray_free(info->aliases);
+    darray_free(info->alias_index);
 }
 
 static void
@@ -165,13 +171,21 @@ InitKeyNamesInfo(KeyNamesInfo *info, struct xkb_context *ctx)
 static xkb_keycode_t
 FindKeyByName(KeyNamesInfo *info, xkb_atom_t name)
 {
-    xkb_keycode_t i;
+    unsigned kc = atom_index_get(&info->key_index, name);
 
-    for (i = info->min_key_code; i <= info->max_key_code; i++)
-        if (darray_item(info->key_names, i) == name)
-            return i;
+    /* The index is not updated when names are dropped, so check it. */
+    if (kc == 0 || kc > darray_size(info->key_names) ||
+        darray_item(info->key_names, kc - 1) != name)
+        return XKB_KEYCODE_INVALID;
 
-    return XKB_KEYCODE_INVALID;
+    return kc - 1;
+}
+
+static void
+SetKeyName(KeyNamesInfo *info, xkb_keycode_t kc, xkb_atom_t name)
+{
+    darray_item(info->key_names, kc) = name;
+    atom_index_set(&info->key_index, name, kc + 1);
 }
 
 static bool
@@ -241,7 +255,7 @@ AddKeyName(KeyNamesInfo *info, xkb_keycode_t kc, xkb_atom_t name,
         }
     }
 
-    darray_item(info->key_names, kc) = name;
+    SetKeyName(info, kc, name);
     return true;
 }
 
@@ -268,6 +282,9 @@ MergeIncludedKeycodes(KeyNamesInfo *into, KeyNamesInfo *from,
     if (darray_empty(into->key_names)) {
         into->key_names = from->key_names;
         darray_init(from->key_names);
+        darray_free(into->key_index);
+        into->key_index = from->key_index;
+        darray_init(from->key_index);
         into->min_key_code = from->min_key_code;
         into->max_key_code = from->max_key_code;
     }
@@ -289,6 +306,9 @@ MergeIncludedKeycodes(KeyNamesInfo *into, KeyNamesInfo *from,
     if (darray_empty(into->aliases)) {
         into->aliases = from->aliases;
         darray_init(from->aliases);
+        darray_free(into->alias_index);
+        into->alias_index = from->alias_index;
+        darray_init(from->alias_index);
     }
     else {
         AliasInfo *alias;
@@ -335,8 +355,7 @@ HandleIncludeKeycodes(KeyNamesInfo *info, IncludeStmt *include)
     KeyNamesInfo included;
 
     InitKeyNamesInfo(&included, info->ctx);
-    included.name = include->stmt;
-    include->stmt = NULL;
+    included.name = strdup_safe(include->stmt);
 
     for (IncludeStmt *stmt = include; stmt; stmt = stmt->next_incl) {
         KeyNamesInfo next_incl;
@@ -356,7 +375,6 @@ HandleIncludeKeycodes(KeyNamesInfo *info, IncludeStmt *include)
         MergeIncludedKeycodes(&included, &next_incl, stmt->merge);
 
         ClearKeyNamesInfo(&next_incl);
-        FreeXkbFile(file);
     }
 
     MergeIncludedKeycodes(info, &included, include->merge);
@@ -389,39 +407,42 @@ static bool
 HandleAliasDef(KeyNamesInfo *info, KeyAliasDef *def, enum merge_mode merge)
 {
     AliasInfo *old, new;
+    unsigned idx;
+
+    idx = atom_index_get(&info->alias_index, def->alias);
+    if (idx != 0 && idx <= darray_size(info->aliases) &&
+        darray_item(info->aliases, idx - 1).alias == def->alias) {
+        old = &darray_item(info->aliases, idx - 1);
+        if (def->real == old->real) {
+            log_vrb(info->ctx, 1,
+                    "Alias of %s for %s declared more than once; "
+                    "First definition ignored\n",
+                    KeyNameText(info->ctx, def->alias),
+                    KeyNameText(info->ctx, def->real));
+        }
+        else {
+            xkb_atom_t use, ignore;
 
-    darray_foreach(old, info->aliases) {
-        if (old->alias == def->alias) {
-            if (def->real == old->real) {
-                log_vrb(info->ctx, 1,
-                        "Alias of %s for %s declared more than once; "
-                        "First definition ignored\n",
-                        KeyNameText(info->ctx, def->alias),
-                        KeyNameText(info->ctx, def->real));
-            }
-            else {
-                xkb_atom_t use, ignore;
-
-                use = (merge == MERGE_AUGMENT ? old->real : def->real);
-                ignore = (merge == MERGE_AUGMENT ? def->real : old->real);
-
-                log_warn(info->ctx,
-                         "Multiple definitions for alias %s; "
-                         "Using %s, ignoring %s\n",
-                         KeyNameText(info->ctx, old->alias),
-                         KeyNameText(info->ctx, use),
-                         KeyNameText(info->ctx, ignore));
+            use = (merge == MERGE_AUGMENT ? old->real : def->real);
+            ignore = (merge == MERGE_AUGMENT ? def->real : old->real);
 
-                old->real = use;
-            }
+            log_warn(info->ctx,
+                     "Multiple definitions for alias %s; "
+                     "Using %s, ignoring %s\n",
+                     KeyNameText(info->ctx, old->alias),
+                     KeyNameText(info->ctx, use),
+                     KeyNameText(info->ctx, ignore));
 
-            old->merge = merge;
-            return true;
+            old->real = use;
         }
+
+        old->merge = merge;
+        return true;
     }
 
     InitAliasInfo(&new, merge, def->alias, def->real);
     darray_append(info->aliases, new);
+    atom_index_set(&info->alias_index, def->alias, darray_size(info->aliases));
     return true;
 }
 
@@ -544,8 +565,13 @@ CopyKeyNamesToKeymap(struct xkb_keymap *keymap, KeyNamesInfo *info)
     for (kc = min_key_code; kc <= max_key_code; kc++)
         keys[kc].keycode = kc;
 
-    for (kc = info->min_key_code; kc <= info->max_key_code; kc++)
-        keys[kc].name = darray_item(info->key_names, kc);
+    for (kc = info->min_key_code; kc <= info->max_key_code; kc++) {
+        xkb_atom_t name = darray_item(info->key_names, kc);
+
+        keys[kc].name = name;
+        if (name != XKB_ATOM_NONE)
+            atom_index_set(&keymap->key_index, name, kc + 1);
+    }
 
     keymap->min_key_code = min_key_code;
     keymap->max_key_code = max_key_code;
@@ -601,6 +627,7 @@ CopyKeyAliasesToKeymap(struct xkb_keymap *keymap, KeyNamesInfo *info)
             key_aliases[i].alias = alias->alias;
             key_aliases[i].real = alias->real;
             i++;
+            atom_index_set(&keymap->alias_index, alias->alias, i);
         }
     }
 
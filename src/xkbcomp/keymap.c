@@ -27,7 +27,10 @@
  *         Ran Benita <ran234@gmail.com>
  */
 
+#include <unistd.h>
+
 #include "xkbcomp-priv.h"
+#include "include.h"
 
 static void
 ComputeEffectiveMask(struct xkb_keymap *keymap, struct xkb_mods *mods)
@@ -61,71 +64,162 @@ static const struct xkb_sym_interpret default_interpret = {
     .action = { .type = ACTION_TYPE_NONE },
 };
 
+/*
+ * The interprets are indexed by keysym, so that each level only needs to
+ * be matched against the interprets for its keysym, and the generic
+ * XKB_KEY_NoSymbol ones. Both lists keep the order of sym_interprets.
+ */
+struct interp_sym_entry {
+    xkb_keysym_t sym;
+    unsigned idx;
+};
+
+struct interp_index {
+    /* Sorted by keysym, then by index. */
+    darray(struct interp_sym_entry) by_sym;
+    darray_uint wildcards;
+};
+
+static int
+cmp_interp_sym_entry(const void *a, const void *b)
+{
+    const struct interp_sym_entry *ea = a, *eb = b;
+
+    if (ea->sym != eb->sym)
+        return ea->sym < eb->sym ? -1 : 1;
+    return ea->idx < eb->idx ? -1 : (ea->idx > eb->idx);
+}
+
+static void
+InitInterpIndex(struct interp_index *index, const struct xkb_keymap *keymap)
+{
+    darray_init(index->by_sym);
+    darray_init(index->wildcards);
+
+    for (unsigned i = 0; i < keymap->num_sym_interprets; i++) {
+        const struct xkb_sym_interpret *interp = &keymap->sym_interprets[i];
+
+        if (interp->sym == XKB_KEY_NoSymbol) {
+            darray_append(index->wildcards, i);
+        }
+        else {
+            struct interp_sym_entry entry = { interp->sym, i };
+            darray_append(index->by_sym, entry);
+        }
+    }
+
+    if (!darray_empty(index->by_sym))
+        qsort(&darray_item(index->by_sym, 0), darray_size(index->by_sym),
+              sizeof(struct interp_sym_entry), cmp_interp_sym_entry);
+}
+
+static void
+ClearInterpIndex(struct interp_index *index)
+{
+    darray_free(index->by_sym);
+    darray_free(index->wildcards);
+}
+
+/* Returns the position of the first entry for @sym, or where it'd be. */
+static unsigned
+InterpIndexFind(const struct interp_index *index, xkb_keysym_t sym)
+{
+    unsigned lo = 0, hi = darray_size(index->by_sym);
+
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        if (darray_item(index->by_sym, mid).sym < sym)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+static bool
+InterpMatchesLevel(const struct xkb_sym_interpret *interp,
+                   const struct xkb_key *key, xkb_level_index_t level)
+{
+    xkb_mod_mask_t mods;
+
+    if (interp->level_one_only && level != 0)
+        mods = 0;
+    else
+        mods = key->modmap;
+
+    switch (interp->match) {
+    case MATCH_NONE:
+        return !(interp->mods & mods);
+    case MATCH_ANY_OR_NONE:
+        return (!mods || (interp->mods & mods));
+    case MATCH_ANY:
+        return (interp->mods & mods);
+    case MATCH_ALL:
+        return ((interp->mods & mods) == interp->mods);
+    case MATCH_EXACTLY:
+        return (interp->mods == mods);
+    }
+
+    return false;
+}
+
 /**
  * Find an interpretation which applies to this particular level, either by
  * finding an exact match for the symbol and modifier combination, or a
  * generic XKB_KEY_NoSymbol match.
  */
 static const struct xkb_sym_interpret *
-FindInterpForKey(struct xkb_keymap *keymap, const struct xkb_key *key,
+FindInterpForKey(struct xkb_keymap *keymap, const struct interp_index *index,
+                 const struct xkb_key *key,
                  xkb_layout_index_t group, xkb_level_index_t level)
 {
     const xkb_keysym_t *syms;
     int num_syms;
+    unsigned s, s_end, w = 0;
+    const unsigned w_end = darray_size(index->wildcards);
 
     num_syms = xkb_keymap_key_get_syms_by_level(keymap, key->keycode, group,
                                                 level, &syms);
     if (num_syms == 0)
         return NULL;
 
+    /* Only the generic interprets apply to levels with several keysyms. */
+    s = s_end = 0;
+    if (num_syms == 1) {
+        s = s_end = InterpIndexFind(index, syms[0]);
+        while (s_end < darray_size(index->by_sym) &&
+               darray_item(index->by_sym, s_end).sym == syms[0])
+            s_end++;
+    }
+
     /*
      * There may be multiple matchings interprets; we should always return
      * the most specific. Here we rely on compat.c to set up the
      * sym_interprets array from the most specific to the least specific,
-     * such that when we find a match we return immediately.
+     * such that when we find a match we return immediately. So the two
+     * candidate lists are walked merged, in the order of the array.
      */
-    for (unsigned i = 0; i < keymap->num_sym_interprets; i++) {
-        const struct xkb_sym_interpret *interp = &keymap->sym_interprets[i];
-
-        xkb_mod_mask_t mods;
-        bool found = false;
-
-        if ((num_syms > 1 || interp->sym != syms[0]) &&
-            interp->sym != XKB_KEY_NoSymbol)
-            continue;
+    while (s < s_end || w < w_end) {
+        unsigned idx;
 
-        if (interp->level_one_only && level != 0)
-            mods = 0;
+        if (w >= w_end || (s < s_end &&
+                           darray_item(index->by_sym, s).idx <
+                           darray_item(index->wildcards, w)))
+            idx = darray_item(index->by_sym, s++).idx;
         else
-            mods = key->modmap;
-
-        switch (interp->match) {
-        case MATCH_NONE:
-            found = !(interp->mods & mods);
-            break;
-        case MATCH_ANY_OR_NONE:
-            found = (!mods || (interp->mods & mods));
-            break;
-        case MATCH_ANY:
-            found = (interp->mods & mods);
-            break;
-        case MATCH_ALL:
-            found = ((interp->mods & mods) == interp->mods);
-            break;
-        case MATCH_EXACTLY:
-            found = (interp->mods == mods);
-            break;
-        }
+            idx = darray_item(index->wildcards, w++);
 
-        if (found)
-            return interp;
+        if (InterpMatchesLevel(&keymap->sym_interprets[idx], key, level))
+            return &keymap->sym_interprets[idx];
     }
 
     return &default_interpret;
 }
 
 static bool
-ApplyInterpsToKey(struct xkb_keymap *keymap, struct xkb_key *key)
+ApplyInterpsToKey(struct xkb_keymap *keymap, const struct interp_index *index,
+                  struct xkb_key *key)
 {
     xkb_mod_mask_t vmodmap = 0;
     xkb_layout_index_t group;
@@ -139,7 +233,7 @@ ApplyInterpsToKey(struct xkb_keymap *keymap, struct xkb_key *key)
         for (level = 0; level < XkbKeyGroupWidth(key, group); level++) {
             const struct xkb_sym_interpret *interp;
 
-            interp = FindInterpForKey(keymap, key, group, level);
+            interp = FindInterpForKey(keymap, index, key, group, level);
             if (!interp)
                 continue;
 
@@ -176,12 +270,18 @@ UpdateDerivedKeymapFields(struct xkb_keymap *keymap)
     struct xkb_mod *mod;
     struct xkb_led *led;
     unsigned int i, j;
+    struct interp_index interp_index;
 
     /* Find all the interprets for the key and bind them to actions,
      * which will also update the vmodmap. */
-    xkb_keys_foreach(key, keymap)
-        if (!ApplyInterpsToKey(keymap, key))
+    InitInterpIndex(&interp_index, keymap);
+    xkb_keys_foreach(key, keymap) {
+        if (!ApplyInterpsToKey(keymap, &interp_index, key)) {
+            ClearInterpIndex(&interp_index);
             return false;
+        }
+    }
+    ClearInterpIndex(&interp_index);
 
     /* Update keymap->mods, the virtual -> real mod mapping. */
     xkb_keys_foreach(key, keymap)
@@ -197,6 +297,9 @@ UpdateDerivedKeymapFields(struct xkb_keymap *keymap)
             ComputeEffectiveMask(keymap, &keymap->types[i].entries[j].mods);
             ComputeEffectiveMask(keymap, &keymap->types[i].entries[j].preserve);
         }
+
+        if (!XkbKeyTypeUpdateEntryMap(&keymap->types[i]))
+            return false;
     }
 
     /* Update action modifiers. */
@@ -228,6 +331,56 @@ static const compile_file_fn compile_file_fns[LAST_KEYMAP_FILE_TYPE + 1] = {
     [FILE_TYPE_SYMBOLS] = CompileSymbols,
 };
 
+struct prefetch_job {
+    struct xkb_context *ctx;
+    XkbFile *file;
+};
+
+static void *
+PrefetchThread(void *data)
+{
+    struct prefetch_job *job = data;
+
+    PrefetchIncludeFiles(job->ctx, job->file);
+    return NULL;
+}
+
+/*
+ * Read and parse the include trees of all the sections concurrently,
+ * one thread per section.  The sections still need to be compiled in
+ * order, since each builds on the virtual modifiers and keys of the ones
+ * before it; but then their includes are found in the include cache.
+ */
+static void
+PrefetchSections(struct xkb_context *ctx, XkbFile **files)
+{
+    struct prefetch_job jobs[LAST_KEYMAP_FILE_TYPE];
+    pthread_t threads[LAST_KEYMAP_FILE_TYPE];
+    bool started[LAST_KEYMAP_FILE_TYPE];
+    enum xkb_file_type type;
+
+    /* The threads would only get in each other's way. */
+    if (sysconf(_SC_NPROCESSORS_ONLN) < 2)
+        return;
+
+    for (type = FIRST_KEYMAP_FILE_TYPE; type < LAST_KEYMAP_FILE_TYPE; type++) {
+        jobs[type].ctx = ctx;
+        jobs[type].file = files[type];
+        started[type] = (pthread_create(&threads[type], NULL,
+                                        PrefetchThread, &jobs[type]) == 0);
+    }
+
+    /* The last section, symbols, is usually the biggest; do it here. */
+    PrefetchIncludeFiles(ctx, files[LAST_KEYMAP_FILE_TYPE]);
+
+    for (type = FIRST_KEYMAP_FILE_TYPE; type < LAST_KEYMAP_FILE_TYPE; type++) {
+        if (started[type])
+            pthread_join(threads[type], NULL);
+        else
+            PrefetchIncludeFiles(ctx, files[type]);
+    }
+}
+
 bool
 CompileKeymap(XkbFile *file, struct xkb_keymap *keymap, enum merge_mode merge)
 {
@@ -257,10 +410,9 @@ CompileKeymap(XkbFile *file, struct xkb_keymap *keymap, enum merge_mode merge)
             continue;
         }
 
-        if (!file->topName) {
-            free(file->topName);
-            file->topName = strdup(main_name);
-        }
+        /* main_name lives as long as the sections do. */
+        if (!file->topName)
+            file->topName = main_name;
 
         files[file->file_type] = file;
     }
@@ -282,6 +434,13 @@ CompileKeymap(XkbFile *file, struct xkb_keymap *keymap, enum merge_mode merge)
     if (!ok)
         return false;
 
+    /*
+     * The threads share the context, and may call its logging function,
+     * which the caller has only allowed for a thread-safe context.
+     */
+    if ((keymap->flags & XKB_KEYMAP_COMPILE_PARALLEL) && ctx->threaded)
+        PrefetchSections(ctx, files);
+
     /* Compile sections. */
     for (type = FIRST_KEYMAP_FILE_TYPE;
          type <= LAST_KEYMAP_FILE_TYPE;
@@ -297,5 +456,15 @@ CompileKeymap(XkbFile *file, struct xkb_keymap *keymap, enum merge_mode merge)
         }
     }
 
-    return UpdateDerivedKeymapFields(keymap);
+    /* The indexes are only needed while compiling. */
+    darray_free(keymap->key_index);
+    darray_free(keymap->alias_index);
+    free(keymap->keysym_index);
+    keymap->keysym_index = NULL;
+
+    if (!UpdateDerivedKeymapFields(keymap))
+        return false;
+
+    XkbCompactKeymap(keymap);
+    return true;
 }
@@ -198,17 +198,6 @@ struct group {
     darray_sval elements;
 };
 
-struct mapping {
-    int mlvo_at_pos[_MLVO_NUM_ENTRIES];
-    unsigned int num_mlvo;
-    unsigned int defined_mlvo_mask;
-    xkb_layout_index_t layout_idx, variant_idx;
-    int kccgst_at_pos[_KCCGST_NUM_ENTRIES];
-    unsigned int num_kccgst;
-    unsigned int defined_kccgst_mask;
-    bool skip;
-};
-
 enum mlvo_match_type {
     MLVO_MATCH_NORMAL = 0,
     MLVO_MATCH_WILDCARD,
@@ -218,33 +207,87 @@ enum mlvo_match_type {
 struct rule {
     struct sval mlvo_value_at_pos[_MLVO_NUM_ENTRIES];
     enum mlvo_match_type match_type_at_pos[_MLVO_NUM_ENTRIES];
+    /* For MLVO_MATCH_GROUP, the index of the group, or -1 if undeclared. */
+    int group_at_pos[_MLVO_NUM_ENTRIES];
     unsigned int num_mlvo_values;
     struct sval kccgst_value_at_pos[_KCCGST_NUM_ENTRIES];
     unsigned int num_kccgst_values;
+    /* Where the rule is, for error messages. */
+    unsigned line, column;
     bool skip;
 };
 
+/* A rule whose first value is matched literally, for looking it up. */
+struct rule_key {
+    struct sval value;
+    unsigned int rule_idx;
+};
+
+struct mapping {
+    int mlvo_at_pos[_MLVO_NUM_ENTRIES];
+    unsigned int num_mlvo;
+    unsigned int defined_mlvo_mask;
+    xkb_layout_index_t layout_idx, variant_idx;
+    int kccgst_at_pos[_KCCGST_NUM_ENTRIES];
+    unsigned int num_kccgst;
+    unsigned int defined_kccgst_mask;
+    bool skip;
+    /* The rule set. */
+    darray(struct rule) rules;
+    /*
+     * The rules which match their first value literally, sorted by that
+     * value; and the indexes of all other rules. Only these need to be
+     * tried when matching (see matcher_match_mapping()).
+     */
+    darray(struct rule_key) keys;
+    darray_uint other_rules;
+};
+
 /*
- * This is the main object used to match a given RMLVO against a rules
- * file and aggragate the results in a KcCGST. It goes through a simple
- * matching state machine, with tokens as transitions (see
- * matcher_match()).
+ * A parsed rules file. It does not depend on the RMLVO, so it is kept in
+ * the context and can be matched against any number of them.
  */
-struct matcher {
-    struct xkb_context *ctx;
-    /* Input.*/
-    struct rule_names rmlvo;
+struct rules {
+    char *file_name;
+    /* The contents of the file; all of the svals point into it. */
+    char *string;
+    darray(struct group) groups;
+    darray(struct mapping) mappings;
+};
+
+/*
+ * Parses a rules file. It goes through a simple state machine, with
+ * tokens as transitions (see rules_parse()).
+ */
+struct parser {
+    struct rules *rules;
     union lvalue val;
     struct scanner scanner;
-    darray(struct group) groups;
     /* Current mapping. */
     struct mapping mapping;
     /* Current rule. */
     struct rule rule;
+};
+
+/*
+ * This is the main object used to match a given RMLVO against a rules
+ * file and aggragate the results in a KcCGST.
+ */
+struct matcher {
+    struct xkb_context *ctx;
+    const struct rules *rules;
+    /* Input.*/
+    struct rule_names rmlvo;
     /* Output. */
     darray_char kccgst[_KCCGST_NUM_ENTRIES];
 };
 
+struct rules_cache_entry {
+    char *path;
+    struct file_stamp stamp;
+    struct rules *rules;
+};
+
 static struct sval
 strip_spaces(struct sval v)
 {
@@ -253,97 +296,92 @@ strip_spaces(struct sval v)
     return v;
 }
 
-static darray_sval
-split_comma_separated_string(const char *s)
+static void
+split_comma_separated_string(darray_sval *arr, const char *s)
 {
-    darray_sval arr = darray_new();
+    /* The array is reused between lookups, so keep its allocation. */
+    darray_resize(*arr, 0);
 
     /*
-     * Make sure the array returned by this function always includes at
-     * least one value, e.g. "" -> { "" } and "," -> { "", "" }.
+     * Make sure the array always ends up with at least one value,
+     * e.g. "" -> { "" } and "," -> { "", "" }.
      */
 
     if (!s) {
         struct sval val = { NULL, 0 };
-        darray_append(arr, val);
-        return arr;
+        darray_append(*arr, val);
+        return;
     }
 
     while (true) {
         struct sval val = { s, 0 };
         while (*s != '\0' && *s != ',') { s++; val.len++; }
-        darray_append(arr, strip_spaces(val));
+        darray_append(*arr, strip_spaces(val));
         if (*s == '\0') break;
         if (*s == ',') s++;
     }
-
-    return arr;
 }
 
-static struct matcher *
-matcher_new(struct xkb_context *ctx,
-            const struct xkb_rule_names *rmlvo)
+static int
+svalcmp(struct sval s1, struct sval s2)
 {
-    struct matcher *m = calloc(1, sizeof(*m));
-    if (!m)
-        return NULL;
-
-    m->ctx = ctx;
-    m->rmlvo.model.start = rmlvo->model;
-    m->rmlvo.model.len = strlen_safe(rmlvo->model);
-    m->rmlvo.layouts = split_comma_separated_string(rmlvo->layout);
-    m->rmlvo.variants = split_comma_separated_string(rmlvo->variant);
-    m->rmlvo.options = split_comma_separated_string(rmlvo->options);
-
-    return m;
+    unsigned len = MIN(s1.len, s2.len);
+    int ret = (len > 0 ? memcmp(s1.start, s2.start, len) : 0);
+    if (ret != 0)
+        return ret;
+    return (s1.len > s2.len) - (s1.len < s2.len);
 }
 
 static void
-matcher_free(struct matcher *m)
+rules_free(struct rules *rules)
 {
     struct group *group;
-    if (!m)
+    struct mapping *mapping;
+
+    if (!rules)
         return;
-    darray_free(m->rmlvo.layouts);
-    darray_free(m->rmlvo.variants);
-    darray_free(m->rmlvo.options);
-    darray_foreach(group, m->groups)
+
+    darray_foreach(group, rules->groups)
         darray_free(group->elements);
-    for (int i = 0; i < _KCCGST_NUM_ENTRIES; i++)
-        darray_free(m->kccgst[i]);
-    darray_free(m->groups);
-    free(m);
+    darray_free(rules->groups);
+    darray_foreach(mapping, rules->mappings) {
+        darray_free(mapping->rules);
+        darray_free(mapping->keys);
+        darray_free(mapping->other_rules);
+    }
+    darray_free(rules->mappings);
+    free(rules->string);
+    free(rules->file_name);
+    free(rules);
 }
 
-#define matcher_err(matcher, fmt, ...) \
-    scanner_err(&(matcher)->scanner, fmt, ## __VA_ARGS__)
+#define parser_err(parser, fmt, ...) \
+    scanner_err(&(parser)->scanner, fmt, ## __VA_ARGS__)
 
 static void
-matcher_group_start_new(struct matcher *m, struct sval name)
+parser_group_start_new(struct parser *p, struct sval name)
 {
     struct group group = { .name = name, .elements = darray_new() };
-    darray_append(m->groups, group);
+    darray_append(p->rules->groups, group);
 }
 
 static void
-matcher_group_add_element(struct matcher *m, struct sval element)
+parser_group_add_element(struct parser *p, struct sval element)
 {
-    darray_append(darray_item(m->groups, darray_size(m->groups) - 1).elements,
+    darray_append(darray_item(p->rules->groups,
+                              darray_size(p->rules->groups) - 1).elements,
                   element);
 }
 
 static void
-matcher_mapping_start_new(struct matcher *m)
+parser_mapping_start_new(struct parser *p)
 {
+    memset(&p->mapping, 0, sizeof(p->mapping));
     for (unsigned i = 0; i < _MLVO_NUM_ENTRIES; i++)
-        m->mapping.mlvo_at_pos[i] = -1;
+        p->mapping.mlvo_at_pos[i] = -1;
     for (unsigned i = 0; i < _KCCGST_NUM_ENTRIES; i++)
-        m->mapping.kccgst_at_pos[i] = -1;
-    m->mapping.layout_idx = m->mapping.variant_idx = XKB_LAYOUT_INVALID;
-    m->mapping.num_mlvo = m->mapping.num_kccgst = 0;
-    m->mapping.defined_mlvo_mask = 0;
-    m->mapping.defined_kccgst_mask = 0;
-    m->mapping.skip = false;
+        p->mapping.kccgst_at_pos[i] = -1;
+    p->mapping.layout_idx = p->mapping.variant_idx = XKB_LAYOUT_INVALID;
 }
 
 static int
@@ -363,7 +401,7 @@ extract_layout_index(const char *s, size_t max_len, xkb_layout_index_t *out)
 }
 
 static void
-matcher_mapping_set_mlvo(struct matcher *m, struct sval ident)
+parser_mapping_set_mlvo(struct parser *p, struct sval ident)
 {
     enum rules_mlvo mlvo;
     struct sval mlvo_sval;
@@ -377,16 +415,16 @@ matcher_mapping_set_mlvo(struct matcher *m, struct sval ident)
 
     /* Not found. */
     if (mlvo >= _MLVO_NUM_ENTRIES) {
-        matcher_err(m, "invalid mapping: %.*s is not a valid value here; ignoring rule set",
-                    ident.len, ident.start);
-        m->mapping.skip = true;
+        parser_err(p, "invalid mapping: %.*s is not a valid value here; ignoring rule set",
+                   ident.len, ident.start);
+        p->mapping.skip = true;
         return;
     }
 
-    if (m->mapping.defined_mlvo_mask & (1u << mlvo)) {
-        matcher_err(m, "invalid mapping: %.*s appears twice on the same line; ignoring rule set",
-                    mlvo_sval.len, mlvo_sval.start);
-        m->mapping.skip = true;
+    if (p->mapping.defined_mlvo_mask & (1u << mlvo)) {
+        parser_err(p, "invalid mapping: %.*s appears twice on the same line; ignoring rule set",
+                   mlvo_sval.len, mlvo_sval.start);
+        p->mapping.skip = true;
         return;
     }
 
@@ -396,33 +434,33 @@ matcher_mapping_set_mlvo(struct matcher *m, struct sval ident)
         int consumed = extract_layout_index(ident.start + mlvo_sval.len,
                                             ident.len - mlvo_sval.len, &idx);
         if ((int) (ident.len - mlvo_sval.len) != consumed) {
-            matcher_err(m, "invalid mapping: \"%.*s\" may only be followed by a valid group index; ignoring rule set",
-                        mlvo_sval.len, mlvo_sval.start);
-            m->mapping.skip = true;
+            parser_err(p, "invalid mapping: \"%.*s\" may only be followed by a valid group index; ignoring rule set",
+                       mlvo_sval.len, mlvo_sval.start);
+            p->mapping.skip = true;
             return;
         }
 
         if (mlvo == MLVO_LAYOUT) {
-            m->mapping.layout_idx = idx;
+            p->mapping.layout_idx = idx;
         }
         else if (mlvo == MLVO_VARIANT) {
-            m->mapping.variant_idx = idx;
+            p->mapping.variant_idx = idx;
         }
         else {
-            matcher_err(m, "invalid mapping: \"%.*s\" cannot be followed by a group index; ignoring rule set",
-                        mlvo_sval.len, mlvo_sval.start);
-            m->mapping.skip = true;
+            parser_err(p, "invalid mapping: \"%.*s\" cannot be followed by a group index; ignoring rule set",
+                       mlvo_sval.len, mlvo_sval.start);
+            p->mapping.skip = true;
             return;
         }
     }
 
-    m->mapping.mlvo_at_pos[m->mapping.num_mlvo] = mlvo;
-    m->mapping.defined_mlvo_mask |= 1u << mlvo;
-    m->mapping.num_mlvo++;
+    p->mapping.mlvo_at_pos[p->mapping.num_mlvo] = mlvo;
+    p->mapping.defined_mlvo_mask |= 1u << mlvo;
+    p->mapping.num_mlvo++;
 }
 
 static void
-matcher_mapping_set_kccgst(struct matcher *m, struct sval ident)
+parser_mapping_set_kccgst(struct parser *p, struct sval ident)
 {
     enum rules_kccgst kccgst;
     struct sval kccgst_sval;
@@ -436,147 +474,478 @@ matcher_mapping_set_kccgst(struct matcher *m, struct sval ident)
 
     /* Not found. */
     if (kccgst >= _KCCGST_NUM_ENTRIES) {
-        matcher_err(m, "invalid mapping: %.*s is not a valid value here; ignoring rule set",
-                    ident.len, ident.start);
-        m->mapping.skip = true;
+        parser_err(p, "invalid mapping: %.*s is not a valid value here; ignoring rule set",
+                   ident.len, ident.start);
+        p->mapping.skip = true;
         return;
     }
 
-    if (m->mapping.defined_kccgst_mask & (1u << kccgst)) {
-        matcher_err(m, "invalid mapping: %.*s appears twice on the same line; ignoring rule set",
-                    kccgst_sval.len, kccgst_sval.start);
-        m->mapping.skip = true;
+    if (p->mapping.defined_kccgst_mask & (1u << kccgst)) {
+        parser_err(p, "invalid mapping: %.*s appears twice on the same line; ignoring rule set",
+                   kccgst_sval.len, kccgst_sval.start);
+        p->mapping.skip = true;
         return;
     }
 
-    m->mapping.kccgst_at_pos[m->mapping.num_kccgst] = kccgst;
-    m->mapping.defined_kccgst_mask |= 1u << kccgst;
-    m->mapping.num_kccgst++;
+    p->mapping.kccgst_at_pos[p->mapping.num_kccgst] = kccgst;
+    p->mapping.defined_kccgst_mask |= 1u << kccgst;
+    p->mapping.num_kccgst++;
 }
 
 static void
-matcher_mapping_verify(struct matcher *m)
+parser_mapping_verify(struct parser *p)
 {
-    if (m->mapping.num_mlvo == 0) {
-        matcher_err(m, "invalid mapping: must have at least one value on the left hand side; ignoring rule set");
+    if (p->mapping.num_mlvo == 0) {
+        parser_err(p, "invalid mapping: must have at least one value on the left hand side; ignoring rule set");
         goto skip;
     }
 
-    if (m->mapping.num_kccgst == 0) {
-        matcher_err(m, "invalid mapping: must have at least one value on the right hand side; ignoring rule set");
+    if (p->mapping.num_kccgst == 0) {
+        parser_err(p, "invalid mapping: must have at least one value on the right hand side; ignoring rule set");
         goto skip;
     }
 
-    /*
-     * This following is very stupid, but this is how it works.
-     * See the "Notes" section in the overview above.
-     */
+    return;
 
-    if (m->mapping.defined_mlvo_mask & (1u << MLVO_LAYOUT)) {
-        if (m->mapping.layout_idx == XKB_LAYOUT_INVALID) {
-            if (darray_size(m->rmlvo.layouts) > 1)
-                goto skip;
-        }
-        else {
-            if (darray_size(m->rmlvo.layouts) == 1 ||
-                m->mapping.layout_idx >= darray_size(m->rmlvo.layouts))
-                goto skip;
-        }
-    }
+skip:
+    p->mapping.skip = true;
+}
 
-    if (m->mapping.defined_mlvo_mask & (1u << MLVO_VARIANT)) {
-        if (m->mapping.variant_idx == XKB_LAYOUT_INVALID) {
-            if (darray_size(m->rmlvo.variants) > 1)
-                goto skip;
+/* By value, then by rule, so that rules with equal keys stay in order. */
+static int
+cmp_rule_key(const void *a, const void *b)
+{
+    const struct rule_key *ka = a, *kb = b;
+    int ret = svalcmp(ka->value, kb->value);
+
+    if (ret != 0)
+        return ret;
+    return ka->rule_idx < kb->rule_idx ? -1 : (ka->rule_idx > kb->rule_idx);
+}
+
+/* Index the rules of the last mapping; no more rules are added to it. */
+static void
+parser_mapping_finish(struct parser *p)
+{
+    struct mapping *mapping;
+
+    if (darray_empty(p->rules->mappings))
+        return;
+
+    mapping = &darray_item(p->rules->mappings,
+                           darray_size(p->rules->mappings) - 1);
+
+    for (unsigned i = 0; i < darray_size(mapping->rules); i++) {
+        const struct rule *rule = &darray_item(mapping->rules, i);
+
+        if (rule->match_type_at_pos[0] == MLVO_MATCH_NORMAL) {
+            struct rule_key key = { rule->mlvo_value_at_pos[0], i };
+            darray_append(mapping->keys, key);
         }
         else {
-            if (darray_size(m->rmlvo.variants) == 1 ||
-                m->mapping.variant_idx >= darray_size(m->rmlvo.variants))
-                goto skip;
+            darray_append(mapping->other_rules, i);
         }
     }
 
-    return;
+    if (!darray_empty(mapping->keys))
+        qsort(&darray_item(mapping->keys, 0), darray_size(mapping->keys),
+              sizeof(struct rule_key), cmp_rule_key);
+}
 
-skip:
-    m->mapping.skip = true;
+static void
+parser_mapping_add(struct parser *p)
+{
+    if (p->mapping.skip)
+        return;
+
+    parser_mapping_finish(p);
+    darray_append(p->rules->mappings, p->mapping);
 }
 
 static void
-matcher_rule_start_new(struct matcher *m)
+parser_rule_start_new(struct parser *p)
 {
-    memset(&m->rule, 0, sizeof(m->rule));
-    m->rule.skip = m->mapping.skip;
+    memset(&p->rule, 0, sizeof(p->rule));
+    p->rule.skip = p->mapping.skip;
+    p->rule.line = p->scanner.token_line;
+    p->rule.column = p->scanner.token_column;
 }
 
 static void
-matcher_rule_set_mlvo_common(struct matcher *m, struct sval ident,
-                             enum mlvo_match_type match_type)
+parser_rule_set_mlvo_common(struct parser *p, struct sval ident,
+                            enum mlvo_match_type match_type)
 {
-    if (m->rule.num_mlvo_values + 1 > m->mapping.num_mlvo) {
-        matcher_err(m, "invalid rule: has more values than the mapping line; ignoring rule");
-        m->rule.skip = true;
+    if (p->rule.num_mlvo_values + 1 > p->mapping.num_mlvo) {
+        parser_err(p, "invalid rule: has more values than the mapping line; ignoring rule");
+        p->rule.skip = true;
         return;
     }
-    m->rule.match_type_at_pos[m->rule.num_mlvo_values] = match_type;
-    m->rule.mlvo_value_at_pos[m->rule.num_mlvo_values] = ident;
-    m->rule.num_mlvo_values++;
+    p->rule.match_type_at_pos[p->rule.num_mlvo_values] = match_type;
+    p->rule.mlvo_value_at_pos[p->rule.num_mlvo_values] = ident;
+    p->rule.num_mlvo_values++;
 }
 
 static void
-matcher_rule_set_mlvo_wildcard(struct matcher *m)
+parser_rule_set_mlvo_wildcard(struct parser *p)
 {
     struct sval dummy = { NULL, 0 };
-    matcher_rule_set_mlvo_common(m, dummy, MLVO_MATCH_WILDCARD);
+    parser_rule_set_mlvo_common(p, dummy, MLVO_MATCH_WILDCARD);
 }
 
 static void
-matcher_rule_set_mlvo_group(struct matcher *m, struct sval ident)
+parser_rule_set_mlvo_group(struct parser *p, struct sval ident)
 {
-    matcher_rule_set_mlvo_common(m, ident, MLVO_MATCH_GROUP);
+    /*
+     * Only groups declared before the rule count. rules/evdev
+     * intentionally uses some undeclared group names in rules (e.g.
+     * commented group definitions which may be uncommented if needed);
+     * these never match.
+     */
+    int group_idx = -1;
+
+    for (unsigned i = 0; i < darray_size(p->rules->groups); i++) {
+        if (svaleq(darray_item(p->rules->groups, i).name, ident)) {
+            group_idx = i;
+            break;
+        }
+    }
+
+    if (p->rule.num_mlvo_values < _MLVO_NUM_ENTRIES)
+        p->rule.group_at_pos[p->rule.num_mlvo_values] = group_idx;
+    parser_rule_set_mlvo_common(p, ident, MLVO_MATCH_GROUP);
 }
 
 static void
-matcher_rule_set_mlvo(struct matcher *m, struct sval ident)
+parser_rule_set_mlvo(struct parser *p, struct sval ident)
 {
-    matcher_rule_set_mlvo_common(m, ident, MLVO_MATCH_NORMAL);
+    parser_rule_set_mlvo_common(p, ident, MLVO_MATCH_NORMAL);
 }
 
 static void
-matcher_rule_set_kccgst(struct matcher *m, struct sval ident)
+parser_rule_set_kccgst(struct parser *p, struct sval ident)
 {
-    if (m->rule.num_kccgst_values + 1 > m->mapping.num_kccgst) {
-        matcher_err(m, "invalid rule: has more values than the mapping line; ignoring rule");
-        m->rule.skip = true;
+    if (p->rule.num_kccgst_values + 1 > p->mapping.num_kccgst) {
+        parser_err(p, "invalid rule: has more values than the mapping line; ignoring rule");
+        p->rule.skip = true;
         return;
     }
-    m->rule.kccgst_value_at_pos[m->rule.num_kccgst_values] = ident;
-    m->rule.num_kccgst_values++;
+    p->rule.kccgst_value_at_pos[p->rule.num_kccgst_values] = ident;
+    p->rule.num_kccgst_values++;
+}
+
+static void
+parser_rule_verify(struct parser *p)
+{
+    if (p->rule.num_mlvo_values != p->mapping.num_mlvo ||
+        p->rule.num_kccgst_values != p->mapping.num_kccgst) {
+        parser_err(p, "invalid rule: must have same number of values as mapping line; ignoring rule");
+        p->rule.skip = true;
+    }
+}
+
+static void
+parser_rule_add(struct parser *p)
+{
+    struct mapping *mapping = &darray_item(p->rules->mappings,
+                                           darray_size(p->rules->mappings) - 1);
+    darray_append(mapping->rules, p->rule);
+}
+
+static enum rules_token
+gettok(struct parser *p)
+{
+    return lex(&p->scanner, &p->val);
 }
 
 static bool
-match_group(struct matcher *m, struct sval group_name, struct sval to)
+rules_parse(struct parser *p)
 {
-    struct group *group;
-    struct sval *element;
-    bool found = false;
+    enum rules_token tok;
 
-    darray_foreach(group, m->groups) {
-        if (svaleq(group->name, group_name)) {
-            found = true;
-            break;
-        }
+initial:
+    switch (tok = gettok(p)) {
+    case TOK_BANG:
+        goto bang;
+    case TOK_END_OF_LINE:
+        goto initial;
+    case TOK_END_OF_FILE:
+        goto finish;
+    default:
+        goto unexpected;
     }
 
-    if (!found) {
-        /*
-         * rules/evdev intentionally uses some undeclared group names
-         * in rules (e.g. commented group definitions which may be
-         * uncommented if needed). So we continue silently.
-         */
-        return false;
+bang:
+    switch (tok = gettok(p)) {
+    case TOK_GROUP_NAME:
+        parser_group_start_new(p, p->val.string);
+        goto group_name;
+    case TOK_IDENTIFIER:
+        parser_mapping_start_new(p);
+        parser_mapping_set_mlvo(p, p->val.string);
+        goto mapping_mlvo;
+    default:
+        goto unexpected;
+    }
+
+group_name:
+    switch (tok = gettok(p)) {
+    case TOK_EQUALS:
+        goto group_element;
+    default:
+        goto unexpected;
+    }
+
+group_element:
+    switch (tok = gettok(p)) {
+    case TOK_IDENTIFIER:
+        parser_group_add_element(p, p->val.string);
+        goto group_element;
+    case TOK_END_OF_LINE:
+        goto initial;
+    default:
+        goto unexpected;
+    }
+
+mapping_mlvo:
+    switch (tok = gettok(p)) {
+    case TOK_IDENTIFIER:
+        if (!p->mapping.skip)
+            parser_mapping_set_mlvo(p, p->val.string);
+        goto mapping_mlvo;
+    case TOK_EQUALS:
+        goto mapping_kccgst;
+    default:
+        goto unexpected;
+    }
+
+mapping_kccgst:
+    switch (tok = gettok(p)) {
+    case TOK_IDENTIFIER:
+        if (!p->mapping.skip)
+            parser_mapping_set_kccgst(p, p->val.string);
+        goto mapping_kccgst;
+    case TOK_END_OF_LINE:
+        if (!p->mapping.skip)
+            parser_mapping_verify(p);
+        parser_mapping_add(p);
+        goto rule_mlvo_first;
+    default:
+        goto unexpected;
+    }
+
+rule_mlvo_first:
+    switch (tok = gettok(p)) {
+    case TOK_BANG:
+        goto bang;
+    case TOK_END_OF_LINE:
+        goto rule_mlvo_first;
+    case TOK_END_OF_FILE:
+        goto finish;
+    default:
+        parser_rule_start_new(p);
+        goto rule_mlvo_no_tok;
+    }
+
+rule_mlvo:
+    tok = gettok(p);
+rule_mlvo_no_tok:
+    switch (tok) {
+    case TOK_IDENTIFIER:
+        if (!p->rule.skip)
+            parser_rule_set_mlvo(p, p->val.string);
+        goto rule_mlvo;
+    case TOK_STAR:
+        if (!p->rule.skip)
+            parser_rule_set_mlvo_wildcard(p);
+        goto rule_mlvo;
+    case TOK_GROUP_NAME:
+        if (!p->rule.skip)
+            parser_rule_set_mlvo_group(p, p->val.string);
+        goto rule_mlvo;
+    case TOK_EQUALS:
+        goto rule_kccgst;
+    default:
+        goto unexpected;
+    }
+
+rule_kccgst:
+    switch (tok = gettok(p)) {
+    case TOK_IDENTIFIER:
+        if (!p->rule.skip)
+            parser_rule_set_kccgst(p, p->val.string);
+        goto rule_kccgst;
+    case TOK_END_OF_LINE:
+        if (!p->rule.skip)
+            parser_rule_verify(p);
+        if (!p->rule.skip)
+            parser_rule_add(p);
+        goto rule_mlvo_first;
+    default:
+        goto unexpected;
+    }
+
+unexpected:
+    switch (tok) {
+    case TOK_ERROR:
+        goto error;
+    default:
+        goto state_error;
     }
 
+finish:
+    parser_mapping_finish(p);
+    return true;
+
+state_error:
+    parser_err(p, "unexpected token");
+error:
+    return false;
+}
+
+static struct rules *
+rules_new_from_file(struct xkb_context *ctx, FILE *file, const char *path)
+{
+    bool ok;
+    const char *string;
+    size_t size;
+    struct rules *rules;
+    struct parser p = { .rules = NULL };
+
+    ok = map_file(file, &string, &size);
+    if (!ok) {
+        log_err(ctx, "Couldn't read rules file \"%s\": %s\n",
+                path, strerror(errno));
+        return NULL;
+    }
+
+    rules = calloc(1, sizeof(*rules));
+    if (!rules)
+        goto err;
+
+    rules->file_name = strdup(path);
+    rules->string = malloc(size > 0 ? size : 1);
+    if (!rules->file_name || !rules->string)
+        goto err;
+    memcpy(rules->string, string, size);
+
+    p.rules = rules;
+    scanner_init(&p.scanner, ctx, rules->string, size, rules->file_name);
+    if (!rules_parse(&p))
+        goto err;
+
+    unmap_file(string, size);
+    return rules;
+
+err:
+    rules_free(rules);
+    unmap_file(string, size);
+    return NULL;
+}
+
+/* Returns the parsed rules file, from the cache if it hasn't changed. */
+static const struct rules *
+rules_get(struct xkb_context *ctx, FILE *file, const char *path)
+{
+    struct rules_cache_entry *entry;
+    struct rules_cache_entry new;
+    struct file_stamp stamp;
+
+    if (!file_stamp_get(&stamp, file)) {
+        log_err(ctx, "Couldn't stat rules file \"%s\": %s\n",
+                path, strerror(errno));
+        return NULL;
+    }
+
+    darray_foreach(entry, ctx->rules_cache) {
+        if (!streq(entry->path, path))
+            continue;
+
+        if (file_stamp_eq(&entry->stamp, &stamp))
+            return entry->rules;
+
+        /* It has changed; rules are only in use during a lookup. */
+        rules_free(entry->rules);
+        entry->rules = rules_new_from_file(ctx, file, path);
+        entry->stamp = stamp;
+        return entry->rules;
+    }
+
+    new.path = strdup(path);
+    if (!new.path)
+        return NULL;
+    new.stamp = stamp;
+    new.rules = rules_new_from_file(ctx, file, path);
+    darray_append(ctx->rules_cache, new);
+    return new.rules;
+}
+
+void
+xkb_context_rules_cache_clear(struct xkb_context *ctx)
+{
+    struct rules_cache_entry *entry;
+
+    darray_foreach(entry, ctx->rules_cache) {
+        free(entry->path);
+        rules_free(entry->rules);
+    }
+    darray_free(ctx->rules_cache);
+}
+
+static struct matcher *
+matcher_new(struct xkb_context *ctx, const struct rules *rules)
+{
+    struct matcher *m = calloc(1, sizeof(*m));
+    if (!m)
+        return NULL;
+
+    m->ctx = ctx;
+    m->rules = rules;
+
+    return m;
+}
+
+/* Prepare the matcher for a new lookup, reusing its arrays. */
+static void
+matcher_set_names(struct matcher *m, const struct xkb_rule_names *rmlvo)
+{
+    m->rmlvo.model.start = rmlvo->model;
+    m->rmlvo.model.len = strlen_safe(rmlvo->model);
+    split_comma_separated_string(&m->rmlvo.layouts, rmlvo->layout);
+    split_comma_separated_string(&m->rmlvo.variants, rmlvo->variant);
+    split_comma_separated_string(&m->rmlvo.options, rmlvo->options);
+
+    for (int i = 0; i < _KCCGST_NUM_ENTRIES; i++)
+        darray_resize(m->kccgst[i], 0);
+}
+
+static void
+matcher_free(struct matcher *m)
+{
+    if (!m)
+        return;
+    darray_free(m->rmlvo.layouts);
+    darray_free(m->rmlvo.variants);
+    darray_free(m->rmlvo.options);
+    for (int i = 0; i < _KCCGST_NUM_ENTRIES; i++)
+        darray_free(m->kccgst[i]);
+    free(m);
+}
+
+#define matcher_err(matcher, rule, fmt, ...) \
+    xkb_log((matcher)->ctx, XKB_LOG_LEVEL_ERROR, 0, "%s:%u:%u: " fmt "\n", \
+            (matcher)->rules->file_name, (rule)->line, (rule)->column, \
+            ## __VA_ARGS__)
+
+static bool
+match_group(struct matcher *m, int group_idx, struct sval to)
+{
+    const struct group *group;
+    const struct sval *element;
+
+    if (group_idx < 0)
+        return false;
+
+    group = &darray_item(m->rules->groups, group_idx);
     darray_foreach(element, group->elements)
         if (svaleq(to, *element))
             return true;
@@ -585,14 +954,16 @@ match_group(struct matcher *m, struct sval group_name, struct sval to)
 }
 
 static bool
-match_value(struct matcher *m, struct sval val, struct sval to,
-          enum mlvo_match_type match_type)
+match_value(struct matcher *m, const struct rule *rule, unsigned pos,
+            struct sval to)
 {
+    enum mlvo_match_type match_type = rule->match_type_at_pos[pos];
+
     if (match_type == MLVO_MATCH_WILDCARD)
         return true;
     if (match_type == MLVO_MATCH_GROUP)
-        return match_group(m, val, to);
-    return svaleq(val, to);
+        return match_group(m, rule->group_at_pos[pos], to);
+    return svaleq(rule->mlvo_value_at_pos[pos], to);
 }
 
 /*
@@ -600,8 +971,8 @@ match_value(struct matcher *m, struct sval val, struct sval to,
  * and appends the result to @to.
  */
 static bool
-append_expanded_kccgst_value(struct matcher *m, darray_char *to,
-                             struct sval value)
+append_expanded_kccgst_value(struct matcher *m, const struct rule *rule,
+                             darray_char *to, struct sval value)
 {
     const char *s = value.start;
     darray_char expanded = darray_new();
@@ -650,7 +1021,7 @@ append_expanded_kccgst_value(struct matcher *m, darray_char *to,
             int consumed;
 
             if (mlv != MLVO_LAYOUT && mlv != MLVO_VARIANT) {
-                matcher_err(m, "invalid index in %%-expansion; may only index layout or variant");
+                matcher_err(m, rule, "invalid index in %%-expansion; may only index layout or variant");
                 goto error;
             }
 
@@ -724,275 +1095,298 @@ append_expanded_kccgst_value(struct matcher *m, darray_char *to,
 
 error:
     darray_free(expanded);
-    matcher_err(m, "invalid %%-expansion in value; not used");
+    matcher_err(m, rule, "invalid %%-expansion in value; not used");
     return false;
 }
 
-static void
-matcher_rule_verify(struct matcher *m)
-{
-    if (m->rule.num_mlvo_values != m->mapping.num_mlvo ||
-        m->rule.num_kccgst_values != m->mapping.num_kccgst) {
-        matcher_err(m, "invalid rule: must have same number of values as mapping line; ignoring rule");
-        m->rule.skip = true;
-    }
-}
-
-static void
-matcher_rule_apply_if_matches(struct matcher *m)
+/*
+ * Whether the mapping line applies to the RMLVO at all.
+ * This following is very stupid, but this is how it works.
+ * See the "Notes" section in the overview above.
+ */
+static bool
+matcher_mapping_applies(struct matcher *m, const struct mapping *mapping)
 {
-    for (unsigned i = 0; i < m->mapping.num_mlvo; i++) {
-        enum rules_mlvo mlvo = m->mapping.mlvo_at_pos[i];
-        struct sval value = m->rule.mlvo_value_at_pos[i];
-        enum mlvo_match_type match_type = m->rule.match_type_at_pos[i];
-        bool matched = false;
-
-        if (mlvo == MLVO_MODEL) {
-            matched = match_value(m, value, m->rmlvo.model, match_type);
+    if (mapping->defined_mlvo_mask & (1u << MLVO_LAYOUT)) {
+        if (mapping->layout_idx == XKB_LAYOUT_INVALID) {
+            if (darray_size(m->rmlvo.layouts) > 1)
+                return false;
         }
-        else if (mlvo == MLVO_LAYOUT) {
-            xkb_layout_index_t idx = m->mapping.layout_idx;
-            idx = (idx == XKB_LAYOUT_INVALID ? 0 : idx);
-            matched = match_value(m, value,
-                                  darray_item(m->rmlvo.layouts, idx),
-                                  match_type);
+        else {
+            if (darray_size(m->rmlvo.layouts) == 1 ||
+                mapping->layout_idx >= darray_size(m->rmlvo.layouts))
+                return false;
         }
-        else if (mlvo == MLVO_VARIANT) {
-            xkb_layout_index_t idx = m->mapping.layout_idx;
-            idx = (idx == XKB_LAYOUT_INVALID ? 0 : idx);
-            matched = match_value(m, value,
-                                  darray_item(m->rmlvo.variants, idx),
-                                  match_type);
+    }
+
+    if (mapping->defined_mlvo_mask & (1u << MLVO_VARIANT)) {
+        if (mapping->variant_idx == XKB_LAYOUT_INVALID) {
+            if (darray_size(m->rmlvo.variants) > 1)
+                return false;
         }
-        else if (mlvo == MLVO_OPTION) {
-            struct sval *option;
-            darray_foreach(option, m->rmlvo.options) {
-                matched = match_value(m, value, *option, match_type);
-                if (matched)
-                    break;
-            }
+        else {
+            if (darray_size(m->rmlvo.variants) == 1 ||
+                mapping->variant_idx >= darray_size(m->rmlvo.variants))
+                return false;
         }
-
-        if (!matched)
-            return;
     }
 
-    for (unsigned i = 0; i < m->mapping.num_kccgst; i++) {
-        enum rules_kccgst kccgst = m->mapping.kccgst_at_pos[i];
-        struct sval value = m->rule.kccgst_value_at_pos[i];
-        append_expanded_kccgst_value(m, &m->kccgst[kccgst], value);
-    }
+    return true;
+}
 
-    /*
-     * If a rule matches in a rule set, the rest of the set should be
-     * skipped. However, rule sets matching against options may contain
-     * several legitimate rules, so they are processed entirely.
-     */
-    if (!(m->mapping.defined_mlvo_mask & (1 << MLVO_OPTION)))
-        m->mapping.skip = true;
+/* The values of the RMLVO which @mlvo is matched against. */
+static const struct sval *
+matcher_values(struct matcher *m, const struct mapping *mapping,
+               enum rules_mlvo mlvo, unsigned *num_values)
+{
+    xkb_layout_index_t idx = mapping->layout_idx;
+    idx = (idx == XKB_LAYOUT_INVALID ? 0 : idx);
+
+    *num_values = 1;
+    switch (mlvo) {
+    case MLVO_MODEL:
+        return &m->rmlvo.model;
+    case MLVO_LAYOUT:
+        return &darray_item(m->rmlvo.layouts, idx);
+    case MLVO_VARIANT:
+        return &darray_item(m->rmlvo.variants, idx);
+    case MLVO_OPTION:
+    default:
+        *num_values = darray_size(m->rmlvo.options);
+        return m->rmlvo.options.item;
+    }
 }
 
-static enum rules_token
-gettok(struct matcher *m)
+static bool
+matcher_rule_matches(struct matcher *m, const struct mapping *mapping,
+                     const struct rule *rule)
 {
-    return lex(&m->scanner, &m->val);
+    for (unsigned i = 0; i < mapping->num_mlvo; i++) {
+        const struct sval *values;
+        unsigned num_values;
+        bool matched = false;
+
+        values = matcher_values(m, mapping, mapping->mlvo_at_pos[i],
+                                &num_values);
+        for (unsigned j = 0; j < num_values && !matched; j++)
+            matched = match_value(m, rule, i, values[j]);
+
+        if (!matched)
+            return false;
+    }
+
+    return true;
 }
 
+/* Returns true if the rule matched. */
 static bool
-matcher_match(struct matcher *m, const char *string, size_t len,
-              const char *file_name, struct xkb_component_names *out)
+matcher_rule_apply_if_matches(struct matcher *m,
+                              const struct mapping *mapping,
+                              unsigned int rule_idx)
 {
-    enum rules_token tok;
+    const struct rule *rule = &darray_item(mapping->rules, rule_idx);
 
-    if (!m)
+    if (!matcher_rule_matches(m, mapping, rule))
         return false;
 
-    scanner_init(&m->scanner, m->ctx, string, len, file_name);
-
-initial:
-    switch (tok = gettok(m)) {
-    case TOK_BANG:
-        goto bang;
-    case TOK_END_OF_LINE:
-        goto initial;
-    case TOK_END_OF_FILE:
-        goto finish;
-    default:
-        goto unexpected;
+    for (unsigned i = 0; i < mapping->num_kccgst; i++) {
+        enum rules_kccgst kccgst = mapping->kccgst_at_pos[i];
+        struct sval value = rule->kccgst_value_at_pos[i];
+        append_expanded_kccgst_value(m, rule, &m->kccgst[kccgst], value);
     }
 
-bang:
-    switch (tok = gettok(m)) {
-    case TOK_GROUP_NAME:
-        matcher_group_start_new(m, m->val.string);
-        goto group_name;
-    case TOK_IDENTIFIER:
-        matcher_mapping_start_new(m);
-        matcher_mapping_set_mlvo(m, m->val.string);
-        goto mapping_mlvo;
-    default:
-        goto unexpected;
-    }
+    return true;
+}
 
-group_name:
-    switch (tok = gettok(m)) {
-    case TOK_EQUALS:
-        goto group_element;
-    default:
-        goto unexpected;
+/* Appends the indexes of the rules keyed by @value to @candidates. */
+static void
+mapping_find_keyed_rules(const struct mapping *mapping, struct sval value,
+                         darray_uint *candidates)
+{
+    unsigned lo = 0, hi = darray_size(mapping->keys);
+
+    /* Find the first key not less than @value. */
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        if (svalcmp(darray_item(mapping->keys, mid).value, value) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
 
-group_element:
-    switch (tok = gettok(m)) {
-    case TOK_IDENTIFIER:
-        matcher_group_add_element(m, m->val.string);
-        goto group_element;
-    case TOK_END_OF_LINE:
-        goto initial;
-    default:
-        goto unexpected;
+    for (; lo < darray_size(mapping->keys); lo++) {
+        const struct rule_key *key = &darray_item(mapping->keys, lo);
+        if (!svaleq(key->value, value))
+            break;
+        darray_append(*candidates, key->rule_idx);
     }
+}
 
-mapping_mlvo:
-    switch (tok = gettok(m)) {
-    case TOK_IDENTIFIER:
-        if (!m->mapping.skip)
-            matcher_mapping_set_mlvo(m, m->val.string);
-        goto mapping_mlvo;
-    case TOK_EQUALS:
-        goto mapping_kccgst;
-    default:
-        goto unexpected;
+/*
+ * Only the rules whose first value is a wildcard or a group, or equal to
+ * the value it is matched against, can match; the rest need not be
+ * looked at. The candidates are tried in the order of the file.
+ */
+static void
+matcher_match_mapping(struct matcher *m, const struct mapping *mapping)
+{
+    darray_uint candidates = darray_new();
+    const struct sval *values;
+    unsigned num_values;
+    unsigned int *rule_idx;
+
+    values = matcher_values(m, mapping, mapping->mlvo_at_pos[0], &num_values);
+    for (unsigned i = 0; i < num_values; i++)
+        mapping_find_keyed_rules(mapping, values[i], &candidates);
+    if (!darray_empty(mapping->other_rules))
+        darray_append_items(candidates, mapping->other_rules.item,
+                            darray_size(mapping->other_rules));
+
+    /* Insertion sort, there are usually very few. */
+    for (unsigned i = 1; i < darray_size(candidates); i++) {
+        unsigned int idx = darray_item(candidates, i);
+        unsigned j = i;
+
+        while (j > 0 && darray_item(candidates, j - 1) > idx) {
+            darray_item(candidates, j) = darray_item(candidates, j - 1);
+            j--;
+        }
+        darray_item(candidates, j) = idx;
     }
 
-mapping_kccgst:
-    switch (tok = gettok(m)) {
-    case TOK_IDENTIFIER:
-        if (!m->mapping.skip)
-            matcher_mapping_set_kccgst(m, m->val.string);
-        goto mapping_kccgst;
-    case TOK_END_OF_LINE:
-        if (!m->mapping.skip)
-            matcher_mapping_verify(m);
-        goto rule_mlvo_first;
-    default:
-        goto unexpected;
-    }
+    darray_foreach(rule_idx, candidates) {
+        /* The same option might be given twice. */
+        if (rule_idx != candidates.item && *rule_idx == *(rule_idx - 1))
+            continue;
 
-rule_mlvo_first:
-    switch (tok = gettok(m)) {
-    case TOK_BANG:
-        goto bang;
-    case TOK_END_OF_LINE:
-        goto rule_mlvo_first;
-    case TOK_END_OF_FILE:
-        goto finish;
-    default:
-        matcher_rule_start_new(m);
-        goto rule_mlvo_no_tok;
+        /*
+         * If a rule matches in a rule set, the rest of the set should be
+         * skipped. However, rule sets matching against options may
+         * contain several legitimate rules, so they are processed
+         * entirely.
+         */
+        if (matcher_rule_apply_if_matches(m, mapping, *rule_idx) &&
+            !(mapping->defined_mlvo_mask & (1 << MLVO_OPTION)))
+            break;
     }
 
-rule_mlvo:
-    tok = gettok(m);
-rule_mlvo_no_tok:
-    switch (tok) {
-    case TOK_IDENTIFIER:
-        if (!m->rule.skip)
-            matcher_rule_set_mlvo(m, m->val.string);
-        goto rule_mlvo;
-    case TOK_STAR:
-        if (!m->rule.skip)
-            matcher_rule_set_mlvo_wildcard(m);
-        goto rule_mlvo;
-    case TOK_GROUP_NAME:
-        if (!m->rule.skip)
-            matcher_rule_set_mlvo_group(m, m->val.string);
-        goto rule_mlvo;
-    case TOK_EQUALS:
-        goto rule_kccgst;
-    default:
-        goto unexpected;
-    }
+    darray_free(candidates);
+}
 
-rule_kccgst:
-    switch (tok = gettok(m)) {
-    case TOK_IDENTIFIER:
-        if (!m->rule.skip)
-            matcher_rule_set_kccgst(m, m->val.string);
-        goto rule_kccgst;
-    case TOK_END_OF_LINE:
-        if (!m->rule.skip)
-            matcher_rule_verify(m);
-        if (!m->rule.skip)
-            matcher_rule_apply_if_matches(m);
-        goto rule_mlvo_first;
-    default:
-        goto unexpected;
-    }
+static bool
+matcher_match(struct matcher *m, struct xkb_component_names *out)
+{
+    const struct mapping *mapping;
 
-unexpected:
-    switch (tok) {
-    case TOK_ERROR:
-        goto error;
-    default:
-        goto state_error;
-    }
+    darray_foreach(mapping, m->rules->mappings)
+        if (matcher_mapping_applies(m, mapping))
+            matcher_match_mapping(m, mapping);
 
-finish:
     if (darray_empty(m->kccgst[KCCGST_KEYCODES]) ||
         darray_empty(m->kccgst[KCCGST_TYPES]) ||
         darray_empty(m->kccgst[KCCGST_COMPAT]) ||
         /* darray_empty(m->kccgst[KCCGST_GEOMETRY]) || */
         darray_empty(m->kccgst[KCCGST_SYMBOLS]))
-        goto error;
+        return false;
 
     darray_steal(m->kccgst[KCCGST_KEYCODES], &out->keycodes, NULL);
     darray_steal(m->kccgst[KCCGST_TYPES], &out->types, NULL);
     darray_steal(m->kccgst[KCCGST_COMPAT], &out->compat, NULL);
     darray_steal(m->kccgst[KCCGST_SYMBOLS], &out->symbols, NULL);
-    darray_free(m->kccgst[KCCGST_GEOMETRY]);
 
     return true;
-
-state_error:
-    matcher_err(m, "unexpected token");
-error:
-    return false;
 }
 
-bool
-xkb_components_from_rules(struct xkb_context *ctx,
-                          const struct xkb_rule_names *rmlvo,
-                          struct xkb_component_names *out)
+/*
+ * Resolve all the names in @rmlvos which use the same rules file as
+ * @rmlvos[first], and mark them in @done.  Returns the number of names
+ * resolved successfully.
+ */
+static size_t
+components_from_rules_file(struct xkb_context *ctx,
+                           const struct xkb_rule_names *rmlvos,
+                           size_t first, size_t count, bool *done,
+                           struct xkb_component_names *out)
 {
-    bool ret = false;
+    size_t n = 0;
     FILE *file;
-    char *path;
-    const char *string;
-    size_t size;
-    struct matcher *matcher;
+    char *path = NULL;
+    const struct rules *rules = NULL;
+    struct matcher *matcher = NULL;
+    const char *rules_name = rmlvos[first].rules;
+
+    /* The parsed rules may be replaced by another thread otherwise. */
+    xkb_context_lock(ctx, &ctx->rules_lock);
+
+    file = FindFileInXkbPath(ctx, rules_name, FILE_TYPE_RULES, &path);
+    if (file) {
+        rules = rules_get(ctx, file, path);
+        fclose(file);
+    }
+    if (rules)
+        matcher = matcher_new(ctx, rules);
 
-    file = FindFileInXkbPath(ctx, rmlvo->rules, FILE_TYPE_RULES, &path);
-    if (!file)
-        goto err_out;
+    for (size_t i = first; i < count; i++) {
+        if (done[i] || !streq_null(rmlvos[i].rules, rules_name))
+            continue;
+        done[i] = true;
 
-    ret = map_file(file, &string, &size);
-    if (!ret) {
-        log_err(ctx, "Couldn't read rules file \"%s\": %s\n",
-                path, strerror(errno));
-        goto err_file;
+        if (matcher) {
+            matcher_set_names(matcher, &rmlvos[i]);
+            if (matcher_match(matcher, &out[i])) {
+                n++;
+                continue;
+            }
+        }
+
+        if (path)
+            log_err(ctx, "No components returned from XKB rules \"%s\"\n",
+                    path);
     }
 
-    matcher = matcher_new(ctx, rmlvo);
-    ret = matcher_match(matcher, string, size, path, out);
-    if (!ret)
-        log_err(ctx, "No components returned from XKB rules \"%s\"\n", path);
     matcher_free(matcher);
-
-    unmap_file(string, size);
-err_file:
+    xkb_context_unlock(ctx, &ctx->rules_lock);
     free(path);
-    fclose(file);
-err_out:
-    return ret;
+    return n;
+}
+
+static size_t
+components_from_rules(struct xkb_context *ctx,
+                      const struct xkb_rule_names *rmlvos, size_t count,
+                      struct xkb_component_names *out)
+{
+    size_t n = 0;
+    bool *done;
+
+    memset(out, 0, count * sizeof(*out));
+
+    done = calloc(count > 0 ? count : 1, sizeof(*done));
+    if (!done)
+        return 0;
+
+    /* Group the lookups by rules file, so each is only fetched once. */
+    for (size_t i = 0; i < count; i++)
+        if (!done[i])
+            n += components_from_rules_file(ctx, rmlvos, i, count, done, out);
+
+    free(done);
+    return n;
+}
+
+bool
+xkb_components_from_rules(struct xkb_context *ctx,
+                          const struct xkb_rule_names *rmlvo,
+                          struct xkb_component_names *out)
+{
+    return components_from_rules(ctx, rmlvo, 1, out) == 1;
+}
+
+size_t
+xkb_components_from_rules_bulk(struct xkb_context *ctx,
+                               const struct xkb_rule_names *rmlvos,
+                               size_t count,
+                               struct xkb_component_names *out)
+{
+    RefreshIncludeCaches(ctx);
+    return components_from_rules(ctx, rmlvos, count, out);
 }
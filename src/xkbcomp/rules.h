@@ -29,4 +29,11 @@ xkb_components_from_rules(struct xkb_context *ctx,
                           const struct xkb_rule_names *rmlvo,
                           struct xkb_component_names *out);
 
+/* Resolves @count names at once, fetching each rules file only once. */
+size_t
+xkb_components_from_rules_bulk(struct xkb_context *ctx,
+                               const struct xkb_rule_names *rmlvos,
+                               size_t count,
+                               struct xkb_component_names *out);
+
 #endif
@@ -173,6 +173,8 @@ typedef struct {
     enum merge_mode merge;
     xkb_layout_index_t explicit_group;
     darray(KeyInfo) keys;
+    /* Key name -> index in keys + 1. */
+    darray_uint key_index;
     KeyInfo default_key;
     ActionsInfo *actions;
     darray(xkb_atom_t) group_names;
@@ -206,6 +208,7 @@ ClearSymbolsInfo(SymbolsInfo *info)
     darray_foreach(keyi, info->keys)
         ClearKeyInfo(keyi);
     darray_free(info->keys);
+    darray_free(info->key_index);
     darray_free(info->group_names);
     darray_free(info->modmaps);
     ClearKeyInfo(&info->default_key);
@@ -415,7 +418,7 @@ static bool
 AddKeySymbols(SymbolsInfo *info, KeyInfo *keyi, bool same_file)
 {
     xkb_atom_t real_name;
-    KeyInfo *iter;
+    unsigned idx;
 
     /*
      * Don't keep aliases in the keys array; this guarantees that
@@ -427,11 +430,14 @@ AddKeySymbols(SymbolsInfo *info, KeyInfo *keyi, bool same_file)
     if (real_name != XKB_ATOM_NONE)
         keyi->name = real_name;
 
-    darray_foreach(iter, info->keys)
-        if (iter->name == keyi->name)
-            return MergeKeys(info, iter, keyi, same_file);
+    idx = atom_index_get(&info->key_index, keyi->name);
+    if (idx != 0 && idx <= darray_size(info->keys) &&
+        darray_item(info->keys, idx - 1).name == keyi->name)
+        return MergeKeys(info, &darray_item(info->keys, idx - 1), keyi,
+                         same_file);
 
     darray_append(info->keys, *keyi);
+    atom_index_set(&info->key_index, keyi->name, darray_size(info->keys));
     InitKeyInfo(info->ctx, keyi);
     return true;
 }
@@ -520,6 +526,9 @@ MergeIncludedSymbols(SymbolsInfo *into, SymbolsInfo *from,
     if (darray_empty(into->keys)) {
         into->keys = from->keys;
         darray_init(from->keys);
+        darray_free(into->key_index);
+        into->key_index = from->key_index;
+        darray_init(from->key_index);
     }
     else {
         darray_foreach(keyi, from->keys) {
@@ -551,8 +560,7 @@ HandleIncludeSymbols(SymbolsInfo *info, IncludeStmt *include)
     SymbolsInfo included;
 
     InitSymbolsInfo(&included, info->keymap, info->actions, &info->mods);
-    included.name = include->stmt;
-    include->stmt = NULL;
+    included.name = strdup_safe(include->stmt);
 
     for (IncludeStmt *stmt = include; stmt; stmt = stmt->next_incl) {
         SymbolsInfo next_incl;
@@ -586,7 +594,6 @@ HandleIncludeSymbols(SymbolsInfo *info, IncludeStmt *include)
         MergeIncludedSymbols(&included, &next_incl, stmt->merge);
 
         ClearSymbolsInfo(&next_incl);
-        FreeXkbFile(file);
     }
 
     MergeIncludedSymbols(info, &included, include->merge);
@@ -1242,38 +1249,19 @@ HandleSymbolsFile(SymbolsInfo *info, XkbFile *file, enum merge_mode merge)
 static struct xkb_key *
 FindKeyForSymbol(struct xkb_keymap *keymap, xkb_keysym_t sym)
 {
-    struct xkb_key *key, *ret = NULL;
-    xkb_layout_index_t group, min_group = UINT32_MAX;
-    xkb_level_index_t level, min_level = UINT16_MAX;
-
-    xkb_keys_foreach(key, keymap) {
-        for (group = 0; group < key->num_groups; group++) {
-            for (level = 0; level < XkbKeyGroupWidth(key, group); level++) {
-                if (key->groups[group].levels[level].num_syms != 1 ||
-                    key->groups[group].levels[level].u.sym != sym)
-                    continue;
-
-                /*
-                 * If the keysym was found in a group or level > 0, we must
-                 * keep looking since we might find a key in which the keysym
-                 * is in a lower group or level.
-                 */
-                if (group < min_group ||
-                    (group == min_group && level < min_level)) {
-                    ret = key;
-                    if (group == 0 && level == 0) {
-                        return ret;
-                    }
-                    else {
-                        min_group = group;
-                        min_level = level;
-                    }
-                }
-            }
-        }
+    const struct xkb_keysym_location *locs;
+    unsigned int count;
+
+    /* The index is already sorted by group, level and keycode. */
+    locs = XkbKeysymLocations(keymap->keysym_index, sym, &count);
+    for (unsigned int i = 0; i < count; i++) {
+        struct xkb_key *key = &keymap->keys[locs[i].keycode];
+
+        if (key->groups[locs[i].layout].levels[locs[i].level].num_syms == 1)
+            return key;
     }
 
-    return ret;
+    return NULL;
 }
 
 /*
@@ -1545,6 +1533,11 @@ CopySymbolsToKeymap(struct xkb_keymap *keymap, SymbolsInfo *info)
         if (!CopySymbolsDefToKeymap(keymap, info, keyi))
             info->errorCount++;
 
+    /* Freed with the other indexes once the keymap is compiled. */
+    keymap->keysym_index = XkbBuildKeysymIndex(keymap);
+    if (!keymap->keysym_index)
+        return false;
+
     if (xkb_context_get_log_verbosity(keymap->ctx) > 3) {
         struct xkb_key *key;
 
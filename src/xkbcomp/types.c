@@ -53,6 +53,8 @@ typedef struct {
     int errorCount;
 
     darray(KeyTypeInfo) types;
+    /* Type name -> index in types + 1. */
+    darray_uint type_index;
     struct xkb_mod_set mods;
 
     struct xkb_context *ctx;
@@ -117,18 +119,19 @@ ClearKeyTypesInfo(KeyTypesInfo *info)
 {
     free(info->name);
     darray_free(info->types);
+    darray_free(info->type_index);
 }
 
 static KeyTypeInfo *
 FindMatchingKeyType(KeyTypesInfo *info, xkb_atom_t name)
 {
-    KeyTypeInfo *old;
+    unsigned idx = atom_index_get(&info->type_index, name);
 
-    darray_foreach(old, info->types)
-        if (old->name == name)
-            return old;
+    if (idx == 0 || idx > darray_size(info->types) ||
+        darray_item(info->types, idx - 1).name != name)
+        return NULL;
 
-    return NULL;
+    return &darray_item(info->types, idx - 1);
 }
 
 static bool
@@ -165,6 +168,7 @@ AddKeyType(KeyTypesInfo *info, KeyTypeInfo *new, bool same_file)
     }
 
     darray_append(info->types, *new);
+    atom_index_set(&info->type_index, new->name, darray_size(info->types));
     return true;
 }
 
@@ -191,6 +195,9 @@ MergeIncludedKeyTypes(KeyTypesInfo *into, KeyTypesInfo *from,
     if (darray_empty(into->types)) {
         into->types = from->types;
         darray_init(from->types);
+        darray_free(into->type_index);
+        into->type_index = from->type_index;
+        darray_init(from->type_index);
     }
     else {
         darray_foreach(type, from->types) {
@@ -210,8 +217,7 @@ HandleIncludeKeyTypes(KeyTypesInfo *info, IncludeStmt *include)
     KeyTypesInfo included;
 
     InitKeyTypesInfo(&included, info->ctx, &info->mods);
-    included.name = include->stmt;
-    include->stmt = NULL;
+    included.name = strdup_safe(include->stmt);
 
     for (IncludeStmt *stmt = include; stmt; stmt = stmt->next_incl) {
         KeyTypesInfo next_incl;
@@ -231,7 +237,6 @@ HandleIncludeKeyTypes(KeyTypesInfo *info, IncludeStmt *include)
         MergeIncludedKeyTypes(&included, &next_incl, stmt->merge);
 
         ClearKeyTypesInfo(&next_incl);
-        FreeXkbFile(file);
     }
 
     MergeIncludedKeyTypes(info, &included, include->merge);
@@ -29,10 +29,13 @@
 
 #include "xkbcomp-priv.h"
 #include "rules.h"
+#include "include.h"
 
 static bool
 compile_keymap_file(struct xkb_keymap *keymap, XkbFile *file)
 {
+    bool ok;
+
     if (file->file_type != FILE_TYPE_KEYMAP) {
         log_err(keymap->ctx,
                 "Cannot compile a %s file alone into a keymap\n",
@@ -40,7 +43,11 @@ compile_keymap_file(struct xkb_keymap *keymap, XkbFile *file)
         return false;
     }
 
-    if (!CompileKeymap(file, keymap, MERGE_OVERRIDE)) {
+    HoldIncludeCache(keymap->ctx);
+    ok = CompileKeymap(file, keymap, MERGE_OVERRIDE);
+    ReleaseIncludeCache(keymap->ctx);
+
+    if (!ok) {
         log_err(keymap->ctx,
                 "Failed to compile keymap\n");
         return false;
@@ -63,6 +70,8 @@ text_v1_keymap_new_from_names(struct xkb_keymap *keymap,
             rmlvo->rules, rmlvo->model, rmlvo->layout, rmlvo->variant,
             rmlvo->options);
 
+    RefreshIncludeCaches(keymap->ctx);
+
     ok = xkb_components_from_rules(keymap->ctx, rmlvo, &kccgst);
     if (!ok) {
         log_err(keymap->ctx,
@@ -103,6 +112,8 @@ text_v1_keymap_new_from_string(struct xkb_keymap *keymap,
     bool ok;
     XkbFile *xkb_file;
 
+    RefreshIncludeCaches(keymap->ctx);
+
     xkb_file = XkbParseString(keymap->ctx, string, len, "(input string)", NULL);
     if (!xkb_file) {
         log_err(keymap->ctx, "Failed to parse input xkb string\n");
@@ -120,6 +131,8 @@ text_v1_keymap_new_from_file(struct xkb_keymap *keymap, FILE *file)
     bool ok;
     XkbFile *xkb_file;
 
+    RefreshIncludeCaches(keymap->ctx);
+
     xkb_file = XkbParseFile(keymap->ctx, file, "(unknown file)", NULL);
     if (!xkb_file) {
         log_err(keymap->ctx, "Failed to parse input xkb file\n");
@@ -144,6 +144,39 @@ test_random_strings(void)
     atom_table_free(table);
 }
 
+static void
+test_many_strings(void)
+{
+    struct atom_table *table;
+    char buf[4096];
+    xkb_atom_t atoms[5000];
+
+    table = atom_table_new();
+    assert(table);
+
+    /* Enough to grow the index and use several string blocks. */
+    for (int i = 0; i < 5000; i++) {
+        int len = snprintf(buf, sizeof(buf), "atom%d", i);
+        atoms[i] = atom_intern(table, buf, len, false);
+        assert(atoms[i] == (xkb_atom_t) i + 1);
+    }
+
+    /* A string which doesn't fit in a block. */
+    memset(buf, 'x', sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    assert(atom_intern(table, buf, sizeof(buf) - 1, false) == 5001);
+    assert(streq(atom_text(table, 5001), buf));
+    assert(atom_lookup(table, buf, sizeof(buf) - 2) == XKB_ATOM_NONE);
+
+    for (int i = 0; i < 5000; i++) {
+        int len = snprintf(buf, sizeof(buf), "atom%d", i);
+        assert(atom_lookup(table, buf, len) == atoms[i]);
+        assert(streq(atom_text(table, atoms[i]), buf));
+    }
+
+    atom_table_free(table);
+}
+
 int
 main(void)
 {
@@ -176,6 +209,7 @@ main(void)
     atom_table_free(table);
 
     test_random_strings();
+    test_many_strings();
 
     return 0;
 }
@@ -0,0 +1,152 @@
+/*
+ * Copyright © 2012 Ran Benita <ran234@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Like bench-key-proc, but spreads the lookups over many keymaps at once,
+ * so that the keymaps do not all fit in the cache, and counts the cache
+ * misses if the kernel lets us.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "test.h"
+
+#define BENCHMARK_ITERATIONS 5000000
+#define NUM_KEYMAPS 64
+
+static const char *layouts[] = {
+    "us", "de", "ru", "il", "cz", "ca", "ch", "in",
+};
+
+static int
+open_cache_miss_counter(void)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void
+bench(struct xkb_state **states)
+{
+    const xkb_keysym_t *syms;
+    xkb_keycode_t keycode;
+    int i, nsyms;
+
+    for (i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        struct xkb_state *state = states[rand() % NUM_KEYMAPS];
+
+        keycode = (rand() % (255 - 9)) + 9;
+        xkb_state_update_key(state, keycode, XKB_KEY_DOWN);
+        nsyms = xkb_state_key_get_syms(state, keycode, &syms);
+        (void) nsyms;
+        xkb_state_update_key(state, keycode, XKB_KEY_UP);
+    }
+}
+
+int
+main(void)
+{
+    struct xkb_context *ctx;
+    struct xkb_keymap *keymaps[NUM_KEYMAPS];
+    struct xkb_state *states[NUM_KEYMAPS];
+    struct timespec start, stop, elapsed;
+    long long misses = 0;
+    int fd, i;
+
+    ctx = test_get_context(0);
+    assert(ctx);
+
+    xkb_context_set_log_level(ctx, XKB_LOG_LEVEL_CRITICAL);
+    xkb_context_set_log_verbosity(ctx, 0);
+
+    for (i = 0; i < NUM_KEYMAPS; i++) {
+        char layout[32];
+
+        snprintf(layout, sizeof(layout), "%s,%s",
+                 layouts[i % ARRAY_SIZE(layouts)],
+                 layouts[(i / ARRAY_SIZE(layouts)) % ARRAY_SIZE(layouts)]);
+        keymaps[i] = test_compile_rules(ctx, "evdev", "pc104", layout,
+                                        NULL, "grp:menu_toggle");
+        assert(keymaps[i]);
+        states[i] = xkb_state_new(keymaps[i]);
+        assert(states[i]);
+    }
+
+    srand(time(NULL));
+
+    fd = open_cache_miss_counter();
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bench(states);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &misses, sizeof(misses)) != sizeof(misses))
+            misses = -1;
+        close(fd);
+    }
+
+    elapsed.tv_sec = stop.tv_sec - start.tv_sec;
+    elapsed.tv_nsec = stop.tv_nsec - start.tv_nsec;
+    if (elapsed.tv_nsec < 0) {
+        elapsed.tv_nsec += 1000000000;
+        elapsed.tv_sec--;
+    }
+
+    fprintf(stderr, "ran %d iterations over %d keymaps in %ld.%09lds\n",
+            BENCHMARK_ITERATIONS, NUM_KEYMAPS,
+            elapsed.tv_sec, elapsed.tv_nsec);
+    if (fd >= 0 && misses >= 0)
+        fprintf(stderr, "%lld cache misses (%.3f per iteration)\n",
+                misses, (double) misses / BENCHMARK_ITERATIONS);
+    else
+        fprintf(stderr, "cache miss counter not available\n");
+
+    for (i = 0; i < NUM_KEYMAPS; i++) {
+        xkb_state_unref(states[i]);
+        xkb_keymap_unref(keymaps[i]);
+    }
+    xkb_context_unref(ctx);
+
+    return 0;
+}
@@ -0,0 +1,207 @@
+/*
+ * Copyright © 2014 libxkbcommon contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "context.h"
+#include "keymap.h"
+
+/* Loading must fail gracefully on anything but the complete keymap. */
+static void
+test_broken_buffers(struct xkb_context *ctx, const char *binary, size_t len)
+{
+    struct xkb_keymap *keymap;
+    char *copy;
+
+    for (size_t i = 0; i < len; i += 1 + len / 500) {
+        keymap = xkb_keymap_new_from_buffer(ctx, binary, i,
+                                            XKB_KEYMAP_FORMAT_BINARY_V1, 0);
+        assert(!keymap);
+    }
+
+    copy = malloc(len);
+    assert(copy);
+    srand(1);
+    for (int i = 0; i < 1000; i++) {
+        size_t pos = rand() % len;
+
+        memcpy(copy, binary, len);
+        copy[pos] = rand();
+        /* Might succeed with a different keymap; just shouldn't crash. */
+        keymap = xkb_keymap_new_from_buffer(ctx, copy, len,
+                                            XKB_KEYMAP_FORMAT_BINARY_V1, 0);
+        xkb_keymap_unref(keymap);
+    }
+    free(copy);
+}
+
+/* A modifier index out of range must not make it into a keymap. */
+static void
+test_bad_virtual_mod(struct xkb_context *ctx, const char *dump)
+{
+    struct xkb_keymap *keymap;
+    char *binary;
+    size_t len;
+    unsigned i;
+
+    keymap = xkb_keymap_new_from_string(ctx, dump, XKB_KEYMAP_FORMAT_TEXT_V1, 0);
+    assert(keymap);
+    for (i = 0; i < keymap->num_sym_interprets; i++)
+        if (keymap->sym_interprets[i].virtual_mod != XKB_MOD_INVALID)
+            break;
+    assert(i < keymap->num_sym_interprets);
+    keymap->sym_interprets[i].virtual_mod = keymap->mods.num_mods;
+    binary = xkb_keymap_get_as_buffer(keymap, XKB_KEYMAP_FORMAT_BINARY_V1,
+                                      &len);
+    assert(binary);
+    xkb_keymap_unref(keymap);
+
+    assert(!xkb_keymap_new_from_buffer(ctx, binary, len,
+                                       XKB_KEYMAP_FORMAT_BINARY_V1, 0));
+    free(binary);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct xkb_context *ctx = test_get_context(0);
+    struct xkb_context *ctx2;
+    struct xkb_keymap *keymap, *keymap2;
+    struct xkb_state *state;
+    char *dump, *dump2, *binary, *binary2;
+    size_t len, len2;
+    FILE *file;
+    enum xkb_log_level old_level;
+    int fds[2];
+
+    assert(ctx);
+
+    keymap = test_compile_rules(ctx, "evdev", "pc104",
+                                "us,ru,il,de", ",,,neo", "grp:menu_toggle");
+    assert(keymap);
+    dump = xkb_keymap_get_as_string(keymap, XKB_KEYMAP_FORMAT_TEXT_V1);
+    assert(dump);
+    binary = xkb_keymap_get_as_buffer(keymap, XKB_KEYMAP_FORMAT_BINARY_V1,
+                                      &len);
+    assert(binary);
+    assert(!xkb_keymap_get_as_string(keymap, XKB_KEYMAP_FORMAT_BINARY_V1));
+    xkb_keymap_unref(keymap);
+
+    /* Load it into another context, with different atoms. */
+    ctx2 = test_get_context(0);
+    assert(ctx2);
+    xkb_atom_intern_literal(ctx2, "something else");
+    keymap2 = xkb_keymap_new_from_buffer(ctx2, binary, len,
+                                         XKB_KEYMAP_FORMAT_BINARY_V1, 0);
+    assert(keymap2);
+
+    dump2 = xkb_keymap_get_as_string(keymap2, XKB_KEYMAP_FORMAT_TEXT_V1);
+    assert(dump2);
+    assert(streq(dump, dump2));
+    free(dump2);
+
+    binary2 = xkb_keymap_get_as_buffer(keymap2, XKB_KEYMAP_FORMAT_BINARY_V1,
+                                       &len2);
+    assert(binary2);
+    assert(len2 == len && memcmp(binary, binary2, len) == 0);
+    free(binary2);
+
+    /* Its original format is the text one it was compiled from. */
+    dump2 = xkb_keymap_get_as_string(keymap2, XKB_KEYMAP_USE_ORIGINAL_FORMAT);
+    assert(dump2);
+    assert(streq(dump, dump2));
+    free(dump2);
+
+    state = xkb_state_new(keymap2);
+    assert(state);
+    assert(xkb_state_key_get_one_sym(state, 38) == XKB_KEY_a);
+    xkb_state_update_key(state, 135, XKB_KEY_DOWN); /* Menu */
+    xkb_state_update_key(state, 135, XKB_KEY_UP);
+    assert(xkb_state_key_get_one_sym(state, 38) == XKB_KEY_Cyrillic_ef);
+    xkb_state_unref(state);
+    xkb_keymap_unref(keymap2);
+
+    /* The text format can be gotten as a buffer too. */
+    keymap = xkb_keymap_new_from_string(ctx, dump, XKB_KEYMAP_FORMAT_TEXT_V1, 0);
+    assert(keymap);
+    dump2 = xkb_keymap_get_as_buffer(keymap, XKB_KEYMAP_USE_ORIGINAL_FORMAT,
+                                     &len2);
+    assert(dump2);
+    assert(len2 == strlen(dump) && streq(dump, dump2));
+    assert(!xkb_keymap_get_as_buffer(keymap, 4893, &len2));
+    free(dump2);
+    xkb_keymap_unref(keymap);
+
+    /* And from a file. */
+    file = tmpfile();
+    assert(file);
+    assert(fwrite(binary, 1, len, file) == len);
+    rewind(file);
+    keymap = xkb_keymap_new_from_file(ctx, file, XKB_KEYMAP_FORMAT_BINARY_V1, 0);
+    assert(keymap);
+    fclose(file);
+    dump2 = xkb_keymap_get_as_string(keymap, XKB_KEYMAP_FORMAT_TEXT_V1);
+    assert(dump2);
+    assert(streq(dump, dump2));
+    free(dump2);
+    xkb_keymap_unref(keymap);
+
+    /* And from a pipe, which can't be mapped. */
+    assert(pipe(fds) == 0);
+    assert(write(fds[1], binary, len) == (ssize_t) len);
+    close(fds[1]);
+    file = fdopen(fds[0], "r");
+    assert(file);
+    keymap = xkb_keymap_new_from_file(ctx, file, XKB_KEYMAP_FORMAT_BINARY_V1, 0);
+    assert(keymap);
+    fclose(file);
+    binary2 = xkb_keymap_get_as_buffer(keymap, XKB_KEYMAP_FORMAT_BINARY_V1,
+                                       &len2);
+    assert(binary2);
+    assert(len2 == len && memcmp(binary, binary2, len) == 0);
+    free(binary2);
+    xkb_keymap_unref(keymap);
+
+    /* The text format is not a binary keymap, and vice versa. */
+    assert(!xkb_keymap_new_from_buffer(ctx, dump, strlen(dump),
+                                       XKB_KEYMAP_FORMAT_BINARY_V1, 0));
+    assert(!xkb_keymap_new_from_buffer(ctx, binary, len,
+                                       XKB_KEYMAP_FORMAT_TEXT_V1, 0));
+
+    old_level = xkb_context_get_log_level(ctx);
+    xkb_context_set_log_level(ctx, XKB_LOG_LEVEL_CRITICAL);
+    test_broken_buffers(ctx, binary, len);
+    test_bad_virtual_mod(ctx, dump);
+    xkb_context_set_log_level(ctx, old_level);
+
+    free(binary);
+    free(dump);
+    xkb_context_unref(ctx2);
+    xkb_context_unref(ctx);
+
+    return 0;
+}
@@ -32,6 +32,8 @@
 
 #include <limits.h>
 #include <fcntl.h>
+#include <ftw.h>
+#include <signal.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -219,6 +221,64 @@ test_read_file(const char *path_rel)
     return ret;
 }
 
+/* Temporary directories, removed when the test exits or aborts. */
+static char *temp_dirs[8];
+static unsigned int num_temp_dirs;
+
+static int
+remove_temp_entry(const char *path, const struct stat *sb, int flag,
+                  struct FTW *ftw)
+{
+    remove(path);
+    return 0;
+}
+
+static void
+remove_temp_dirs(void)
+{
+    for (unsigned int i = 0; i < num_temp_dirs; i++)
+        nftw(temp_dirs[i], remove_temp_entry, 8, FTW_DEPTH | FTW_PHYS);
+    num_temp_dirs = 0;
+}
+
+static void
+remove_temp_dirs_on_abort(int sig)
+{
+    remove_temp_dirs();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+/*
+ * Create a temporary directory to add to a context's include paths, with
+ * an empty @subdir (e.g. "symbols" or "rules") for the test to put files
+ * in. It is removed with its contents when the test exits, even after a
+ * failed assertion; the returned path is kept for that, so don't free it.
+ */
+char *
+test_make_temp_include_dir(const char *subdir)
+{
+    char *dir, *path;
+
+    assert(num_temp_dirs < ARRAY_SIZE(temp_dirs));
+
+    dir = strdup("/tmp/xkbcommon-test-XXXXXX");
+    assert(dir);
+    assert(mkdtemp(dir));
+
+    if (num_temp_dirs == 0) {
+        atexit(remove_temp_dirs);
+        signal(SIGABRT, remove_temp_dirs_on_abort);
+    }
+    temp_dirs[num_temp_dirs++] = dir;
+
+    assert(asprintf(&path, "%s/%s", dir, subdir) > 0);
+    assert(mkdir(path, 0700) == 0);
+    free(path);
+
+    return dir;
+}
+
 struct xkb_context *
 test_get_context(enum test_context_flags test_flags)
 {
@@ -21,6 +21,10 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
 #include "test.h"
 
 static int
@@ -35,6 +39,73 @@ test_file(struct xkb_context *ctx, const char *path_rel)
     return 1;
 }
 
+static void
+write_symbols_file(const char *path, const char *syms)
+{
+    FILE *file = fopen(path, "w");
+
+    assert(file);
+    fprintf(file, "xkb_symbols \"basic\" { key <AE01> { [ %s ] }; };\n", syms);
+    assert(fclose(file) == 0);
+}
+
+static xkb_keysym_t
+compile_and_get_sym(struct xkb_context *ctx)
+{
+    const char *string =
+        "xkb_keymap {\n"
+        "  xkb_keycodes { include \"evdev\" };\n"
+        "  xkb_types { include \"complete\" };\n"
+        "  xkb_compat { include \"complete\" };\n"
+        "  xkb_symbols { include \"pc+cachetest\" };\n"
+        "};";
+    struct xkb_keymap *keymap;
+    const xkb_keysym_t *syms;
+    xkb_keysym_t sym;
+
+    keymap = test_compile_string(ctx, string);
+    if (!keymap)
+        return XKB_KEY_NoSymbol;
+    assert(xkb_keymap_key_get_syms_by_level(keymap, 10, 0, 0, &syms) == 1);
+    sym = syms[0];
+    xkb_keymap_unref(keymap);
+
+    return sym;
+}
+
+/*
+ * Included files, and where they are found, are cached, but changes to
+ * them must be seen.
+ */
+static void
+test_include_cache(void)
+{
+    struct xkb_context *ctx = test_get_context(0);
+    char *dir, *path;
+
+    assert(ctx);
+    dir = test_make_temp_include_dir("symbols");
+    assert(asprintf(&path, "%s/symbols/cachetest", dir) > 0);
+    assert(xkb_context_include_path_append(ctx, dir));
+
+    assert(compile_and_get_sym(ctx) == XKB_KEY_NoSymbol);
+    assert(compile_and_get_sym(ctx) == XKB_KEY_NoSymbol);
+
+    write_symbols_file(path, "1, exclam");
+    assert(compile_and_get_sym(ctx) == XKB_KEY_1);
+    assert(compile_and_get_sym(ctx) == XKB_KEY_1);
+
+    write_symbols_file(path, "2, at");
+    assert(compile_and_get_sym(ctx) == XKB_KEY_2);
+    assert(compile_and_get_sym(ctx) == XKB_KEY_2);
+
+    unlink(path);
+    assert(compile_and_get_sym(ctx) == XKB_KEY_NoSymbol);
+
+    free(path);
+    xkb_context_unref(ctx);
+}
+
 int
 main(void)
 {
@@ -62,5 +133,7 @@ main(void)
 
     xkb_context_unref(ctx);
 
+    test_include_cache();
+
     return 0;
 }
@@ -81,6 +81,17 @@ test_utf8(xkb_keysym_t keysym, const char *expected)
     return streq(s, expected);
 }
 
+static int
+test_utf32_to_keysym(uint32_t ucs, xkb_keysym_t expected)
+{
+    xkb_keysym_t keysym = xkb_utf32_to_keysym(ucs);
+
+    fprintf(stderr, "Expected utf32_to_keysym(U+%04X) -> %#x\n", ucs, expected);
+    fprintf(stderr, "Received utf32_to_keysym(U+%04X) -> %#x\n\n", ucs, keysym);
+
+    return keysym == expected;
+}
+
 int
 main(void)
 {
@@ -98,6 +109,9 @@ main(void)
     assert(test_string("THORN", 0x00de));
     assert(test_string("Thorn", 0x00de));
     assert(test_string("thorn", 0x00fe));
+    assert(test_string("undo", XKB_KEY_NoSymbol));
+    assert(test_string("Undo2", XKB_KEY_NoSymbol));
+    assert(test_string("", XKB_KEY_NoSymbol));
 
     assert(test_keysym(0x1008FF56, "XF86Close"));
     assert(test_keysym(0x0, "NoSymbol"));
@@ -126,6 +140,9 @@ main(void)
     assert(test_casestring("THORN", 0x00fe));
     assert(test_casestring("Thorn", 0x00fe));
     assert(test_casestring("thorn", 0x00fe));
+    assert(test_casestring("CH", 0xfea0));
+    assert(test_casestring("cH", 0xfea0));
+    assert(test_casestring("", XKB_KEY_NoSymbol));
 
     assert(test_utf8(XKB_KEY_y, "y"));
     assert(test_utf8(XKB_KEY_u, "u"));
@@ -155,6 +172,30 @@ main(void)
     assert(test_utf8(XKB_KEY_KP_Multiply, "*"));
     assert(test_utf8(XKB_KEY_KP_Subtract, "-"));
 
+    assert(xkb_keysym_to_utf32(XKB_KEY_Aogonek) == 0x0104);
+    assert(xkb_keysym_to_utf32(XKB_KEY_EuroSign) == 0x20ac);
+    assert(xkb_keysym_to_utf32(XKB_KEY_KP_Space) == 0x20);
+    assert(xkb_keysym_to_utf32(0x01001234) == 0x1234);
+    assert(xkb_keysym_to_utf32(XKB_KEY_Shift_L) == 0);
+    assert(xkb_keysym_to_utf32(0x09df) == 0); /* blank */
+
+    assert(test_utf32_to_keysym('y', XKB_KEY_y));
+    assert(test_utf32_to_keysym(0x00e9, XKB_KEY_eacute));
+    assert(test_utf32_to_keysym(0x0104, XKB_KEY_Aogonek));
+    assert(test_utf32_to_keysym(0x043c, XKB_KEY_Cyrillic_em));
+    assert(test_utf32_to_keysym(0x05d0, XKB_KEY_hebrew_aleph));
+    assert(test_utf32_to_keysym('\r', XKB_KEY_Return));
+    assert(test_utf32_to_keysym('\t', XKB_KEY_Tab));
+    assert(test_utf32_to_keysym(0x7f, XKB_KEY_Delete));
+    assert(test_utf32_to_keysym('5', XKB_KEY_5));
+    assert(test_utf32_to_keysym(0x1234, 0x01001234));
+    assert(test_utf32_to_keysym(0x1f4a9, 0x0101f4a9));
+    assert(test_utf32_to_keysym(0x01, XKB_KEY_NoSymbol));
+    assert(test_utf32_to_keysym(0x85, XKB_KEY_NoSymbol));
+    assert(test_utf32_to_keysym(0xd800, XKB_KEY_NoSymbol));
+    assert(test_utf32_to_keysym(0xfffe, XKB_KEY_NoSymbol));
+    assert(test_utf32_to_keysym(0x110000, XKB_KEY_NoSymbol));
+
     assert(xkb_keysym_is_lower(XKB_KEY_a));
     assert(xkb_keysym_is_lower(XKB_KEY_Greek_lambda));
     assert(xkb_keysym_is_lower(xkb_keysym_from_name("U03b1", 0))); /* GREEK SMALL LETTER ALPHA */
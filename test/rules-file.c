@@ -22,6 +22,7 @@
  */
 
 #include <time.h>
+#include <unistd.h>
 
 #include "test.h"
 #include "xkbcomp-priv.h"
@@ -88,6 +89,93 @@ test_rules(struct xkb_context *ctx, struct test_data *data)
     return passed;
 }
 
+static void
+write_rules_file(const char *path, const char *symbols)
+{
+    FILE *file = fopen(path, "w");
+
+    assert(file);
+    fprintf(file,
+            "! model = keycodes types compat\n"
+            "  * = evdev complete complete\n"
+            "! layout = symbols\n"
+            "  * = %s\n", symbols);
+    assert(fclose(file) == 0);
+}
+
+/* Parsed rules files are cached, but changes to them must be seen. */
+static void
+test_rules_file_change(void)
+{
+    struct xkb_context *ctx = test_get_context(0);
+    char *dir, *path;
+    struct test_data data = {
+        .rules = "changing",
+        .model = "", .layout = "us", .variant = "", .options = "",
+        .keycodes = "evdev", .types = "complete", .compat = "complete",
+    };
+
+    assert(ctx);
+    dir = test_make_temp_include_dir("rules");
+    assert(asprintf(&path, "%s/rules/changing", dir) > 0);
+    assert(xkb_context_include_path_append(ctx, dir));
+
+    write_rules_file(path, "pc+%l");
+    data.symbols = "pc+us";
+    assert(test_rules(ctx, &data));
+    assert(test_rules(ctx, &data));
+
+    write_rules_file(path, "something+%l");
+    data.symbols = "something+us";
+    assert(test_rules(ctx, &data));
+
+    unlink(path);
+    data.should_fail = true;
+    assert(test_rules(ctx, &data));
+
+    free(path);
+    xkb_context_unref(ctx);
+}
+
+static void
+test_rules_bulk(struct xkb_context *ctx)
+{
+    const struct xkb_rule_names rmlvos[] = {
+        { "simple", "my_model", "my_layout", "my_variant", "my_option" },
+        { "groups", "pc104", "foo", "", "" },
+        { "doesnotexist", "pc104", "us", "", "" },
+        { "simple", "my_model", "my_layout,second_layout", "my_variant",
+          "my_option" },
+        { "groups", "foo", "ar", "bar", "" },
+    };
+    const size_t count = sizeof(rmlvos) / sizeof(rmlvos[0]);
+    struct xkb_component_names kccgst[sizeof(rmlvos) / sizeof(rmlvos[0])];
+
+    assert(xkb_components_from_names(ctx, rmlvos, count, kccgst) == 3);
+
+    assert(streq(kccgst[0].keycodes, "my_keycodes"));
+    assert(streq(kccgst[0].compat, "my_compat|some:compat"));
+    assert(streq(kccgst[0].symbols, "my_symbols+extra_variant"));
+    assert(streq(kccgst[1].keycodes, "something(pc104)"));
+    assert(streq(kccgst[1].symbols, "default_symbols"));
+    assert(streq(kccgst[4].keycodes, "default_keycodes"));
+    assert(streq(kccgst[4].symbols, "my_symbols+(bar)"));
+
+    /* Failed lookups are cleared. */
+    for (size_t i = 2; i <= 3; i++)
+        assert(!kccgst[i].keycodes && !kccgst[i].types &&
+               !kccgst[i].compat && !kccgst[i].symbols);
+
+    for (size_t i = 0; i < count; i++) {
+        free(kccgst[i].keycodes);
+        free(kccgst[i].types);
+        free(kccgst[i].compat);
+        free(kccgst[i].symbols);
+    }
+
+    assert(xkb_components_from_names(ctx, rmlvos, 0, kccgst) == 0);
+}
+
 static void
 benchmark(struct xkb_context *ctx)
 {
@@ -216,6 +304,11 @@ main(int argc, char *argv[])
     };
     assert(test_rules(ctx, &test7));
 
+    test_rules_bulk(ctx);
+
     xkb_context_unref(ctx);
+
+    test_rules_file_change();
+
     return 0;
 }
@@ -22,9 +22,11 @@
  */
 
 #include <linux/input.h>
+#include <pthread.h>
 #include <time.h>
 
 #include "test.h"
+#include "context.h"
 
 #define BENCHMARK_ITERATIONS 2500
 
@@ -154,6 +156,292 @@ benchmark(struct xkb_context *context)
             BENCHMARK_ITERATIONS, elapsed.tv_sec, elapsed.tv_nsec);
 }
 
+static struct keymap_content_entry *
+find_content_entry(struct xkb_context *ctx, struct xkb_keymap *keymap)
+{
+    struct keymap_content_entry *entry;
+
+    darray_foreach(entry, ctx->keymap_contents)
+        if (entry->keymap == keymap)
+            return entry;
+
+    return NULL;
+}
+
+/* A keymap with the same digest and size is not shared unless identical. */
+static void
+test_keymap_cache_collision(struct xkb_context *ctx, struct xkb_keymap *keymap1,
+                            const struct xkb_rule_names *other)
+{
+    struct keymap_content_entry *entry1, *entry2;
+    struct xkb_keymap *keymap2, *keymap3;
+    char *str, *dump2, *dump3;
+    size_t len;
+
+    keymap2 = xkb_keymap_new_from_names(ctx, other, 0);
+    assert(keymap2 && keymap2 != keymap1);
+    str = xkb_keymap_get_as_buffer(keymap2, XKB_KEYMAP_FORMAT_BINARY_V1,
+                                   &len);
+    assert(str);
+
+    /* Only keymap1 now looks like keymap2 to the cache. */
+    entry1 = find_content_entry(ctx, keymap1);
+    entry2 = find_content_entry(ctx, keymap2);
+    assert(entry1 && entry2);
+    entry1->digest = entry2->digest;
+    entry1->size = entry2->size;
+    entry2->digest = ~entry2->digest;
+
+    keymap3 = xkb_keymap_new_from_buffer(ctx, str, len,
+                                         XKB_KEYMAP_FORMAT_BINARY_V1, 0);
+    assert(keymap3 && keymap3 != keymap1 && keymap3 != keymap2);
+    dump2 = xkb_keymap_get_as_string(keymap2, XKB_KEYMAP_FORMAT_TEXT_V1);
+    dump3 = xkb_keymap_get_as_string(keymap3, XKB_KEYMAP_FORMAT_TEXT_V1);
+    assert(dump2 && dump3 && streq(dump2, dump3));
+
+    free(dump2);
+    free(dump3);
+    free(str);
+    xkb_keymap_unref(keymap3);
+    xkb_keymap_unref(keymap2);
+}
+
+static void
+test_keymap_cache(void)
+{
+    struct xkb_context *ctx;
+    struct xkb_keymap *keymap1, *keymap2, *keymap3;
+    struct xkb_rule_names us = { "evdev", "pc105", "us", NULL, NULL };
+    struct xkb_rule_names us_empty = { "evdev", "pc105", "us", "", "" };
+    struct xkb_rule_names de = { "evdev", "pc105", "de", NULL, NULL };
+    char *path, *str;
+    size_t len;
+
+    ctx = xkb_context_new(XKB_CONTEXT_NO_DEFAULT_INCLUDES |
+                          XKB_CONTEXT_NO_ENVIRONMENT_NAMES |
+                          XKB_CONTEXT_KEYMAP_CACHE);
+    assert(ctx);
+    path = test_get_path("");
+    assert(path);
+    assert(xkb_context_include_path_append(ctx, path));
+
+    keymap1 = xkb_keymap_new_from_names(ctx, &us, 0);
+    assert(keymap1);
+    keymap2 = xkb_keymap_new_from_names(ctx, &us_empty, 0);
+    assert(keymap2 == keymap1);
+    keymap3 = xkb_keymap_new_from_names(ctx, &de, 0);
+    assert(keymap3 && keymap3 != keymap1);
+    xkb_keymap_unref(keymap3);
+    xkb_keymap_unref(keymap2);
+
+    /*
+     * Keymaps with identical compiled contents are shared, however
+     * created. The text format does not keep every detail, so loading it
+     * back does not give keymap1 again, but the same string twice gives
+     * the same keymap; and the binary format gives keymap1.
+     */
+    str = xkb_keymap_get_as_string(keymap1, XKB_KEYMAP_FORMAT_TEXT_V1);
+    assert(str);
+    keymap2 = xkb_keymap_new_from_string(ctx, str,
+                                         XKB_KEYMAP_FORMAT_TEXT_V1, 0);
+    assert(keymap2 && keymap2 != keymap1);
+    keymap3 = xkb_keymap_new_from_string(ctx, str,
+                                         XKB_KEYMAP_FORMAT_TEXT_V1, 0);
+    assert(keymap3 == keymap2);
+    xkb_keymap_unref(keymap3);
+    xkb_keymap_unref(keymap2);
+    free(str);
+
+    str = xkb_keymap_get_as_buffer(keymap1, XKB_KEYMAP_FORMAT_BINARY_V1,
+                                   &len);
+    assert(str);
+    keymap2 = xkb_keymap_new_from_buffer(ctx, str, len,
+                                         XKB_KEYMAP_FORMAT_BINARY_V1, 0);
+    assert(keymap2 == keymap1);
+    xkb_keymap_unref(keymap2);
+    free(str);
+
+    test_keymap_cache_collision(ctx, keymap1, &de);
+
+    /* Changing the include paths drops the cached keymaps. */
+    xkb_context_include_path_clear(ctx);
+    assert(xkb_context_include_path_append(ctx, path));
+    keymap2 = xkb_keymap_new_from_names(ctx, &us, 0);
+    assert(keymap2 && keymap2 != keymap1);
+    xkb_keymap_unref(keymap1);
+
+    keymap1 = xkb_keymap_new_from_names(ctx, &us, 0);
+    assert(keymap1 == keymap2);
+    xkb_keymap_unref(keymap1);
+    xkb_keymap_unref(keymap2);
+
+    /* Not referenced anymore, so compiled anew. */
+    keymap1 = xkb_keymap_new_from_names(ctx, &us, 0);
+    assert(keymap1);
+    assert(test_key_seq(keymap1,
+                        KEY_A,          BOTH, XKB_KEY_a,                FINISH));
+    xkb_keymap_unref(keymap1);
+
+    free(path);
+    xkb_context_unref(ctx);
+}
+
+static struct xkb_keymap *
+compile_fresh(const struct xkb_rule_names *rmlvo,
+              enum xkb_context_flags ctx_flags,
+              enum xkb_keymap_compile_flags flags)
+{
+    struct xkb_context *ctx;
+    struct xkb_keymap *keymap;
+    char *path;
+
+    ctx = xkb_context_new(XKB_CONTEXT_NO_DEFAULT_INCLUDES |
+                          XKB_CONTEXT_NO_ENVIRONMENT_NAMES | ctx_flags);
+    assert(ctx);
+    path = test_get_path("");
+    assert(path);
+    assert(xkb_context_include_path_append(ctx, path));
+    free(path);
+
+    keymap = xkb_keymap_new_from_names(ctx, rmlvo, flags);
+    xkb_context_unref(ctx);
+    return keymap;
+}
+
+static void
+test_parallel(void)
+{
+    const struct xkb_rule_names rmlvos[] = {
+        { "evdev", "pc105", "us,il,ru,ca", ",,,multix",
+          "grp:alts_toggle,ctrl:nocaps,compose:rwin" },
+        { "evdev", "pc105", "us", "intl", "" },
+        { "base", "empty", "empty", "", "" },
+    };
+    const struct xkb_rule_names missing = {
+        "evdev", "pc105", "us,does-not-exist", "", ""
+    };
+
+    for (size_t i = 0; i < sizeof(rmlvos) / sizeof(rmlvos[0]); i++) {
+        struct xkb_keymap *serial, *parallel, *ignored;
+        char *serial_str, *parallel_str, *ignored_str;
+
+        serial = compile_fresh(&rmlvos[i], XKB_CONTEXT_THREAD_SAFE,
+                               XKB_KEYMAP_COMPILE_NO_FLAGS);
+        parallel = compile_fresh(&rmlvos[i], XKB_CONTEXT_THREAD_SAFE,
+                                 XKB_KEYMAP_COMPILE_PARALLEL);
+        /* Not a thread-safe context, so compiled serially. */
+        ignored = compile_fresh(&rmlvos[i], XKB_CONTEXT_NO_FLAGS,
+                                XKB_KEYMAP_COMPILE_PARALLEL);
+        assert(serial && parallel && ignored);
+
+        serial_str = xkb_keymap_get_as_string(serial,
+                                              XKB_KEYMAP_FORMAT_TEXT_V1);
+        parallel_str = xkb_keymap_get_as_string(parallel,
+                                                XKB_KEYMAP_FORMAT_TEXT_V1);
+        ignored_str = xkb_keymap_get_as_string(ignored,
+                                               XKB_KEYMAP_FORMAT_TEXT_V1);
+        assert(serial_str && parallel_str && ignored_str);
+        assert(streq(serial_str, parallel_str));
+        assert(streq(serial_str, ignored_str));
+
+        free(serial_str);
+        free(parallel_str);
+        free(ignored_str);
+        xkb_keymap_unref(serial);
+        xkb_keymap_unref(parallel);
+        xkb_keymap_unref(ignored);
+    }
+
+    assert(!compile_fresh(&missing, XKB_CONTEXT_THREAD_SAFE,
+                         XKB_KEYMAP_COMPILE_PARALLEL));
+}
+
+#define THREAD_COUNT 4
+
+struct thread_test {
+    struct xkb_context *ctx;
+    const struct xkb_rule_names *rmlvos;
+    char **expected;
+    size_t count;
+};
+
+static void *
+thread_safe_worker(void *data)
+{
+    struct thread_test *t = data;
+
+    for (int round = 0; round < 5; round++) {
+        for (size_t i = 0; i < t->count; i++) {
+            struct xkb_keymap *keymap;
+            char *str;
+
+            keymap = xkb_keymap_new_from_names(t->ctx, &t->rmlvos[i], 0);
+            assert(keymap);
+            str = xkb_keymap_get_as_string(keymap, XKB_KEYMAP_FORMAT_TEXT_V1);
+            assert(str && streq(str, t->expected[i]));
+            free(str);
+            xkb_keymap_unref(keymap);
+        }
+    }
+
+    return NULL;
+}
+
+static void
+test_thread_safe(void)
+{
+    const struct xkb_rule_names rmlvos[] = {
+        { "evdev", "pc105", "us,il,ru,ca", ",,,multix",
+          "grp:alts_toggle,ctrl:nocaps,compose:rwin" },
+        { "evdev", "pc105", "us", "intl", "" },
+        { "evdev", "pc105", "de", "", "" },
+    };
+    const size_t count = sizeof(rmlvos) / sizeof(rmlvos[0]);
+    char *expected[sizeof(rmlvos) / sizeof(rmlvos[0])];
+    pthread_t threads[THREAD_COUNT];
+    struct thread_test t;
+    struct xkb_context *ctx;
+    char *path;
+
+    for (size_t i = 0; i < count; i++) {
+        struct xkb_keymap *keymap = compile_fresh(&rmlvos[i], 0, 0);
+        assert(keymap);
+        expected[i] = xkb_keymap_get_as_string(keymap,
+                                               XKB_KEYMAP_FORMAT_TEXT_V1);
+        assert(expected[i]);
+        xkb_keymap_unref(keymap);
+    }
+
+    /* Once sharing compiled keymaps, and once not. */
+    for (int cache = 0; cache <= 1; cache++) {
+        ctx = xkb_context_new(XKB_CONTEXT_NO_DEFAULT_INCLUDES |
+                              XKB_CONTEXT_NO_ENVIRONMENT_NAMES |
+                              XKB_CONTEXT_THREAD_SAFE |
+                              (cache ? XKB_CONTEXT_KEYMAP_CACHE : 0));
+        assert(ctx);
+        path = test_get_path("");
+        assert(path);
+        assert(xkb_context_include_path_append(ctx, path));
+        free(path);
+
+        t.ctx = ctx;
+        t.rmlvos = rmlvos;
+        t.expected = expected;
+        t.count = count;
+
+        for (int i = 0; i < THREAD_COUNT; i++)
+            assert(pthread_create(&threads[i], NULL,
+                                  thread_safe_worker, &t) == 0);
+        for (int i = 0; i < THREAD_COUNT; i++)
+            assert(pthread_join(threads[i], NULL) == 0);
+
+        xkb_context_unref(ctx);
+    }
+
+    for (size_t i = 0; i < count; i++)
+        free(expected[i]);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -253,4 +541,8 @@ main(int argc, char *argv[])
     }
 
     xkb_context_unref(ctx);
+
+    test_keymap_cache();
+    test_parallel();
+    test_thread_safe();
 }
@@ -24,6 +24,7 @@
  */
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <linux/input.h>
@@ -243,6 +244,199 @@ test_update_key(struct xkb_keymap *keymap)
     xkb_state_unref(state);
 }
 
+static void
+test_update_keys(struct xkb_keymap *keymap)
+{
+    struct xkb_state *state = xkb_state_new(keymap);
+    struct xkb_state *expected = xkb_state_new(keymap);
+    const struct xkb_key_event events[] = {
+        { KEY_CAPSLOCK + EVDEV_OFFSET, XKB_KEY_DOWN },
+        { KEY_CAPSLOCK + EVDEV_OFFSET, XKB_KEY_UP },
+        { KEY_COMPOSE + EVDEV_OFFSET, XKB_KEY_DOWN },
+        { KEY_COMPOSE + EVDEV_OFFSET, XKB_KEY_UP },
+        { KEY_LEFTSHIFT + EVDEV_OFFSET, XKB_KEY_DOWN },
+        { 0, XKB_KEY_DOWN },
+        { KEY_A + EVDEV_OFFSET, XKB_KEY_DOWN },
+    };
+    enum xkb_state_component changed[ARRAY_SIZE(events)];
+    enum xkb_state_component total;
+
+    assert(state && expected);
+
+    /* Per-event changes are the same as for single updates. */
+    total = xkb_state_update_keys(state, events, ARRAY_SIZE(events), changed);
+    for (unsigned i = 0; i < ARRAY_SIZE(events); i++)
+        assert(changed[i] == xkb_state_update_key(expected, events[i].keycode,
+                                                  events[i].direction));
+
+    assert(total == (XKB_STATE_MODS_DEPRESSED | XKB_STATE_MODS_LOCKED |
+                     XKB_STATE_MODS_EFFECTIVE | XKB_STATE_LAYOUT_LOCKED |
+                     XKB_STATE_LAYOUT_EFFECTIVE | XKB_STATE_LEDS));
+    assert(xkb_state_serialize_mods(state, XKB_STATE_MODS_EFFECTIVE) ==
+           xkb_state_serialize_mods(expected, XKB_STATE_MODS_EFFECTIVE));
+    assert(xkb_state_serialize_layout(state, XKB_STATE_LAYOUT_EFFECTIVE) == 1);
+    assert(xkb_state_led_name_is_active(state, XKB_LED_NAME_CAPS) > 0);
+
+    /* Without per-event changes, the LEDs still end up right. */
+    total = xkb_state_update_keys(state, events, 2, NULL);
+    assert(total == (XKB_STATE_MODS_LOCKED | XKB_STATE_MODS_EFFECTIVE |
+                     XKB_STATE_LEDS));
+    assert(xkb_state_led_name_is_active(state, XKB_LED_NAME_CAPS) == 0);
+
+    assert(xkb_state_update_keys(state, NULL, 0, NULL) == 0);
+
+    xkb_state_unref(expected);
+    xkb_state_unref(state);
+}
+
+static void
+test_clone_snapshot(struct xkb_keymap *keymap)
+{
+    struct xkb_state *state = xkb_state_new(keymap);
+    struct xkb_state *clone, *snapshot, *snapshot2;
+    const struct xkb_key_event event = {
+        KEY_LEFTSHIFT + EVDEV_OFFSET, XKB_KEY_UP
+    };
+    enum xkb_state_component changed;
+
+    assert(state);
+
+    xkb_state_update_key(state, KEY_CAPSLOCK + EVDEV_OFFSET, XKB_KEY_DOWN);
+    xkb_state_update_key(state, KEY_CAPSLOCK + EVDEV_OFFSET, XKB_KEY_UP);
+    xkb_state_update_key(state, KEY_LEFTSHIFT + EVDEV_OFFSET, XKB_KEY_DOWN);
+
+    clone = xkb_state_clone(state);
+    snapshot = xkb_state_snapshot(state);
+    assert(clone && snapshot);
+    assert(xkb_state_get_keymap(clone) == keymap);
+    assert(xkb_state_get_keymap(snapshot) == keymap);
+
+    /* Both keep what they had when the original moves on. */
+    xkb_state_update_key(state, KEY_LEFTSHIFT + EVDEV_OFFSET, XKB_KEY_UP);
+    assert(xkb_state_mod_name_is_active(state, XKB_MOD_NAME_SHIFT,
+                                        XKB_STATE_MODS_EFFECTIVE) == 0);
+    assert(xkb_state_mod_name_is_active(clone, XKB_MOD_NAME_SHIFT,
+                                        XKB_STATE_MODS_DEPRESSED) > 0);
+    assert(xkb_state_mod_name_is_active(snapshot, XKB_MOD_NAME_SHIFT,
+                                        XKB_STATE_MODS_DEPRESSED) > 0);
+    assert(xkb_state_led_name_is_active(snapshot, XKB_LED_NAME_CAPS) > 0);
+    assert(xkb_state_key_get_one_sym(snapshot, KEY_A + EVDEV_OFFSET) ==
+           XKB_KEY_a);
+    assert(xkb_state_key_get_one_sym(state, KEY_A + EVDEV_OFFSET) ==
+           XKB_KEY_A);
+
+    /* The clone still knows that Shift is held down. */
+    changed = xkb_state_update_key(clone, KEY_LEFTSHIFT + EVDEV_OFFSET,
+                                   XKB_KEY_UP);
+    assert(changed == (XKB_STATE_MODS_DEPRESSED | XKB_STATE_MODS_EFFECTIVE));
+    assert(xkb_state_serialize_mods(clone, XKB_STATE_MODS_EFFECTIVE) ==
+           xkb_state_serialize_mods(state, XKB_STATE_MODS_EFFECTIVE));
+
+    /* The snapshot can't be updated. */
+    assert(xkb_state_update_key(snapshot, KEY_LEFTSHIFT + EVDEV_OFFSET,
+                                XKB_KEY_UP) == 0);
+    assert(xkb_state_update_keys(snapshot, &event, 1, NULL) == 0);
+    assert(xkb_state_update_mask(snapshot, 0, 0, 0, 0, 0, 0) == 0);
+    assert(xkb_state_mod_name_is_active(snapshot, XKB_MOD_NAME_SHIFT,
+                                        XKB_STATE_MODS_DEPRESSED) > 0);
+
+    /* Nor can a clone of it. */
+    snapshot2 = xkb_state_clone(snapshot);
+    assert(snapshot2);
+    assert(xkb_state_update_mask(snapshot2, 0, 0, 0, 0, 0, 0) == 0);
+    assert(xkb_state_serialize_mods(snapshot2, XKB_STATE_MODS_EFFECTIVE) ==
+           xkb_state_serialize_mods(snapshot, XKB_STATE_MODS_EFFECTIVE));
+
+    xkb_state_unref(snapshot2);
+    xkb_state_unref(snapshot);
+    xkb_state_unref(clone);
+    xkb_state_unref(state);
+}
+
+struct snapshot_reader {
+    struct xkb_state *state;
+    xkb_mod_mask_t shift, caps;
+    xkb_led_index_t caps_led;
+    int done;
+};
+
+static void *
+snapshot_reader_thread(void *data)
+{
+    struct snapshot_reader *reader = data;
+    struct xkb_state *snapshot = xkb_state_snapshot(reader->state);
+    xkb_mod_mask_t depressed, locked;
+
+    assert(snapshot);
+
+    while (!atomic_load_acquire(&reader->done)) {
+        xkb_state_update_snapshot(snapshot, reader->state);
+        depressed = xkb_state_serialize_mods(snapshot,
+                                             XKB_STATE_MODS_DEPRESSED);
+        locked = xkb_state_serialize_mods(snapshot, XKB_STATE_MODS_LOCKED);
+
+        /* Never half of an update. */
+        assert((depressed == reader->shift && locked == 0) ||
+               (depressed == 0 && locked == reader->caps));
+        assert(xkb_state_serialize_mods(snapshot, XKB_STATE_MODS_EFFECTIVE) ==
+               (depressed | locked));
+        assert((xkb_state_led_index_is_active(snapshot,
+                                              reader->caps_led) > 0) ==
+               (locked != 0));
+    }
+
+    xkb_state_unref(snapshot);
+    return NULL;
+}
+
+static void
+test_snapshot_update(struct xkb_keymap *keymap)
+{
+    struct xkb_state *state = xkb_state_new(keymap);
+    struct xkb_state *snapshot;
+    struct snapshot_reader reader;
+    pthread_t thread;
+    enum xkb_state_component changed;
+
+    assert(state);
+
+    reader.state = state;
+    reader.shift = 1u << xkb_keymap_mod_get_index(keymap, XKB_MOD_NAME_SHIFT);
+    reader.caps = 1u << xkb_keymap_mod_get_index(keymap, XKB_MOD_NAME_CAPS);
+    /* Names are looked up in the context, which is not thread-safe. */
+    reader.caps_led = xkb_keymap_led_get_index(keymap, XKB_LED_NAME_CAPS);
+    assert(reader.caps_led != XKB_LED_INVALID);
+    reader.done = 0;
+
+    snapshot = xkb_state_snapshot(state);
+    assert(snapshot);
+
+    xkb_state_update_mask(state, 0, 0, reader.caps, 0, 0, 0);
+    assert(xkb_state_led_name_is_active(snapshot, XKB_LED_NAME_CAPS) == 0);
+    changed = xkb_state_update_snapshot(snapshot, state);
+    assert(changed == (XKB_STATE_MODS_LOCKED | XKB_STATE_MODS_EFFECTIVE |
+                       XKB_STATE_LEDS));
+    assert(xkb_state_led_name_is_active(snapshot, XKB_LED_NAME_CAPS) > 0);
+    assert(xkb_state_update_snapshot(snapshot, state) == 0);
+
+    /* Only snapshots can be updated this way. */
+    assert(xkb_state_update_snapshot(state, snapshot) == 0);
+
+    assert(pthread_create(&thread, NULL, snapshot_reader_thread,
+                          &reader) == 0);
+    for (int i = 0; i < 100000; i++) {
+        if (i % 2)
+            xkb_state_update_mask(state, 0, 0, reader.caps, 0, 0, 0);
+        else
+            xkb_state_update_mask(state, reader.shift, 0, 0, 0, 0, 0);
+    }
+    atomic_store_release(&reader.done, 1);
+    assert(pthread_join(thread, NULL) == 0);
+
+    xkb_state_unref(snapshot);
+    xkb_state_unref(state);
+}
+
 static void
 test_serialisation(struct xkb_keymap *keymap)
 {
@@ -485,6 +679,104 @@ test_range(struct xkb_keymap *keymap)
     assert(counter == xkb_keymap_max_keycode(keymap) + 1);
 }
 
+struct keysym_lookup {
+    xkb_keysym_t keysym;
+    unsigned int count;
+    xkb_keycode_t first_key;
+    xkb_layout_index_t first_layout;
+    xkb_level_index_t first_level;
+};
+
+static void
+keysym_iter(struct xkb_keymap *keymap, xkb_keycode_t key,
+            xkb_layout_index_t layout, xkb_level_index_t level, void *data)
+{
+    struct keysym_lookup *lookup = data;
+    const xkb_keysym_t *syms;
+    int nsyms, i;
+
+    nsyms = xkb_keymap_key_get_syms_by_level(keymap, key, layout, level,
+                                             &syms);
+    for (i = 0; i < nsyms; i++)
+        if (syms[i] == lookup->keysym)
+            break;
+    assert(i < nsyms);
+
+    if (lookup->count++ == 0) {
+        lookup->first_key = key;
+        lookup->first_layout = layout;
+        lookup->first_level = level;
+    }
+}
+
+static void
+keysym_count_iter(struct xkb_keymap *keymap, xkb_keycode_t key, void *data)
+{
+    struct keysym_lookup *lookup = data;
+    const xkb_keysym_t *syms;
+    int nsyms;
+
+    for (xkb_layout_index_t layout = 0;
+         layout < xkb_keymap_num_layouts_for_key(keymap, key); layout++) {
+        for (xkb_level_index_t level = 0;
+             level < xkb_keymap_num_levels_for_key(keymap, key, layout);
+             level++) {
+            nsyms = xkb_keymap_key_get_syms_by_level(keymap, key, layout,
+                                                     level, &syms);
+            for (int i = 0; i < nsyms; i++) {
+                if (syms[i] == lookup->keysym) {
+                    lookup->count++;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+static void
+test_keysym_lookup(struct xkb_keymap *keymap)
+{
+    const xkb_keysym_t keysyms[] = {
+        XKB_KEY_a, XKB_KEY_A, XKB_KEY_Cyrillic_ef, XKB_KEY_Shift_L,
+        XKB_KEY_ISO_Next_Group, XKB_KEY_KP_1, XKB_KEY_space, XKB_KEY_Hyper_R,
+    };
+    struct keysym_lookup lookup, expected;
+
+    memset(&lookup, 0, sizeof(lookup));
+    lookup.keysym = XKB_KEY_a;
+    xkb_keymap_keysym_for_each(keymap, XKB_KEY_a, keysym_iter, &lookup);
+    assert(lookup.count == 1);
+    assert(lookup.first_key == KEY_A + EVDEV_OFFSET);
+    assert(lookup.first_layout == 0 && lookup.first_level == 0);
+
+    memset(&lookup, 0, sizeof(lookup));
+    lookup.keysym = XKB_KEY_Cyrillic_EF;
+    xkb_keymap_keysym_for_each(keymap, XKB_KEY_Cyrillic_EF, keysym_iter,
+                               &lookup);
+    assert(lookup.count == 1);
+    assert(lookup.first_key == KEY_A + EVDEV_OFFSET);
+    assert(lookup.first_layout == 1 && lookup.first_level == 1);
+
+    memset(&lookup, 0, sizeof(lookup));
+    lookup.keysym = XKB_KEY_Greek_alpha;
+    xkb_keymap_keysym_for_each(keymap, XKB_KEY_Greek_alpha, keysym_iter,
+                               &lookup);
+    assert(lookup.count == 0);
+
+    /* Compare against going over every key. */
+    for (unsigned i = 0; i < ARRAY_SIZE(keysyms); i++) {
+        memset(&lookup, 0, sizeof(lookup));
+        lookup.keysym = keysyms[i];
+        xkb_keymap_keysym_for_each(keymap, keysyms[i], keysym_iter, &lookup);
+
+        memset(&expected, 0, sizeof(expected));
+        expected.keysym = keysyms[i];
+        xkb_keymap_key_for_each(keymap, keysym_count_iter, &expected);
+
+        assert(lookup.count == expected.count);
+    }
+}
+
 static void
 test_caps_keysym_transformation(struct xkb_keymap *keymap)
 {
@@ -552,6 +844,29 @@ test_caps_keysym_transformation(struct xkb_keymap *keymap)
     xkb_state_unref(state);
 }
 
+/* Check that xkb_state_key_get_info() agrees with the single functions. */
+static void
+check_key_info(struct xkb_state *state, xkb_keycode_t kc)
+{
+    struct xkb_key_info info;
+    const xkb_keysym_t *syms;
+    char buf[64], info_buf[64];
+    int len;
+
+    len = xkb_state_key_get_info(state, kc, &info, info_buf, sizeof(info_buf));
+    assert(len == xkb_state_key_get_utf8(state, kc, buf, sizeof(buf)));
+    assert(streq(info_buf, buf));
+    assert(xkb_state_key_get_info(state, kc, &info, NULL, 0) == len);
+
+    assert(info.layout == xkb_state_key_get_layout(state, kc));
+    assert(info.level == xkb_state_key_get_level(state, kc, info.layout));
+    assert(info.num_syms == xkb_state_key_get_syms(state, kc, &syms));
+    assert(info.syms == syms);
+    assert(info.sym == xkb_state_key_get_one_sym(state, kc));
+    assert(info.utf32 == xkb_state_key_get_utf32(state, kc));
+    assert(info.consumed_mods == xkb_state_key_get_consumed_mods(state, kc));
+}
+
 static void
 test_get_utf8_utf32(struct xkb_keymap *keymap)
 {
@@ -564,6 +879,7 @@ test_get_utf8_utf32(struct xkb_keymap *keymap)
     assert(xkb_state_key_get_utf8(state, key + 8, buf, sizeof(buf)) == strlen(expected_utf8)); \
     assert(memcmp(buf, expected_utf8, sizeof(expected_utf8)) == 0); \
     assert(xkb_state_key_get_utf32(state, key + 8) == expected_utf32); \
+    check_key_info(state, key + 8); \
 } while (0)
 
     /* Simple ASCII. */
@@ -624,6 +940,9 @@ test_get_utf8_utf32(struct xkb_keymap *keymap)
     TEST_KEY(KEY_6, "HELLO", 0);
     TEST_KEY(KEY_7, "YES THIS IS DOG", 0);
 
+    /* Invalid keycode. */
+    check_key_info(state, 0);
+
     xkb_state_unref(state);
 }
 
@@ -690,11 +1009,15 @@ main(void)
     assert(keymap);
 
     test_update_key(keymap);
+    test_update_keys(keymap);
+    test_clone_snapshot(keymap);
+    test_snapshot_update(keymap);
     test_serialisation(keymap);
     test_update_mask_mods(keymap);
     test_repeat(keymap);
     test_consume(keymap);
     test_range(keymap);
+    test_keysym_lookup(keymap);
     test_get_utf8_utf32(keymap);
     test_ctrl_string_transformation(keymap);
 
@@ -58,6 +58,9 @@ test_get_path(const char *path_rel);
 char *
 test_read_file(const char *path_rel);
 
+char *
+test_make_temp_include_dir(const char *subdir);
+
 enum test_context_flags {
     CONTEXT_NO_FLAG = 0,
     CONTEXT_ALLOW_ENVIRONMENT_NAMES = (1 << 0),
@@ -362,6 +362,28 @@ struct xkb_rule_names {
     const char *options;
 };
 
+/**
+ * Keymap component names, also known as KcCGST.
+ *
+ * These are the names of the keycodes, types, compat and symbols
+ * sections which a set of RMLVO names resolves to, according to the
+ * rules file.  Each field is a string like "evdev+aliases(qwerty)", as
+ * found in the include statements of a keymap.
+ *
+ * @sa xkb_components_from_names()
+ * @since 0.5.0
+ */
+struct xkb_component_names {
+    /** The keycodes component, e.g. "evdev+aliases(qwerty)". */
+    char *keycodes;
+    /** The types component, e.g. "complete". */
+    char *types;
+    /** The compat component, e.g. "complete". */
+    char *compat;
+    /** The symbols component, e.g. "pc+us+inet(evdev)". */
+    char *symbols;
+};
+
 /**
  * @defgroup keysyms Keysyms
  * Utility functions related to keysyms.
@@ -486,6 +508,25 @@ xkb_keysym_to_utf8(xkb_keysym_t keysym, char *buffer, size_t size);
 uint32_t
 xkb_keysym_to_utf32(xkb_keysym_t keysym);
 
+/**
+ * Get the keysym corresponding to a Unicode/UTF-32 codepoint.
+ *
+ * @returns The keysym corresponding to the specified Unicode
+ * codepoint, or XKB_KEY_NoSymbol if there is none.
+ *
+ * This function is the inverse of xkb_keysym_to_utf32().  Where several
+ * keysyms map to the same codepoint, the legacy keysym with the lowest
+ * value is returned, e.g. XKB_KEY_Return rather than XKB_KEY_KP_Enter for
+ * U+000D; codepoints without a legacy keysym are returned as Unicode
+ * keysyms (0x01000000 + codepoint).  Control characters without a keysym,
+ * surrogates and noncharacters return XKB_KEY_NoSymbol.
+ *
+ * @sa xkb_keysym_to_utf32()
+ * @since 0.5.0
+ */
+xkb_keysym_t
+xkb_utf32_to_keysym(uint32_t ucs);
+
 /** @} */
 
 /**
@@ -508,7 +549,47 @@ enum xkb_context_flags {
      * Don't take RMLVO names from the environment.
      * @since 0.3.0
      */
-    XKB_CONTEXT_NO_ENVIRONMENT_NAMES = (1 << 1)
+    XKB_CONTEXT_NO_ENVIRONMENT_NAMES = (1 << 1),
+    /**
+     * Share keymaps compiled from the same RMLVO names.
+     *
+     * With this flag, xkb_keymap_new_from_names() returns a new reference
+     * to a keymap previously compiled in this context from the same names
+     * and flags, for as long as that keymap is still referenced, instead
+     * of compiling it again.
+     *
+     * Also, any keymap created in this context, by name, from a string or
+     * from a file, whose compiled contents turn out to be identical to
+     * those of a keymap in the cache, is discarded in favor of a new
+     * reference to the latter; so many keyboards with the same keymap
+     * hold a single copy of it.  This is the case for a keymap loaded
+     * from the XKB_KEYMAP_FORMAT_BINARY_V1 format of a cached keymap,
+     * but not necessarily for one loaded from its
+     * XKB_KEYMAP_FORMAT_TEXT_V1 format, which does not keep every detail
+     * of the compiled keymap.
+     *
+     * Changing the include paths of the context discards all keymaps from
+     * the cache.
+     *
+     * @since 0.5.0
+     */
+    XKB_CONTEXT_KEYMAP_CACHE = (1 << 2),
+    /**
+     * Allow the context to be used from several threads at once.
+     *
+     * With this flag, keymaps can be created in the context from several
+     * threads concurrently, e.g. to compile the keymaps of many devices
+     * in parallel; they share the context's atom table and caches.
+     * Keymaps and the context itself can also be referenced and
+     * unreferenced from any thread.
+     *
+     * The context's settings, such as its include paths, log level and
+     * user data, must still not be changed while other threads use it.
+     * The logging function may be called from any of the threads.
+     *
+     * @since 0.5.0
+     */
+    XKB_CONTEXT_THREAD_SAFE = (1 << 3)
 };
 
 /**
@@ -757,7 +838,26 @@ xkb_context_set_log_fn(struct xkb_context *context,
 /** Flags for keymap compilation. */
 enum xkb_keymap_compile_flags {
     /** Do not apply any flags. */
-    XKB_KEYMAP_COMPILE_NO_FLAGS = 0
+    XKB_KEYMAP_COMPILE_NO_FLAGS = 0,
+    /**
+     * Read and parse the files included by the keycodes, types, compat
+     * and symbols sections of the keymap concurrently, on a few threads
+     * which are started for the compilation.  The sections are then
+     * compiled into the keymap one after the other, as usual; the
+     * resulting keymap is the same.
+     *
+     * The flag only has an effect if the context was created with
+     * XKB_CONTEXT_THREAD_SAFE, since the threads share the context and
+     * may call its logging function; otherwise it is ignored.
+     *
+     * This reduces the time it takes to compile a keymap whose files
+     * have not been read by the context before.  It does not help when
+     * the files are already in the context's caches: starting the
+     * threads then costs more than it saves, on every compilation.
+     *
+     * @since 0.5.0
+     */
+    XKB_KEYMAP_COMPILE_PARALLEL = (1 << 0)
 };
 
 /**
@@ -781,10 +881,63 @@ xkb_keymap_new_from_names(struct xkb_context *context,
                           const struct xkb_rule_names *names,
                           enum xkb_keymap_compile_flags flags);
 
+/**
+ * Resolve RMLVO names to keymap component names.
+ *
+ * This performs the first step of xkb_keymap_new_from_names() for many
+ * sets of names at once, without compiling any keymaps: each set of
+ * names is matched against its rules file, and the resulting KcCGST
+ * names are returned.  The names are filled in with the same defaults
+ * as xkb_keymap_new_from_names() would use.
+ *
+ * Each rules file is looked up, read and parsed only once per call (and
+ * is kept in the context for later calls), however many of the names
+ * use it; this is much cheaper than resolving the names one at a time,
+ * e.g. when listing the components of every layout on the system.
+ *
+ * @param[in]  context        The context in which to look up the rules.
+ * @param[in]  names          An array of @p count RMLVO names.
+ * @param[in]  count          The number of names to resolve.
+ * @param[out] components_out An array of @p count component names, which
+ * is filled in with the result for the respective names.  If some names
+ * could not be resolved, all the fields of their entry are set to NULL.
+ * The strings are dynamically allocated, and should be freed by the
+ * caller.
+ *
+ * @returns The number of names which were resolved successfully.
+ *
+ * @sa xkb_rule_names xkb_component_names
+ * @memberof xkb_context
+ * @since 0.5.0
+ */
+size_t
+xkb_components_from_names(struct xkb_context *context,
+                          const struct xkb_rule_names *names,
+                          size_t count,
+                          struct xkb_component_names *components_out);
+
 /** The possible keymap formats. */
 enum xkb_keymap_format {
     /** The current/classic XKB text format, as generated by xkbcomp -xkb. */
-    XKB_KEYMAP_FORMAT_TEXT_V1 = 1
+    XKB_KEYMAP_FORMAT_TEXT_V1 = 1,
+    /**
+     * A binary encoding of a compiled keymap, which can be loaded without
+     * parsing or compiling it.
+     *
+     * It is only meant for passing keymaps between processes on the same
+     * machine: it can only be loaded by the same version of xkbcommon,
+     * on a machine of the same byte order.  Use xkb_keymap_get_as_buffer()
+     * and xkb_keymap_new_from_buffer() with this format, since it may
+     * contain NUL bytes; it cannot be used with xkb_keymap_new_from_names().
+     * A keymap loaded from this format has XKB_KEYMAP_FORMAT_TEXT_V1, which
+     * it was compiled from, as its original format.
+     * xkb_keymap_new_from_file() maps the file into memory rather than
+     * reading it, when possible, so a keymap shared between processes as
+     * a file, e.g. over a memfd, is loaded without being copied first.
+     *
+     * @since 0.5.0
+     */
+    XKB_KEYMAP_FORMAT_BINARY_V1 = 2
 };
 
 /**
@@ -887,6 +1040,31 @@ char *
 xkb_keymap_get_as_string(struct xkb_keymap *keymap,
                          enum xkb_keymap_format format);
 
+/**
+ * Get the compiled keymap as a memory buffer.
+ *
+ * This is just like xkb_keymap_get_as_string(), but also returns the
+ * length of the buffer, so that it can be used with formats which are
+ * not NUL-terminated strings, such as XKB_KEYMAP_FORMAT_BINARY_V1.
+ *
+ * @param[in]  keymap     The keymap to get as a buffer.
+ * @param[in]  format     The keymap format to use, or
+ * XKB_KEYMAP_USE_ORIGINAL_FORMAT.
+ * @param[out] length_out The length of the returned buffer, in bytes.
+ *
+ * @returns The keymap as a buffer, or NULL if unsuccessful.  The buffer
+ * may be fed back into xkb_keymap_new_from_buffer() with the same format.
+ * It is dynamically allocated and should be freed by the caller.
+ *
+ * @sa xkb_keymap_get_as_string()
+ * @memberof xkb_keymap
+ * @since 0.5.0
+ */
+char *
+xkb_keymap_get_as_buffer(struct xkb_keymap *keymap,
+                         enum xkb_keymap_format format,
+                         size_t *length_out);
+
 /** @} */
 
 /**
@@ -1067,6 +1245,39 @@ xkb_keymap_key_get_syms_by_level(struct xkb_keymap *keymap,
                                  xkb_level_index_t level,
                                  const xkb_keysym_t **syms_out);
 
+/**
+ * The iterator used by xkb_keymap_keysym_for_each().
+ *
+ * @sa xkb_keymap_keysym_for_each
+ * @memberof xkb_keymap
+ * @since 0.5.0
+ */
+typedef void
+(*xkb_keymap_keysym_iter_t)(struct xkb_keymap *keymap, xkb_keycode_t key,
+                            xkb_layout_index_t layout,
+                            xkb_level_index_t level, void *data);
+
+/**
+ * Run a specified function for every key, layout and shift level which
+ * produces a keysym.
+ *
+ * This is the reverse of xkb_keymap_key_get_syms_by_level().  Levels
+ * which produce several keysyms are included if the keysym is one of
+ * them.
+ *
+ * The function is called in order of layout, then shift level, then
+ * keycode, so the first call is for the key which is easiest to reach.
+ * The first call builds an index of the keymap by keysym, so the
+ * following ones do not need to go over every key.
+ *
+ * @sa xkb_keymap_key_get_syms_by_level()
+ * @memberof xkb_keymap
+ * @since 0.5.0
+ */
+void
+xkb_keymap_keysym_for_each(struct xkb_keymap *keymap, xkb_keysym_t keysym,
+                           xkb_keymap_keysym_iter_t iter, void *data);
+
 /**
  * Get the number of LEDs in the keymap.
  *
@@ -1161,6 +1372,47 @@ xkb_state_ref(struct xkb_state *state);
 void
 xkb_state_unref(struct xkb_state *state);
 
+/**
+ * Create a copy of a keyboard state object.
+ *
+ * The copy starts out in the same state as @p state, including any keys
+ * currently held down, and is updated independently from it afterwards.
+ *
+ * @returns A new keyboard state object, or NULL on failure.
+ *
+ * @memberof xkb_state
+ * @since 0.5.0
+ */
+struct xkb_state *
+xkb_state_clone(struct xkb_state *state);
+
+/**
+ * Create a read-only snapshot of a keyboard state object.
+ *
+ * The snapshot has the modifiers, layout and LEDs of @p state as of its
+ * last update, and can be queried with all of the xkb_state_key_get_*(),
+ * xkb_state_serialize_*() and xkb_state_*_is_active() functions like any
+ * other state.  It cannot be updated with xkb_state_update_key(),
+ * xkb_state_update_keys() or xkb_state_update_mask(), which do nothing
+ * and return 0 for it, but only with xkb_state_update_snapshot().  It is
+ * cheaper to make than a full copy, since it doesn't carry the actions of
+ * the keys held down.
+ *
+ * This function may be called from any thread, while @p state is being
+ * updated in another one.  A snapshot may be queried from several threads
+ * at once, as long as it is not being updated; each thread should hold
+ * its own reference.  Functions which look up modifiers, layouts or LEDs
+ * by name should only be used this way if the context is
+ * XKB_CONTEXT_THREAD_SAFE.
+ *
+ * @returns A new keyboard state object, or NULL on failure.
+ *
+ * @memberof xkb_state
+ * @since 0.5.0
+ */
+struct xkb_state *
+xkb_state_snapshot(struct xkb_state *state);
+
 /**
  * Get the keymap which a keyboard state object is using.
  *
@@ -1251,6 +1503,49 @@ enum xkb_state_component
 xkb_state_update_key(struct xkb_state *state, xkb_keycode_t key,
                      enum xkb_key_direction direction);
 
+/**
+ * A key event, as passed to xkb_state_update_keys().
+ *
+ * @since 0.5.0
+ */
+struct xkb_key_event {
+    /** The keycode of the key. */
+    xkb_keycode_t keycode;
+    /** Whether the key was pressed or released. */
+    enum xkb_key_direction direction;
+};
+
+/**
+ * Update the keyboard state to reflect a series of keys being pressed or
+ * released.
+ *
+ * This is equivalent to calling xkb_state_update_key() for each event in
+ * order, but is cheaper when several events are available at once, for
+ * example all the key events of an evdev SYN_REPORT frame, or events being
+ * replayed.
+ *
+ * @param[in]  state       The keyboard state object.
+ * @param[in]  events      The key events, in order.
+ * @param[in]  num_events  The number of events in @p events.
+ * @param[out] changed_out If not NULL, an array of @p num_events entries,
+ * which is filled with the mask of state components that have changed as
+ * a result of each event, as returned by xkb_state_update_key().  Passing
+ * NULL is faster, since the LEDs are then only updated once at the end.
+ *
+ * @returns A mask of state components that differ between the state before
+ * the first event and the state after the last one.  If nothing in the
+ * state has changed, returns 0.
+ *
+ * @memberof xkb_state
+ * @since 0.5.0
+ *
+ * @sa xkb_state_update_key()
+ */
+enum xkb_state_component
+xkb_state_update_keys(struct xkb_state *state,
+                      const struct xkb_key_event *events, size_t num_events,
+                      enum xkb_state_component *changed_out);
+
 /**
  * Update a keyboard state from a set of explicit masks.
  *
@@ -1287,6 +1582,35 @@ xkb_state_update_mask(struct xkb_state *state,
                       xkb_layout_index_t latched_layout,
                       xkb_layout_index_t locked_layout);
 
+/**
+ * Bring a snapshot up to date with the state it was taken from.
+ *
+ * This gives the snapshot the modifiers, layout and LEDs of @p state as
+ * of its last update, without allocating or taking any lock: a thread
+ * updating @p state never waits for the readers, and the readers only
+ * retry if they happen to read while an update is being published.  So,
+ * for example, each of a render and an accessibility thread can keep a
+ * snapshot of the state updated by the input thread, and update it
+ * before querying it.
+ *
+ * Like xkb_state_snapshot(), this function may be called from any thread
+ * while @p state is being updated in another one; but not while
+ * @p snapshot is being queried or updated in another thread.
+ *
+ * @param snapshot A snapshot, made by xkb_state_snapshot() from a state
+ * with the same keymap as @p state.
+ * @param state The state to update the snapshot from.
+ *
+ * @returns A mask of state components that have changed in the snapshot,
+ * as for xkb_state_update_key(), or 0 if @p snapshot is not a snapshot or
+ * has a different keymap.
+ *
+ * @memberof xkb_state
+ * @since 0.5.0
+ */
+enum xkb_state_component
+xkb_state_update_snapshot(struct xkb_state *snapshot, struct xkb_state *state);
+
 /**
  * Get the keysyms obtained from pressing a particular key in a given
  * keyboard state.
@@ -1426,6 +1750,63 @@ xkb_level_index_t
 xkb_state_key_get_level(struct xkb_state *state, xkb_keycode_t key,
                         xkb_layout_index_t layout);
 
+/**
+ * Everything obtained from pressing a particular key in a given keyboard
+ * state, as filled in by xkb_state_key_get_info().
+ *
+ * @since 0.5.0
+ */
+struct xkb_key_info {
+    /** The layout, as from xkb_state_key_get_layout(). */
+    xkb_layout_index_t layout;
+    /** The shift level in @p layout, as from xkb_state_key_get_level(). */
+    xkb_level_index_t level;
+    /** The keysyms, as from xkb_state_key_get_syms(). */
+    const xkb_keysym_t *syms;
+    /** The number of keysyms in @p syms. */
+    int num_syms;
+    /** The single keysym, as from xkb_state_key_get_one_sym(). */
+    xkb_keysym_t sym;
+    /** The UTF-32 codepoint, as from xkb_state_key_get_utf32(). */
+    uint32_t utf32;
+    /** The consumed modifiers, as from xkb_state_key_get_consumed_mods(). */
+    xkb_mod_mask_t consumed_mods;
+};
+
+/**
+ * Get everything obtained from pressing a particular key in a given
+ * keyboard state at once.
+ *
+ * This gives the same results as calling xkb_state_key_get_layout(),
+ * xkb_state_key_get_level(), xkb_state_key_get_syms(),
+ * xkb_state_key_get_one_sym(), xkb_state_key_get_utf32(),
+ * xkb_state_key_get_consumed_mods() and xkb_state_key_get_utf8()
+ * separately, but the layout and level of the key are only looked up
+ * once.
+ *
+ * As with the individual functions, you should usually call this
+ * *before* updating the state with the key event itself.
+ *
+ * @param[in]  state  The keyboard state object.
+ * @param[in]  key    The keycode of the key.
+ * @param[out] info   The key information.  If the key is invalid, the
+ * layout and level are set to XKB_LAYOUT_INVALID and XKB_LEVEL_INVALID,
+ * and everything else is empty.
+ * @param[out] buffer A buffer to write the UTF-8 string into, as with
+ * xkb_state_key_get_utf8().
+ * @param[in]  size   Size of the buffer.
+ *
+ * @returns The number of bytes required for the UTF-8 string, excluding
+ * the NUL byte, as with xkb_state_key_get_utf8().  You may pass NULL and
+ * 0 to @p buffer and @p size if you are not interested in the string.
+ *
+ * @memberof xkb_state
+ * @since 0.5.0
+ */
+int
+xkb_state_key_get_info(struct xkb_state *state, xkb_keycode_t key,
+                       struct xkb_key_info *info, char *buffer, size_t size);
+
 /**
  * Match flags for xkb_state_mod_indices_are_active and
  * xkb_state_mod_names_are_active, specifying how the conditions for a